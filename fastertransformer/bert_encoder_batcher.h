@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * BERT encoder runner for the dynamic batcher
+ *
+ * Gathers the requests of a batch into a padded [batch, bucket_seq_len, hidden] tensor,
+ * removes the padding, runs all layers with BertEncoderTransformer and scatters the
+ * compacted result back to the requests. The buffers of the attention are kept for the
+ * max_cached_encoders most recent (batch size, bucket) shapes.
+ **/
+
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include "fastertransformer/bert_encoder_stack.h"
+#include "fastertransformer/utils/encoder_batcher.h"
+
+namespace fastertransformer
+{
+
+template <class Traits_>
+class BertEncoderBatchRunner : public IEncoderBatchRunner<typename Traits_::DataType>
+{
+  typedef typename Traits_::DataType DataType_;
+
+  IAllocator *allocator_;
+  // weights of each layer; the activations, stream and handles are set by run()
+  std::vector<BertInitParam<DataType_>> layer_params_;
+  const int hidden_units_;
+  const int max_batch_size_;
+  const int max_seq_len_;
+  cublasHandle_t cublas_handle_;
+  cublasLtHandle_t cublaslt_handle_;
+  cudaStream_t stream_;
+
+  BertEncoderCache<Traits_> encoders_;
+
+  void *buf_ = nullptr;
+  DataType_ *from_tensor_padded_;
+  DataType_ *tensor_[2];
+  DataType_ *attr_mask_;
+  int *sequence_length_;
+  int *tmp_sequence_id_offset_;
+  int *sequence_id_offset_;
+  int *trt_seqlen_offset_;
+
+  EncoderBatchStaging<DataType_> staging_;
+  PinnedHostBuffer<DataType_> h_tensor_;
+
+public:
+  BertEncoderBatchRunner(IAllocator *allocator,
+                         const std::vector<BertInitParam<DataType_>> &layer_params,
+                         const int head_num, const int size_per_head,
+                         const int max_batch_size, const int max_seq_len,
+                         cublasHandle_t cublas_handle, cublasLtHandle_t cublaslt_handle, cudaStream_t stream,
+                         const bool use_trt_kernel = true, const bool allow_gemm_test = false,
+                         const int max_cached_encoders = 8)
+      : allocator_(allocator), layer_params_(layer_params), hidden_units_(head_num * size_per_head),
+        max_batch_size_(max_batch_size), max_seq_len_(max_seq_len),
+        cublas_handle_(cublas_handle), cublaslt_handle_(cublaslt_handle), stream_(stream),
+        encoders_(allocator, head_num, size_per_head, use_trt_kernel, allow_gemm_test, max_cached_encoders, stream),
+        staging_(max_batch_size, max_seq_len),
+        h_tensor_((size_t)max_batch_size * max_seq_len * head_num * size_per_head)
+  {
+#ifndef NDEBUG
+    PRINT_FUNC_NAME_();
+#endif
+    const size_t tensor_size = (size_t)max_batch_size_ * max_seq_len_ * hidden_units_;
+    const size_t mask_size = (size_t)max_batch_size_ * max_seq_len_ * max_seq_len_;
+    // sequence_length, tmp_sequence_id_offset (+ valid_word_num), sequence_id_offset, trt_seqlen_offset
+    const size_t int_buf_size = (size_t)div_up(max_batch_size_, 4) * 4 +
+                                (size_t)div_up(max_batch_size_ * max_seq_len_ + 1, 4) * 4 +
+                                (size_t)max_batch_size_ * max_seq_len_ +
+                                (size_t)div_up(max_batch_size_ + 1, 4) * 4;
+    buf_ = allocator_->malloc(sizeof(DataType_) * (3 * tensor_size + mask_size) + sizeof(int) * int_buf_size, false);
+
+    from_tensor_padded_ = (DataType_ *)buf_;
+    tensor_[0] = from_tensor_padded_ + tensor_size;
+    tensor_[1] = tensor_[0] + tensor_size;
+    attr_mask_ = tensor_[1] + tensor_size;
+    sequence_length_ = (int *)(attr_mask_ + mask_size);
+    tmp_sequence_id_offset_ = sequence_length_ + div_up(max_batch_size_, 4) * 4;
+    sequence_id_offset_ = tmp_sequence_id_offset_ + div_up(max_batch_size_ * max_seq_len_ + 1, 4) * 4;
+    trt_seqlen_offset_ = sequence_id_offset_ + max_batch_size_ * max_seq_len_;
+  }
+
+  ~BertEncoderBatchRunner()
+  {
+    cudaStreamSynchronize(stream_);
+    allocator_->free(buf_);
+  }
+
+  void run(const EncoderBatch<DataType_> &batch) override
+  {
+    const int batch_size = batch.requests.size();
+    const int seq_len = batch.seq_len;
+    if (batch_size > max_batch_size_ || seq_len > max_seq_len_)
+      throw std::runtime_error("[FT][ERROR][BertEncoderBatchRunner] batch is larger than max_batch_size * max_seq_len.");
+
+    // pack the requests into a padded tensor, and upload their lengths, offsets and mask
+    DataType_ *h_tensor = h_tensor_.get();
+    std::vector<int> sequence_length(batch_size);
+    memset(h_tensor, 0, sizeof(DataType_) * batch_size * seq_len * hidden_units_);
+    for (int b = 0; b < batch_size; b++)
+    {
+      const EncoderRequest<DataType_> *request = batch.requests[b];
+      memcpy(h_tensor + (size_t)b * seq_len * hidden_units_, request->input,
+             sizeof(DataType_) * request->seq_len * hidden_units_);
+      sequence_length[b] = request->seq_len;
+    }
+    check_cuda_error(cudaMemcpyAsync(from_tensor_padded_, h_tensor, sizeof(DataType_) * batch_size * seq_len * hidden_units_,
+                                     cudaMemcpyHostToDevice, stream_));
+    const int *h_trt_seqlen_offset = staging_.upload(sequence_length.data(), batch_size, seq_len, sequence_length_,
+                                                     trt_seqlen_offset_, attr_mask_, tmp_sequence_id_offset_, stream_);
+    const int valid_word_num = h_trt_seqlen_offset[batch_size];
+    remove_sequence_length_padding_kernelLauncher(from_tensor_padded_, tensor_[0], tmp_sequence_id_offset_,
+                                                  sequence_id_offset_, valid_word_num, hidden_units_, stream_);
+
+    BertEncoderTransformer<Traits_> *encoder = encoders_.get(batch_size, seq_len);
+    check_cuda_error(cublasSetStream(cublas_handle_, stream_));
+    const int layer_num = layer_params_.size();
+    for (int layer = 0; layer < layer_num; layer++)
+    {
+      BertInitParam<DataType_> param = layer_params_[layer];
+      param.from_tensor = tensor_[layer & 0x1];
+      param.to_tensor = tensor_[layer & 0x1];
+      param.transformer_out = tensor_[1 - (layer & 0x1)];
+      param.attr_mask = attr_mask_;
+      param.sequence_id_offset = sequence_id_offset_;
+      param.valid_word_num = valid_word_num;
+      param.trt_seqlen_offset = trt_seqlen_offset_;
+      param.trt_seqlen_size = batch_size + 1;
+      param.layer_idx = layer;
+      param.layer_num = layer_num;
+      param.cublas_handle = cublas_handle_;
+      param.cublaslt_handle = cublaslt_handle_;
+      param.stream = stream_;
+      encoder->initialize(param);
+      encoder->forward();
+    }
+
+    // the compacted output keeps the requests in order, each one seq_len rows long
+    check_cuda_error(cudaMemcpyAsync(h_tensor, tensor_[layer_num & 0x1], sizeof(DataType_) * valid_word_num * hidden_units_,
+                                     cudaMemcpyDeviceToHost, stream_));
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    for (int b = 0; b < batch_size; b++)
+    {
+      const EncoderRequest<DataType_> *request = batch.requests[b];
+      memcpy(request->output, h_tensor + (size_t)h_trt_seqlen_offset[b] * hidden_units_,
+             sizeof(DataType_) * request->seq_len * hidden_units_);
+    }
+  }
+};
+
+} // namespace fastertransformer
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * BERT encoder stack with layer-wise early exit
+ *
+ * Runs the layers on the compacted (padding removed) tensor. After each layer with an
+ * exit head, the [CLS] logits are copied to the host, the confident samples leave the
+ * batch, and the rows of the survivors are gathered with remove_sequence_length_padding
+ * so that the next layers run on a smaller batch.
+ **/
+
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include "fastertransformer/bert_encoder_stack.h"
+#include "fastertransformer/utils/early_exit.h"
+
+namespace fastertransformer
+{
+
+template <typename T>
+struct EarlyExitHead
+{
+  const T *kernel = nullptr; // [hidden_units, num_classes], nullptr if the layer has no head
+  const float *bias = nullptr; // [num_classes], on the host since the logits are finished there
+};
+
+template <class Traits_>
+class BertEncoderEarlyExit
+{
+  typedef typename Traits_::DataType DataType_;
+
+  IAllocator *allocator_;
+  std::vector<BertInitParam<DataType_>> layer_params_;
+  std::vector<EarlyExitHead<DataType_>> heads_;
+  const int num_classes_;
+  const float threshold_;
+  const int hidden_units_;
+  const int max_batch_size_;
+  const int max_seq_len_;
+  cublasHandle_t cublas_handle_;
+  cublasLtHandle_t cublaslt_handle_;
+  cudaStream_t stream_;
+
+  // the buffers of the attention depend on the batch size, which shrinks from layer to layer;
+  // the ones of the least recently used shapes are freed
+  BertEncoderCache<Traits_> encoders_;
+
+  void *buf_ = nullptr;
+  DataType_ *tensor_[2];
+  DataType_ *attr_mask_;
+  DataType_ *cls_buf_;
+  float *logits_buf_;
+  int *sequence_length_;
+  int *sequence_id_offset_; // followed by the valid word number written by build_sequence_length_padding_offset
+  int *gather_offset_;
+  int *mask_offset_tmp_;    // written by remove_sequence_length_padding, not used
+  int *trt_seqlen_offset_;
+
+  EncoderBatchStaging<DataType_> staging_;
+  PinnedHostBuffer<int> h_gather_offset_;
+  PinnedHostBuffer<float> h_logits_;
+
+  EarlyExitBatch batch_;
+
+  // Upload the lengths, the offsets and the mask of the active samples.
+  void updateBatchInfo(const int seq_len)
+  {
+    staging_.upload(batch_.getSeqLens().data(), batch_.size(), seq_len, sequence_length_, trt_seqlen_offset_,
+                    attr_mask_, sequence_id_offset_, stream_);
+  }
+
+public:
+  // heads has one entry per layer; the last layer must have a head since every sample left exits there.
+  // The batch size changes at most once per head, so a forward runs at most one shape per head:
+  // with fewer max_cached_encoders than heads, a forward may free and allocate buffers again.
+  BertEncoderEarlyExit(IAllocator *allocator,
+                       const std::vector<BertInitParam<DataType_>> &layer_params,
+                       const std::vector<EarlyExitHead<DataType_>> &heads,
+                       const int num_classes, const float threshold,
+                       const int head_num, const int size_per_head,
+                       const int max_batch_size, const int max_seq_len,
+                       cublasHandle_t cublas_handle, cublasLtHandle_t cublaslt_handle, cudaStream_t stream,
+                       const bool use_trt_kernel = true, const bool allow_gemm_test = false,
+                       const int max_cached_encoders = 8)
+      : allocator_(allocator), layer_params_(layer_params), heads_(heads), num_classes_(num_classes), threshold_(threshold),
+        hidden_units_(head_num * size_per_head), max_batch_size_(max_batch_size), max_seq_len_(max_seq_len),
+        cublas_handle_(cublas_handle), cublaslt_handle_(cublaslt_handle), stream_(stream),
+        encoders_(allocator, head_num, size_per_head, use_trt_kernel, allow_gemm_test, max_cached_encoders, stream),
+        staging_(max_batch_size, max_seq_len),
+        h_gather_offset_((size_t)max_batch_size * max_seq_len),
+        h_logits_((size_t)max_batch_size * num_classes)
+  {
+#ifndef NDEBUG
+    PRINT_FUNC_NAME_();
+#endif
+    if (heads_.size() != layer_params_.size() || heads_.back().kernel == nullptr)
+      throw std::runtime_error("[FT][ERROR][BertEncoderEarlyExit] heads should have one entry per layer and the last layer needs a head.");
+
+    const size_t tensor_size = (size_t)max_batch_size_ * max_seq_len_ * hidden_units_;
+    const size_t mask_size = (size_t)max_batch_size_ * max_seq_len_ * max_seq_len_;
+    const size_t cls_size = (size_t)div_up(max_batch_size_ * hidden_units_, 4) * 4;
+    const size_t token_num = (size_t)max_batch_size_ * max_seq_len_;
+    // sequence_length, sequence_id_offset (+ valid_word_num), gather_offset, mask_offset_tmp, trt_seqlen_offset
+    const size_t int_buf_size = (size_t)div_up(max_batch_size_, 4) * 4 +
+                                (size_t)div_up((int)token_num + 1, 4) * 4 +
+                                2 * token_num +
+                                (size_t)div_up(max_batch_size_ + 1, 4) * 4;
+    buf_ = allocator_->malloc(sizeof(DataType_) * (2 * tensor_size + mask_size + cls_size) +
+                                  sizeof(float) * max_batch_size_ * num_classes_ + sizeof(int) * int_buf_size, false);
+
+    tensor_[0] = (DataType_ *)buf_;
+    tensor_[1] = tensor_[0] + tensor_size;
+    attr_mask_ = tensor_[1] + tensor_size;
+    cls_buf_ = attr_mask_ + mask_size;
+    logits_buf_ = (float *)(cls_buf_ + cls_size);
+    sequence_length_ = (int *)(logits_buf_ + max_batch_size_ * num_classes_);
+    sequence_id_offset_ = sequence_length_ + div_up(max_batch_size_, 4) * 4;
+    gather_offset_ = sequence_id_offset_ + div_up((int)token_num + 1, 4) * 4;
+    mask_offset_tmp_ = gather_offset_ + token_num;
+    trt_seqlen_offset_ = mask_offset_tmp_ + token_num;
+  }
+
+  ~BertEncoderEarlyExit()
+  {
+    cudaStreamSynchronize(stream_);
+    allocator_->free(buf_);
+  }
+
+  /**
+   * from_tensor: [batch_size, seq_len, hidden_units] on the device, padded
+   * sequence_length: [batch_size] on the host
+   * logits: [batch_size, num_classes] on the host, the logits of the head each sample exited at
+   * exit_layer: [batch_size] on the host, the layer each sample exited after
+   **/
+  void forward(const DataType_ *from_tensor, const int *sequence_length, const int batch_size, const int seq_len,
+               float *logits, int *exit_layer)
+  {
+#ifndef NDEBUG
+    PRINT_FUNC_NAME_();
+#endif
+    if (batch_size > max_batch_size_ || seq_len > max_seq_len_)
+      throw std::runtime_error("[FT][ERROR][BertEncoderEarlyExit] batch is larger than max_batch_size * max_seq_len.");
+
+    batch_.reset(sequence_length, batch_size);
+    updateBatchInfo(seq_len);
+    int valid_word_num = batch_.getValidWordNum();
+    remove_sequence_length_padding_kernelLauncher(from_tensor, tensor_[0], sequence_id_offset_,
+                                                  mask_offset_tmp_, valid_word_num, hidden_units_, stream_);
+
+    check_cuda_error(cublasSetStream(cublas_handle_, stream_));
+    const int layer_num = layer_params_.size();
+    int cur = 0;
+    for (int layer = 0; layer < layer_num && batch_.size() > 0; layer++)
+    {
+      BertEncoderTransformer<Traits_> *encoder = encoders_.get(batch_.size(), seq_len);
+      BertInitParam<DataType_> param = layer_params_[layer];
+      param.from_tensor = tensor_[cur];
+      param.to_tensor = tensor_[cur];
+      param.transformer_out = tensor_[1 - cur];
+      param.attr_mask = attr_mask_;
+      param.sequence_id_offset = sequence_id_offset_;
+      param.valid_word_num = valid_word_num;
+      param.trt_seqlen_offset = trt_seqlen_offset_;
+      param.trt_seqlen_size = batch_.size() + 1;
+      param.layer_idx = layer;
+      param.layer_num = layer_num;
+      param.cublas_handle = cublas_handle_;
+      param.cublaslt_handle = cublaslt_handle_;
+      param.stream = stream_;
+      encoder->initialize(param);
+      encoder->forward();
+      cur = 1 - cur;
+
+      if (heads_[layer].kernel == nullptr)
+        continue;
+
+      // logits of the [CLS] token of each active sample
+      const int active_num = batch_.size();
+      sequence_pooling_kernelLauncher(cls_buf_, (const DataType_ *)tensor_[cur], sequence_length_, active_num, seq_len,
+                                      true, hidden_units_, PoolingType::CLS, stream_);
+      const float alpha = 1.0f, beta = 0.0f;
+      check_cuda_error(cublasGemmEx(cublas_handle_, CUBLAS_OP_N, CUBLAS_OP_N,
+                                    num_classes_, active_num, hidden_units_,
+                                    &alpha,
+                                    heads_[layer].kernel, Traits_::AType, num_classes_,
+                                    cls_buf_, Traits_::BType, hidden_units_,
+                                    &beta,
+                                    logits_buf_, CUDA_R_32F, num_classes_,
+                                    CUDA_R_32F, CUBLAS_GEMM_DEFAULT));
+      check_cuda_error(cudaMemcpyAsync(h_logits_.get(), logits_buf_, sizeof(float) * active_num * num_classes_,
+                                       cudaMemcpyDeviceToHost, stream_));
+      check_cuda_error(cudaStreamSynchronize(stream_));
+
+      std::vector<bool> is_exit(active_num);
+      int exit_num = 0;
+      for (int i = 0; i < active_num; i++)
+      {
+        float *sample_logits = h_logits_.get() + i * num_classes_;
+        if (heads_[layer].bias != nullptr)
+        {
+          for (int c = 0; c < num_classes_; c++)
+            sample_logits[c] += heads_[layer].bias[c];
+        }
+        is_exit[i] = layer == layer_num - 1 || exit_confidence(sample_logits, num_classes_) >= threshold_;
+        if (is_exit[i])
+        {
+          const int id = batch_.getId(i);
+          memcpy(logits + id * num_classes_, sample_logits, sizeof(float) * num_classes_);
+          exit_layer[id] = layer;
+          exit_num++;
+        }
+      }
+      if (exit_num == 0)
+        continue;
+      if (exit_num == active_num)
+        break;
+
+      // gather the rows of the survivors into the other buffer, then rebuild the offsets and the mask
+      valid_word_num = batch_.shrink(is_exit, h_gather_offset_.get());
+      check_cuda_error(cudaMemcpyAsync(gather_offset_, h_gather_offset_.get(), sizeof(int) * valid_word_num,
+                                       cudaMemcpyHostToDevice, stream_));
+      remove_sequence_length_padding_kernelLauncher((const DataType_ *)tensor_[cur], tensor_[1 - cur], gather_offset_,
+                                                    mask_offset_tmp_, valid_word_num, hidden_units_, stream_);
+      cur = 1 - cur;
+      // the pinned buffers are only rewritten after the next synchronization on the logits
+      updateBatchInfo(seq_len);
+    }
+  }
+};
+
+} // namespace fastertransformer
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Pieces of the BERT encoders that run the whole layer stack on a batch without padding
+ * (bert_encoder_batcher.h, bert_encoder_early_exit.h)
+ *
+ * The encoders of the recent batch shapes, the padding mask built on the host, and the pinned
+ * host buffers through which the lengths, the offsets and the mask of a batch are uploaded.
+ **/
+
+#pragma once
+
+#include <cstring>
+#include <list>
+#include <stdexcept>
+#include "fastertransformer/bert_encoder_transformer.h"
+
+namespace fastertransformer
+{
+
+// mask[b, i, j] = 1 if j < sequence_length[b], else 0: [batch_size, seq_len, seq_len]
+template <typename T>
+void build_padding_mask(T *mask, const int *sequence_length, const int batch_size, const int seq_len)
+{
+  for (int b = 0; b < batch_size; b++)
+  {
+    for (int i = 0; i < seq_len; i++)
+    {
+      T *mask_row = mask + ((size_t)b * seq_len + i) * seq_len;
+      for (int j = 0; j < seq_len; j++)
+        mask_row[j] = (T)(j < sequence_length[b] ? 1.0f : 0.0f);
+    }
+  }
+}
+
+// A host buffer of count elements in pinned memory, so that its copies run asynchronously.
+template <typename T>
+class PinnedHostBuffer
+{
+  T *ptr_ = nullptr;
+
+public:
+  explicit PinnedHostBuffer(const size_t count)
+  {
+    check_cuda_error(cudaMallocHost((void **)&ptr_, sizeof(T) * count));
+  }
+  ~PinnedHostBuffer() { cudaFreeHost(ptr_); }
+
+  PinnedHostBuffer(const PinnedHostBuffer &) = delete;
+  PinnedHostBuffer &operator=(const PinnedHostBuffer &) = delete;
+
+  T *get() const { return ptr_; }
+};
+
+// One encoder per (batch_size, seq_len), since the buffers of the attention depend on both.
+// They are copied from a prototype that holds the gemm algo map. At most max_cached_encoders of
+// them keep their buffers: a new shape evicts the least recently used one, once the work on
+// stream that may still use its buffers is done.
+template <class Traits_>
+class BertEncoderCache
+{
+  struct Entry
+  {
+    int batch_size;
+    int seq_len;
+    BertEncoderTransformer<Traits_> *encoder;
+  };
+
+  IAllocator *allocator_;
+  const int head_num_;
+  const int size_per_head_;
+  const bool use_trt_kernel_;
+  const int max_cached_encoders_;
+  cudaStream_t stream_;
+  BertEncoderTransformer<Traits_> *prototype_;
+  // most recently used first
+  std::list<Entry> encoders_;
+
+  static void destroy(Entry &entry)
+  {
+    entry.encoder->freeBuffer();
+    delete entry.encoder;
+  }
+
+public:
+  // only the float/half path is supported; the int8 layers need per-layer amax lists and COL32 layouts
+  BertEncoderCache(IAllocator *allocator, const int head_num, const int size_per_head,
+                   const bool use_trt_kernel, const bool allow_gemm_test, const int max_cached_encoders,
+                   cudaStream_t stream)
+      : allocator_(allocator), head_num_(head_num), size_per_head_(size_per_head), use_trt_kernel_(use_trt_kernel),
+        max_cached_encoders_(max_cached_encoders), stream_(stream),
+        prototype_(new BertEncoderTransformer<Traits_>(0, allow_gemm_test))
+  {
+    if (max_cached_encoders_ < 1)
+    {
+      delete prototype_;
+      throw std::runtime_error("[FT][ERROR][BertEncoderCache] max_cached_encoders should be positive.");
+    }
+  }
+
+  // The owner synchronizes its stream before, since the buffers may still be in use.
+  ~BertEncoderCache()
+  {
+    for (Entry &entry : encoders_)
+      destroy(entry);
+    delete prototype_;
+  }
+
+  BertEncoderCache(const BertEncoderCache &) = delete;
+  BertEncoderCache &operator=(const BertEncoderCache &) = delete;
+
+  BertEncoderTransformer<Traits_> *get(const int batch_size, const int seq_len)
+  {
+    for (auto it = encoders_.begin(); it != encoders_.end(); ++it)
+    {
+      if (it->batch_size == batch_size && it->seq_len == seq_len)
+      {
+        encoders_.splice(encoders_.begin(), encoders_, it);
+        return it->encoder;
+      }
+    }
+    if ((int)encoders_.size() == max_cached_encoders_)
+    {
+      check_cuda_error(cudaStreamSynchronize(stream_));
+      destroy(encoders_.back());
+      encoders_.pop_back();
+    }
+    Entry entry = {batch_size, seq_len, new BertEncoderTransformer<Traits_>(prototype_)};
+    entry.encoder->allocateBuffer(allocator_, batch_size, seq_len, seq_len,
+                                  head_num_, size_per_head_, use_trt_kernel_);
+    encoders_.push_front(entry);
+    return entry.encoder;
+  }
+
+  int size() const { return encoders_.size(); }
+};
+
+// The pinned host copies of the lengths, the trt_seqlen_offset and the padding mask of a batch.
+template <typename T>
+class EncoderBatchStaging
+{
+  const int max_batch_size_;
+  PinnedHostBuffer<T> attr_mask_;
+  PinnedHostBuffer<int> int_buf_; // sequence_length, trt_seqlen_offset
+
+public:
+  EncoderBatchStaging(const int max_batch_size, const int max_seq_len)
+      : max_batch_size_(max_batch_size), attr_mask_((size_t)max_batch_size * max_seq_len * max_seq_len),
+        int_buf_(2 * (size_t)max_batch_size + 1)
+  {
+  }
+
+  /**
+   * Uploads sequence_length [batch_size], the trt_seqlen_offset [batch_size + 1] of the batch
+   * without padding and the padding mask [batch_size, seq_len, seq_len] on stream, then builds
+   * sequence_id_offset [batch_size * seq_len] followed by the valid word number on the device.
+   * Returns the trt_seqlen_offset on the host, i.e. the first row of each sample in the batch
+   * without padding. It and the uploads stay valid until the next call, which the caller makes
+   * only after a synchronization on stream.
+   **/
+  const int *upload(const int *sequence_length, const int batch_size, const int seq_len,
+                    int *d_sequence_length, int *d_trt_seqlen_offset, T *d_attr_mask, int *d_sequence_id_offset,
+                    cudaStream_t stream)
+  {
+    int *h_sequence_length = int_buf_.get();
+    int *h_trt_seqlen_offset = int_buf_.get() + max_batch_size_;
+    memcpy(h_sequence_length, sequence_length, sizeof(int) * batch_size);
+    h_trt_seqlen_offset[0] = 0;
+    for (int b = 0; b < batch_size; b++)
+      h_trt_seqlen_offset[b + 1] = h_trt_seqlen_offset[b] + sequence_length[b];
+    build_padding_mask(attr_mask_.get(), sequence_length, batch_size, seq_len);
+
+    check_cuda_error(cudaMemcpyAsync(d_sequence_length, h_sequence_length, sizeof(int) * batch_size,
+                                     cudaMemcpyHostToDevice, stream));
+    check_cuda_error(cudaMemcpyAsync(d_trt_seqlen_offset, h_trt_seqlen_offset, sizeof(int) * (batch_size + 1),
+                                     cudaMemcpyHostToDevice, stream));
+    check_cuda_error(cudaMemcpyAsync(d_attr_mask, attr_mask_.get(), sizeof(T) * batch_size * seq_len * seq_len,
+                                     cudaMemcpyHostToDevice, stream));
+    // valid_word_num is known on the host, so the one written by the kernel is not copied back
+    build_sequence_length_padding_offset_kernelLauncher(d_sequence_length, batch_size, seq_len,
+                                                        d_sequence_id_offset + batch_size * seq_len,
+                                                        d_sequence_id_offset, stream);
+    return h_trt_seqlen_offset;
+  }
+};
+
+} // namespace fastertransformer
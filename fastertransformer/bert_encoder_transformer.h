@@ -69,6 +69,14 @@ public:
   const float *amaxList = nullptr;
   const int* trt_seqlen_offset = nullptr;
   int trt_seqlen_size = -1;
+
+  // Only used by the last layer (layer_idx == layer_num - 1), and only when int8_mode == 0.
+  // With pooling_type != NONE, the last layer writes [batch_size, hidden] into pooled_out instead of
+  // the full sequence into transformer_out. For CLS, only the first token of each sequence goes through
+  // the attention output projection and the FFN. MEAN and MAX need sequence_length [batch_size].
+  PoolingType pooling_type = PoolingType::NONE;
+  T *pooled_out = nullptr;
+  const int *sequence_length = nullptr;
 };
 
 template <OperationType OpType_, template <OperationType> class MultiHeadAttention_>
@@ -146,28 +154,38 @@ public:
   }
 
   size_t calBufSizeInByte(int batch_size, int seq_len, int head_num, int size_per_head, int int8_mode){
+    return calBufFootprint(batch_size, seq_len, head_num, size_per_head, int8_mode).getTotalBytes();
+  }
+
+  // the sub-buffers of buf_, in the order they are carved out of it
+  MemoryFootprint calBufFootprint(int batch_size, int seq_len, int head_num, int size_per_head, int int8_mode){
     size_t m = batch_size*seq_len;
     size_t n = head_num*size_per_head;
     size_t k = n;
-    size_t normal_buf_size;
+    MemoryFootprint footprint;
     if (int8_mode != 0){
-                         //transA_from_tensor & transformer_out_tmp_DataType
-       normal_buf_size = m*k*sizeof(DataType_) +
-                         //int8_from_tensor & attr_matmul_buf_tmp & transformer_out_tmp_int8
-                         m*k*sizeof(int8_t) +
-                         //int8 qkv weight
-                         3*n*k*sizeof(int8_t) +
-                         //FC0 & FC1 & FC2 for m*k(4k)*sizeof(DataType)
-                         4*m*k * sizeof(int) +
-                         //attr_out_buf_ & attr_matmul_buf_ & inter_matmul_buf_
-                         6*m*n*sizeof(DataType_) +
-                         //temp buf
-                         m*n*sizeof(DataType_);
+      //transA_from_tensor & transformer_out_tmp_DataType
+      footprint.add("transposed from tensor", m*k*sizeof(DataType_));
+      //int8_from_tensor & attr_matmul_buf_tmp & transformer_out_tmp_int8
+      footprint.add("int8 from tensor", m*k*sizeof(int8_t));
+      //int8 qkv weight
+      footprint.add("int8 qkv kernel", 3*n*k*sizeof(int8_t));
+      //FC0 & FC1 & FC2 for m*k(4k)*sizeof(DataType)
+      footprint.add("int32 gemm output", 4*m*k * sizeof(int));
+      //attr_out_buf_ & attr_matmul_buf_ & inter_matmul_buf_
+      footprint.add("attention output", 2*m*n*sizeof(DataType_));
+      footprint.add("ffn intermediate", 4*m*n*sizeof(DataType_));
+      //temp buf
+      footprint.add("tmp buffer", m*n*sizeof(DataType_));
     }
     else{
-      normal_buf_size = sizeof(DataType_) * (m*n) * 7 + ((sizeof(half) == sizeof(DataType_)) ? CUBLAS_WORKSPACE_SIZE : 0);
+      footprint.add("cublas workspace", (sizeof(half) == sizeof(DataType_)) ? CUBLAS_WORKSPACE_SIZE : 0);
+      //attr_out_buf_ & attr_matmul_buf_, inter_matmul_buf_, attr_matmul_unnormed_buf_
+      footprint.add("attention output", 2*m*n*sizeof(DataType_));
+      footprint.add("ffn intermediate", 4*m*n*sizeof(DataType_));
+      footprint.add("unnormed attention output", m*n*sizeof(DataType_));
     }
-    return normal_buf_size;  
+    return footprint;
   }
 
   bool checkParameterInMap(int batch_size, int seq_len, int head_num, int size_per_head, int int8_mode, int is_fp16)
@@ -210,7 +228,9 @@ public:
          buffer = NULL;
          return;
       }
-      buffer = reinterpret_cast<void *>(allocator->malloc(buf_size_in_byte, false));
+      MemoryFootprint footprint;
+      footprint.add("gemm test buffer", buf_size_in_byte);
+      buffer = reinterpret_cast<void *>(allocator->mallocBuffers(footprint, false));
   }
   
   bool gemmTest(int batch_size, int seq_len, int head_num, 
@@ -354,12 +374,12 @@ public:
         int n = k;
 
         int buf_size = m * n;
-        size_t buf_size_in_byte = calBufSizeInByte(batch_size_, from_seq_len_, head_num_, size_per_head_, int8_mode_);
+        const MemoryFootprint footprint = calBufFootprint(batch_size_, from_seq_len_, head_num_, size_per_head_, int8_mode_);
         
         //allocate buffer
         if (int8_mode_ != 0){
 
-          buf_ = reinterpret_cast<DataType_ *>(allocator_->malloc(buf_size_in_byte, false));
+          buf_ = reinterpret_cast<DataType_ *>(allocator_->mallocBuffers(footprint, false));
           if (buf_ == nullptr)
             throw std::runtime_error(std::string("Allocator failed to allocate internal buffer."));
 
@@ -379,7 +399,7 @@ public:
           tmp_int8_ = (int8_t*)tmp_DataType_;
         }
         else{
-          buf_ = reinterpret_cast<DataType_ *>(allocator_->malloc(buf_size_in_byte, false));
+          buf_ = reinterpret_cast<DataType_ *>(allocator_->mallocBuffers(footprint, false));
           if (buf_ == nullptr)
             throw std::runtime_error(std::string("Allocator failed to allocate internal buffer."));
 
@@ -513,11 +533,22 @@ public:
 
     param_ = param;
     cuda::MultiHeadInitParam<DataType_> multi_head_init_param;
+    layer_idx_ = param_.layer_idx;
+    layer_num_ = param_.layer_num;
+    if (param_.pooling_type != PoolingType::NONE && layer_idx_ == layer_num_ - 1)
+    {
+      if (int8_mode_ != 0)
+        throw std::runtime_error(std::string("[FT][ERROR] pooling_type != NONE only supports int8_mode == 0 \n"));
+      if (param_.pooled_out == nullptr)
+        throw std::runtime_error(std::string("[FT][ERROR] pooled_out is required when pooling_type != NONE \n"));
+      if (param_.pooling_type != PoolingType::CLS && param_.sequence_length == nullptr)
+        throw std::runtime_error(std::string("[FT][ERROR] sequence_length is required by MEAN and MAX pooling \n"));
+      if (param_.pooling_type == PoolingType::CLS && param_.sequence_id_offset != nullptr && param_.sequence_length == nullptr)
+        throw std::runtime_error(std::string("[FT][ERROR] sequence_length is required by CLS pooling when the padding is removed \n"));
+    }
 
     if (int8_mode_ != 0){
       int hidden_dim = size_per_head_*head_num_;
-      layer_idx_ = param_.layer_idx;
-      layer_num_ = param_.layer_num;
 
       bmm2_amax_ptr = param_.amaxList + 36;
       ProjBiasNorm_amax_ptr = param_.amaxList + 44; 
@@ -592,9 +623,9 @@ public:
 #endif
     try
     {
-      PUSH_RANGE("Encoder Cell")    //mgwg
+      PUSH_RANGE("Encoder Cell", param_.stream)    //mgwg
 
-      PUSH_RANGE("Encoder/MHA/attention_")    //mgwg
+      PUSH_RANGE("Encoder/MHA/attention_", param_.stream)    //mgwg
       attention_->forward();
       POP_RANGE // "Encoder/MHA/attention_"   //mgwg
 
@@ -605,10 +636,31 @@ public:
 
       DataType_ alpha = (DataType_)1.0f;
       DataType_ beta = (DataType_)0.0f;
-      const int m = param_.sequence_id_offset == nullptr ? batch_size_ * from_seq_len_ : param_.valid_word_num;
+      int m = param_.sequence_id_offset == nullptr ? batch_size_ * from_seq_len_ : param_.valid_word_num;
       int k = head_num_ * size_per_head_;
       int n = k;
 
+      const bool is_remove_padding = param_.sequence_id_offset != nullptr;
+      const PoolingType pooling_type = layer_idx_ == layer_num_ - 1 ? param_.pooling_type : PoolingType::NONE;
+      const DataType_ *attr_out = attr_out_buf_;
+      const DataType_ *residual = param_.from_tensor;
+      DataType_ *transformer_out = param_.transformer_out;
+      if (int8_mode_ == 0 && pooling_type == PoolingType::CLS && from_seq_len_ >= 2)
+      {
+        // Rows of different tokens do not interact after the attention, so the rest of the layer
+        // only runs on the [CLS] rows, gathered into attr_matmul_unnormed_buf_ (batch_size x k each).
+        DataType_ *cls_attr_out = attr_matmul_unnormed_buf_;
+        DataType_ *cls_residual = attr_matmul_unnormed_buf_ + batch_size_ * k;
+        sequence_pooling_kernelLauncher(cls_attr_out, attr_out_buf_, param_.sequence_length, batch_size_, from_seq_len_,
+                                        is_remove_padding, k, PoolingType::CLS, param_.stream);
+        sequence_pooling_kernelLauncher(cls_residual, param_.from_tensor, param_.sequence_length, batch_size_, from_seq_len_,
+                                        is_remove_padding, k, PoolingType::CLS, param_.stream);
+        attr_out = cls_attr_out;
+        residual = cls_residual;
+        transformer_out = param_.pooled_out;
+        m = batch_size_;
+      }
+
       if (int8_mode_ != 0){
         if (int8_mode_ == 1)
         {
@@ -714,18 +766,18 @@ public:
 #endif  
       }
       else{
-        PUSH_RANGE("Encoder/MHA/att_out_GEMM")    //mgwg
+        PUSH_RANGE("Encoder/MHA/att_out_GEMM", param_.stream)    //mgwg
         cublasMM_cublasLtMM_wrapper(param_.cublaslt_handle, param_.cublas_handle, CUBLAS_OP_N, CUBLAS_OP_N, 
                                     n, m, k, &alpha, 
                                     param_.self_attention.attention_output_weight.kernel, AType_, n,
-                                    attr_out_buf_, BType_, k, 
+                                    attr_out, BType_, k, 
                                     &beta, (DataType_ *)attr_matmul_buf_, CType_, n,
                                     param_.stream, cublasAlgoMap_, sm_, cublas_workspace_); 
 
         POP_RANGE // "Encoder/MHA/att_out_GEMM"   //mgwg
-        PUSH_RANGE("Encoder/MHA/add_bias_input_layernorm")    //mgwg
+        PUSH_RANGE("Encoder/MHA/add_bias_input_layernorm", param_.stream)    //mgwg
         add_bias_input_layernorm_kernelLauncher<DataType_>(attr_matmul_buf_,
-                                                           param_.from_tensor, 
+                                                           residual, 
                                                            param_.self_attention.attention_output_weight.bias,
                                                            param_.self_layernorm.gamma,
                                                            param_.self_layernorm.beta, 
@@ -739,7 +791,7 @@ public:
 
         n *= 4;
         
-        PUSH_RANGE("Encoder/FFN/GEMM1")    //mgwg
+        PUSH_RANGE("Encoder/FFN/GEMM1", param_.stream)    //mgwg
         cublasMM_cublasLtMM_wrapper(param_.cublaslt_handle, param_.cublas_handle, CUBLAS_OP_N, CUBLAS_OP_N, 
                                     n, m, k, &alpha, 
                                     param_.ffn.intermediate_weight.kernel, AType_, n,
@@ -748,7 +800,7 @@ public:
                                     param_.stream, cublasAlgoMap_, sm_, cublas_workspace_); 
                             
         POP_RANGE // "Encoder/FFN/GEMM1"   //mgwg
-        PUSH_RANGE("Encoder/FFN/add_bias_act")    //mgwg
+        PUSH_RANGE("Encoder/FFN/add_bias_act", param_.stream)    //mgwg
         add_bias_act_kernelLauncher<DataType_>(inter_matmul_buf_, param_.ffn.intermediate_weight.bias, m, n, ActivationType::GELU, param_.stream);
       
         POP_RANGE // "Encoder/FFN/add_bias_act"   //mgwg
@@ -760,18 +812,18 @@ public:
         n = k;
         k *= 4;
         
-        PUSH_RANGE("Encoder/FFN/GEMM2")    //mgwg
+        PUSH_RANGE("Encoder/FFN/GEMM2", param_.stream)    //mgwg
 
         cublasMM_cublasLtMM_wrapper(param_.cublaslt_handle, param_.cublas_handle, CUBLAS_OP_N, CUBLAS_OP_N, 
                                     n, m, k, &alpha, 
                                     param_.ffn.output_weight.kernel, AType_, n,
                                     inter_matmul_buf_, BType_, k, 
-                                    &beta, (DataType_ *)(param_.transformer_out), CType_, n,
+                                    &beta, transformer_out, CType_, n,
                                     param_.stream, cublasAlgoMap_, sm_, cublas_workspace_); 
                                     
         POP_RANGE // "Encoder/FFN/GEMM2"   //mgwg
-        PUSH_RANGE("Encoder/FFN/add_bias_input_layernorm")    //mgwg
-         add_bias_input_layernorm_kernelLauncher<DataType_>(param_.transformer_out, 
+        PUSH_RANGE("Encoder/FFN/add_bias_input_layernorm", param_.stream)    //mgwg
+         add_bias_input_layernorm_kernelLauncher<DataType_>(transformer_out, 
                                                             attr_matmul_buf_,
                                                             param_.ffn.output_weight.bias,
                                                             param_.ffn_layernorm.gamma,
@@ -779,6 +831,14 @@ public:
                                                             m, n, param_.stream);
                                                          
         POP_RANGE // "Encoder/FFN/add_bias_input_layernorm"   //mgwg
+
+        if (pooling_type == PoolingType::MEAN || pooling_type == PoolingType::MAX ||
+            (pooling_type == PoolingType::CLS && transformer_out != param_.pooled_out))
+        {
+          // pool straight from the compacted output, so the sequence never has to be rebuilt
+          sequence_pooling_kernelLauncher(param_.pooled_out, (const DataType_ *)transformer_out, param_.sequence_length,
+                                          batch_size_, from_seq_len_, is_remove_padding, n, pooling_type, param_.stream);
+        }
 #ifndef NDEBUG
         cudaDeviceSynchronize();
         check_cuda_error(cudaGetLastError());
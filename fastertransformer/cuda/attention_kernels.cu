@@ -688,6 +688,59 @@ void attn_softmax_kernelLauncher(
   }
 }
 
+// Softmax of the causal attention, without a mask in memory. Query q of sequence b attends
+// to the keys [0, min(q + 1, sequence_lengths[b])), the others are set to 0.
+//grid = batch_size * head_num * seq_len
+//block.x = min(1024, max(32, (seq_len + 31)/32*32))
+template <typename T>
+__global__
+void causal_softmax_kernel(T* qk_buf_, const int* sequence_lengths, const int batch_size, const int head_num,
+  const int seq_len, const float scalar)
+{
+    int batch_id = blockIdx.x / head_num / seq_len;
+    int seq_id = blockIdx.x % seq_len;
+    int qk_offset = blockIdx.x * seq_len;
+    int valid_len = seq_id + 1;
+    if(sequence_lengths != nullptr)
+      valid_len = min(valid_len, sequence_lengths[batch_id]);
+
+    __shared__ float s_sum, s_max;
+
+    float local_max = -1e20f;
+    for(int i = threadIdx.x; i < valid_len; i += blockDim.x)
+      local_max = max(local_max, (float)qk_buf_[i + qk_offset] * scalar);
+    float max_val = blockReduceMax<float>(local_max);
+    if(threadIdx.x == 0)
+      s_max = max_val;
+    __syncthreads();
+
+    float local_sum = 0.0f;
+    for(int i = threadIdx.x; i < valid_len; i += blockDim.x)
+      local_sum += __expf((float)qk_buf_[i + qk_offset] * scalar - s_max);
+    float sum_val = blockReduceSum<float>(local_sum);
+    if(threadIdx.x == 0)
+      s_sum = sum_val + 1e-6f;
+    __syncthreads();
+
+    for(int i = threadIdx.x; i < seq_len; i += blockDim.x)
+      qk_buf_[i + qk_offset] = i < valid_len ? (T)(__expf((float)qk_buf_[i + qk_offset] * scalar - s_max) / s_sum) : (T)(0.0f);
+}
+
+template<typename T>
+void causal_attn_softmax_kernelLauncher(
+  T* buffer,
+  const int* sequence_lengths,
+  const int batch_size,
+  const int seq_len,
+  const int head_num,
+  const T scalar,
+  cudaStream_t stream)
+{
+  dim3 grid(batch_size * head_num * seq_len);
+  dim3 block(min(1024, (seq_len + 31)/32*32));
+  causal_softmax_kernel<T><<<grid, block, 0, stream>>>(buffer, sequence_lengths, batch_size, head_num, seq_len, (float)scalar);
+}
+
 template<typename T>
 __global__
 void transpose(T* src, T* dst, const int batch_size, const int seq_len, const int head_num, const int size_per_head)
@@ -824,6 +877,24 @@ template void attn_softmax_kernelLauncher(
     const half scalar,
     cudaStream_t stream);
       
+template void causal_attn_softmax_kernelLauncher(
+    float* buffer,
+    const int* sequence_lengths,
+    const int batch_size,
+    const int seq_len,
+    const int head_num,
+    const float scalar,
+    cudaStream_t stream);
+
+template void causal_attn_softmax_kernelLauncher(
+    half* buffer,
+    const int* sequence_lengths,
+    const int batch_size,
+    const int seq_len,
+    const int head_num,
+    const half scalar,
+    cudaStream_t stream);
+
 template void transpose_kernelLauncher(
     float* dst,
     float* src,
@@ -63,6 +63,18 @@ void attn_softmax_kernelLauncher(
   const T scalar,
   cudaStream_t stream);
 
+// Causal softmax of the context attention, the masking is derived from the positions and,
+// if not nullptr, the sequence lengths, instead of a batch_size x seq_len x seq_len mask.
+template <typename T>
+void causal_attn_softmax_kernelLauncher(
+  T* buffer,
+  const int* sequence_lengths,
+  const int batch_size,
+  const int seq_len,
+  const int head_num,
+  const T scalar,
+  cudaStream_t stream);
+
 template <typename T>
 void transpose_kernelLauncher(
   T* dst,
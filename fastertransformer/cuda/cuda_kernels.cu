@@ -270,6 +270,55 @@ void rebuild_sequence_length_padding_kernelLauncher(const T* src, T* tgt,
   rebuild_sequence_length_padding<<<m, 256, 0, stream>>>(src, tgt, mask_offset, n);
 }
 
+template<typename T>
+__global__ void sequence_pooling(T* tgt, const T* src,
+                                 const int* sequence_length,
+                                 const int max_seq_len,
+                                 const bool is_remove_padding,
+                                 const int n,
+                                 const PoolingType pooling_type)
+{
+  const int tid = threadIdx.x;
+  const int bid = blockIdx.x;
+
+  // without padding the rows of sequence bid start after the valid tokens of the previous ones
+  int row_start = bid * max_seq_len;
+  if(is_remove_padding)
+  {
+    row_start = 0;
+    for(int i = 0; i < bid; i++)
+      row_start += sequence_length[i];
+  }
+  const int seq_len = pooling_type == PoolingType::CLS ? 1 : sequence_length[bid];
+
+  for(int i = tid; i < n; i += blockDim.x)
+  {
+    float val = (float)src[row_start * n + i];
+    for(int j = 1; j < seq_len; j++)
+    {
+      const float x = (float)src[(row_start + j) * n + i];
+      val = pooling_type == PoolingType::MAX ? fmaxf(val, x) : val + x;
+    }
+    if(pooling_type == PoolingType::MEAN)
+      val /= seq_len;
+    tgt[bid * n + i] = (T)val;
+  }
+}
+
+template<typename T>
+void sequence_pooling_kernelLauncher(T* tgt, const T* src,
+                                     const int* sequence_length,
+                                     const int batch_size, const int max_seq_len,
+                                     const bool is_remove_padding, const int n,
+                                     const PoolingType pooling_type, cudaStream_t stream)
+{
+  // src: [valid_word_num, hidden_dim] if is_remove_padding, else [batch_size*max_seq_len, hidden_dim]
+  // tgt: [batch_size, hidden_dim]
+  // sequence_length is only read for MEAN/MAX, or to locate the rows when is_remove_padding
+  sequence_pooling<<<batch_size, 256, 0, stream>>>(tgt, src, sequence_length, max_seq_len,
+                                                   is_remove_padding, n, pooling_type);
+}
+
 __global__ void build_sequence_length_padding_offset(const int* sequence_length, 
   const int batch_size, const int max_seq_len, int* valid_word_num, int* tmp_mask_offset)
 {
@@ -308,6 +357,16 @@ template void rebuild_sequence_length_padding_kernelLauncher(const half* src, ha
   const int* mask_offset, const int m, 
   const int n, cudaStream_t stream);
 
+template void sequence_pooling_kernelLauncher(float* tgt, const float* src,
+  const int* sequence_length, const int batch_size, const int max_seq_len,
+  const bool is_remove_padding, const int n,
+  const PoolingType pooling_type, cudaStream_t stream);
+
+template void sequence_pooling_kernelLauncher(half* tgt, const half* src,
+  const int* sequence_length, const int batch_size, const int max_seq_len,
+  const bool is_remove_padding, const int n,
+  const PoolingType pooling_type, cudaStream_t stream);
+
 template void remove_sequence_length_padding_kernelLauncher(const float* src, float* tgt, 
   const int* tmp_mask_offset, 
   int* mask_offset, const int m, 
@@ -53,6 +53,13 @@ void rebuild_sequence_length_padding_kernelLauncher(const T *src, T *tgt,
                                                     const int *mask_offset, const int m,
                                                     const int n, cudaStream_t stream);
 
+template <typename T>
+void sequence_pooling_kernelLauncher(T *tgt, const T *src,
+                                     const int *sequence_length,
+                                     const int batch_size, const int max_seq_len,
+                                     const bool is_remove_padding, const int n,
+                                     const PoolingType pooling_type, cudaStream_t stream);
+
 template <typename T>
 void embedding_position_lookups_kernel_launcher(T* from_tensor,
                                                 const T* embedding_table, 
@@ -329,7 +329,12 @@ class OpenMultiHeadAttention: IMultiHeadAttention<OpType_>
 
   size_t get_workspace_size()
   {
-    size_t size = 0;
+    return get_workspace_footprint().getTotalBytes();
+  }
+
+  MemoryFootprint get_workspace_footprint()
+  {
+    MemoryFootprint footprint;
     
     const int buf_size = batch_size_ * head_num_ * from_seq_len_ * size_per_head_;
     const int qk_buf_size = batch_size_ * head_num_ * from_seq_len_ * from_seq_len_;
@@ -339,22 +344,24 @@ class OpenMultiHeadAttention: IMultiHeadAttention<OpType_>
 
     if(int8_mode_ != 0)
     {
-             //query_buf_(Q_int_buf_) key_buf_(K_int_buf_) value_buf_(V_int_buf_) qk_int_buf_ transpose_dst_(transpose_dst_int_buf_)
-      size = sizeof(int) * (4*buf_size + padded_qk_buf_size) +
-             //int8 q_buf_ k_buf_ v_buf_ qk_buf_
-             sizeof(int8_t) * (3*padded_buf_size + padded_qk_buf_size) +
-             //sequence_id_map 
-             (batch_size_*from_seq_len_)*sizeof(int) +
-             //trt_attn_workspace_
-             (dispatcher_int8.get() ? dispatcher_int8->getWorkspaceSize() : 0);
-
+      //query_buf_(Q_int_buf_) key_buf_(K_int_buf_) value_buf_(V_int_buf_) qk_int_buf_ transpose_dst_(transpose_dst_int_buf_)
+      footprint.add("attention qkv", sizeof(int) * 4*buf_size);
+      footprint.add("attention scores", sizeof(int) * padded_qk_buf_size);
+      //int8 q_buf_ k_buf_ v_buf_ qk_buf_
+      footprint.add("attention qkv", sizeof(int8_t) * 3*padded_buf_size);
+      footprint.add("attention scores", sizeof(int8_t) * padded_qk_buf_size);
+      //sequence_id_map 
+      footprint.add("attention sequence id map", (batch_size_*from_seq_len_)*sizeof(int));
+      //trt_attn_workspace_
+      footprint.add("trt attention workspace", dispatcher_int8.get() ? dispatcher_int8->getWorkspaceSize() : 0);
     }
     else
     {
-      size = sizeof(DataType_) * (buf_size * 7 + qk_buf_size) + sizeof(DataType_*) * 9 + 
-                (dispatcher_fp16.get() ? dispatcher_fp16->getWorkspaceSize() : 0);
+      footprint.add("attention qkv", sizeof(DataType_) * buf_size * 7 + sizeof(DataType_*) * 9);
+      footprint.add("attention scores", sizeof(DataType_) * qk_buf_size);
+      footprint.add("trt attention workspace", dispatcher_fp16.get() ? dispatcher_fp16->getWorkspaceSize() : 0);
     }
-    return size;
+    return footprint;
   }
 
   //allocate buffer for OpenMultiHeadAttention
@@ -409,7 +416,7 @@ class OpenMultiHeadAttention: IMultiHeadAttention<OpType_>
           const int padded_buf_size = batch_size_ * head_num_ * seq_len_padded * size_per_head_;
           const int padded_qk_buf_size = batch_size_ * head_num_ * seq_len_padded * seq_len_padded;
           
-          buf_ = (DataType_*) allocator_->malloc(get_workspace_size(), false);
+          buf_ = (DataType_*) allocator_->mallocBuffers(get_workspace_footprint(), false);
           if (buf_ == NULL)
             throw std::runtime_error(std::string("Allocator failed to allocate internal buffer."));
           Q_int_buf_ = (int *)(buf_);
@@ -429,7 +436,7 @@ class OpenMultiHeadAttention: IMultiHeadAttention<OpType_>
         {
         if (use_trt_kernel && (sm_ == kSM_70 || sm_ == kSM_86 || sm_ == kSM_80 || sm_ == kSM_75 || sm_ == kSM_72) && size_per_head_ == 64)
             dispatcher_fp16.reset(new FusedMHARunnerFP16v2(head_num_, size_per_head_, sm_, q_scaling_));
-          buf_ = (DataType_*) allocator_->malloc(get_workspace_size(), false);
+          buf_ = (DataType_*) allocator_->mallocBuffers(get_workspace_footprint(), false);
           if (buf_ == NULL)
             throw std::runtime_error(std::string("Allocator failed to allocate internal buffer."));
           query_buf_ = buf_;
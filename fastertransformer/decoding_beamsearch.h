@@ -40,6 +40,8 @@ private:
   typedef DecoderTransformerTraits<OpType_> Traits_;
   typedef typename Traits_::DataType DataType_;
   const IAllocator &allocator_;
+  // the batch size the buffers are allocated for, args_.batch_size_ is the one of the next forward
+  int max_batch_size_;
   struct DecodingBeamsearchArguments args_;
 
   const cudaDataType_t computeType_ = Traits_::computeType;
@@ -91,6 +93,7 @@ public:
     PRINT_FUNC_NAME_();
 #endif
     args_.batch_size_ = batch_size;
+    max_batch_size_ = batch_size;
     args_.beam_width_ = beam_width;
     args_.seq_len_ = seq_len;
     args_.head_num_ = head_num;
@@ -158,21 +161,25 @@ public:
                         args_,
                         0);
 
-    size_t datatype_buf_size = from_tensor_size * 2 + decoder_workspace_size +
-                            (cache_size * 4 + mem_cache_size * 2) * args_.decoder_layers_ + decoder_normed_result_buffer_size;
-
-    buf_ = reinterpret_cast<void *>(allocator_.malloc(
-        ((sizeof(DataType_) == sizeof(half)) ? CUBLAS_WORKSPACE_SIZE : 0) + 
-        sizeof(DataType_) * datatype_buf_size +
-        sizeof(float) * (logits_buf_size + cum_log_buf_size) +
-        sizeof(DataType_) * tmp_logits_buf_size +
-        sizeof(DataType_) * padded_embedding_kernel_size +
-        sizeof(float) * padded_embedding_bias_size +
-        sizeof(int) * word_ids_buf_size +
-        sizeof(bool) * finished_buf_size +
-        topk_workspace_size_ +
-        sizeof(float) * args_.temp_storage_size_ + // should be always float
-        sizeof(int) * finished_count_size));
+    // in the order the buffers are carved out of buf_
+    MemoryFootprint footprint;
+    footprint.add("cublas workspace", (sizeof(DataType_) == sizeof(half)) ? CUBLAS_WORKSPACE_SIZE : 0);
+    footprint.add("from tensor", sizeof(DataType_) * from_tensor_size * 2);
+    footprint.add("memory kv cache", sizeof(DataType_) * mem_cache_size * 2 * args_.decoder_layers_);
+    footprint.add("kv cache", sizeof(DataType_) * cache_size * 4 * args_.decoder_layers_);
+    footprint.add("decoder workspace", sizeof(DataType_) * decoder_workspace_size);
+    footprint.add("decoder output", sizeof(DataType_) * decoder_normed_result_buffer_size);
+    footprint.add("logits", sizeof(float) * logits_buf_size);
+    footprint.add("cum log probs", sizeof(float) * cum_log_buf_size);
+    footprint.add("word ids", sizeof(int) * word_ids_buf_size);
+    footprint.add("finished flags", sizeof(bool) * finished_buf_size);
+    footprint.add("beam search storage", sizeof(float) * args_.temp_storage_size_); // should be always float
+    footprint.add("finished count", sizeof(int) * finished_count_size);
+    footprint.add("top-k workspace", topk_workspace_size_);
+    footprint.add("padded embedding kernel", sizeof(DataType_) * padded_embedding_kernel_size);
+    footprint.add("padded embedding bias", sizeof(float) * padded_embedding_bias_size);
+    footprint.add("tmp logits", sizeof(DataType_) * tmp_logits_buf_size);
+    buf_ = allocator_.mallocBuffers(footprint);
 
     if (sizeof(DataType_) == sizeof(half))
     {
@@ -262,11 +269,24 @@ public:
     }
   }
 
+  // Decodes batch_size sentences in the next forwards, at most the batch size of the constructor, so
+  // that one object and its buffers serve requests of any smaller batch. The memory length of a request,
+  // request_max_mem_seq_len of the decoder params, is at most memory_max_seq_len of the constructor.
+  void set_batch_size(const int batch_size)
+  {
+    if (batch_size <= 0 || batch_size > max_batch_size_)
+      throw std::runtime_error("[FT][ERROR] DecodingBeamsearch: batch size " + std::to_string(batch_size) +
+                               " is not in [1, " + std::to_string(max_batch_size_) + "]");
+    args_.batch_size_ = batch_size;
+  }
+
+  int get_max_batch_size() const { return max_batch_size_; }
+
   void forward(const DecoderInitParam<DataType_> *param,
                DecodingInitParam<DataType_> decoding_params)
   {
 
-    PUSH_RANGE("Entire Forward")    //mgwg
+    PUSH_RANGE("Entire Forward", decoding_params.stream)    //mgwg
 
 #ifndef NDEBUG
     PRINT_FUNC_NAME_();
@@ -332,12 +352,12 @@ public:
     for (uint step = 1; step <= args_.seq_len_; ++step)
     {
 
-      PUSH_RANGE("one step")    //mgwg
+      PUSH_RANGE("one step", decoding_params.stream)    //mgwg
 
       //we use two-way buffer
       int kv_cache_id = step & 0x1;
 
-      PUSH_RANGE("input embedding")    //mgwg
+      PUSH_RANGE("input embedding", decoding_params.stream)    //mgwg
       embedding_lookup_sine_position_encoding_kernel_launcher(from_tensor_[0],
                                                               decoding_params.embedding_table,
                                                               decoding_params.position_encoding_table + (step - 1) * args_.hidden_units_,
@@ -373,7 +393,7 @@ public:
         check_cuda_error(cudaGetLastError());
 #endif
 
-        PUSH_RANGE("one decoder layer")    //mgwg
+        PUSH_RANGE("one decoder layer", decoding_params.stream)    //mgwg
 
         decoder_->forward(from_tensor_[from_id], decoding_params.memory_tensor,
                           K_cache_[kv_cache_id] + layer * cache_size,
@@ -390,7 +410,7 @@ public:
 #endif
       }
 
-      PUSH_RANGE("layer_norm")    //mgwg
+      PUSH_RANGE("layer_norm", decoding_params.stream)    //mgwg
 
       layer_norm(from_tensor_[out_id], decoding_params.layernorm.gamma,
                  decoding_params.layernorm.beta, decoder_normed_result_buf_, m, k, decoding_params.stream);
@@ -400,7 +420,7 @@ public:
       DataType_ alpha = (DataType_)1.0f;
       DataType_ beta = (DataType_)0.0f;
 
-      PUSH_RANGE("classifier")    //mgwg
+      PUSH_RANGE("classifier", decoding_params.stream)    //mgwg
 
       cublasMM_cublasLtMM_wrapper_decoder(decoding_params.cublaslt_handle, 
                                           decoding_params.cublas_handle, 
@@ -425,7 +445,7 @@ public:
       if (is_fuse_topk_softMax_ == true)
       {
 
-        PUSH_RANGE("fused_topk_softmax")    //mgwg
+        PUSH_RANGE("fused_topk_softmax", decoding_params.stream)    //mgwg
 
         topK_softMax(tmp_logits_buf_,
                      embedding_bias_ptr,
@@ -443,7 +463,7 @@ public:
         check_cuda_error(cudaGetLastError());
 #endif
 
-        PUSH_RANGE("update_kernel")    //mgwg
+        PUSH_RANGE("update_kernel", decoding_params.stream)    //mgwg
 
         update_kernelLauncher_v2(finished_buf_,
                                  decoding_params.parent_ids + (step - 1) * m,
@@ -523,7 +543,7 @@ public:
         // chose which self cache to use
         int decoder_max_seq_len = (decoder_->getCacheFormat() != 0)? args_.seq_len_ : -1;
 
-        PUSH_RANGE("update_KV_cache")    //mgwg
+        PUSH_RANGE("update_KV_cache", decoding_params.stream)    //mgwg
 
         update_KV_cache_kernelLauncher(K_cache_, V_cache_,
                                       decoding_params.parent_ids + (step - 1) * m,
@@ -548,7 +568,7 @@ public:
 
       // TODO Find a better method to check the is_finished
 
-      PUSH_RANGE("is_finished")    //mgwg
+      PUSH_RANGE("is_finished", decoding_params.stream)    //mgwg
 
       cudaMemcpy(h_finished_buf_, finished_buf_, sizeof(bool) * m, cudaMemcpyDeviceToHost);
       int sum = 0;
@@ -40,6 +40,8 @@ private:
   typedef DecoderTransformerTraits<OpType_> Traits_;
   typedef typename Traits_::DataType DataType_;
   const IAllocator &allocator_;
+  // the batch size the buffers are allocated for, args_.batch_size_ is the one of the next forward
+  int max_batch_size_;
   struct DecodingSamplingArguments args_;
 
   const cudaDataType_t computeType_ = Traits_::computeType;
@@ -58,6 +60,7 @@ private:
   DataType_ *decoder_normed_result_buf_;
   DataType_ *logits_buf_;
   int *word_ids_buf_;
+  int *init_word_ids_buf_; // word_ids_buf_ moves to the output ids during a forward
   bool *finished_buf_;
 
   void *buf_;
@@ -89,6 +92,7 @@ public:
                    const int is_fuse_qkv = false) : allocator_(allocator)
   {
     args_.batch_size_ = batch_size;
+    max_batch_size_ = batch_size;
     args_.seq_len_ = seq_len;
     args_.head_num_ = head_num;
     args_.size_per_head_ = size_per_head;
@@ -224,6 +228,7 @@ public:
     decoder_normed_result_buf_ = (decoder_buf_ + decoder_workspace_size);
     logits_buf_ = decoder_normed_result_buf_ + decoder_normed_result_buffer_size;
     word_ids_buf_ = (int *)(logits_buf_ + logits_buf_size);
+    init_word_ids_buf_ = word_ids_buf_;
     finished_buf_ = (bool *)(word_ids_buf_ + word_ids_buf_size);
     finished_count_buf_ = (int *)(finished_buf_ + finished_buf_size);
     topp_id_vals_buf_ = (int *)(finished_count_buf_ + finished_count_size);
@@ -275,11 +280,24 @@ public:
     }
   }
 
+  // Decodes batch_size sentences in the next forwards, at most the batch size of the constructor, so
+  // that one object and its buffers serve requests of any smaller batch. The memory length of a request,
+  // request_max_mem_seq_len of the decoder params, is at most memory_max_seq_len of the constructor.
+  void set_batch_size(const int batch_size)
+  {
+    if (batch_size <= 0 || batch_size > max_batch_size_)
+      throw std::runtime_error("[FT][ERROR] DecodingSampling: batch size " + std::to_string(batch_size) +
+                               " is not in [1, " + std::to_string(max_batch_size_) + "]");
+    args_.batch_size_ = batch_size;
+  }
+
+  int get_max_batch_size() const { return max_batch_size_; }
+
   void forward(const DecoderInitParam<DataType_> *param,
                DecodingInitParam<DataType_> decoding_params)
   {
 
-    PUSH_RANGE("Entire Forward")    //mgwg
+    PUSH_RANGE("Entire Forward", decoding_params.stream)    //mgwg
 
 #ifndef NDEBUG
     PRINT_FUNC_NAME_();
@@ -296,6 +314,9 @@ public:
       word_ids: start_id_
     */
 
+    // word_ids_buf_ points to the output ids of the last step of the previous forward
+    word_ids_buf_ = init_word_ids_buf_;
+
     if (args_.candidate_num_ != 0)
     {
       sampling_init_kernelLauncher(finished_buf_, decoding_params.sequence_length, word_ids_buf_, 
@@ -353,9 +374,9 @@ public:
     for (uint step = 1; step <= args_.seq_len_; ++step)
     {
 
-      PUSH_RANGE("one step")    //mgwg
+      PUSH_RANGE("one step", decoding_params.stream)    //mgwg
 
-      PUSH_RANGE("input embedding")    //mgwg
+      PUSH_RANGE("input embedding", decoding_params.stream)    //mgwg
 
       embedding_lookup_sine_position_encoding_kernel_launcher(from_tensor_[0],
                                                               decoding_params.embedding_table,
@@ -392,7 +413,7 @@ public:
         check_cuda_error(cudaGetLastError());
 #endif
 
-        PUSH_RANGE("one decoder layer")    //mgwg
+        PUSH_RANGE("one decoder layer", decoding_params.stream)    //mgwg
 
         decoder_->forward(from_tensor_[from_id], decoding_params.memory_tensor,
                           K_cache_[0] + layer * cache_size,
@@ -409,7 +430,7 @@ public:
 #endif
       }
 
-      PUSH_RANGE("layer_norm")    //mgwg
+      PUSH_RANGE("layer_norm", decoding_params.stream)    //mgwg
 
       layer_norm(from_tensor_[out_id], decoding_params.layernorm.gamma,
                  decoding_params.layernorm.beta, decoder_normed_result_buf_, m, k, decoding_params.stream);
@@ -419,7 +440,7 @@ public:
       DataType_ alpha = (DataType_)1.0f;
       DataType_ beta = (DataType_)0.0f;
 
-      PUSH_RANGE("classifier")    //mgwg
+      PUSH_RANGE("classifier", decoding_params.stream)    //mgwg
 
       cublasMM_cublasLtMM_wrapper_decoder(decoding_params.cublaslt_handle, 
                                           decoding_params.cublas_handle, 
@@ -443,7 +464,7 @@ public:
       if (args_.candidate_num_ != 0)
       {
 
-        PUSH_RANGE("update_logits_without_softmax")    //mgwg
+        PUSH_RANGE("update_logits_without_softmax", decoding_params.stream)    //mgwg
 
         // top k sampling
         update_logits_without_softmax(logits_buf_,
@@ -459,7 +480,7 @@ public:
       check_cuda_error(cudaGetLastError());
 #endif
 
-        PUSH_RANGE("topK_sampling")    //mgwg
+        PUSH_RANGE("topK_sampling", decoding_params.stream)    //mgwg
 
         topK_sampling_kernel_kernelLauncher_v2(topk_workspace_,
                                                topk_workspace_size_,
@@ -478,7 +499,7 @@ public:
       else if (args_.probability_threshold_ != 0.0)
       {
 
-        PUSH_RANGE("softmax")    //mgwg
+        PUSH_RANGE("softmax", decoding_params.stream)    //mgwg
 
         // top p sampling
         softmax_kernelLauncher(logits_buf_,
@@ -494,7 +515,7 @@ public:
       check_cuda_error(cudaGetLastError());
 #endif
 
-        PUSH_RANGE("topP_sampling")    //mgwg
+        PUSH_RANGE("topP_sampling", decoding_params.stream)    //mgwg
 
         topP_sampling_kernel_kernelLauncher_v2(topp_workspace_,
                                                topp_workspace_size_,
@@ -522,7 +543,7 @@ public:
       check_cuda_error(cudaGetLastError());
 #endif
 
-      PUSH_RANGE("is_finished")    //mgwg
+      PUSH_RANGE("is_finished", decoding_params.stream)    //mgwg
 
       // TODO Find a better method to check the is_finished
       cudaMemcpy(h_finished_buf_, finished_buf_, sizeof(bool) * args_.batch_size_, cudaMemcpyDeviceToHost);
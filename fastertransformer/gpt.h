@@ -28,6 +28,7 @@
 #include <cuda_runtime.h>
 #include <stdlib.h>
 #include "fastertransformer/utils/nvtx_utils.h"
+#include "fastertransformer/utils/generation_metrics.h"
 
 namespace fastertransformer
 {
@@ -77,6 +78,18 @@ private:
 
     bool *finished_buf_;
     bool *h_finished_buf_;
+
+    // optional, filled by forward() when not null
+    GenerationTrace *trace_ = nullptr;
+
+    // the layer parallel pipeline of forward(), see pipeline_transfer()
+    cudaStream_t pipeline_stream_ = nullptr;
+    cudaEvent_t compute_done_event_ = nullptr;
+    cudaEvent_t transfer_done_event_ = nullptr;
+    cudaEvent_t step_done_events_[2] = {nullptr, nullptr};
+    bool *h_step_finished_ = nullptr; // pinned, the finished flags at the start of the last two steps
+    DataType_ *recv_from_tensor_ = nullptr; // the receives of pipeline_transfer() into the rows it sends
+    bool *recv_finished_buf_ = nullptr;
     
 public:
     DecodingGpt(const IAllocator &allocator, const int batch_size,
@@ -122,113 +135,41 @@ public:
 
         args_.vocab_size_padded_ = div_up(args_.vocab_size_, 64) * 64;
 
-        size_t from_tensor_size = args_.batch_size_ * args_.hidden_units_;                    // type T
-        size_t decoder_workspace_size = (size_t)decoder_->getWorkspaceSize();                                             // type T
-        size_t decoder_normed_result_buffer_size = args_.batch_size_ * args_.hidden_units_;   // type T
-        // cache costs lots of memory, so we only store part of them when we use multi-gpu for inference
-        size_t cache_size = args_.batch_size_ * args_.seq_len_ * args_.hidden_units_ / tensor_para_size;         // type T
-        size_t logits_buf_size = args_.batch_size_ * args_.vocab_size_padded_; // type T
-
-        size_t topp_id_vals_buf_size = args_.batch_size_ * args_.vocab_size_padded_; // type int
-        size_t topp_offset_buf_size = args_.batch_size_ + 1;
-        size_t begin_topp_offset_buf_size = topp_offset_buf_size;
-        size_t curandState_size = args_.batch_size_;
-        size_t finished_buf_size = args_.batch_size_;
-
-        const int MEM_C = 128;
-        size_t embedding_kernel_transposed_padded_size = args_.hidden_units_ * args_.vocab_size_padded_;
-        embedding_kernel_transposed_padded_size = div_up(embedding_kernel_transposed_padded_size, MEM_C) * MEM_C;
-
-        // prevent memory misalinged address
-        logits_buf_size = (size_t)(ceil(logits_buf_size / 4.)) * 4;
-        
-        topp_id_vals_buf_size = (size_t)(ceil(topp_id_vals_buf_size / 4.)) * 4;
-        topp_offset_buf_size = (size_t)(ceil(topp_offset_buf_size / 4.)) * 4;
-        begin_topp_offset_buf_size = topp_offset_buf_size;
-        curandState_size = (size_t)(ceil(curandState_size / 32.)) * 32;
-        finished_buf_size = (size_t)(ceil(finished_buf_size / 32.)) * 32;
-
-        topP_sampling_kernel_kernelLauncher_v2(topp_workspace_,
-                                               topp_workspace_size_,
-                                               logits_buf_,
-                                               topp_id_vals_buf_,
-                                               topp_offset_buf_,
-                                               begin_topp_offset_buf_,
-                                               nullptr,
-                                               curandstate_buf_,
-                                               args_,
-                                               nullptr,
-                                               nullptr,
-                                               args_.vocab_size_padded_,
-                                               0,
-                                               args_.batch_size_);
-
-        topK_sampling_kernel_kernelLauncher_v2(topk_workspace_,
-                                               topk_workspace_size_,
-                                               logits_buf_,
-                                               nullptr,
-                                               nullptr,
-                                               nullptr,
-                                               curandstate_buf_,
-                                               args_,
-                                               0,
-                                               args_.batch_size_);
-
-        topK_topP_sampling_kernel_kernelLauncher_v2(topk_topp_workspace_,
-                                              topk_topp_workspace_size_,
-                                              nullptr,
-                                              logits_buf_,
-                                              nullptr,
-                                              curandstate_buf_,
-                                              args_,
-                                              0,
-                                              args_.batch_size_);
-
-        size_t datatype_buf_size = from_tensor_size * 2 + decoder_workspace_size +
-                                cache_size * 2 * (args_.decoder_layers_ / layer_para_size) + decoder_normed_result_buffer_size;
-
-        nccl_buf_size_ = args_.batch_size_ * args_.vocab_size_padded_;
-        nccl_buf_size_ = (size_t)(ceil(nccl_buf_size_ / 4.)) * 4;
-
-        buf_ = reinterpret_cast<void *>(allocator_.malloc(
-            ((sizeof(DataType_) == sizeof(half)) ? CUBLAS_WORKSPACE_SIZE : 0) + 
-            sizeof(DataType_) * embedding_kernel_transposed_padded_size +
-            sizeof(DataType_) * (datatype_buf_size + logits_buf_size) + 
-            sizeof(int) * (topp_id_vals_buf_size + topp_offset_buf_size + begin_topp_offset_buf_size) +
-            topp_workspace_size_ + topk_workspace_size_ + topk_topp_workspace_size_ + sizeof(DataType_) * nccl_buf_size_ +
-            finished_buf_size + curandState_size * sizeof(curandState_t)));
-
-        if (sizeof(DataType_) == sizeof(half))
+        const MemoryFootprint footprint = get_buffer_footprint(args_, tensor_para_size, layer_para_size);
+        topp_workspace_size_ = footprint.getBytes("top-p workspace");
+        topk_workspace_size_ = footprint.getBytes("top-k workspace");
+        topk_topp_workspace_size_ = footprint.getBytes("top-k top-p workspace");
+        nccl_buf_size_ = footprint.getBytes("nccl logits") / sizeof(DataType_);
+
+        buf_ = allocator_.mallocBuffers(footprint);
+        char *buf = (char *)buf_;
+        // cublas_workspace_ is the start of buf_, for the 16B alignment of cudaMalloc()
+        cublas_workspace_ = footprint.getBytes("cublas workspace") > 0 ? buf_ : nullptr;
+        embedding_kernel_padded_ = (DataType_ *)(buf + footprint.getOffset("embedding kernel"));
+        from_tensor_[0] = (DataType_ *)(buf + footprint.getOffset("from tensor"));
+        from_tensor_[1] = from_tensor_[0] + args_.batch_size_ * args_.hidden_units_;
+        K_cache_[0] = (DataType_ *)(buf + footprint.getOffset("k cache"));
+        V_cache_[0] = (DataType_ *)(buf + footprint.getOffset("v cache"));
+        decoder_buf_ = (DataType_ *)(buf + footprint.getOffset("decoder workspace"));
+        decoder_normed_result_buf_ = (DataType_ *)(buf + footprint.getOffset("decoder output"));
+        logits_buf_ = (DataType_ *)(buf + footprint.getOffset("logits"));
+        topp_id_vals_buf_ = (int *)(buf + footprint.getOffset("top-p id vals"));
+        begin_topp_offset_buf_ = (int *)(buf + footprint.getOffset("top-p begin offsets"));
+        topp_offset_buf_ = (int *)(buf + footprint.getOffset("top-p offsets"));
+        topp_workspace_ = (void *)(buf + footprint.getOffset("top-p workspace"));
+        topk_workspace_ = (void *)(buf + footprint.getOffset("top-k workspace"));
+        topk_topp_workspace_ = (void *)(buf + footprint.getOffset("top-k top-p workspace"));
+        nccl_logits_buf_ = (DataType_ *)(buf + footprint.getOffset("nccl logits"));
+        curandstate_buf_ = (curandState_t *)(buf + footprint.getOffset("curand states"));
+        finished_buf_ = (bool *)(buf + footprint.getOffset("finished flags"));
+        if (layer_para_size > 1)
         {
-          cublas_workspace_ = buf_;
-          embedding_kernel_padded_ = (DataType_ *)((char*)cublas_workspace_ + CUBLAS_WORKSPACE_SIZE);
+            recv_from_tensor_ = (DataType_ *)(buf + footprint.getOffset("pipeline from tensor"));
+            recv_finished_buf_ = (bool *)(buf + footprint.getOffset("pipeline finished flags"));
         }
-        else
-        {
-          cublas_workspace_ = nullptr;
-          embedding_kernel_padded_ = (DataType_ *)buf_;
-        }
-        from_tensor_[0] = (DataType_ *)(embedding_kernel_padded_ + embedding_kernel_transposed_padded_size);
-        from_tensor_[1] = (DataType_ *)(from_tensor_[0] + from_tensor_size);
-
-        K_cache_[0] = from_tensor_[1] + from_tensor_size + 0 * cache_size * args_.decoder_layers_ / layer_para_size;
-        V_cache_[0] = from_tensor_[1] + from_tensor_size + 1 * cache_size * args_.decoder_layers_ / layer_para_size;
-
-        decoder_buf_ = V_cache_[0] + cache_size * args_.decoder_layers_ / layer_para_size;
-        decoder_normed_result_buf_ = (decoder_buf_ + decoder_workspace_size);
-        logits_buf_ = decoder_normed_result_buf_ + decoder_normed_result_buffer_size;
-        topp_id_vals_buf_ = (int *)((DataType_*)logits_buf_ + logits_buf_size);
-        begin_topp_offset_buf_ = (int *)(topp_id_vals_buf_ + topp_id_vals_buf_size);
-        topp_offset_buf_ = (int *)((int*)begin_topp_offset_buf_ + begin_topp_offset_buf_size);
-        topp_workspace_ = (void *)((int*)topp_offset_buf_ + topp_offset_buf_size);
-        topk_workspace_ = (void *)((char*)topp_workspace_ + topp_workspace_size_);
-        topk_topp_workspace_ = (void *)((char*)topk_workspace_ + topk_workspace_size_);
-        nccl_logits_buf_ = (DataType_ *)((char*)topk_topp_workspace_ + topk_topp_workspace_size_);
-        curandstate_buf_ = (curandState_t*)(nccl_logits_buf_ + nccl_buf_size_);
-        finished_buf_ = (bool*)(curandstate_buf_ + curandState_size);
         h_finished_buf_ = new bool[args_.batch_size_];
 
-        cudaMemset(embedding_kernel_padded_, 0, embedding_kernel_transposed_padded_size * sizeof(DataType_));
+        cudaMemset(embedding_kernel_padded_, 0, footprint.getBytes("embedding kernel"));
 
         int isConfigExist = access("decoding_gemm_config.in", 0);
         if (isConfigExist == -1)
@@ -276,6 +217,96 @@ public:
     {
         l_parallel_param_ = param;
         decoder_->set_layer_parallel_param(param);
+        if (param.world_size > 1 && pipeline_stream_ == nullptr)
+        {
+            check_cuda_error(cudaStreamCreateWithFlags(&pipeline_stream_, cudaStreamNonBlocking));
+            check_cuda_error(cudaEventCreateWithFlags(&compute_done_event_, cudaEventDisableTiming));
+            check_cuda_error(cudaEventCreateWithFlags(&transfer_done_event_, cudaEventDisableTiming));
+            check_cuda_error(cudaEventCreateWithFlags(&step_done_events_[0], cudaEventDisableTiming));
+            check_cuda_error(cudaEventCreateWithFlags(&step_done_events_[1], cudaEventDisableTiming));
+            check_cuda_error(cudaMallocHost(&h_step_finished_, sizeof(bool) * 2 * args_.batch_size_));
+        }
+    }
+
+    /**
+     * One NCCL group on pipeline_stream_, after the work of the compute stream enqueued so far: sends the
+     * output of micro-batch send_ite of send_step to the next stage (if send_ite >= 0) and receives the input
+     * of recv_ite_num micro-batches of recv_step from the previous one, starting at recv_ite. The first stage
+     * receives the tokens of recv_step - 1 from the last one, the last stage sends its tokens to the first.
+     * The finished flags of the micro-batch go with them, so the stages need no broadcast.
+     *
+     * In one group, the receive does not wait for the next stage to take the output, and the compute stream
+     * only waits for the group; each micro-batch has its own rows of from_tensor_, so the compute of one
+     * micro-batch overlaps the transfers of the others. NCCL does not order the sends and the receives of a
+     * group, so a micro-batch that is both sent and received, e.g. with a single one, is received into
+     * recv_from_tensor_ and recv_finished_buf_ and copied to its rows after the group.
+     **/
+    void pipeline_transfer(const DecodingInitParam<DataType_> &decoding_params, const int m, const int local_batch,
+                           const int send_step, const int send_ite, const int recv_step, const int recv_ite,
+                           const int recv_ite_num = 1)
+    {
+        const int rank = l_parallel_param_.rank;
+        const int last_rank = l_parallel_param_.world_size - 1;
+        const int first_layer = l_parallel_param_.layers_per_group * rank;
+        const int last_layer = first_layer + l_parallel_param_.layers_per_group - 1;
+        const int size = local_batch * t_parallel_param_.local_hidden_units_;
+        const size_t hidden_offset = (size_t)size * t_parallel_param_.rank;
+        // the rows of from_tensor_ that a middle stage sends and receives are the same ones if layers_per_group is even
+        const bool is_same_from_tensor = rank != 0 && rank != last_rank && (first_layer & 0x1) == 1 - (last_layer & 0x1);
+        const bool is_sent_received = send_ite >= recv_ite && send_ite < recv_ite + recv_ite_num;
+        ncclComm_t comm = l_parallel_param_.nccl_comm;
+
+        check_cuda_error(cudaEventRecord(compute_done_event_, decoding_params.stream));
+        check_cuda_error(cudaStreamWaitEvent(pipeline_stream_, compute_done_event_, 0));
+        PUSH_RANGE("pipeline/transfer", pipeline_stream_)
+        nccl_group_start();
+        if (send_ite >= 0)
+        {
+            const int peer = rank == last_rank ? 0 : rank + 1;
+            if (rank == last_rank)
+                nccl_send(decoding_params.output_ids + send_step * m + send_ite * local_batch, local_batch, peer,
+                          comm, pipeline_stream_);
+            else
+                nccl_send(from_tensor_[1 - (last_layer & 0x1)] + (size_t)send_ite * local_batch * args_.hidden_units_ + hidden_offset,
+                          size, peer, comm, pipeline_stream_);
+            nccl_send(finished_buf_ + send_ite * local_batch, local_batch, peer, comm, pipeline_stream_);
+        }
+        for (int ite = recv_ite; ite < recv_ite + recv_ite_num; ite++)
+        {
+            const int peer = rank == 0 ? last_rank : rank - 1;
+            const bool is_sent = ite == send_ite;
+            const size_t tensor_offset = (size_t)ite * local_batch * args_.hidden_units_ + hidden_offset;
+            if (rank == 0)
+                nccl_recv(decoding_params.output_ids + (recv_step - 1) * m + ite * local_batch, local_batch, peer,
+                          comm, pipeline_stream_);
+            else
+                nccl_recv((is_sent && is_same_from_tensor ? recv_from_tensor_ : from_tensor_[first_layer & 0x1]) + tensor_offset,
+                          size, peer, comm, pipeline_stream_);
+            nccl_recv((is_sent ? recv_finished_buf_ : finished_buf_) + ite * local_batch, local_batch, peer, comm, pipeline_stream_);
+        }
+        nccl_group_end();
+        if (is_sent_received)
+        {
+            const size_t tensor_offset = (size_t)send_ite * local_batch * args_.hidden_units_ + hidden_offset;
+            if (is_same_from_tensor)
+                check_cuda_error(cudaMemcpyAsync(from_tensor_[first_layer & 0x1] + tensor_offset, recv_from_tensor_ + tensor_offset,
+                                                 sizeof(DataType_) * size, cudaMemcpyDeviceToDevice, pipeline_stream_));
+            check_cuda_error(cudaMemcpyAsync(finished_buf_ + send_ite * local_batch, recv_finished_buf_ + send_ite * local_batch,
+                                             sizeof(bool) * local_batch, cudaMemcpyDeviceToDevice, pipeline_stream_));
+        }
+        POP_RANGE
+        check_cuda_error(cudaEventRecord(transfer_done_event_, pipeline_stream_));
+        check_cuda_error(cudaStreamWaitEvent(decoding_params.stream, transfer_done_event_, 0));
+    }
+
+    // The number of finished sequences at the start of step, from the flags forward() copied to h_step_finished_.
+    int get_step_finished_num(const int step, const int request_batch_size) const
+    {
+        const bool *finished = h_step_finished_ + (step % 2) * args_.batch_size_;
+        int sum = 0;
+        for (int i = 0; i < request_batch_size; i++)
+            sum += (int)finished[i];
+        return sum;
     }
 
     void forward_context(const DecoderInitParam<DataType_> *decoder_param,
@@ -284,6 +315,7 @@ public:
 #ifndef NDEBUG
         PRINT_FUNC_NAME_();
 #endif
+        Timeline::setThreadRank(l_parallel_param_.rank * t_parallel_param_.world_size + t_parallel_param_.rank);
         const int input_len = decoding_params.request_input_len;
         const int max_len = (decoding_params.request_output_len > 0 && input_len + decoding_params.request_output_len <= args_.seq_len_) ?
                             input_len + decoding_params.request_output_len :
@@ -312,10 +344,9 @@ public:
         DataType_* from_tensor[2];
         DataType_* decoder_output;
         DataType_* decoder_workspace;
-        void *buf = reinterpret_cast<void *>(allocator_.malloc(
-            decoder_->getContextWorkspaceSize(input_len, local_batch_size) + 
-            (m * h_1 + 2 * request_batch_size * input_len * h_1) * sizeof(DataType_)
-        ));
+        void *buf = allocator_.mallocBuffers(get_context_footprint(input_len, request_batch_size, local_batch_size, h_1,
+                                                                   t_parallel_param_.local_head_num_,
+                                                                   t_parallel_param_.local_hidden_units_));
 #ifndef NDEBUG
         cudaDeviceSynchronize();
         check_cuda_error(cudaGetLastError());
@@ -333,7 +364,7 @@ public:
 
         if(l_parallel_param_.rank == 0)
         {
-            PUSH_RANGE("Before Transformer/Embedding")
+            PUSH_RANGE("Before Transformer/Embedding", decoding_params.stream)
             start_id_embedding_position_lookups_kernel_launcher(from_tensor[0],
                                                                 decoding_params.output_ids,
                                                                 decoding_params.embedding_table,
@@ -360,14 +391,17 @@ public:
             {
                 if(l_parallel_param_.is_valid(layer))
                 {
+                    PUSH_RANGE_INDEX("context layer", decoding_params.stream, layer)
                     in_id = layer & 0x1;
                     out_id = 1 - in_id;
 
                     if(layer == l_parallel_param_.layers_per_group * l_parallel_param_.rank && layer != 0 && l_parallel_param_.world_size > 1)
                     {
                         const int size = m * t_parallel_param_.local_hidden_units_;
+                        PUSH_RANGE("nccl_recv", decoding_params.stream)
                         nccl_recv(from_tensor[in_id] + ite * m * h_1 + size * t_parallel_param_.rank, size, l_parallel_param_.rank - 1, 
                                     l_parallel_param_.nccl_comm, decoding_params.stream);
+                        POP_RANGE
                         all2all_gather(from_tensor[in_id] + ite * m * h_1, from_tensor[in_id] + ite * m * h_1, size, 
                                     t_parallel_param_, decoding_params.stream);
                     }
@@ -397,7 +431,9 @@ public:
                                               K_cache_[0] + cache_offset,
                                               V_cache_[0] + cache_offset,
                                               from_tensor[in_id] + ite * m * h_1,
-                                              decoding_params.d_attn_mask + ite * local_batch_size * input_len * input_len,
+                                              decoding_params.d_attn_mask != nullptr ?
+                                                  decoding_params.d_attn_mask + ite * local_batch_size * input_len * input_len : nullptr,
+                                              decoding_params.d_start_lengths + ite * local_batch_size,
                                               local_batch_size,
                                               input_len,
                                               ite,
@@ -410,9 +446,12 @@ public:
                     if(layer == l_parallel_param_.layers_per_group * (l_parallel_param_.rank + 1) - 1 && layer != args_.decoder_layers_ - 1 && l_parallel_param_.world_size > 1)
                     {
                         const int size = m * t_parallel_param_.local_hidden_units_;
+                        PUSH_RANGE("nccl_send", decoding_params.stream)
                         nccl_send(from_tensor[out_id] + ite * m * h_1 + size * t_parallel_param_.rank, size, l_parallel_param_.rank + 1,
                                     l_parallel_param_.nccl_comm, decoding_params.stream);
+                        POP_RANGE
                     }
+                    POP_RANGE
                 }
             } // end of for loop of layer
         } // end of for loop of ite
@@ -429,6 +468,7 @@ public:
 #ifndef NDEBUG
         PRINT_FUNC_NAME_();
 #endif
+        Timeline::setThreadRank(l_parallel_param_.rank * t_parallel_param_.world_size + t_parallel_param_.rank);
         const int input_len = decoding_params.request_input_len;
         const int max_input_len = decoding_params.max_input_len;
         const int request_batch_size = decoding_params.request_batch_size;
@@ -480,33 +520,63 @@ public:
 #endif
         bool is_generation_done = false;
         const int local_batch = l_parallel_param_.local_batch_size;
+        const int ite_num = request_batch_size / local_batch;
+        if (trace_ != nullptr)
+            trace_->reset(input_len);
+
+        /*
+            With layer parallelism, the micro-batches of local_batch sequences flow through the stages without
+            blocking them: the transfers run on pipeline_stream_ (see pipeline_transfer), and the host checks the
+            finished flags that the stages got two steps before, which are identical on all of them, so the
+            stages keep their queues full and stop at the same step. A stage cannot check fresher flags without
+            stopping at another step than the others, so the generation runs up to 2 steps after all the
+            sequences finished.
+        */
+        const bool is_pipelined = l_parallel_param_.world_size > 1;
+        int prev_step = -1, prev_ite = -1; // the last micro-batch whose output is not sent yet
+        int traced_step = input_len;       // the first step whose flags are not in trace_ yet
+        int end_step = max_len;
         for (size_t step = input_len; step < max_len; ++step)
         {
-
-            PUSH_RANGE("one step")
-
-            const int ite_num = request_batch_size / local_batch;
-            for(size_t ite = 0; ite < ite_num; ite++)
+            if (is_pipelined && trace_ != nullptr && step == (size_t)input_len)
             {
-                if(l_parallel_param_.rank == 0 && l_parallel_param_.world_size > 1)
+                // the end of the context phase, the pipeline is empty anyway
+                check_cuda_error(cudaStreamSynchronize(decoding_params.stream));
+                trace_->step_done_time.push_back(MetricsClock::now());
+                trace_->finished_num.push_back(0);
+                traced_step = input_len + 1;
+            }
+            if (is_pipelined && step >= (size_t)input_len + 2)
+            {
+                check_cuda_error(cudaEventSynchronize(step_done_events_[step % 2]));
+                const int finished_num = get_step_finished_num(step - 2, request_batch_size);
+                if (trace_ != nullptr && step - 2 >= (size_t)traced_step)
                 {
-                    if(step != (size_t)input_len)
-                    {
-                        PUSH_RANGE("token/recv")
-                        nccl_recv(decoding_params.output_ids + (step - 1) * m + ite * local_batch, local_batch,
-                                  l_parallel_param_.world_size - 1, l_parallel_param_.nccl_comm, decoding_params.stream);
-                        POP_RANGE
-                    }
+                    trace_->step_done_time.push_back(MetricsClock::now());
+                    trace_->finished_num.push_back(finished_num);
+                    traced_step = step - 1;
+                }
+                if (finished_num == request_batch_size)
+                {
+                    is_generation_done = true;
+                    end_step = step;
+                    break;
                 }
+            }
+
+            PUSH_RANGE("one step", decoding_params.stream)
 
-                if(l_parallel_param_.rank < l_parallel_param_.world_size - 1 && l_parallel_param_.world_size > 1)
+            for(size_t ite = 0; ite < ite_num; ite++)
+            {
+                if (is_pipelined)
                 {
-                    if(step != (size_t)input_len)
-                    {
-                        nccl_broadcast(finished_buf_ + ite * local_batch, local_batch, l_parallel_param_.world_size - 1, l_parallel_param_, decoding_params.stream);
-                    }
+                    const bool has_input = l_parallel_param_.rank > 0 || step != (size_t)input_len;
+                    if (prev_ite >= 0 || has_input)
+                        pipeline_transfer(decoding_params, m, local_batch, prev_step, prev_ite, step, ite, has_input ? 1 : 0);
+                    cudaMemcpyAsync(h_step_finished_ + (step % 2) * args_.batch_size_ + ite * local_batch, finished_buf_ + ite * local_batch,
+                                    sizeof(bool) * local_batch, cudaMemcpyDeviceToHost, decoding_params.stream);
                 }
-                if(ite == 0)
+                else if(ite == 0)
                 {
                     cudaMemcpyAsync(h_finished_buf_, finished_buf_, sizeof(bool) * request_batch_size, cudaMemcpyDeviceToHost, decoding_params.stream);
                     cudaStreamSynchronize(decoding_params.stream);
@@ -515,6 +585,11 @@ public:
                     {
                         sum += (int)h_finished_buf_[i];
                     }
+                    if (trace_ != nullptr)
+                    {
+                        trace_->step_done_time.push_back(MetricsClock::now());
+                        trace_->finished_num.push_back(sum);
+                    }
                     if (sum == request_batch_size)
                     {
                         is_generation_done = true;
@@ -522,10 +597,12 @@ public:
                     }
                 }
 
+                // the rows of from_tensor_ of the micro-batch
+                const size_t tensor_offset = ite * local_batch * args_.hidden_units_;
                 if(l_parallel_param_.rank == 0)
                 {
-                    PUSH_RANGE("Before Transformer/Embedding")
-                    embedding_position_lookups_kernel_launcher(from_tensor_[0],
+                    PUSH_RANGE("Before Transformer/Embedding", decoding_params.stream)
+                    embedding_position_lookups_kernel_launcher(from_tensor_[0] + tensor_offset,
                                                             decoding_params.embedding_table,
                                                             decoding_params.position_encoding_table,
                                                             decoding_params.output_ids,
@@ -550,6 +627,7 @@ public:
                 {
                     if(l_parallel_param_.is_valid(layer))
                     {
+                        PUSH_RANGE_INDEX("layer", decoding_params.stream, layer)
                         /*
                             For the first layer (layer-0), from_id is 0. We also stored the embedding lookup 
                             result in from_tensor_[0]
@@ -559,10 +637,9 @@ public:
 
                         if(layer == l_parallel_param_.layers_per_group * l_parallel_param_.rank && layer != 0 && l_parallel_param_.world_size > 1)
                         {
+                            // the share of this tensor rank was received by pipeline_transfer
                             const int size = local_batch * t_parallel_param_.local_hidden_units_;
-                            nccl_recv(from_tensor_[from_id] + size * t_parallel_param_.rank, size, l_parallel_param_.rank - 1, 
-                                      l_parallel_param_.nccl_comm, decoding_params.stream);
-                            all2all_gather(from_tensor_[from_id], from_tensor_[from_id], size, 
+                            all2all_gather(from_tensor_[from_id] + tensor_offset, from_tensor_[from_id] + tensor_offset, size, 
                                            t_parallel_param_, decoding_params.stream);
                         }
 
@@ -595,13 +672,13 @@ public:
                                             args_.batch_size_ * args_.seq_len_ * t_parallel_param_.local_hidden_units_ + 
                                             ite * local_batch * args_.seq_len_ * t_parallel_param_.local_hidden_units_;
                         }
-                        decoder_->forward_v2(from_tensor_[from_id], 
+                        decoder_->forward_v2(from_tensor_[from_id] + tensor_offset, 
                                             nullptr, // memory_tensor should be nullptr
                                             K_cache_[0] + cache_offset,
                                             V_cache_[0] + cache_offset,
                                             nullptr, nullptr, // key_mem_cache_ and value_mem_cache_ should be nullptr
                                             nullptr, // memory_sequence_length should be nullptr
-                                            from_tensor_[out_id], step, dummy_decoder_max_seq_len,
+                                            from_tensor_[out_id] + tensor_offset, step, dummy_decoder_max_seq_len,
                                             false, 
                                             finished_buf_ + ite * local_batch,
                                             max_input_len, 
@@ -611,20 +688,14 @@ public:
                         cudaDeviceSynchronize();
                         check_cuda_error(cudaGetLastError());
 #endif          
-
-                        if(layer == l_parallel_param_.layers_per_group * (l_parallel_param_.rank + 1) - 1 && layer != args_.decoder_layers_ - 1 && l_parallel_param_.world_size > 1)
-                        {
-                            const size_t size = local_batch * t_parallel_param_.local_hidden_units_;
-                            nccl_send(from_tensor_[out_id] + size * t_parallel_param_.rank, size, l_parallel_param_.rank + 1, 
-                                      l_parallel_param_.nccl_comm, decoding_params.stream);
-                        }
+                        POP_RANGE
                     }
                 }
 
                 if(l_parallel_param_.rank == l_parallel_param_.world_size - 1)
                 {
 
-                    layer_norm(from_tensor_[out_id],
+                    layer_norm(from_tensor_[out_id] + tensor_offset,
                                decoding_params.layernorm.gamma,
                                decoding_params.layernorm.beta,
                                decoder_normed_result_buf_,
@@ -644,7 +715,7 @@ public:
                     
                     if(t_parallel_param_.world_size == 1)
                     {
-                        PUSH_RANGE("After Transformer/GEMM")
+                        PUSH_RANGE("After Transformer/GEMM", decoding_params.stream)
                         cublasMM_cublasLtMM_wrapper_decoder(decoding_params.cublaslt_handle, 
                                                             decoding_params.cublas_handle, 
                                                             CUBLAS_OP_T, CUBLAS_OP_N,
@@ -660,7 +731,7 @@ public:
                     }
                     else
                     {
-                        PUSH_RANGE("After Transformer/GEMM")
+                        PUSH_RANGE("After Transformer/GEMM", decoding_params.stream)
                         cublasMM_cublasLtMM_wrapper_decoder(decoding_params.cublaslt_handle, 
                                                             decoding_params.cublas_handle, 
                                                             CUBLAS_OP_T, CUBLAS_OP_N,
@@ -721,9 +792,12 @@ public:
                     // reduce and concat the reuslt
                     if(t_parallel_param_.world_size > 1)
                     {
-                        PUSH_RANGE("After Transformer/all2all_gather")
+                        // the logits are gathered exactly, the sampling tells close logits apart
+                        TensorParallelParam logits_parallel_param = t_parallel_param_;
+                        logits_parallel_param.int8_comm_block_size = 0;
+                        PUSH_RANGE("After Transformer/all2all_gather", decoding_params.stream)
                         all2all_gather(nccl_logits_buf_, nccl_logits_buf_, local_batch * n, 
-                                       t_parallel_param_, decoding_params.stream);
+                                       logits_parallel_param, decoding_params.stream);
                         POP_RANGE
                         
                         transpose_axis_01_kernelLauncher(logits_buf_, nccl_logits_buf_, 
@@ -739,7 +813,7 @@ public:
 
                     // Apply repetition penalty.
                     if (args_.repetition_penalty_ != 1.0) {
-                        PUSH_RANGE("After Transformer/Repetition_penalty")
+                        PUSH_RANGE("After Transformer/Repetition_penalty", decoding_params.stream)
                         apply_repetition_penalty_kernelLauncher(logits_buf_,
                                                                 args_.repetition_penalty_,
                                                                 decoding_params.d_start_ids,
@@ -764,7 +838,7 @@ public:
                     // Sampling
                     if(args_.candidate_num_ > 0 && args_.probability_threshold_ == 0.0)
                     {
-                        PUSH_RANGE("After Transformer/Sampling")
+                        PUSH_RANGE("After Transformer/Sampling", decoding_params.stream)
                         // top k sampling
                         topK_sampling_kernel_kernelLauncher_v2(topk_workspace_,
                                                                topk_workspace_size_,
@@ -780,7 +854,7 @@ public:
                     }
                     else if(args_.candidate_num_ == 0 && args_.probability_threshold_ > 0.0f)
                     {
-                        PUSH_RANGE("After Transformer/Sampling")
+                        PUSH_RANGE("After Transformer/Sampling", decoding_params.stream)
                         // top p sampling
                         softmax_kernelLauncher(logits_buf_,
                                                (DataType_*) nullptr,
@@ -813,7 +887,7 @@ public:
                     }
                     else if(args_.candidate_num_ > 0 && args_.probability_threshold_ > 0.0f)
                     {
-                        PUSH_RANGE("After Transformer/Sampling")
+                        PUSH_RANGE("After Transformer/Sampling", decoding_params.stream)
                         topK_topP_sampling_kernel_kernelLauncher_v2(topk_topp_workspace_,
                                                                     topk_topp_workspace_size_,
                                                                     decoding_params.output_ids + step * m + ite * local_batch,
@@ -837,41 +911,51 @@ public:
                                                  step, ite, request_batch_size, local_batch, args_.end_id_, decoding_params.stream);
                 }
 
-                if(l_parallel_param_.rank == l_parallel_param_.world_size - 1 && l_parallel_param_.world_size > 1)
-                {
-                    PUSH_RANGE("token/send")
-                    nccl_send(decoding_params.output_ids + step * m + ite * local_batch, local_batch, 0, l_parallel_param_.nccl_comm, decoding_params.stream);
-                    POP_RANGE
-                }
-
-#ifndef NDEBUG
-                cudaDeviceSynchronize();
-                check_cuda_error(cudaGetLastError());
-#endif
+                // sent with the transfer of the next micro-batch
+                prev_step = step;
+                prev_ite = ite;
 
-                if(l_parallel_param_.rank == l_parallel_param_.world_size - 1 && l_parallel_param_.world_size > 1 && step < max_len - 1)
-                {
-                    nccl_broadcast(finished_buf_ + ite * local_batch, local_batch, l_parallel_param_.world_size - 1, l_parallel_param_, decoding_params.stream);
-                }
 #ifndef NDEBUG
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
 #endif
             } // end for ite for loop
+            if (is_pipelined)
+                check_cuda_error(cudaEventRecord(step_done_events_[step % 2], decoding_params.stream));
 
+            POP_RANGE // one step
             if (is_generation_done) {
+                end_step = step;
                 break;
             }
-            POP_RANGE // one step
         } // end for decoding step for loop
-        if(l_parallel_param_.rank == 0 && l_parallel_param_.world_size > 1)
+        if (is_pipelined)
         {
-            for(size_t ite = 0; ite < request_batch_size / local_batch; ite++)
+            // the output of the last micro-batch, and the first stage gets the tokens of the last step
+            const bool is_first_stage = l_parallel_param_.rank == 0;
+            pipeline_transfer(decoding_params, m, local_batch, prev_step, prev_ite, end_step, 0, is_first_stage ? ite_num : 0);
+            if (trace_ != nullptr)
             {
-                nccl_recv(decoding_params.output_ids + (max_len - 1) * m + ite * local_batch,
-                          local_batch, l_parallel_param_.world_size - 1,
-                          l_parallel_param_.nccl_comm, decoding_params.stream);
+                check_cuda_error(cudaStreamSynchronize(decoding_params.stream));
+                for (int step = traced_step; step < end_step; step++)
+                {
+                    trace_->step_done_time.push_back(MetricsClock::now());
+                    trace_->finished_num.push_back(get_step_finished_num(step, request_batch_size));
+                }
+            }
+        }
+        if (trace_ != nullptr && !is_generation_done)
+        {
+            // the tokens of the last step are not checked by the loop
+            cudaMemcpyAsync(h_finished_buf_, finished_buf_, sizeof(bool) * request_batch_size, cudaMemcpyDeviceToHost, decoding_params.stream);
+            cudaStreamSynchronize(decoding_params.stream);
+            int sum = 0;
+            for (int i = 0; i < request_batch_size; i++)
+            {
+                sum += (int)h_finished_buf_[i];
             }
+            trace_->step_done_time.push_back(MetricsClock::now());
+            trace_->finished_num.push_back(sum);
         }
     } // end of forward
 
@@ -882,10 +966,131 @@ public:
         delete decoder_;
         allocator_.free(buf_);
         delete [] h_finished_buf_;
+        if (pipeline_stream_ != nullptr)
+        {
+            cudaEventDestroy(compute_done_event_);
+            cudaEventDestroy(transfer_done_event_);
+            cudaEventDestroy(step_done_events_[0]);
+            cudaEventDestroy(step_done_events_[1]);
+            cudaStreamDestroy(pipeline_stream_);
+            cudaFreeHost(h_step_finished_);
+        }
     }
 
     inline int get_num_layer() {return args_.decoder_layers_;}
 
+    // The trace is filled at the synchronization forward() already does every step. With layer parallelism,
+    // forward() reads the finished flags two steps late, so the times after the first one are later too.
+    inline void set_generation_trace(GenerationTrace *trace) {trace_ = trace;}
+
+    /**
+     * Sizes in bytes of the sub-buffers of buf_, in the order they are carved out of it.
+     * Nothing is allocated. Like the constructor, it sets args.cub_temp_storage_size_ for the top-p kernel.
+     **/
+    static MemoryFootprint get_buffer_footprint(GptArguments &args, const int tensor_para_size, const int layer_para_size)
+    {
+        const size_t from_tensor_size = args.batch_size_ * args.hidden_units_;                                     // type T
+        const size_t decoder_workspace_size = OpenDecoder<OpType_>::get_workspace_size(args.batch_size_, args.hidden_units_); // type T
+        const size_t decoder_normed_result_buffer_size = args.batch_size_ * args.hidden_units_;                  // type T
+        // cache costs lots of memory, so we only store part of them when we use multi-gpu for inference
+        const size_t cache_size = args.batch_size_ * args.seq_len_ * args.hidden_units_ / tensor_para_size;        // type T
+        size_t logits_buf_size = args.batch_size_ * args.vocab_size_padded_; // type T
+
+        size_t topp_id_vals_buf_size = args.batch_size_ * args.vocab_size_padded_; // type int
+        size_t topp_offset_buf_size = args.batch_size_ + 1;
+        size_t curandState_size = args.batch_size_;
+        size_t finished_buf_size = args.batch_size_;
+        size_t nccl_buf_size = args.batch_size_ * args.vocab_size_padded_;
+
+        const int MEM_C = 128;
+        size_t embedding_kernel_transposed_padded_size = args.hidden_units_ * args.vocab_size_padded_;
+        embedding_kernel_transposed_padded_size = div_up(embedding_kernel_transposed_padded_size, MEM_C) * MEM_C;
+
+        // prevent memory misalinged address
+        logits_buf_size = (size_t)(ceil(logits_buf_size / 4.)) * 4;
+        topp_id_vals_buf_size = (size_t)(ceil(topp_id_vals_buf_size / 4.)) * 4;
+        topp_offset_buf_size = (size_t)(ceil(topp_offset_buf_size / 4.)) * 4;
+        curandState_size = (size_t)(ceil(curandState_size / 32.)) * 32;
+        finished_buf_size = (size_t)(ceil(finished_buf_size / 32.)) * 32;
+        nccl_buf_size = (size_t)(ceil(nccl_buf_size / 4.)) * 4;
+
+        // with a null workspace, the launchers only compute the size of their workspace
+        size_t topp_workspace_size = 0;
+        size_t topk_workspace_size = 0;
+        size_t topk_topp_workspace_size = 0;
+        topP_sampling_kernel_kernelLauncher_v2(nullptr, topp_workspace_size, (DataType_ *)nullptr, nullptr, nullptr, nullptr,
+                                               nullptr, nullptr, args, nullptr, nullptr, args.vocab_size_padded_, 0, args.batch_size_);
+        topK_sampling_kernel_kernelLauncher_v2(nullptr, topk_workspace_size, (DataType_ *)nullptr, nullptr, nullptr, nullptr,
+                                               nullptr, args, 0, args.batch_size_);
+        topK_topP_sampling_kernel_kernelLauncher_v2(nullptr, topk_topp_workspace_size, nullptr, (DataType_ *)nullptr, nullptr,
+                                                    nullptr, args, 0, args.batch_size_);
+
+        const size_t layer_num = args.decoder_layers_ / layer_para_size;
+        MemoryFootprint footprint;
+        footprint.add("cublas workspace", (sizeof(DataType_) == sizeof(half)) ? CUBLAS_WORKSPACE_SIZE : 0);
+        footprint.add("embedding kernel", sizeof(DataType_) * embedding_kernel_transposed_padded_size);
+        footprint.add("from tensor", sizeof(DataType_) * from_tensor_size * 2);
+        footprint.add("k cache", sizeof(DataType_) * cache_size * layer_num);
+        footprint.add("v cache", sizeof(DataType_) * cache_size * layer_num);
+        footprint.add("decoder workspace", sizeof(DataType_) * decoder_workspace_size);
+        footprint.add("decoder output", sizeof(DataType_) * decoder_normed_result_buffer_size);
+        footprint.add("logits", sizeof(DataType_) * logits_buf_size);
+        footprint.add("top-p id vals", sizeof(int) * topp_id_vals_buf_size);
+        footprint.add("top-p begin offsets", sizeof(int) * topp_offset_buf_size);
+        footprint.add("top-p offsets", sizeof(int) * topp_offset_buf_size);
+        footprint.add("top-p workspace", topp_workspace_size);
+        footprint.add("top-k workspace", topk_workspace_size);
+        footprint.add("top-k top-p workspace", topk_topp_workspace_size);
+        footprint.add("nccl logits", sizeof(DataType_) * nccl_buf_size);
+        footprint.add("curand states", sizeof(curandState_t) * curandState_size);
+        footprint.add("finished flags", sizeof(bool) * finished_buf_size);
+        footprint.add("pipeline from tensor", layer_para_size > 1 ? sizeof(DataType_) * from_tensor_size : 0);
+        footprint.add("pipeline finished flags", layer_para_size > 1 ? sizeof(bool) * finished_buf_size : 0);
+        return footprint;
+    }
+
+    // The temporary buffer of forward_context(), in carving order.
+    static MemoryFootprint get_context_footprint(const int input_len, const int request_batch_size, const int local_batch_size,
+                                                 const int hidden_units, const int local_head_num, const int local_hidden_units)
+    {
+        const size_t m = (size_t)local_batch_size * input_len;
+        MemoryFootprint footprint;
+        footprint.add("context from tensor", sizeof(DataType_) * 2 * request_batch_size * input_len * hidden_units);
+        footprint.add("context decoder output", sizeof(DataType_) * m * hidden_units);
+        footprint.add("context decoder workspace", OpenDecoder<OpType_>::get_context_workspace_size(
+                                                       input_len, local_batch_size, hidden_units, local_head_num, local_hidden_units));
+        return footprint;
+    }
+
+    /**
+     * Device memory of one rank, predicted without allocating: the weights as gpt_sample loads them,
+     * buf_ and, when max_input_len > 1, the temporary buffer of forward_context() for that length.
+     * args needs the sizes, the vocabulary and the sampling arguments the constructor gets.
+     **/
+    static MemoryFootprint predict_footprint(GptArguments args, const int tensor_para_size = 1,
+                                             const int layer_para_size = 1, const int max_input_len = 0)
+    {
+        args.hidden_units_ = args.head_num_ * args.size_per_head_;
+        args.vocab_size_padded_ = div_up(args.vocab_size_, 64) * 64;
+        const size_t h = args.hidden_units_;
+        const size_t local_h = h / tensor_para_size;
+        const size_t layer_num = args.decoder_layers_ / layer_para_size;
+        // QKV, attention output and the two FFN kernels with their biases, and the two layernorms
+        const size_t layer_weight_size = h * 3 * local_h + 3 * local_h + local_h * h + h +
+                                         h * 4 * local_h + 4 * local_h + 4 * local_h * h + h + 4 * h;
+        MemoryFootprint footprint;
+        // plus the embedding table, the position encoding and the final layernorm
+        footprint.add("weights", sizeof(DataType_) * (layer_num * layer_weight_size + (args.vocab_size_ + args.seq_len_ + 2) * h));
+        footprint.add(get_buffer_footprint(args, tensor_para_size, layer_para_size));
+        if (max_input_len > 1)
+        {
+            const int local_batch_size = (int)ceil(args.batch_size_ * 1.0 / layer_para_size);
+            footprint.add(get_context_footprint(max_input_len, args.batch_size_, local_batch_size, h,
+                                                args.head_num_ / tensor_para_size, local_h));
+        }
+        return footprint;
+    }
+
     inline void set_local_batch_size(int local_batch)
     { 
         l_parallel_param_.local_batch_size = local_batch;
@@ -110,6 +110,11 @@ private:
 
     bool is_fuse_QKV_in_batched_gemm_;
     const bool is_fuse_QKV_in_normal_gemm_;
+
+    // the all-reduces of the chunks, see gemm_all2all_reduce_sum
+    cudaStream_t comm_stream_ = nullptr;
+    cudaEvent_t gemm_done_event_ = nullptr;
+    cudaEvent_t comm_done_event_ = nullptr;
 public:
 
     void judgeFusedQKV()
@@ -200,12 +205,24 @@ public:
     int getWorkspaceSize()
     {
         assert(max_batch_size_ != -1);
-        return 13 * max_batch_size_ * hidden_units_ + sizeof(DataType_ *) * 9;
+        return get_workspace_size(max_batch_size_, hidden_units_);
+    }
+
+    // the static versions of the workspace sizes give the sizes without a decoder, e.g. to predict the footprint
+    static int get_workspace_size(const int max_batch_size, const int hidden_units)
+    {
+        return 13 * max_batch_size * hidden_units + sizeof(DataType_ *) * 9;
     }
 
     void set_tensor_parallel_param(const TensorParallelParam param)
     {
         t_parallel_param_ = param;
+        if (param.world_size > 1 && param.all_reduce_chunk_num > 1 && comm_stream_ == nullptr)
+        {
+            check_cuda_error(cudaStreamCreateWithFlags(&comm_stream_, cudaStreamNonBlocking));
+            check_cuda_error(cudaEventCreateWithFlags(&gemm_done_event_, cudaEventDisableTiming));
+            check_cuda_error(cudaEventCreateWithFlags(&comm_done_event_, cudaEventDisableTiming));
+        }
     }
 
     void set_layer_parallel_param(const LayerParallelParam param)
@@ -279,7 +296,7 @@ public:
             cudaDeviceSynchronize();
             check_cuda_error(cudaGetLastError());
 #endif
-            PUSH_RANGE("Transformer/slf_attn")
+            PUSH_RANGE("Transformer/slf_attn", param_.stream)
             masked_multi_head_attention(norm_from_tensor_buf_, key_cache_, value_cache_, masked_output_buf_, finished, step, decoder_max_seq_len);
             POP_RANGE
 
@@ -307,9 +324,11 @@ public:
 #endif
                 // For Attention is All You Need decoder
                 /* cross attention with memory */
+                PUSH_RANGE("Transformer/cross_attn", param_.stream)
                 cross_multi_head_attention(norm_masked_output_buf_, memory_tensor,
                                            key_mem_cache_, value_mem_cache_, cross_output_buf_,
                                            memory_sequence_length, finished, param_.request_max_mem_seq_len, step);
+                POP_RANGE
 #ifndef NDEBUG
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
@@ -328,7 +347,9 @@ public:
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
 #endif
+                PUSH_RANGE("Transformer/MLP", param_.stream)
                 ffn(norm_cross_output_buf_, ffn_inner_buf_, decoder_output, m, 4 * t_parallel_param_.local_hidden_units_, hidden_units_, ActivationType::RELU);
+                POP_RANGE
 #ifndef NDEBUG
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
@@ -348,7 +369,7 @@ public:
                 check_cuda_error(cudaGetLastError());
 #endif
                 // For GPT-2 decoder
-                PUSH_RANGE("Transformer/MLP")
+                PUSH_RANGE("Transformer/MLP", param_.stream)
                 ffn(norm_masked_output_buf_, ffn_inner_buf_, decoder_output, m, 4 * t_parallel_param_.local_hidden_units_, hidden_units_, ActivationType::GELU);
                 POP_RANGE
 
@@ -400,7 +421,7 @@ public:
             cudaDeviceSynchronize();
             check_cuda_error(cudaGetLastError());
 #endif
-            PUSH_RANGE("Transformer/slf_attn")
+            PUSH_RANGE("Transformer/slf_attn", param_.stream)
             masked_multi_head_attention_v2(norm_from_tensor_buf_, key_cache_, value_cache_, masked_output_buf_, finished, step, decoder_max_seq_len, max_input_len, input_lengths);
             POP_RANGE
 
@@ -428,9 +449,11 @@ public:
 #endif
                 // For Attention is All You Need decoder
                 /* cross attention with memory */
+                PUSH_RANGE("Transformer/cross_attn", param_.stream)
                 cross_multi_head_attention(norm_masked_output_buf_, memory_tensor,
                                            key_mem_cache_, value_mem_cache_, cross_output_buf_,
                                            memory_sequence_length, finished, param_.request_max_mem_seq_len, step);
+                POP_RANGE
 #ifndef NDEBUG
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
@@ -449,7 +472,9 @@ public:
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
 #endif
+                PUSH_RANGE("Transformer/MLP", param_.stream)
                 ffn(norm_cross_output_buf_, ffn_inner_buf_, decoder_output, m, 4 * t_parallel_param_.local_hidden_units_, hidden_units_, ActivationType::RELU);
+                POP_RANGE
 #ifndef NDEBUG
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
@@ -468,7 +493,7 @@ public:
                 cudaDeviceSynchronize();
                 check_cuda_error(cudaGetLastError());
 #endif
-                PUSH_RANGE("Transformer/MLP")
+                PUSH_RANGE("Transformer/MLP", param_.stream)
                 ffn(norm_masked_output_buf_, ffn_inner_buf_, decoder_output, m, 4 * t_parallel_param_.local_hidden_units_, hidden_units_, ActivationType::GELU);
                 POP_RANGE
 
@@ -491,25 +516,35 @@ public:
     }
 
     size_t getContextWorkspaceSize(const int seq_len, const int local_batch_size)
+    {
+        return get_context_workspace_size(seq_len, local_batch_size, hidden_units_,
+                                          t_parallel_param_.local_head_num_, t_parallel_param_.local_hidden_units_);
+    }
+
+    static size_t get_context_workspace_size(const int seq_len, const int local_batch_size, const int hidden_units,
+                                             const int local_head_num, const int local_hidden_units)
     {
         const size_t m = local_batch_size * seq_len;
-        const size_t qk_buf_size = (size_t)(ceil(local_batch_size * t_parallel_param_.local_head_num_ * seq_len * seq_len / 4.)) * 4;
-        const size_t attn_work_space_size = 3 * m * hidden_units_ /* Q, K, V */ +
-                                         3 * m * t_parallel_param_.local_hidden_units_ /* q_buf, k_buf, v_buf */ +
+        const size_t qk_buf_size = (size_t)(ceil(local_batch_size * local_head_num * seq_len * seq_len / 4.)) * 4;
+        const size_t attn_work_space_size = 3 * m * hidden_units /* Q, K, V */ +
+                                         3 * m * local_hidden_units /* q_buf, k_buf, v_buf */ +
                                          qk_buf_size + 
-                                         2 * m * t_parallel_param_.local_hidden_units_ /* trans_attn, attn */;
-        return (m * hidden_units_ * 3 +
+                                         2 * m * local_hidden_units /* trans_attn, attn */;
+        return (m * hidden_units * 3 +
                 attn_work_space_size +
-                m * t_parallel_param_.local_hidden_units_ * 4 /* ffn buffer */ ) * sizeof(DataType_);
+                m * local_hidden_units * 4 /* ffn buffer */ ) * sizeof(DataType_);
     }
 
     // use to compute the context of gpt model
+    // d_attn_mask is [local_batch_size, seq_len, seq_len]; if it is nullptr, the attention is causal,
+    // limited to d_sequence_lengths[b] keys when d_sequence_lengths is not nullptr.
     void forward_context(DataType_* workspace,
                          DataType_ *decoder_output, 
                          DataType_ *key_cache_, 
                          DataType_ *value_cache_,
                          const DataType_ *from_tensor,
                          const DataType_ *d_attn_mask,
+                         const int *d_sequence_lengths,
                          const int local_batch_size,
                          const int seq_len,
                          const int ite,
@@ -547,13 +582,14 @@ public:
             cudaDeviceSynchronize();
             check_cuda_error(cudaGetLastError());
 #endif
-            PUSH_RANGE("Transformer/slf_attn")
+            PUSH_RANGE("Transformer/slf_attn", param_.stream)
             unfused_masked_multi_head_attention(attention_workspace,
                                                 norm_from_tensor_buf,
                                                 key_cache_,
                                                 value_cache_,
                                                 masked_output_buf,
                                                 d_attn_mask,
+                                                d_sequence_lengths,
                                                 local_batch_size,
                                                 seq_len,
                                                 ite,
@@ -576,7 +612,7 @@ public:
             check_cuda_error(cudaGetLastError());
 #endif
             // For GPT decoder
-            PUSH_RANGE("Transformer/MLP");
+            PUSH_RANGE("Transformer/MLP", param_.stream);
             ffn(norm_masked_output_buf, ffn_inner_buf, decoder_output, m, 4 * t_parallel_param_.local_hidden_units_, hidden_units_, ActivationType::GELU);
             POP_RANGE
 #ifndef NDEBUG
@@ -699,22 +735,8 @@ public:
         k = t_parallel_param_.local_hidden_units_;
         n = hidden_units_;
 
-        cublasMM_cublasLtMM_wrapper_decoder(param_.cublaslt_handle, 
-                                            param_.cublas_handle, 
-                                            CUBLAS_OP_N, CUBLAS_OP_N,
-                                            n, m, k,
-                                            &alpha,
-                                            param_.self_attention.attention_output_weight.kernel, AType_, n,
-                                            context_buf_, BType_, k,
-                                            &beta,
-                                            decoder_output, CType_, n,
-                                            param_.stream, cublasAlgoMap_,
-                                            cublas_workspace_);
-
-        PUSH_RANGE("Transformer/slf_attn/all2all_reduce")
-        all2all_reduce_sum(decoder_output, decoder_output, m*n,
-                           t_parallel_param_, param_.stream);
-        POP_RANGE  
+        gemm_all2all_reduce_sum(param_.self_attention.attention_output_weight.kernel, context_buf_, decoder_output,
+                                m, n, k, "Transformer/slf_attn/all2all_reduce");
     }
 
     void masked_multi_head_attention_v2(const DataType_ *from_tensor, DataType_ *key_cache_,
@@ -755,22 +777,8 @@ public:
         k = t_parallel_param_.local_hidden_units_;
         n = hidden_units_;
 
-        cublasMM_cublasLtMM_wrapper_decoder(param_.cublaslt_handle, 
-                                            param_.cublas_handle, 
-                                            CUBLAS_OP_N, CUBLAS_OP_N,
-                                            n, m, k,
-                                            &alpha,
-                                            param_.self_attention.attention_output_weight.kernel, AType_, n,
-                                            context_buf_, BType_, k,
-                                            &beta,
-                                            decoder_output, CType_, n,
-                                            param_.stream, cublasAlgoMap_,
-                                            cublas_workspace_);
-
-        PUSH_RANGE("Transformer/slf_attn/all2all_reduce")
-        all2all_reduce_sum(decoder_output, decoder_output, m*n,
-                           t_parallel_param_, param_.stream);
-        POP_RANGE  
+        gemm_all2all_reduce_sum(param_.self_attention.attention_output_weight.kernel, context_buf_, decoder_output,
+                                m, n, k, "Transformer/slf_attn/all2all_reduce");
     }
 
     /* attention with source sentence */
@@ -856,6 +864,50 @@ public:
     }
                                     
 
+    // output[m, n] = input[m, k] * kernel[k, n], summed over the tensor parallel ranks. With
+    // all_reduce_chunk_num > 1, the rows are split in chunks and the all-reduce of each chunk runs
+    // on comm_stream_ while param_.stream computes the GEMM of the next chunk.
+    void gemm_all2all_reduce_sum(const DataType_ *kernel, const DataType_ *input, DataType_ *output,
+                                 const int m, const int n, const int k, const char *range_name)
+    {
+        DataType_ alpha = (DataType_)1.0f, beta = (DataType_)0.0f;
+        const int chunk_num = comm_stream_ != nullptr && t_parallel_param_.world_size > 1 ?
+                              std::min(t_parallel_param_.all_reduce_chunk_num, m) : 1;
+        for (int i = 0; i < chunk_num; i++)
+        {
+            const int row = m * i / chunk_num;
+            const int rows = m * (i + 1) / chunk_num - row;
+            cublasMM_cublasLtMM_wrapper_decoder(param_.cublaslt_handle, 
+                                                param_.cublas_handle, 
+                                                CUBLAS_OP_N, CUBLAS_OP_N,
+                                                n, rows, k,
+                                                &alpha,
+                                                kernel, AType_, n,
+                                                input + (size_t)row * k, BType_, k,
+                                                &beta,
+                                                output + (size_t)row * n, CType_, n,
+                                                param_.stream, cublasAlgoMap_,
+                                                cublas_workspace_);
+            if (chunk_num == 1)
+            {
+                PUSH_RANGE(range_name, param_.stream)
+                all2all_reduce_sum(output, output, m*n,
+                                   t_parallel_param_, param_.stream);
+                POP_RANGE
+                return;
+            }
+            check_cuda_error(cudaEventRecord(gemm_done_event_, param_.stream));
+            check_cuda_error(cudaStreamWaitEvent(comm_stream_, gemm_done_event_, 0));
+            PUSH_RANGE(range_name, comm_stream_)
+            all2all_reduce_sum(output + (size_t)row * n, output + (size_t)row * n, rows * n,
+                               t_parallel_param_, comm_stream_);
+            POP_RANGE
+        }
+        // the next kernels of param_.stream read the reduced output
+        check_cuda_error(cudaEventRecord(comm_done_event_, comm_stream_));
+        check_cuda_error(cudaStreamWaitEvent(param_.stream, comm_done_event_, 0));
+    }
+
     void ffn(const DataType_ *input, DataType_ *ffn_inner, DataType_ *output,
              const int m, const int inner_size, const int n, ActivationType activation_type)
     {
@@ -878,22 +930,8 @@ public:
         add_bias_act_kernelLauncher(ffn_inner, param_.ffn.intermediate_weight.bias, m1, inner_size, activation_type, param_.stream);
 
         int m2 = m, n2 = n, k2 = inner_size;
-        cublasMM_cublasLtMM_wrapper_decoder(param_.cublaslt_handle, 
-                                            param_.cublas_handle, 
-                                            CUBLAS_OP_N, CUBLAS_OP_N,
-                                            n2, m2, k2,
-                                            &alpha,
-                                            param_.ffn.output_weight.kernel, AType_, n2,
-                                            ffn_inner, BType_, k2,
-                                            &beta,
-                                            output, CType_, n2,
-                                            param_.stream, cublasAlgoMap_,
-                                            cublas_workspace_);
-
-        PUSH_RANGE("Transformer/MLP/all2all_reduce")
-        all2all_reduce_sum(output, output, m*n,
-                           t_parallel_param_, param_.stream);
-        POP_RANGE
+        gemm_all2all_reduce_sum(param_.ffn.output_weight.kernel, ffn_inner, output,
+                                m2, n2, k2, "Transformer/MLP/all2all_reduce");
     }
 
     void unfused_masked_multi_head_attention(DataType_ *workspace,
@@ -902,6 +940,7 @@ public:
                                              DataType_* value_cache_,
                                              DataType_* decoder_output,
                                              const DataType_* attr_mask,
+                                             const int* sequence_lengths,
                                              const int local_batch_size,
                                              const int seq_len,
                                              const int ite,
@@ -1056,13 +1095,26 @@ public:
           computeType_,
           cublasAlgo));
 
-        attn_softmax_kernelLauncher(qk_buf, 
-                                    attr_mask,
-                                    local_batch_size,
-                                    seq_len,
-                                    t_parallel_param_.local_head_num_,
-                                    scalar,
-                                    param_.stream);
+        if(attr_mask != nullptr)
+        {
+            attn_softmax_kernelLauncher(qk_buf, 
+                                        attr_mask,
+                                        local_batch_size,
+                                        seq_len,
+                                        t_parallel_param_.local_head_num_,
+                                        scalar,
+                                        param_.stream);
+        }
+        else
+        {
+            causal_attn_softmax_kernelLauncher(qk_buf,
+                                               sequence_lengths,
+                                               local_batch_size,
+                                               seq_len,
+                                               t_parallel_param_.local_head_num_,
+                                               scalar,
+                                               param_.stream);
+        }
 
         cublasAlgo = static_cast<cublasGemmAlgo_t>(getAlgoIdFromMap(cublasAlgoMap_, local_batch_size * t_parallel_param_.local_head_num_, size_per_head_, seq_len, seq_len, std::is_same<float, DataType_>::value ? FLOAT_DATATYPE : HALF_DATATYPE));
         
@@ -1090,22 +1142,8 @@ public:
             const int k = t_parallel_param_.local_hidden_units_;
             const int n = hidden_units_;
 
-            cublasMM_cublasLtMM_wrapper_decoder(param_.cublaslt_handle,
-                                                param_.cublas_handle,
-                                                CUBLAS_OP_N, CUBLAS_OP_N,
-                                                n, m, k,
-                                                &alpha,
-                                                param_.self_attention.attention_output_weight.kernel, AType_, n,
-                                                attn_out, BType_, k,
-                                                &beta,
-                                                decoder_output, CType_, n,
-                                                param_.stream, cublasAlgoMap_,
-                                                cublas_workspace_);
-
-            PUSH_RANGE("Transformer/slf_attn/all2all_reduce")
-            all2all_reduce_sum(decoder_output, decoder_output, m*n,
-                            t_parallel_param_, param_.stream);
-            POP_RANGE
+            gemm_all2all_reduce_sum(param_.self_attention.attention_output_weight.kernel, attn_out, decoder_output,
+                                    m, n, k, "Transformer/slf_attn/all2all_reduce");
         }
     }
 
@@ -1129,6 +1167,13 @@ public:
         cross_output_buf_ = nullptr;
         norm_cross_output_buf_ = nullptr;
         ffn_inner_buf_ = nullptr;
+
+        if (comm_stream_ != nullptr)
+        {
+            cudaEventDestroy(gemm_done_event_);
+            cudaEventDestroy(comm_done_event_);
+            cudaStreamDestroy(comm_stream_);
+        }
     }
 
     inline void set_local_batch_size(int local_batch)
@@ -21,6 +21,7 @@
 #include "fastertransformer/utils/common.h"
 
 #include "fastertransformer/tf_op/common_op.h"
+#include "fastertransformer/tf_op/decoding_resource.h"
 #include "fastertransformer/tf_op/tf_traits.h"
 
 #include "tensorflow/core/lib/core/errors.h"
@@ -128,53 +129,59 @@ public:
   void Compute(OpKernelContext *context) override
     {
         assert((int)(context->input(0).dims()) == 3);
-        batch_size_ = (int)context->input(0).dim_size(0) / beam_width_;
+        const int batch_size = (int)context->input(0).dim_size(0) / beam_width_;
         const int memory_max_seq_len = (int)context->input(0).dim_size(1);
         const int memory_hidden_dim = (int)context->input(0).dim_size(2);
         const int vocab_size = (int)context->input(30).dim_size(0);
 
+        // the decoding object and its buffers are kept across the calls, see decoding_resource.h
+        auto resource = resource_pool_.acquire();
+
         DecodingInitParam<DataType_> decoding_params;
-        decoding_params.cublas_handle = this->get_cublas_handler();
-        decoding_params.cublaslt_handle = this->get_cublaslt_handler();
+        decoding_params.cublas_handle = resource->get_cublas_handler();
+        decoding_params.cublaslt_handle = resource->get_cublaslt_handler();
         Tensor *output_ids = nullptr;
         OP_REQUIRES_OK(
             context,
-            context->allocate_output(0, {max_seq_len_, batch_size_ * beam_width_}, &output_ids));
+            context->allocate_output(0, {max_seq_len_, batch_size * beam_width_}, &output_ids));
 
         Tensor *parent_ids = nullptr;
         OP_REQUIRES_OK(
             context,
-            context->allocate_output(1, {max_seq_len_, batch_size_ * beam_width_}, &parent_ids));
+            context->allocate_output(1, {max_seq_len_, batch_size * beam_width_}, &parent_ids));
 
         Tensor *sequence_length = nullptr;
         OP_REQUIRES_OK(
             context,
-            context->allocate_output(2, {batch_size_ * beam_width_}, &sequence_length));
+            context->allocate_output(2, {batch_size * beam_width_}, &sequence_length));
 
         decoding_params.output_ids = reinterpret_cast<int *>(output_ids->flat<int>().data());
         decoding_params.parent_ids = reinterpret_cast<int *>(parent_ids->flat<int>().data());
         decoding_params.sequence_length = reinterpret_cast<int *>(sequence_length->flat<int>().data());
 
-        check_cuda_error(cudaMemset(decoding_params.output_ids, 0, sizeof(int) * max_seq_len_ * batch_size_ * beam_width_));
-        check_cuda_error(cudaMemset(decoding_params.parent_ids, 0, sizeof(int) * max_seq_len_ * batch_size_ * beam_width_));
-        check_cuda_error(cudaMemset(decoding_params.sequence_length, 0, sizeof(int) * batch_size_ * beam_width_));
+        check_cuda_error(cudaMemset(decoding_params.output_ids, 0, sizeof(int) * max_seq_len_ * batch_size * beam_width_));
+        check_cuda_error(cudaMemset(decoding_params.parent_ids, 0, sizeof(int) * max_seq_len_ * batch_size * beam_width_));
+        check_cuda_error(cudaMemset(decoding_params.sequence_length, 0, sizeof(int) * batch_size * beam_width_));
 
-        typedef DecoderTransformerTraits<traits_::OpType> DecodingTraits_;
-        DecodingBeamsearch<DecodingTraits_::OpType> *decoding_beamsearch_;
         const cudaStream_t &stream = context->eigen_device<Device>().stream();
         decoding_params.stream = stream;
-        fastertransformer::Allocator<AllocatorType::TF> allocator_(context, stream);
+        DecodingBeamsearch_ *decoding_beamsearch_ = nullptr;
         try
         {
-            decoding_beamsearch_ = new DecodingBeamsearch<DecodingTraits_::OpType>(
-                allocator_, batch_size_, beam_width_,
-                max_seq_len_, head_num_, size_per_head_,
-                vocab_size, num_layer_,
-                memory_hidden_dim, memory_max_seq_len,
-                start_id_, end_id_, 
-                beam_search_diversity_rate_,
-                true,
-                is_fuse_qkv_);
+            decoding_beamsearch_ = resource->get(
+                context, stream, batch_size, memory_max_seq_len, vocab_size, memory_hidden_dim,
+                [&](const IAllocator &allocator, const int max_batch_size, const int max_mem_seq_len) {
+                    return new DecodingBeamsearch_(
+                        allocator, max_batch_size, beam_width_,
+                        max_seq_len_, head_num_, size_per_head_,
+                        vocab_size, num_layer_,
+                        memory_hidden_dim, max_mem_seq_len,
+                        start_id_, end_id_, 
+                        beam_search_diversity_rate_,
+                        true,
+                        is_fuse_qkv_);
+                });
+            decoding_beamsearch_->set_batch_size(batch_size);
         }
         catch (std::runtime_error &error)
         {
@@ -187,15 +194,15 @@ public:
         decoding_params.memory_sequence_length = reinterpret_cast<const int *>(context->input(1).flat<int>().data());
         OP_REQUIRES(context, decoding_params.memory_sequence_length != nullptr, errors::InvalidArgument("memory_sequence_length"));
 
-        DecoderInitParam<DataType_> *params = new DecoderInitParam<DataType_>[num_layer_];
+        std::vector<DecoderInitParam<DataType_> > params(num_layer_);
         const int hidden_unit = size_per_head_ * head_num_;
         for (int i = 0; i < num_layer_; i++)
         {
-            params[i].request_batch_size = batch_size_ * beam_width_;
+            params[i].request_batch_size = batch_size * beam_width_;
             params[i].request_max_mem_seq_len = memory_max_seq_len;
             params[i].stream = stream;
-            params[i].cublas_handle = this->get_cublas_handler();
-            params[i].cublaslt_handle = this->get_cublaslt_handler();
+            params[i].cublas_handle = resource->get_cublas_handler();
+            params[i].cublaslt_handle = resource->get_cublaslt_handler();
             check_cuda_error(cublasSetStream(params[i].cublas_handle, params[i].stream));
 
             this->get_tensor(context, 2, &params[i].self_layernorm.beta, i * hidden_unit);
@@ -245,7 +252,7 @@ public:
 
         try
         {
-            decoding_beamsearch_->forward(params, decoding_params);
+            decoding_beamsearch_->forward(params.data(), decoding_params);
         }
         catch(std::runtime_error& error)
         {
@@ -257,19 +264,18 @@ public:
             std::cout << errors::Internal("Runtime error");
             exit(-1);
         }
-
-        delete decoding_beamsearch_;
-        delete [] params;
     }
 
 private:
-    int batch_size_, beam_width_, max_seq_len_;
+    int beam_width_, max_seq_len_;
     int head_num_, size_per_head_, num_layer_;
     int start_id_, end_id_;
     float beam_search_diversity_rate_;
     bool is_fuse_qkv_;
     typedef TFTraits<T> traits_;
     typedef typename traits_::DataType DataType_;
+    typedef DecodingBeamsearch<DecoderTransformerTraits<traits_::OpType>::OpType> DecodingBeamsearch_;
+    ResourcePool<DecodingResource<DecodingBeamsearch_> > resource_pool_;
 };
 
 #ifdef GOOGLE_CUDA
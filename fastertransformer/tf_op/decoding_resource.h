@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Decoding objects kept by the TensorFlow decoding ops across their Compute calls
+ *
+ * Building a decoding object allocates its buffers (the KV caches, the logits and the
+ * workspaces) and reads decoding_gemm_config.in, so the ops keep the object with its buffers
+ * instead of building one per session run. The buffers are allocated for the largest batch
+ * and memory length seen so far and only reallocated when a request exceeds them.
+ *
+ * An op kernel is built per node and device, and TF may run its Compute concurrently for
+ * different steps. Each call takes an idle resource of the op's pool, or a new one if all of
+ * them are in use, and gives it back when it returns.
+ **/
+
+#pragma once
+
+#include "fastertransformer/utils/allocator.h"
+#include "fastertransformer/utils/common.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tensorflow
+{
+namespace
+{
+
+template <typename Decoding>
+class DecodingResource
+{
+public:
+  typedef fastertransformer::Allocator<fastertransformer::AllocatorType::TF> TFAllocator;
+
+  DecodingResource()
+  {
+    check_cuda_error(cublasCreate(&cublas_handle_));
+    check_cuda_error(cublasLtCreate(&cublaslt_handle_));
+  }
+
+  ~DecodingResource()
+  {
+    // the decoding object frees its buffers with the allocator
+    decoding_.reset();
+    allocator_.reset();
+    cublasDestroy(cublas_handle_);
+    cublasLtDestroy(cublaslt_handle_);
+  }
+
+  // Returns the decoding object for a request of batch_size and mem_seq_len. create(allocator, batch_size,
+  // mem_seq_len) builds a new one when there is none, when the request is larger than its buffers, or when
+  // the vocabulary size or the memory hidden units change; otherwise the object is reused and allocates
+  // in the context of this call. Throws the runtime_error of create.
+  template <typename Create>
+  Decoding *get(OpKernelContext *context, cudaStream_t stream, const int batch_size, const int mem_seq_len,
+                const int vocab_size, const int memory_hidden_dim, Create create)
+  {
+    if (decoding_ == nullptr || batch_size > batch_size_ || mem_seq_len > mem_seq_len_ ||
+        vocab_size != vocab_size_ || memory_hidden_dim != memory_hidden_dim_)
+    {
+      decoding_.reset();
+      allocator_.reset();
+      batch_size_ = std::max(batch_size, batch_size_);
+      mem_seq_len_ = std::max(mem_seq_len, mem_seq_len_);
+      vocab_size_ = vocab_size;
+      memory_hidden_dim_ = memory_hidden_dim;
+      allocator_.reset(new TFAllocator(context, stream));
+      decoding_.reset(create(*allocator_, batch_size_, mem_seq_len_));
+    }
+    else
+    {
+      allocator_->setContext(context);
+    }
+    return decoding_.get();
+  }
+
+  cublasHandle_t get_cublas_handler() { return cublas_handle_; }
+  cublasLtHandle_t get_cublaslt_handler() { return cublaslt_handle_; }
+
+private:
+  std::unique_ptr<TFAllocator> allocator_;
+  std::unique_ptr<Decoding> decoding_;
+  cublasHandle_t cublas_handle_;
+  cublasLtHandle_t cublaslt_handle_;
+  int batch_size_ = 0;
+  int mem_seq_len_ = 0;
+  int vocab_size_ = 0;
+  int memory_hidden_dim_ = 0;
+};
+
+template <typename Resource>
+class ResourcePool
+{
+public:
+  // A resource taken from the pool, given back when it goes out of scope.
+  class Lease
+  {
+  public:
+    Lease(ResourcePool &pool, std::unique_ptr<Resource> resource) : pool_(pool), resource_(std::move(resource)) {}
+    Lease(Lease &&other) : pool_(other.pool_), resource_(std::move(other.resource_)) {}
+    ~Lease()
+    {
+      if (resource_ != nullptr)
+        pool_.release(std::move(resource_));
+    }
+    Resource *operator->() const { return resource_.get(); }
+
+  private:
+    ResourcePool &pool_;
+    std::unique_ptr<Resource> resource_;
+  };
+
+  Lease acquire()
+  {
+    std::unique_ptr<Resource> resource;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (!idle_.empty())
+      {
+        resource = std::move(idle_.back());
+        idle_.pop_back();
+      }
+    }
+    if (resource == nullptr)
+      resource.reset(new Resource());
+    return Lease(*this, std::move(resource));
+  }
+
+private:
+  void release(std::unique_ptr<Resource> resource)
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    idle_.push_back(std::move(resource));
+  }
+
+  std::mutex mu_;
+  std::vector<std::unique_ptr<Resource>> idle_;
+};
+
+} //namespace
+} //namespace tensorflow
@@ -21,6 +21,7 @@
 #include "fastertransformer/utils/common.h"
 
 #include "fastertransformer/tf_op/common_op.h"
+#include "fastertransformer/tf_op/decoding_resource.h"
 #include "fastertransformer/tf_op/tf_traits.h"
 
 namespace tensorflow
@@ -108,9 +109,12 @@ public:
     {
         const int vocab_size = (int)context->input(18).dim_size(0);
 
+        // the decoding object and its buffers are kept across the calls, see decoding_resource.h
+        auto resource = resource_pool_.acquire();
+
         DecodingInitParam<DataType_> decoding_params;
-        decoding_params.cublas_handle = this->get_cublas_handler();
-        decoding_params.cublaslt_handle = this->get_cublaslt_handler();
+        decoding_params.cublas_handle = resource->get_cublas_handler();
+        decoding_params.cublaslt_handle = resource->get_cublaslt_handler();
         Tensor *output_ids = nullptr;
         OP_REQUIRES_OK(
             context,
@@ -120,20 +124,23 @@ public:
 
         check_cuda_error(cudaMemset(decoding_params.output_ids, 0, sizeof(int) * max_seq_len_ * batch_size_));
 
-        typedef DecoderTransformerTraits<traits_::OpType> DecodingTraits_;
-        DecodingGpt<DecodingTraits_::OpType> *decoding_handler;
         const cudaStream_t &stream = context->eigen_device<Device>().stream();
         decoding_params.stream = stream;
-        fastertransformer::Allocator<AllocatorType::TF> allocator_(context, stream);
+        DecodingGpt_ *decoding_handler = nullptr;
         try
         {
-            decoding_handler = new DecodingGpt<DecodingTraits_::OpType>(
-                allocator_, batch_size_, 
-                max_seq_len_, head_num_, size_per_head_,
-                vocab_size, num_layer_,
-                start_id_, end_id_,
-                candidate_num_, probability_threshold_, temperature_,
-                1, 1, is_fuse_qkv_);
+            // GPT has no memory, the batch size is an attribute
+            decoding_handler = resource->get(
+                context, stream, batch_size_, 0, vocab_size, 0,
+                [&](const IAllocator &allocator, const int max_batch_size, const int) {
+                    return new DecodingGpt_(
+                        allocator, max_batch_size, 
+                        max_seq_len_, head_num_, size_per_head_,
+                        vocab_size, num_layer_,
+                        start_id_, end_id_,
+                        candidate_num_, probability_threshold_, temperature_,
+                        1, 1, is_fuse_qkv_);
+                });
         }
         catch (std::runtime_error &error)
         {
@@ -143,14 +150,14 @@ public:
         OP_REQUIRES(context, context->num_inputs() <= 26, errors::InvalidArgument("[ERROR] Require less input arguments"));
         OP_REQUIRES(context, context->num_inputs() >= 26, errors::InvalidArgument("[ERROR] Require more input arguments"));
 
-        DecoderInitParam<DataType_> *params = new DecoderInitParam<DataType_>[num_layer_];
+        std::vector<DecoderInitParam<DataType_> > params(num_layer_);
         const int hidden_unit = size_per_head_ * head_num_;
         for (int i = 0; i < num_layer_; i++)
         {
             params[i].request_batch_size = batch_size_;
             params[i].stream = stream;
-            params[i].cublas_handle = this->get_cublas_handler();
-            params[i].cublaslt_handle = this->get_cublaslt_handler();
+            params[i].cublas_handle = resource->get_cublas_handler();
+            params[i].cublaslt_handle = resource->get_cublaslt_handler();
             check_cuda_error(cublasSetStream(params[i].cublas_handle, params[i].stream));
 
             this->get_tensor(context, 0, &params[i].self_layernorm.beta, i * hidden_unit);
@@ -235,8 +242,8 @@ public:
 
         try
         {
-            decoding_handler->forward_context(params, decoding_params);
-            decoding_handler->forward(params, decoding_params);
+            decoding_handler->forward_context(params.data(), decoding_params);
+            decoding_handler->forward(params.data(), decoding_params);
         }
         catch (std::runtime_error &error)
         {
@@ -248,9 +255,6 @@ public:
             std::cout << errors::Internal("Runtime error");
             exit(-1);
         }
-
-        delete decoding_handler;
-        delete[] params;
     }
 
 private:
@@ -261,6 +265,8 @@ private:
     bool is_fuse_qkv_;
     typedef TFTraits<T> traits_;
     typedef typename traits_::DataType DataType_;
+    typedef DecodingGpt<DecoderTransformerTraits<traits_::OpType>::OpType> DecodingGpt_;
+    ResourcePool<DecodingResource<DecodingGpt_> > resource_pool_;
 };
 
 #ifdef GOOGLE_CUDA
@@ -46,7 +46,7 @@ FasterTransformerEncoder::FasterTransformerEncoder(
   bool allow_gemm_test,
   bool use_trt_kernel,
   double q_scaling)
-: _st(q_kernel.scalar_type()), _remove_padding(remove_padding),
+: _st(q_kernel.scalar_type()), _remove_padding(remove_padding), _is_last_layer(layer_idx == layer_num - 1),
   weights{q_kernel, q_bias, k_kernel, k_bias, v_kernel, v_bias,
           attr_output_kernel, attr_output_bias, attr_output_layernorm_gamma, attr_output_layernorm_beta,
           inter_kernel, inter_bias,
@@ -119,10 +119,41 @@ Tensor FasterTransformerEncoder::forward(Tensor input, Tensor attr_mask, Tensor
     TORCH_CHECK(sequence_id_offset.numel()!=0, "sequence_id_offset should not be empty tensor");
   }
   auto output = torch::empty_like(input);
-  ftencoder->forward(batch_size, seq_len, input, attr_mask, output, trt_seqlen_offset, sequence_id_offset, _remove_padding);
+  Tensor pooled_output, sequence_lengths;
+  ftencoder->forward(batch_size, seq_len, input, attr_mask, output, trt_seqlen_offset, sequence_id_offset, _remove_padding,
+                     PoolingType::NONE, pooled_output, sequence_lengths);
   return output;
 }
 
+Tensor FasterTransformerEncoder::forward_pooled(Tensor input, Tensor attr_mask, Tensor trt_seqlen_offset, Tensor sequence_id_offset,
+                                                Tensor sequence_lengths, int64_t pooling_type) {
+  CHECK_INPUT(input, _st);
+  CHECK_INPUT(attr_mask, _st);
+  TORCH_CHECK(attr_mask.dim()==4, "Invalid rank. The rank of attention mask should be 4 ([batch_size, 1, seq_len, seq_len])");
+  TORCH_CHECK(attr_mask.size(2)==attr_mask.size(3), "Wrong attr_mask size");
+  CHECK_CUDA(trt_seqlen_offset); CHECK_CONTIGUOUS(trt_seqlen_offset);
+  TORCH_CHECK(trt_seqlen_offset.dtype()==torch::kInt32, "trt_seqlen_offset dtype should be int32");
+  CHECK_CUDA(sequence_lengths); CHECK_CONTIGUOUS(sequence_lengths);
+  TORCH_CHECK(sequence_lengths.dtype()==torch::kInt32, "sequence_lengths dtype should be int32");
+  TORCH_CHECK(pooling_type>=1 && pooling_type<=3, "pooling_type can only be one of [1 (CLS), 2 (MEAN), 3 (MAX)]");
+  TORCH_CHECK(_is_last_layer, "forward_pooled can only be called on the last layer");
+  TORCH_CHECK(head_info[3].item().to<int>()==0, "forward_pooled only supports int8_mode == 0");
+  int batch_size = attr_mask.size(0);
+  int seq_len = attr_mask.size(2);
+  if (_remove_padding) {
+    CHECK_CUDA(sequence_id_offset); CHECK_CONTIGUOUS(sequence_id_offset);
+    TORCH_CHECK(sequence_id_offset.dtype()==torch::kInt32, "v dtype should be int32");
+    TORCH_CHECK(sequence_id_offset.numel()!=0, "sequence_id_offset should not be empty tensor");
+  }
+  PoolingType type = pooling_type == 1 ? PoolingType::CLS : (pooling_type == 2 ? PoolingType::MEAN : PoolingType::MAX);
+  // with CLS pooling the last FFN only runs on the first token, and the full output is never written
+  auto output = type == PoolingType::CLS && seq_len >= 2 ? torch::empty({0}, input.options()) : torch::empty_like(input);
+  auto pooled_output = torch::empty({batch_size, input.size(-1)}, input.options());
+  ftencoder->forward(batch_size, seq_len, input, attr_mask, output, trt_seqlen_offset, sequence_id_offset, _remove_padding,
+                     type, pooled_output, sequence_lengths);
+  return pooled_output;
+}
+
 std::vector<Tensor> FasterTransformerEncoder::get_pickle_info() const {
   std::vector<Tensor> tmp(weights);
   tmp.push_back(head_info);
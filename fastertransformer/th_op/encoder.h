@@ -15,6 +15,10 @@
  */
 
 #include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <iostream>
 #include <cuda_fp16.h>
 #include <nvToolsExt.h> 
@@ -43,7 +47,10 @@ public:
                        Tensor& output,
                        Tensor& trt_seqlen_offset,
                        Tensor& sequence_id_offset,
-                       bool removing_padding) = 0;
+                       bool removing_padding,
+                       PoolingType pooling_type,
+                       Tensor& pooled_output,
+                       Tensor& sequence_lengths) = 0;
 };
 
 template <typename T>
@@ -51,11 +58,9 @@ class FTEncoder : public IFTEncoder {
 public:
   FTEncoder(int head_num, int head_size,
             int int8_mode, int layer_num, int layer_idx, float q_scaling, bool allow_gemm_test, bool use_trt_kernel,
-            const std::vector<Tensor>& w) : _head_num(head_num), _head_size(head_size), _use_trt_kernel(use_trt_kernel),
-            _q_scaling(q_scaling), _weights(w) {
-    int hidden_dim = _head_num * _head_size;
-    check_cuda_error(cublasCreate(&_cublasHandle));
-    check_cuda_error(cublasLtCreate(&_cublasltHandle));
+            const std::vector<Tensor>& w, int max_cached_encoders = 8) : _weights(w),
+            _cache(getSharedCache(head_num, head_size, int8_mode, allow_gemm_test, use_trt_kernel, max_cached_encoders)),
+            _q_scaling(q_scaling) {
     encoder_param.self_attention.query_weight.kernel = get_ptr<T>(_weights[0]);
     encoder_param.self_attention.query_weight.bias = get_ptr<T>(_weights[1]);
     encoder_param.self_attention.key_weight.kernel = get_ptr<T>(_weights[2]);
@@ -72,24 +77,13 @@ public:
     encoder_param.ffn.output_weight.bias = get_ptr<T>(_weights[13]);
     encoder_param.ffn_layernorm.gamma = get_ptr<T>(_weights[14]);
     encoder_param.ffn_layernorm.beta = get_ptr<T>(_weights[15]);
+    encoder_param.layer_num = layer_num;
+    encoder_param.layer_idx = layer_idx;
     if (int8_mode) {
       encoder_param.amaxList = get_ptr<float>(_weights[16]);
-      encoder_param.layer_num = layer_num;
-      encoder_param.layer_idx = layer_idx;
     } else {
       encoder_param.amaxList = nullptr;
     }
-    encoder_param.cublas_handle = _cublasHandle;
-    encoder_param.cublaslt_handle = _cublasltHandle;
-    encoder = new BertEncoderTransformer<EncoderTraits_>(int8_mode, allow_gemm_test);
-  }
-
-  ~FTEncoder() override {
-    cublasDestroy(_cublasHandle);
-    cublasLtDestroy(_cublasltHandle);
-    if (encoder != nullptr) {
-      delete encoder;
-    }
   }
 
   void forward(int batch_size,
@@ -99,46 +93,186 @@ public:
                Tensor& output,
                Tensor& trt_seqlen_offset,
                Tensor& sequence_id_offset,
-               bool removing_padding) override {
-    BertEncoderTransformer<EncoderTraits_>* encoder_tmp = new BertEncoderTransformer<EncoderTraits_>(encoder);
+               bool removing_padding,
+               PoolingType pooling_type,
+               Tensor& pooled_output,
+               Tensor& sequence_lengths) override {
     auto stream = at::cuda::getCurrentCUDAStream().stream();
-    encoder_param.stream = stream;
-    int hidden_dim = _head_num * _head_size;
+    std::shared_ptr<EncoderInstance> instance = _cache->acquireEncoder(batch_size, seq_len, stream);
+
+    // encoder_param is shared by all threads; every call works on its own copy.
+    BertInitParam<T> param = encoder_param;
+    param.stream = stream;
+    param.cublas_handle = instance->cublas_handle;
+    param.cublaslt_handle = instance->cublaslt_handle;
 
     if (removing_padding) {
-      encoder_param.sequence_id_offset = get_ptr<int>(sequence_id_offset);
-      encoder_param.valid_word_num = sequence_id_offset.size(0);
+      param.sequence_id_offset = get_ptr<int>(sequence_id_offset);
+      param.valid_word_num = sequence_id_offset.size(0);
     } else {
-      encoder_param.sequence_id_offset = nullptr;
-      encoder_param.valid_word_num = batch_size * seq_len;
+      param.sequence_id_offset = nullptr;
+      param.valid_word_num = batch_size * seq_len;
     }
 
-    encoder_param.from_tensor = get_ptr<T>(input);
-    encoder_param.to_tensor = get_ptr<T>(input);
-    encoder_param.transformer_out = get_ptr<T>(output);
-    encoder_param.attr_mask = get_ptr<T>(attr_mask);
-    encoder_param.trt_seqlen_offset = get_ptr<int>(trt_seqlen_offset);
-    encoder_param.trt_seqlen_size = (int)trt_seqlen_offset.size(0);
-    check_cuda_error(cublasSetStream(encoder_param.cublas_handle, encoder_param.stream));
-    fastertransformer::Allocator<AllocatorType::TH>* allocator = new fastertransformer::Allocator<AllocatorType::TH>();
-    encoder_tmp->allocateBuffer(allocator, batch_size, seq_len, seq_len, _head_num, _head_size, _use_trt_kernel);
-    encoder_tmp->initialize(encoder_param);
-    encoder_tmp->forward();
-    encoder_tmp->freeBuffer();
-    delete encoder_tmp;
-    delete allocator;
+    param.from_tensor = get_ptr<T>(input);
+    param.to_tensor = get_ptr<T>(input);
+    param.transformer_out = get_ptr<T>(output);
+    param.attr_mask = get_ptr<T>(attr_mask);
+    param.trt_seqlen_offset = get_ptr<int>(trt_seqlen_offset);
+    param.trt_seqlen_size = (int)trt_seqlen_offset.size(0);
+    param.pooling_type = pooling_type;
+    if (pooling_type != PoolingType::NONE) {
+      param.pooled_out = get_ptr<T>(pooled_output);
+      param.sequence_length = get_ptr<int>(sequence_lengths);
+    }
+    check_cuda_error(cublasSetStream(param.cublas_handle, param.stream));
+    instance->encoder->initialize(param);
+    instance->encoder->forward();
+    _cache->releaseEncoder(instance, stream);
   }
 
 private:
   typedef BertEncoderTransformerTraits<THTraits<T>::OpType, cuda::OpenMultiHeadAttention> EncoderTraits_;
-  const int _head_num;
-  const int _head_size;
+
+  // An encoder whose buffers are allocated for one (batch_size, seq_len).
+  // Each instance owns its cublas handles so that idle instances can be
+  // handed to different threads without sharing handle state.
+  struct EncoderInstance {
+    int batch_size;
+    int seq_len;
+    BertEncoderTransformer<EncoderTraits_>* encoder = nullptr;
+    fastertransformer::Allocator<AllocatorType::TH>* allocator = nullptr;
+    cublasHandle_t cublas_handle = nullptr;
+    cublasLtHandle_t cublaslt_handle = nullptr;
+    // recorded on the stream of the last forward, the next user waits on it
+    // before touching the buffers from another stream
+    cudaEvent_t done_event = nullptr;
+
+    // also called on a partly built instance, when one of the creations in acquireEncoder throws
+    ~EncoderInstance() {
+      if (done_event != nullptr) {
+        cudaEventSynchronize(done_event);
+        cudaEventDestroy(done_event);
+      }
+      if (encoder != nullptr) {
+        encoder->freeBuffer();
+        delete encoder;
+      }
+      if (allocator != nullptr) {
+        delete allocator;
+      }
+      if (cublas_handle != nullptr) {
+        cublasDestroy(cublas_handle);
+      }
+      if (cublaslt_handle != nullptr) {
+        cublasLtDestroy(cublaslt_handle);
+      }
+    }
+  };
+
+  // The idle instances of all the layers of an encoder. The buffers of a layer only depend on
+  // the shape, and the layer itself is set by initialize(), so any layer can run on any instance
+  // and the bound holds for the whole encoder rather than for each layer.
+  class EncoderCache {
+  public:
+    EncoderCache(int head_num, int head_size, int int8_mode, bool allow_gemm_test, bool use_trt_kernel,
+                 int max_cached_encoders) : _head_num(head_num), _head_size(head_size),
+                 _use_trt_kernel(use_trt_kernel), _max_cached_encoders(max_cached_encoders) {
+      if (max_cached_encoders < 1) {
+        throw std::runtime_error("[FT][ERROR][FTEncoder] max_cached_encoders should be positive.");
+      }
+      // The prototype only holds the gemm algo maps; the per-shape instances are copied from it
+      // so the gemm config file is parsed once per encoder instead of once per forward.
+      encoder = new BertEncoderTransformer<EncoderTraits_>(int8_mode, allow_gemm_test);
+    }
+
+    ~EncoderCache() {
+      _cached_encoders.clear();
+      delete encoder;
+    }
+
+    // Take an idle instance for (batch_size, seq_len) out of the cache,
+    // or build a new one when there is none (first use, or all in use by other threads and layers).
+    std::shared_ptr<EncoderInstance> acquireEncoder(int batch_size, int seq_len, cudaStream_t stream) {
+      std::shared_ptr<EncoderInstance> instance;
+      {
+        std::lock_guard<std::mutex> lock(_cache_mutex);
+        for (auto it = _cached_encoders.begin(); it != _cached_encoders.end(); ++it) {
+          if ((*it)->batch_size == batch_size && (*it)->seq_len == seq_len) {
+            instance = *it;
+            _cached_encoders.erase(it);
+            break;
+          }
+        }
+      }
+      if (instance != nullptr) {
+        check_cuda_error(cudaStreamWaitEvent(stream, instance->done_event, 0));
+        return instance;
+      }
+
+      instance = std::make_shared<EncoderInstance>();
+      instance->batch_size = batch_size;
+      instance->seq_len = seq_len;
+      check_cuda_error(cublasCreate(&instance->cublas_handle));
+      check_cuda_error(cublasLtCreate(&instance->cublaslt_handle));
+      check_cuda_error(cudaEventCreateWithFlags(&instance->done_event, cudaEventDisableTiming));
+      instance->allocator = new fastertransformer::Allocator<AllocatorType::TH>();
+      instance->encoder = new BertEncoderTransformer<EncoderTraits_>(encoder);
+      instance->encoder->allocateBuffer(instance->allocator, batch_size, seq_len, seq_len,
+                                        _head_num, _head_size, _use_trt_kernel);
+      return instance;
+    }
+
+    // Return an instance to the front of the LRU list and evict the least recently used
+    // ones beyond _max_cached_encoders. Evicted instances are destroyed outside the lock.
+    void releaseEncoder(std::shared_ptr<EncoderInstance> instance, cudaStream_t stream) {
+      check_cuda_error(cudaEventRecord(instance->done_event, stream));
+      std::list<std::shared_ptr<EncoderInstance>> evicted;
+      {
+        std::lock_guard<std::mutex> lock(_cache_mutex);
+        _cached_encoders.push_front(instance);
+        while ((int)_cached_encoders.size() > _max_cached_encoders) {
+          evicted.splice(evicted.end(), _cached_encoders, std::prev(_cached_encoders.end()));
+        }
+      }
+    }
+
+  private:
+    const int _head_num;
+    const int _head_size;
+    const bool _use_trt_kernel;
+    const int _max_cached_encoders;
+    BertEncoderTransformer<EncoderTraits_>* encoder = nullptr;
+    std::mutex _cache_mutex;
+    // idle encoder instances, most recently used first
+    std::list<std::shared_ptr<EncoderInstance>> _cached_encoders;
+  };
+
+  // CustomEncoder builds one op per layer with the same configuration, so the layers find the
+  // same cache here; it lives as long as one of them. Keyed by the device as well, since the
+  // buffers are allocated on the current one.
+  static std::shared_ptr<EncoderCache> getSharedCache(int head_num, int head_size, int int8_mode,
+                                                      bool allow_gemm_test, bool use_trt_kernel,
+                                                      int max_cached_encoders) {
+    int device;
+    check_cuda_error(cudaGetDevice(&device));
+    const std::vector<int> key = {device, head_num, head_size, int8_mode, (int)allow_gemm_test,
+                                  (int)use_trt_kernel, max_cached_encoders};
+    static std::mutex caches_mutex;
+    static std::map<std::vector<int>, std::weak_ptr<EncoderCache>> caches;
+    std::lock_guard<std::mutex> lock(caches_mutex);
+    std::shared_ptr<EncoderCache> cache = caches[key].lock();
+    if (cache == nullptr) {
+      cache = std::make_shared<EncoderCache>(head_num, head_size, int8_mode, allow_gemm_test, use_trt_kernel,
+                                             max_cached_encoders);
+      caches[key] = cache;
+    }
+    return cache;
+  }
+
   std::vector<Tensor> _weights;
-  cublasHandle_t _cublasHandle;
-  cublasLtHandle_t _cublasltHandle;
   BertInitParam<T> encoder_param;
-  BertEncoderTransformer<EncoderTraits_>* encoder = nullptr;
-  bool _use_trt_kernel;
+  std::shared_ptr<EncoderCache> _cache;
   float _q_scaling;
 };
 
@@ -237,11 +371,17 @@ public:
   
   Tensor forward(Tensor input, Tensor attr_mask, Tensor trt_seqlen_offset, Tensor sequence_id_offset);
 
+  // Only for the last layer: returns [batch_size, hidden_dim] pooled by pooling_type (1: CLS, 2: MEAN, 3: MAX)
+  // instead of the whole sequence, so no rebuild_padding is needed afterwards.
+  Tensor forward_pooled(Tensor input, Tensor attr_mask, Tensor trt_seqlen_offset, Tensor sequence_id_offset,
+                        Tensor sequence_lengths, int64_t pooling_type);
+
   std::vector<Tensor> get_pickle_info() const;
 
 private:
   const at::ScalarType _st;
   bool _remove_padding;
+  bool _is_last_layer;
   IFTEncoder* ftencoder;
   Tensor head_info;
   Tensor _q_scaling;
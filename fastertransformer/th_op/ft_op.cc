@@ -36,6 +36,7 @@ static auto fasterTransformerEncoderTHS =
                         Tensor, Tensor, Tensor, Tensor, Tensor,
                         int64_t, int64_t, bool, int64_t, int64_t, int64_t, bool, bool, double>())
   .def("forward", &torch_ext::FasterTransformerEncoder::forward)
+  .def("forward_pooled", &torch_ext::FasterTransformerEncoder::forward_pooled)
   .def_pickle(
     [](const c10::intrusive_ptr<torch_ext::FasterTransformerEncoder>& self) -> std::vector<Tensor> {
       return self->get_pickle_info();
@@ -18,6 +18,8 @@
 
 #include <vector>
 #include <iostream>
+#include <mutex>
+#include <algorithm>
 #include <cuda_fp16.h>
 
 #include <torch/script.h>
@@ -167,6 +169,8 @@ public:
     decoding_params.layernorm.beta = get_ptr<T>(layernorm_beta);
 
     check_cuda_error(cublasLtCreate(&cublasLtHandle));
+    // DecodingGpt keeps a reference to the allocator, so it has to outlive every decoding object.
+    allocator_ = new fastertransformer::Allocator<AllocatorType::TH>();
   }
 
   void init_nccl_comm(ncclUniqueId &tensor_para_nccl_uid, ncclUniqueId &layer_para_nccl_uid,
@@ -220,6 +224,13 @@ public:
   }
 
   ~GPT() override {
+    if(decoding_ != nullptr)
+    {
+      check_cuda_error(cudaDeviceSynchronize());
+      delete decoding_;
+    }
+    delete allocator_;
+
     ncclCommDestroy(tensor_para_nccl_comm);
     ncclCommDestroy(layer_para_nccl_comm);
 
@@ -229,11 +240,12 @@ public:
 
   void forward(Tensor& start_ids, Tensor& start_lengths, Tensor& attn_mask, Tensor& output_ids, int output_len) override
   {
-
-    PUSH_RANGE("Constructing")
+    // the decoding object and its buffers are shared by all calls
+    std::lock_guard<std::mutex> lock(forward_mutex_);
 
     // Set cudaStream, and cublasHandlers.
     cudaStream_t stream = at::cuda::getCurrentCUDAStream().stream();
+    PUSH_RANGE("Constructing", stream)
     cublasHandle_t cublasHandle = at::cuda::getCurrentCUDABlasHandle();
     check_cuda_error(cublasSetStream(cublasHandle, stream));
 
@@ -252,18 +264,9 @@ public:
       param[i].cublaslt_handle = cublasLtHandle;
     }
 
-    fastertransformer::Allocator<AllocatorType::TH> allocator;
-    // TODO This is a workaround. Better to move it into the constructor, but need to fix the "Caught signal 11 (Segmentation fault: address not mapped to object at address" error first.
-    DecodingGpt<THTraits<T>::OpType> *decoding = new DecodingGpt<THTraits<T>::OpType>(allocator, max_batch_size_,
-                                                                                        max_seq_len_, global_head_num_, size_per_head_,
-                                                                                        vocab_size_, decoder_layers_,
-                                                                                        start_id_, end_id_,
-                                                                                        candidate_num_, probability_threshold_,
-                                                                                        temperature_, tensor_para_size_, layer_para_size_, 
-                                                                                        is_fuse_QKV_, repetition_penalty_);
-    
-    decoding->set_tensor_parallel_param(tensor_parallel_param);
-    decoding->set_layer_parallel_param(layer_parallel_param);
+    // The decoding object (KV caches, logits and sampling workspaces, gemm algo map) lives across calls.
+    // It is only rebuilt when a request needs a larger batch than the current buffers were sized for.
+    DecodingGpt<THTraits<T>::OpType> *decoding = get_decoding(batch_size);
 
     decoding_params.request_batch_size = batch_size;
     decoding_params.request_output_len = output_len;
@@ -276,16 +279,36 @@ public:
 
     POP_RANGE // Constructing
 
-    PUSH_RANGE("forward_s1")
+    PUSH_RANGE("forward_s1", stream)
     decoding->forward_context(param, decoding_params);
     POP_RANGE // forward_s1
 
-    PUSH_RANGE("forward_s2")
+    PUSH_RANGE("forward_s2", stream)
     decoding->forward(param, decoding_params);
     POP_RANGE // forward_s2
+  }
 
-    // TODO This is a workaround. Better to move it into the deconstructor, but need to fix the "Caught signal 11 (Segmentation fault: address not mapped to object at address" error first.
-    delete decoding;
+  DecodingGpt<THTraits<T>::OpType>* get_decoding(const int batch_size)
+  {
+    if(decoding_ != nullptr && batch_size <= decoding_batch_size_) return decoding_;
+
+    if(decoding_ != nullptr)
+    {
+      // wait for the previous requests before releasing the buffers they use
+      check_cuda_error(cudaDeviceSynchronize());
+      delete decoding_;
+    }
+    decoding_batch_size_ = std::max(batch_size, max_batch_size_);
+    decoding_ = new DecodingGpt<THTraits<T>::OpType>(*allocator_, decoding_batch_size_,
+                                                     max_seq_len_, global_head_num_, size_per_head_,
+                                                     vocab_size_, decoder_layers_,
+                                                     start_id_, end_id_,
+                                                     candidate_num_, probability_threshold_,
+                                                     temperature_, tensor_para_size_, layer_para_size_,
+                                                     is_fuse_QKV_, repetition_penalty_);
+    decoding_->set_tensor_parallel_param(tensor_parallel_param);
+    decoding_->set_layer_parallel_param(layer_parallel_param);
+    return decoding_;
   }
 
 private:
@@ -310,6 +333,10 @@ private:
   LayerParallelParam layer_parallel_param;
   ncclComm_t tensor_para_nccl_comm, layer_para_nccl_comm;
   cublasLtHandle_t cublasLtHandle;
+  fastertransformer::Allocator<AllocatorType::TH> *allocator_ = nullptr;
+  DecodingGpt<THTraits<T>::OpType> *decoding_ = nullptr;
+  int decoding_batch_size_ = 0;
+  std::mutex forward_mutex_;
 };
 
 class FasterTransformerGPT : public torch::jit::CustomClassHolder {
@@ -16,6 +16,10 @@
  */
 
 #include "fastertransformer/triton_backend/gpt_triton_backend.hpp"
+#include "fastertransformer/utils/quantized_comm.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 using namespace fastertransformer;
 
@@ -33,6 +37,11 @@ std::shared_ptr<AbstractTransformerModel> AbstractTransformerModel::createGptMod
 
   const std::string model_name = reader.Get("ft_instance_hyperparameter", "model_name");
   const int is_half = reader.GetInteger("ft_instance_hyperparameter", "is_half");
+  // the prompts of the requests can be text when the model has a tokenizer
+  std::shared_ptr<GptTokenizer> tokenizer;
+  const std::string vocab_file = reader.Get("tokenizer", "vocab_file", "");
+  if (!vocab_file.empty())
+    tokenizer = std::make_shared<GptTokenizer>(vocab_file, reader.Get("tokenizer", "merges_file", ""));
   if (is_half)
     return std::make_shared<GptModel<fastertransformer::OperationType::FP16>>
                  (reader.GetInteger("ft_instance_hyperparameter", "max_batch_size"),
@@ -50,7 +59,10 @@ std::shared_ptr<AbstractTransformerModel> AbstractTransformerModel::createGptMod
 		  reader.GetFloat("ft_instance_hyperparameter", "temperature"),
                   reader.GetFloat("ft_instance_hyperparameter", "repetition_penalty"),
                   reader.Get("ft_instance_hyperparameter", "model_name"),
-                  reader.Get("ft_instance_hyperparameter", "model_path_prefix"));
+                  reader.Get("ft_instance_hyperparameter", "model_path_prefix"),
+                  tokenizer,
+                  reader.GetInteger("ft_instance_hyperparameter", "all_reduce_chunk_num", 1),
+                  reader.GetInteger("ft_instance_hyperparameter", "int8_comm_block_size", 0));
   else
     return std::make_shared<GptModel<fastertransformer::OperationType::FP32>>
                  (reader.GetInteger("ft_instance_hyperparameter", "max_batch_size"),
@@ -68,16 +80,10 @@ std::shared_ptr<AbstractTransformerModel> AbstractTransformerModel::createGptMod
 		  reader.GetFloat("ft_instance_hyperparameter", "temperature"),
                   reader.GetFloat("ft_instance_hyperparameter", "repetition_penalty"),
                   reader.Get("ft_instance_hyperparameter", "model_name"),
-                  reader.Get("ft_instance_hyperparameter", "model_path_prefix"));
-}
-
-template <typename T>
-void device_malloc(T **ptr, int size)
-{
-  check_cuda_error(cudaMalloc((void **)ptr, sizeof(T) * size));
-  cuda_random_uniform_kernelLauncher(*ptr, size);
-  cudaDeviceSynchronize();
-  check_cuda_error(cudaGetLastError());
+                  reader.Get("ft_instance_hyperparameter", "model_path_prefix"),
+                  tokenizer,
+                  reader.GetInteger("ft_instance_hyperparameter", "all_reduce_chunk_num", 1),
+                  reader.GetInteger("ft_instance_hyperparameter", "int8_comm_block_size", 0));
 }
 
 template <typename T>
@@ -165,6 +171,48 @@ std::shared_ptr<std::vector<Tensor>> prepareRequest(std::string request_config_f
   const int batch_size = reader.GetInteger("request", "request_batch_size");
   const int end_id = 50256;
 
+  // the prompts as text, one per line, encoded by the tokenizer of the model
+  const std::string start_text_file = reader.Get("request", "start_text_file", "");
+  if (!start_text_file.empty())
+  {
+    std::ifstream text_file(start_text_file.c_str(), std::ios::in);
+    if (!text_file.is_open())
+    {
+      printf("[ERROR] Cannot open the file '%s'. \n", start_text_file.c_str());
+      exit(-1);
+    }
+    std::vector<std::string> prompts;
+    std::string line;
+    while (std::getline(text_file, line))
+    {
+      if (!line.empty()) prompts.push_back(line);
+    }
+    if (prompts.empty())
+    {
+      printf("[ERROR] No prompt in the file '%s'. \n", start_text_file.c_str());
+      exit(-1);
+    }
+    while ((int)prompts.size() < batch_size) prompts.push_back(prompts.back());
+    prompts.resize(batch_size);
+
+    std::string bytes;
+    for (const std::string& prompt : prompts)
+    {
+      const uint32_t length = (uint32_t)prompt.size();
+      bytes.append((const char*)&length, sizeof(uint32_t));
+      bytes += prompt;
+    }
+    char *text = new char[bytes.size()];
+    memcpy(text, bytes.data(), bytes.size());
+    int *output_len = new int[batch_size];
+    for(int i = 0; i < batch_size; i++) output_len[i] = 0;
+
+    printf("[INFO] request text at host is prepared\n");
+    return std::shared_ptr<std::vector<Tensor>>(new std::vector<Tensor>{
+        Tensor{MEMORY_CPU, TYPE_BYTES, std::vector<int64_t>{batch_size}, (void *) text},
+        Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size}, (void*)output_len}});
+  }
+
   cudaStream_t stream;
   check_cuda_error(cudaStreamCreate(&stream));
 
@@ -189,50 +237,124 @@ std::shared_ptr<std::vector<Tensor>> prepareRequest(std::string request_config_f
       Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size}, (void*)output_len}});
 }
 
-//template <fastertransformer::OperationType OpType>
-//std::pair<int*, GptModelInstance<OpType>::DataType*> GptModelInstance<OpType>::prepareRequestAttentionMask2(std::shared_ptr<Request> request) {}
-
+// The attention mask is not materialized: the context attention is causal, and the
+// start lengths on the device are its compact form, one int per sequence.
+// The inputs go to device buffers allocated once for the largest request. Inputs on the GPU
+// are used in place and pinned inputs are copied directly; pageable inputs are packed into a
+// pinned staging slot first, so that all the copies are asynchronous on the stream. GPU and
+// pinned inputs must stay valid until the output of the request is read. The start lengths
+// and output lengths are also needed on the host, as start_lengths and output_lens.
 template <fastertransformer::OperationType OpType>
-std::tuple<int*, int*, void*> GptModelInstance<OpType>::prepareRequestAttentionMask(std::shared_ptr<std::vector<Tensor>> input_tensors, const int input_len)
+std::pair<int*, int*> GptModelInstance<OpType>::prepareRequestInputs(std::shared_ptr<std::vector<Tensor>> input_tensors,
+                                                                     const int** start_lengths, const int** output_lens)
 {
-  auto shape = (*input_tensors)[0].shape;
-  auto start_ids = (*input_tensors)[0].data;
-  auto start_lengths = (*input_tensors)[1].data;
-  assert(shape.size() == 2);
-  auto batch_size = shape[0], max_start_len = shape[1];
-  const int start_len = input_len;
+  const Tensor& ids = input_tensors->at(0);
+  const Tensor& lengths = input_tensors->at(1);
+  const Tensor& out_lens = input_tensors->at(2);
+  assert(ids.shape.size() == 2);
+  const int request_batch_size = (int)ids.shape[0], max_start_len = (int)ids.shape[1];
+  if(request_batch_size > batch_size || max_start_len > max_seq_len)
+    throw std::runtime_error("[FT][ERROR] the request [" + std::to_string(request_batch_size) + ", " +
+                             std::to_string(max_start_len) + "] is larger than max_batch_size " +
+                             std::to_string(batch_size) + " and max_seq_len " + std::to_string(max_seq_len));
+  const size_t ids_bytes = sizeof(int) * request_batch_size * max_start_len;
+  const size_t lengths_bytes = sizeof(int) * request_batch_size;
+
+  int* staging_ids = (int*)staging.acquire();
+  int* staging_lengths = staging_ids + (size_t)batch_size * max_seq_len;
+  int* staging_output_lens = staging_lengths + batch_size;
+
+  int* d_start_ids = d_start_ids_buf;
+  if(ids.where == MEMORY_GPU)
+  {
+    d_start_ids = (int*)ids.data;
+  }
+  else
+  {
+    const void* src = ids.data;
+    if(ids.where == MEMORY_CPU)
+    {
+      memcpy(staging_ids, ids.data, ids_bytes);
+      src = staging_ids;
+    }
+    check_cuda_error(cudaMemcpyAsync(d_start_ids, src, ids_bytes, cudaMemcpyHostToDevice, stream));
+  }
 
-  //cudaStream_t stream;
-  //check_cuda_error(cudaStreamCreate(&stream));
+  int* d_start_lengths = d_start_lengths_buf;
+  bool is_device_to_host = false;
+  if(lengths.where == MEMORY_GPU)
+  {
+    d_start_lengths = (int*)lengths.data;
+    check_cuda_error(cudaMemcpyAsync(staging_lengths, lengths.data, lengths_bytes, cudaMemcpyDeviceToHost, stream));
+    *start_lengths = staging_lengths;
+    is_device_to_host = true;
+  }
+  else
+  {
+    const void* src = lengths.data;
+    if(lengths.where == MEMORY_CPU)
+    {
+      memcpy(staging_lengths, lengths.data, lengths_bytes);
+      src = staging_lengths;
+    }
+    check_cuda_error(cudaMemcpyAsync(d_start_lengths, src, lengths_bytes, cudaMemcpyHostToDevice, stream));
+    *start_lengths = (const int*)lengths.data;
+  }
 
-  int* d_start_ids;
-  check_cuda_error(cudaMalloc((void **)&d_start_ids, sizeof(int) * batch_size * max_start_len));
-  check_cuda_error(cudaMemcpyAsync(d_start_ids, start_ids, sizeof(int) * batch_size * max_start_len, cudaMemcpyHostToDevice, stream));
+  if(out_lens.where == MEMORY_GPU)
+  {
+    check_cuda_error(cudaMemcpyAsync(staging_output_lens, out_lens.data, lengths_bytes, cudaMemcpyDeviceToHost, stream));
+    *output_lens = staging_output_lens;
+    is_device_to_host = true;
+  }
+  else
+  {
+    *output_lens = (const int*)out_lens.data;
+  }
 
-  int* d_start_lengths;
-  check_cuda_error(cudaMalloc((void **)&d_start_lengths, sizeof(int) * batch_size));
-  check_cuda_error(cudaMemcpyAsync(d_start_lengths, start_lengths, sizeof(int) * batch_size, cudaMemcpyHostToDevice, stream));
+  staging.release(stream);
+  // the lengths on the GPU are read by the host before the generation starts
+  if(is_device_to_host)
+    check_cuda_error(cudaStreamSynchronize(stream));
+  return std::make_pair(d_start_ids, d_start_lengths);
+}
 
-  DataType* h_attn_mask = new DataType[batch_size * start_len * start_len];
-  memset(h_attn_mask, 0, sizeof(DataType) * batch_size * start_len * start_len);
+template <fastertransformer::OperationType OpType>
+std::shared_ptr<std::vector<Tensor>> GptModelInstance<OpType>::encodeRequestText(std::shared_ptr<std::vector<Tensor>> input_tensors)
+{
+  if(tokenizer == nullptr)
+    throw std::runtime_error("[FT][ERROR] the request has text prompts, but the model has no [tokenizer]");
+  const Tensor& text = input_tensors->at(0);
+  const int batch_size = (int)text.shape[0];
+
+  std::vector<std::vector<int>> ids(batch_size);
+  const char* p = (const char*)text.data;
+  int max_start_len = 0;
   for(int i = 0; i < batch_size; i++)
   {
-    for(int j = 0; j < start_len; j++)
-    {
-      for(int k = 0; k <= j; k++)
-      {
-        h_attn_mask[i * start_len * start_len + j * start_len + k] = (DataType)1.0f;
-      }
-    }
+    uint32_t length;
+    memcpy(&length, p, sizeof(uint32_t));
+    ids[i] = tokenizer->encode(std::string(p + sizeof(uint32_t), length));
+    if(ids[i].empty())
+      throw std::runtime_error("[FT][ERROR] the prompt " + std::to_string(i) + " of the request is empty");
+    max_start_len = std::max(max_start_len, (int)ids[i].size());
+    p += sizeof(uint32_t) + length;
   }
-  DataType* d_attn_mask;
-  check_cuda_error(cudaMalloc((void **)&d_attn_mask, sizeof(DataType) * batch_size * start_len * start_len));
-  check_cuda_error(cudaMemcpyAsync(d_attn_mask, h_attn_mask, sizeof(DataType) * batch_size * start_len * start_len, cudaMemcpyHostToDevice, stream));
-
-  // cudaDeviceSynchronize();
-  // check_cuda_error(cudaGetLastError());
 
-  return std::make_tuple(d_start_ids, d_start_lengths, (void *) d_attn_mask);
+  // the tensors own their buffers, which live as long as the returned vector
+  auto start_ids = std::make_shared<std::vector<int>>((size_t)batch_size * max_start_len, end_id);
+  auto start_lengths = std::make_shared<std::vector<int>>(batch_size);
+  for(int i = 0; i < batch_size; i++)
+  {
+    std::copy(ids[i].begin(), ids[i].end(), start_ids->begin() + (size_t)i * max_start_len);
+    (*start_lengths)[i] = (int)ids[i].size();
+  }
+  return std::shared_ptr<std::vector<Tensor>>(
+      new std::vector<Tensor>{
+          Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size, max_start_len}, (void*)start_ids->data()},
+          Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size}, (void*)start_lengths->data()},
+          input_tensors->at(1)},
+      [start_ids, start_lengths, input_tensors](std::vector<Tensor>* tensors) { delete tensors; });
 }
 
 template <fastertransformer::OperationType OpType>
@@ -253,13 +375,19 @@ std::unique_ptr<AbstractTransformerModelInstance> GptModel<OpType>::createModelI
                                                           candidate_num, probability_threshold,
                                                           temperature, tensor_para_size, layer_para_size, is_fuse_QKV, repetition_penalty);
 
+  // with tensor or layer parallelism, all ranks of a model see the same requests
+  const int rank = node_id * 8 + device_id;
+  const bool is_first_rank = rank % (tensor_para_size * layer_para_size) == 0;
+
   return std::unique_ptr<GptModelInstance<OpType>>
     (new GptModelInstance<OpType>(
       stream,
       std::move(allocator),
       std::move(decoding),
       batch_size,
-      max_seq_len));
+      max_seq_len,
+      is_first_rank ? metrics : nullptr,
+      tokenizer));
 }
 
 template <fastertransformer::OperationType OpType>
@@ -284,12 +412,16 @@ std::unique_ptr<AbstractParamInstance> GptModel<OpType>::createParamInstance (in
       layer_para_batch_size,
       model_path_prefix,
       stream,
-      nccl_ids));
+      nccl_ids,
+      all_reduce_chunk_num,
+      int8_comm_block_size));
 }
 
 void check_inputs(std::shared_ptr<std::vector<Tensor>> output_tensors, const char* filename)
 {
   auto& output = output_tensors->at(0);
+  // text prompts are encoded by the model instance
+  if(output.type == TYPE_BYTES) return;
   auto shape = output.shape;
   assert(shape.size() == 2);
   assert(output.type == TYPE_UINT32);
@@ -326,9 +458,17 @@ void check_outputs(std::shared_ptr<std::vector<Tensor>> output_tensors, const ch
     else
     {
       size_t outCount = max_seq_len * batch_size;
-      int *hBuf = new int[outCount];
-      cudaDeviceSynchronize();
-      cudaMemcpy(hBuf, output.data, outCount * sizeof(int), cudaMemcpyDeviceToHost);
+      int *hBuf;
+      check_cuda_error(cudaMallocHost((void**)&hBuf, outCount * sizeof(int)));
+      if(output.where == MEMORY_GPU)
+      {
+        cudaDeviceSynchronize();
+        check_cuda_error(cudaMemcpy(hBuf, output.data, outCount * sizeof(int), cudaMemcpyDeviceToHost));
+      }
+      else
+      {
+        memcpy(hBuf, output.data, outCount * sizeof(int));
+      }
 
       {
         std::cout << "Writing " << outCount << " elements\n";
@@ -344,11 +484,23 @@ void check_outputs(std::shared_ptr<std::vector<Tensor>> output_tensors, const ch
         }
         std::cout << std::endl << "zeroCount = " << zeroCount << std::endl;
       }
-      delete [] hBuf;
+      cudaFreeHost(hBuf);
     }
   }
 }
 
+template <fastertransformer::OperationType OpType>
+void GptParamInstance<OpType>::weight_malloc(DataType **ptr, size_t size, std::string filename, bool is_random)
+{
+  *ptr = (DataType*)loading_weights_->allocate(filename, sizeof(DataType) * size);
+  if(is_random)
+  {
+    cuda_random_uniform_kernelLauncher(*ptr, size);
+    cudaDeviceSynchronize();
+    check_cuda_error(cudaGetLastError());
+  }
+}
+
 template <fastertransformer::OperationType OpType>
 int GptParamInstance<OpType>::init_device_from_bin(DataType **ptr, std::vector<size_t> shape, std::string filename, int split)
 {
@@ -370,7 +522,7 @@ int GptParamInstance<OpType>::init_device_from_bin(DataType **ptr, std::vector<s
   if(!in.is_open())
   {
     printf("[WARNING] file %s cannot be opened, initializing weights with random values! \n", filename.c_str());
-    device_malloc(ptr, size);
+    weight_malloc(ptr, size, filename, true);
     return 0;
   }
 
@@ -382,11 +534,11 @@ int GptParamInstance<OpType>::init_device_from_bin(DataType **ptr, std::vector<s
   {
     printf("[WARNING] file %s only has %ld, but request %ld, initializing weights with random values! \n",
       filename.c_str(), in_get_size, float_data_size);
-    device_malloc(ptr, size);
+    weight_malloc(ptr, size, filename, true);
     return 0;
   }
 
-  check_cuda_error(cudaMalloc((void **)ptr, sizeof(DataType) * size));
+  weight_malloc(ptr, size, filename);
   if(std::is_same<DataType, float>::value == true)
     cudaMemcpy(*ptr, host_array.data(), sizeof(DataType) * size, cudaMemcpyHostToDevice);
   else
@@ -471,10 +623,10 @@ int GptParamInstance<OpType>::init_device_from_csv(DataType **ptr, std::vector<s
   else
   {
     printf("[WARNING] file %s cannot be opened, initializing weights with random values! \n", filename.c_str());
-    device_malloc(ptr, size);
+    weight_malloc(ptr, size, filename, true);
     return 0;
   }
-  check_cuda_error(cudaMalloc((void **)ptr, sizeof(DataType) * size));
+  weight_malloc(ptr, size, filename);
   cudaMemcpy(*ptr, host_array.data(), sizeof(DataType) * size, cudaMemcpyHostToDevice);
   if (dim0_reached)
     printf("[WARNING] the file dimension does not match with input dim0! %s, dim0=%d, i0=%d\n", filename.c_str(), dim0, i0);
@@ -487,6 +639,14 @@ int GptParamInstance<OpType>::init_device_from_csv(DataType **ptr, std::vector<s
 template <fastertransformer::OperationType OpType>
 int GptParamInstance<OpType>::init_device_from_file(DataType **ptr, std::vector<size_t> shape, std::string filename, int split, std::string type)
 {
+  if(loading_weights_ == nullptr)
+  {
+    // loaded by another instance, or by this one in load_gpt_model_param
+    *ptr = (DataType*)weights_->find(filename);
+    if(*ptr == nullptr)
+      throw std::runtime_error("[FT][ERROR] the shared weights have no " + filename);
+    return 0;
+  }
   std::cout << "[INFO] load ckpt from " << filename << "                                  \r" << std::flush;
   if(type == "bin")
   {
@@ -723,6 +883,57 @@ void GptParamInstance<OpType>::setup_parallel_param_nccls(std::vector<ncclUnique
   // layer_parallel_params.local_batch_size = layer_para_batch_size_;
 }
 
+template <fastertransformer::OperationType OpType>
+int GptParamInstance<OpType>::init_nccl_from_store(RendezvousStore& store, std::string prefix)
+{
+  // the groups of the ids of create_nccl_ids, on the current device
+  tensor_para_rendezvous_.reset(new CommRendezvous(store, prefix + "/tensor/" + std::to_string(rank_ / tensor_para_size_),
+                                                   tensor_para_size_, tensor_parallel_params.rank));
+  layer_para_rendezvous_.reset(new CommRendezvous(store, prefix + "/layer/" + std::to_string(rank_ % tensor_para_size_),
+                                                  layer_para_size_, layer_parallel_params.rank));
+  // every rank forms its tensor group first, or two ranks could wait for each other
+  tensor_parallel_params.nccl_comm = rendezvous_nccl_comm(*tensor_para_rendezvous_);
+  layer_parallel_params.nccl_comm = rendezvous_nccl_comm(*layer_para_rendezvous_);
+  // both groups re-form at the requests of the restarts of this rank
+  if(layer_para_rendezvous_->getStep() != tensor_para_rendezvous_->getStep())
+    throw std::runtime_error("[FT][ERROR] the tensor and layer parallel groups start at requests " +
+                             std::to_string(tensor_para_rendezvous_->getStep()) + " and " +
+                             std::to_string(layer_para_rendezvous_->getStep()));
+  return tensor_para_rendezvous_->getStep();
+}
+
+template <fastertransformer::OperationType OpType>
+bool GptParamInstance<OpType>::refresh_nccl_from_store()
+{
+  if(tensor_para_rendezvous_ == nullptr) return false;
+  bool refreshed = false;
+  if(tensor_para_rendezvous_->isStale())
+  {
+    release_quantized_comm_buffers(tensor_parallel_params.nccl_comm);
+    NCCLCHECK(ncclCommDestroy(tensor_parallel_params.nccl_comm));
+    tensor_parallel_params.nccl_comm = rendezvous_nccl_comm(*tensor_para_rendezvous_);
+    refreshed = true;
+  }
+  if(layer_para_rendezvous_->isStale())
+  {
+    release_quantized_comm_buffers(layer_parallel_params.nccl_comm);
+    NCCLCHECK(ncclCommDestroy(layer_parallel_params.nccl_comm));
+    layer_parallel_params.nccl_comm = rendezvous_nccl_comm(*layer_para_rendezvous_);
+    refreshed = true;
+  }
+  tensor_para_rendezvous_->nextStep();
+  layer_para_rendezvous_->nextStep();
+  return refreshed;
+}
+
+template <fastertransformer::OperationType OpType>
+void GptParamInstance<OpType>::leave_nccl_store()
+{
+  if(tensor_para_rendezvous_ == nullptr) return;
+  tensor_para_rendezvous_->leave();
+  layer_para_rendezvous_->leave();
+}
+
 template <fastertransformer::OperationType OpType>
 void GptParamInstance<OpType>::load_gpt_model_param()
 {
@@ -731,6 +942,36 @@ void GptParamInstance<OpType>::load_gpt_model_param()
   check_cuda_error(cublasCreate(&cublasHandle));
   check_cuda_error(cublasSetStream(cublasHandle, stream));
 
+  // the instances of the same files, device and rank share one copy of the weights
+  int device;
+  check_cuda_error(cudaGetDevice(&device));
+  WeightKey key;
+  key.model_path = model_path_prefix_;
+  key.device_id = device;
+  key.tensor_para_rank = tensor_parallel_params.rank;
+  key.tensor_para_size = tensor_parallel_params.world_size;
+  key.layer_para_rank = layer_parallel_params.rank;
+  key.layer_para_size = layer_parallel_params.world_size;
+  key.data_type = OpType == OperationType::FP16 ? "fp16" : "fp32";
+  weights_ = WeightStore::getInstance().acquire(key, std::make_shared<Allocator<AllocatorType::CUDA>>(device),
+                                                [&](WeightBuffers& buffers) {
+                                                  loading_weights_ = &buffers;
+                                                  init_weights();
+                                                  loading_weights_ = nullptr;
+                                                });
+  init_weights();
+
+  int *d_output_ids;
+  check_cuda_error(cudaMalloc((void **)&d_output_ids, sizeof(int) * max_seq_len_ * batch_size_));
+
+  decoding_params.cublas_handle = cublasHandle;
+  decoding_params.stream = stream;
+  decoding_params.output_ids = d_output_ids;
+}
+
+template <fastertransformer::OperationType OpType>
+void GptParamInstance<OpType>::init_weights()
+{
   uint64_t tensor_para_size = tensor_parallel_params.world_size;
   uint64_t tensor_para_rank = tensor_parallel_params.rank;
   uint64_t global_hidden_units = head_num_ * size_per_head_;
@@ -797,23 +1038,18 @@ void GptParamInstance<OpType>::load_gpt_model_param()
   DataType *d_embedding_table;
   DataType *d_position_encoding_table;
   DataType *d_embedding_kernel;
-  int *d_output_ids;
   DataType *d_gamma, *d_beta;
 
   init_device_from_file(&d_embedding_table, {vocab_size_, global_hidden_units}, path_to_weights("wte.bin", -1, tensor_para_size));
   init_device_from_file(&d_position_encoding_table, {max_seq_len_, global_hidden_units}, path_to_weights("wpe.bin", -1, tensor_para_size));
   d_embedding_kernel = d_embedding_table;
 
-  check_cuda_error(cudaMalloc((void **)&d_output_ids, sizeof(int) * max_seq_len_ * batch_size_));
   init_device_from_file(&d_gamma, {global_hidden_units}, path_to_weights("final_layernorm.weight.bin", -1, tensor_para_size));
   init_device_from_file(&d_beta, {global_hidden_units}, path_to_weights("final_layernorm.bias.bin", -1, tensor_para_size));
 
-  decoding_params.cublas_handle = cublasHandle;
-  decoding_params.stream = stream;
   decoding_params.embedding_table = d_embedding_table;
   decoding_params.position_encoding_table = d_position_encoding_table;
   decoding_params.embedding_kernel = d_embedding_kernel;
-  decoding_params.output_ids = d_output_ids;
   decoding_params.layernorm.gamma = d_gamma;
   decoding_params.layernorm.beta = d_beta;
 }
@@ -823,36 +1059,12 @@ void GptParamInstance<OpType>::free_model_param()
 {
   check_cuda_error(cublasDestroy(cublasHandle));
 
-  for (uint i = 0; i < (uint)decoder_layers_; i++)
-  {
-    if(layer_parallel_params.is_valid(i) == false) continue;
-
-    free_param(&decoder_params[i].self_layernorm.gamma);
-    free_param(&decoder_params[i].self_layernorm.beta);
-    free_param(&decoder_params[i].self_attention.query_weight.kernel);
-    free_param(&decoder_params[i].self_attention.key_weight.kernel);
-    free_param(&decoder_params[i].self_attention.value_weight.kernel);
-    free_param(&decoder_params[i].self_attention.attention_output_weight.kernel);
-    free_param(&decoder_params[i].self_attention.query_weight.bias);
-    free_param(&decoder_params[i].self_attention.key_weight.bias);
-    free_param(&decoder_params[i].self_attention.value_weight.bias);
-    free_param(&decoder_params[i].self_attention.attention_output_weight.bias);
-
-    free_param(&decoder_params[i].ffn_layernorm.gamma);
-    free_param(&decoder_params[i].ffn_layernorm.beta);
-    free_param(&decoder_params[i].ffn.intermediate_weight.bias);
-    free_param(&decoder_params[i].ffn.output_weight.bias);
-    free_param(&decoder_params[i].ffn.intermediate_weight.kernel);
-    free_param(&decoder_params[i].ffn.output_weight.kernel);
-  }
-
-  free_param(&decoding_params.embedding_table);
-  free_param(&decoding_params.position_encoding_table);
-  free_param(&decoding_params.embedding_kernel);
   free_param(&decoding_params.output_ids);
-  free_param(&decoding_params.layernorm.gamma);
-  free_param(&decoding_params.layernorm.beta);
+  // frees the weights if no other instance has them
+  weights_.reset();
 
+  release_quantized_comm_buffers(tensor_parallel_params.nccl_comm);
+  release_quantized_comm_buffers(layer_parallel_params.nccl_comm);
   ncclCommDestroy(tensor_parallel_params.nccl_comm);
   ncclCommDestroy(layer_parallel_params.nccl_comm);
 }
@@ -38,7 +38,10 @@ struct GptModel : public AbstractTransformerModel {
    const float temperature = 0.0,
    const float repetition_penalty = 0.0,
    const std::string model_name = "",
-   const std::string model_path_prefix = "")
+   const std::string model_path_prefix = "",
+   std::shared_ptr<GptTokenizer> tokenizer = nullptr,
+   const int all_reduce_chunk_num = 1,
+   const int int8_comm_block_size = 0)
     : batch_size(batch_size),
       candidate_num(candidate_num),
       head_num(head_num),
@@ -54,7 +57,11 @@ struct GptModel : public AbstractTransformerModel {
       temperature(temperature),
       repetition_penalty(repetition_penalty),
       model_name(model_name),
-      model_path_prefix(model_path_prefix){}
+      model_path_prefix(model_path_prefix),
+      tokenizer(tokenizer),
+      all_reduce_chunk_num(all_reduce_chunk_num),
+      int8_comm_block_size(int8_comm_block_size),
+      metrics(std::make_shared<GenerationMetrics>("ft_gpt", "model=\"" + model_name + "\"")){}
 
   typedef DecoderTransformerTraits<OpType> Traits;
   typedef typename Traits::DataType DataType;
@@ -74,6 +81,14 @@ struct GptModel : public AbstractTransformerModel {
   const float repetition_penalty;
   const std::string model_name;
   const std::string model_path_prefix;
+  // encodes the TYPE_BYTES prompts of the requests, nullptr without a [tokenizer] section in the ini
+  const std::shared_ptr<GptTokenizer> tokenizer;
+  // see TensorParallelParam::all_reduce_chunk_num
+  const int all_reduce_chunk_num;
+  // see ParallelParam::int8_comm_block_size
+  const int int8_comm_block_size;
+  // shared by the instances; with tensor or layer parallelism, only the first rank of each model records
+  const std::shared_ptr<GenerationMetrics> metrics;
 
   virtual std::unique_ptr<AbstractTransformerModelInstance> createModelInstance (int nodeId, int deviceId, int world_size, cudaStream_t stream);
   virtual std::unique_ptr<AbstractParamInstance> createParamInstance(int nodeId, int deviceId, int world_size, cudaStream_t stream, std::vector<ncclUniqueId> nccl_ids);
@@ -94,6 +109,8 @@ struct GptModel : public AbstractTransformerModel {
        << "\nis_fuse_QKV: " << is_fuse_QKV
        << "\ntemperature: " << temperature
        << "\nrepetition_penalty: " << repetition_penalty
+       << "\nall_reduce_chunk_num: " << all_reduce_chunk_num
+       << "\nint8_comm_block_size: " << int8_comm_block_size
        << "\nmodel_name: " << model_name
        << "\nmodel_path_prefix: " << model_path_prefix << std::endl;
     return ss.str();
@@ -127,6 +144,10 @@ struct GptModel : public AbstractTransformerModel {
   {
     return layer_para_size;
   }
+  virtual std::string get_metrics_prometheus()
+  {
+    return metrics->toPrometheus();
+  }
 
 private:
 };
@@ -156,6 +177,13 @@ struct GptParamInstance : AbstractParamInstance
   uint64_t max_seq_len_;
   uint64_t layer_para_batch_size_;
   std::string model_path_prefix_;
+  // the weights shared with the other instances of the files, device and rank
+  std::shared_ptr<const WeightBuffers> weights_;
+  // the weights that init_weights loads into, nullptr when it finds them in weights_
+  WeightBuffers* loading_weights_{nullptr};
+  // the groups of init_nccl_from_store, nullptr otherwise
+  std::unique_ptr<CommRendezvous> tensor_para_rendezvous_;
+  std::unique_ptr<CommRendezvous> layer_para_rendezvous_;
 
   GptParamInstance(uint64_t batch_size,
                    uint64_t head_num,
@@ -170,7 +198,9 @@ struct GptParamInstance : AbstractParamInstance
                    uint64_t layer_para_batch_size,
                    std::string model_path_prefix,
                    cudaStream_t stream,
-                   std::vector<ncclUniqueId> nccl_ids) :
+                   std::vector<ncclUniqueId> nccl_ids,
+                   int all_reduce_chunk_num = 1,
+                   int int8_comm_block_size = 0) :
                           batch_size_(batch_size),
                           head_num_(head_num),
                           size_per_head_(size_per_head),
@@ -186,6 +216,8 @@ struct GptParamInstance : AbstractParamInstance
                           stream(stream)
   {
     setup_parallel_param_ranks();
+    tensor_parallel_params.all_reduce_chunk_num = all_reduce_chunk_num;
+    tensor_parallel_params.int8_comm_block_size = int8_comm_block_size;
     //    setup_parallel_param_nccls(nccl_ids);
     load_gpt_model_param();
   }
@@ -249,6 +281,7 @@ struct GptParamInstance : AbstractParamInstance
 
   void setup_parallel_param(std::vector<ncclUniqueId> nccl_ids);
   void load_gpt_model_param();
+  void init_weights();
 
   void setup_parallel_param_ranks();
   void setup_parallel_param_nccls(std::vector<ncclUniqueId> nccl_ids);
@@ -258,7 +291,11 @@ struct GptParamInstance : AbstractParamInstance
     tensor_parallel_params.nccl_comm = tensor_para_nccl_comm;
     layer_parallel_params.nccl_comm = layer_para_nccl_comm;
   }
+  virtual int init_nccl_from_store(RendezvousStore& store, std::string prefix);
+  virtual bool refresh_nccl_from_store();
+  virtual void leave_nccl_store();
 
+  void weight_malloc(DataType **ptr, size_t size, std::string filename, bool is_random = false);
   int init_device_from_bin(DataType **ptr, std::vector<uint64_t> shape, std::string filename, int split = 1);
   int init_device_from_csv(DataType **ptr, std::vector<uint64_t> shape, std::string filename, int split = 1);
   int init_device_from_file(DataType **ptr, std::vector<uint64_t> shape, std::string filename, int split = 1, std::string type="bin");
@@ -274,16 +311,28 @@ struct GptModelInstance : public AbstractTransformerModelInstance
    std::unique_ptr<fastertransformer::Allocator<AllocatorType::CUDA>> allocator,
    std::unique_ptr<DecodingGpt<OpType>> decoding,
    const int batch_size,
-   const int max_seq_len)
+   const int max_seq_len,
+   std::shared_ptr<GenerationMetrics> metrics = nullptr,
+   std::shared_ptr<GptTokenizer> tokenizer = nullptr)
       : stream(stream),
         allocator(std::move(allocator)),
         decoding(std::move(decoding)),
         batch_size(batch_size),
-        max_seq_len(max_seq_len) {}
+        max_seq_len(max_seq_len),
+        metrics(metrics),
+        tokenizer(tokenizer),
+        staging(sizeof(int) * batch_size * (max_seq_len + 2))
+  {
+    if (this->metrics != nullptr)
+      this->decoding->set_generation_trace(&trace);
+    // the device inputs of the largest request, reused by all the requests
+    d_start_ids_buf = (int*)this->allocator->malloc(sizeof(int) * batch_size * max_seq_len, false);
+    d_start_lengths_buf = (int*)this->allocator->malloc(sizeof(int) * batch_size, false);
+  }
 
   const cudaStream_t stream;
   std::unique_ptr<fastertransformer::Allocator<AllocatorType::CUDA>> allocator;
-  std::unique_ptr<DecoderInitParam<DataType>[]> decoder_param;
+  DecoderInitParam<DataType>* decoder_param = nullptr; // of the param instance
   DecodingInitParam<DataType> decoding_params;
   DecodingInitParam<DataType> decoding_params_2;
   const std::unique_ptr<DecodingGpt<OpType>> decoding;
@@ -291,52 +340,68 @@ struct GptModelInstance : public AbstractTransformerModelInstance
   const int max_seq_len;
   const int start_id = 50256; // In fact, there is no start id in GPT model, I use ' ' token here.
   const int end_id = 50256;
+  const std::shared_ptr<GenerationMetrics> metrics;
+  const std::shared_ptr<GptTokenizer> tokenizer;
+  GenerationTrace trace;
+  // pinned host copies of the inputs in pageable memory, [ids][start lengths][output lengths] per slot
+  PinnedStagingRing staging;
+  int* d_start_ids_buf = nullptr;
+  int* d_start_lengths_buf = nullptr;
+  MetricsClock::time_point arrival_time;
+  bool has_arrival_time = false;
+  RequestMetrics last_request_metrics;
 
   virtual std::shared_ptr<std::vector<Tensor>> forward(std::shared_ptr<std::vector<Tensor>> input_tensors) {
+    const MetricsClock::time_point forward_start_time = MetricsClock::now();
+
+    if(input_tensors->at(0).type == TYPE_BYTES)
+      input_tensors = encodeRequestText(input_tensors);
 
     decoding_params.request_batch_size = input_tensors->at(0).shape[0];
     decoding_params.max_input_len = input_tensors->at(0).shape[1];
     for(int i = 0; i < decoding->get_num_layer(); i++)
     {
-      decoder_param.get()[i].request_batch_size = input_tensors->at(0).shape[0];
+      decoder_param[i].request_batch_size = input_tensors->at(0).shape[0];
     }
 
-    decoding_params.request_input_len = ((int*)input_tensors->at(1).data)[0];
+    const int* start_lengths;
+    const int* output_lens;
+    auto d_inputs = prepareRequestInputs(input_tensors, &start_lengths, &output_lens);
+    decoding_params.d_start_ids = d_inputs.first;
+    decoding_params.d_start_lengths = d_inputs.second;
+    decoding_params.d_attn_mask = nullptr;
+
+    decoding_params.request_input_len = start_lengths[0];
     for(int i = 1; i < decoding_params.request_batch_size; i++)
     {
-      decoding_params.request_input_len = decoding_params.request_input_len < ((int*)input_tensors->at(1).data)[i] ?
-                                          decoding_params.request_input_len : ((int*)input_tensors->at(1).data)[i];
+      decoding_params.request_input_len = decoding_params.request_input_len < start_lengths[i] ?
+                                          decoding_params.request_input_len : start_lengths[i];
     }
-    decoding_params.request_output_len = ((int*)input_tensors->at(2).data)[0];
+    decoding_params.request_output_len = output_lens[0];
     for(int i = 1; i < decoding_params.request_batch_size; i++)
     {
-      decoding_params.request_output_len = decoding_params.request_output_len > ((int*)input_tensors->at(2).data)[i] ?
-                                           decoding_params.request_output_len : ((int*)input_tensors->at(2).data)[i];
+      decoding_params.request_output_len = decoding_params.request_output_len > output_lens[i] ?
+                                           decoding_params.request_output_len : output_lens[i];
     }
-
-    auto d_inputs = prepareRequestAttentionMask(input_tensors, decoding_params.request_input_len);
-    decoding_params.d_start_ids = std::get<0>(d_inputs);
-    decoding_params.d_start_lengths = std::get<1>(d_inputs);
-    decoding_params.d_attn_mask = (DataType *) std::get<2>(d_inputs);
-    cudaDeviceSynchronize();
     
     // TODO: Here, we set the local batch size to request batch size
     // because triton backend only supports single nodes and we don't
     // need local_batch_size currently.
     decoding->set_local_batch_size(decoding_params.request_batch_size);
 
-    // printf("[INFO] start to forward \n");
-    // struct timeval start, end;
-    // gettimeofday(&start, NULL);
-    decoding->forward_context(decoder_param.get(), decoding_params);
-    decoding->forward(decoder_param.get(), decoding_params);
-    // gettimeofday(&end, NULL);
-    // printf("[INFO] inference time: %.2f ms \n", (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) * 0.001);
-
-    cudaFree(std::get<0>(d_inputs));
-    cudaFree(std::get<1>(d_inputs));
-    cudaFree(std::get<2>(d_inputs));
-    
+    decoding->forward_context(decoder_param, decoding_params);
+    decoding->forward(decoder_param, decoding_params);
+
+    if (metrics != nullptr)
+    {
+      last_request_metrics = compute_request_metrics(trace, has_arrival_time ? arrival_time : forward_start_time,
+                                                     forward_start_time, start_lengths,
+                                                     decoding_params.request_batch_size, decoding_params.max_input_len,
+                                                     batch_size);
+      metrics->record(last_request_metrics);
+    }
+    has_arrival_time = false;
+
     return std::shared_ptr<std::vector<Tensor>> (new std::vector<Tensor>{
         Tensor {MEMORY_GPU, TYPE_UINT32,
             std::vector<int64_t>{batch_size, max_seq_len},
@@ -346,17 +411,38 @@ struct GptModelInstance : public AbstractTransformerModelInstance
   virtual void set_param(AbstractParamInstance* param_instance)
   {
     decoding_params = (*dynamic_cast<DecodingInitParam<DataType>*>(param_instance->get_param_ptr("decoding_params")));
-    decoder_param = std::unique_ptr<DecoderInitParam<DataType>[]>(dynamic_cast<DecoderInitParam<DataType>*>(param_instance->get_param_ptr("decoder_params")));
+    decoder_param = dynamic_cast<DecoderInitParam<DataType>*>(param_instance->get_param_ptr("decoder_params"));
     decoding->set_tensor_parallel_param(*dynamic_cast<TensorParallelParam*>(param_instance->get_param_ptr("tensor_parallel_params")));
     decoding->set_layer_parallel_param(*dynamic_cast<LayerParallelParam*>(param_instance->get_param_ptr("layer_parallel_params")));
   }
 
+  virtual void set_request_arrival_time(MetricsClock::time_point arrival_time)
+  {
+    this->arrival_time = arrival_time;
+    has_arrival_time = true;
+  }
+
+  virtual std::shared_ptr<GenerationMetrics> get_metrics()
+  {
+    return metrics;
+  }
+
+  virtual RequestMetrics get_last_request_metrics()
+  {
+    return last_request_metrics;
+  }
+
   ~GptModelInstance()
   {
+    cudaStreamSynchronize(stream);
+    allocator->free(d_start_ids_buf);
+    allocator->free(d_start_lengths_buf);
   }
 
 private:
-  std::tuple<int*, int*, void*> prepareRequestAttentionMask(std::shared_ptr<std::vector<Tensor>> input_tensors, const int input_len);
+  std::pair<int*, int*> prepareRequestInputs(std::shared_ptr<std::vector<Tensor>> input_tensors,
+                                             const int** start_lengths, const int** output_lens);
+  std::shared_ptr<std::vector<Tensor>> encodeRequestText(std::shared_ptr<std::vector<Tensor>> input_tensors);
 };
 
 std::shared_ptr<std::vector<Tensor>> prepareRequest(std::string request_config_filename, std::string start_id_filename = std::string("../sample/cpp/start_ids.csv"));
@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Open-loop load generator for AbstractTransformerModelInstance
+ *
+ * The requests arrive at the times of a recorded trace, or of a synthetic Poisson or bursty
+ * process, whether or not the model keeps up, so the latencies include the queueing of an
+ * overloaded model. Each replica (the instances of all the ranks of one model) takes the
+ * requests waiting in a FIFO queue, up to max_batch_size at a time, pads them into one batch
+ * and forwards it. MockModelInstance sleeps instead of running a model, so that the generator
+ * runs without GPU.
+ *
+ * The load spec is the [load] section of an ini file:
+ *   mode          trace, poisson or bursty
+ *   trace_file    csv lines "arrival_ms,prompt_len,output_len" for mode=trace
+ *   rate          mean requests per second of poisson and bursty
+ *   request_num   number of synthetic requests
+ *   burst_size    requests arriving together in bursty mode
+ *   prompt_len_min, prompt_len_max, output_len_min, output_len_max   uniform lengths
+ *   seed
+ **/
+
+#pragma once
+
+#include "fastertransformer/triton_backend/transformer.hpp"
+#include "fastertransformer/utils/bench_utils.h"
+#include "fastertransformer/utils/INIReader.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fastertransformer
+{
+
+struct LoadRequest
+{
+  double arrival_ms = 0.0; // from the start of the run
+  int prompt_len = 1;
+  int output_len = 1;
+};
+
+struct LoadSpec
+{
+  std::string mode = "poisson";
+  std::string trace_file;
+  double rate = 1.0;
+  int request_num = 100;
+  int burst_size = 8;
+  int prompt_len_min = 8;
+  int prompt_len_max = 8;
+  int output_len_min = 32;
+  int output_len_max = 32;
+  unsigned int seed = 0;
+};
+
+inline LoadSpec read_load_spec(const std::string &ini_name)
+{
+  INIReader reader = INIReader(ini_name);
+  if (reader.ParseError() < 0)
+  {
+    printf("[ERROR][load_generator] Can't load '%s'\n", ini_name.c_str());
+    exit(-1);
+  }
+  LoadSpec spec;
+  spec.mode = reader.Get("load", "mode", spec.mode);
+  spec.trace_file = reader.Get("load", "trace_file", spec.trace_file);
+  spec.rate = reader.GetFloat("load", "rate", spec.rate);
+  spec.request_num = reader.GetInteger("load", "request_num", spec.request_num);
+  spec.burst_size = reader.GetInteger("load", "burst_size", spec.burst_size);
+  spec.prompt_len_min = reader.GetInteger("load", "prompt_len_min", spec.prompt_len_min);
+  spec.prompt_len_max = reader.GetInteger("load", "prompt_len_max", spec.prompt_len_min);
+  spec.output_len_min = reader.GetInteger("load", "output_len_min", spec.output_len_min);
+  spec.output_len_max = reader.GetInteger("load", "output_len_max", spec.output_len_min);
+  spec.seed = (unsigned int)reader.GetInteger("load", "seed", spec.seed);
+  if (spec.mode != "trace" && spec.mode != "poisson" && spec.mode != "bursty")
+  {
+    printf("[ERROR][load_generator] load.mode should be trace, poisson or bursty, got %s\n", spec.mode.c_str());
+    exit(-1);
+  }
+  if (spec.mode != "trace" && (spec.rate <= 0.0 || spec.burst_size < 1 || spec.prompt_len_min < 1 ||
+                               spec.prompt_len_max < spec.prompt_len_min || spec.output_len_min < 1 ||
+                               spec.output_len_max < spec.output_len_min))
+  {
+    printf("[ERROR][load_generator] invalid rate, burst_size or lengths in %s\n", ini_name.c_str());
+    exit(-1);
+  }
+  return spec;
+}
+
+// csv lines "arrival_ms,prompt_len,output_len"; empty lines, # comments and a header line are skipped.
+inline std::vector<LoadRequest> read_load_trace(const std::string &file_name)
+{
+  std::ifstream file(file_name);
+  if (!file.is_open())
+  {
+    printf("[ERROR][load_generator] Can't open the trace '%s'\n", file_name.c_str());
+    exit(-1);
+  }
+  std::vector<LoadRequest> requests;
+  std::string line;
+  int line_num = 0;
+  while (std::getline(file, line))
+  {
+    line_num++;
+    if (line.empty() || line[0] == '#')
+      continue;
+    LoadRequest request;
+    char comma_0 = 0, comma_1 = 0;
+    std::istringstream is(line);
+    if (!(is >> request.arrival_ms >> comma_0 >> request.prompt_len >> comma_1 >> request.output_len) ||
+        comma_0 != ',' || comma_1 != ',')
+    {
+      if (requests.empty() && line_num == 1)
+        continue; // header
+      printf("[ERROR][load_generator] %s:%d should be arrival_ms,prompt_len,output_len\n", file_name.c_str(), line_num);
+      exit(-1);
+    }
+    requests.push_back(request);
+  }
+  std::stable_sort(requests.begin(), requests.end(),
+                   [](const LoadRequest &a, const LoadRequest &b) { return a.arrival_ms < b.arrival_ms; });
+  return requests;
+}
+
+/**
+ * poisson: exponential inter-arrival times of mean 1 / rate.
+ * bursty:  burst_size requests arrive together, with exponential gaps of mean burst_size / rate
+ *          between the bursts, so that the mean rate is the same.
+ **/
+inline std::vector<LoadRequest> generate_load_trace(const LoadSpec &spec)
+{
+  if (spec.mode == "trace")
+    return read_load_trace(spec.trace_file);
+
+  std::mt19937 gen(spec.seed);
+  const int burst_size = spec.mode == "bursty" ? spec.burst_size : 1;
+  std::exponential_distribution<double> gap_dist(spec.rate / burst_size / 1000.0);
+  std::uniform_int_distribution<int> prompt_dist(spec.prompt_len_min, spec.prompt_len_max);
+  std::uniform_int_distribution<int> output_dist(spec.output_len_min, spec.output_len_max);
+  std::vector<LoadRequest> requests(spec.request_num);
+  double arrival_ms = 0.0;
+  for (int i = 0; i < spec.request_num; i++)
+  {
+    if (i > 0 && i % burst_size == 0)
+      arrival_ms += gap_dist(gen);
+    requests[i].arrival_ms = arrival_ms;
+    requests[i].prompt_len = prompt_dist(gen);
+    requests[i].output_len = output_dist(gen);
+  }
+  return requests;
+}
+
+struct LoadResult
+{
+  int id = 0;
+  double arrival_ms = 0.0;
+  double start_ms = 0.0;  // when its batch started the forward
+  double finish_ms = 0.0;
+  int batch_size = 0;
+  int prompt_len = 0;
+  int output_len = 0;
+};
+
+/**
+ * Model instance that sleeps instead of computing: context_us_per_token for every token of the
+ * padded input batch, then step_ms for every generation step. The outputs are in host memory,
+ * the input ids followed by end_id.
+ **/
+class MockModelInstance : public AbstractTransformerModelInstance
+{
+public:
+  MockModelInstance(const int max_seq_len, const double context_us_per_token, const double step_ms,
+                    const int end_id = 50256)
+      : max_seq_len_(max_seq_len), context_us_per_token_(context_us_per_token), step_ms_(step_ms), end_id_(end_id)
+  {
+  }
+
+  std::shared_ptr<std::vector<Tensor>> forward(std::shared_ptr<std::vector<Tensor>> input_tensors) override
+  {
+    const int batch_size = (int)input_tensors->at(0).shape[0];
+    const int max_input_len = (int)input_tensors->at(0).shape[1];
+    const int *start_ids = (const int *)input_tensors->at(0).data;
+    int output_len = 0;
+    for (int i = 0; i < batch_size; i++)
+      output_len = std::max(output_len, ((const int *)input_tensors->at(2).data)[i]);
+    // like GptModelInstance, 0 generates up to max_seq_len
+    const int total_len = output_len > 0 && max_input_len + output_len <= max_seq_len_ ? max_input_len + output_len : max_seq_len_;
+
+    std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(
+        context_us_per_token_ * batch_size * max_input_len + step_ms_ * 1000.0 * (total_len - max_input_len)));
+
+    output_ids_.assign((size_t)batch_size * total_len, end_id_);
+    for (int i = 0; i < batch_size; i++)
+      std::copy(start_ids + (size_t)i * max_input_len, start_ids + (size_t)(i + 1) * max_input_len,
+                output_ids_.begin() + (size_t)i * total_len);
+    return std::shared_ptr<std::vector<Tensor>>(new std::vector<Tensor>{
+        Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size, total_len}, (void *)output_ids_.data()}});
+  }
+
+  void set_param(AbstractParamInstance *param_instance) override {}
+
+private:
+  const int max_seq_len_;
+  const double context_us_per_token_;
+  const double step_ms_;
+  const int end_id_;
+  std::vector<int> output_ids_;
+};
+
+class LoadGenerator
+{
+public:
+  // The instances of all the ranks of one model; they forward every batch together.
+  struct Replica
+  {
+    std::vector<AbstractTransformerModelInstance *> instances;
+    // called in the thread of each rank before its forward, e.g. to set the device
+    std::function<void(const int rank)> init_thread;
+  };
+
+  LoadGenerator(const std::vector<Replica> &replicas, const int max_batch_size, const int max_seq_len,
+                const int end_id = 50256)
+      : replicas_(replicas), max_batch_size_(max_batch_size), max_seq_len_(max_seq_len), end_id_(end_id)
+  {
+  }
+
+  // Requests longer than max_seq_len are shortened; the results are in the order of the requests.
+  std::vector<LoadResult> run(std::vector<LoadRequest> requests)
+  {
+    int clipped_num = 0;
+    for (LoadRequest &request : requests)
+    {
+      const int prompt_len = std::min(std::max(request.prompt_len, 1), max_seq_len_ - 1);
+      const int output_len = std::min(std::max(request.output_len, 1), max_seq_len_ - prompt_len);
+      clipped_num += prompt_len != request.prompt_len || output_len != request.output_len;
+      request.prompt_len = prompt_len;
+      request.output_len = output_len;
+    }
+    if (clipped_num > 0)
+      printf("[WARNING][load_generator] %d requests are shortened to max_seq_len %d\n", clipped_num, max_seq_len_);
+
+    requests_ = requests;
+    results_.assign(requests.size(), LoadResult());
+    queue_.clear();
+    done_ = false;
+    start_time_ = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (size_t r = 0; r < replicas_.size(); r++)
+      workers.push_back(std::thread(&LoadGenerator::serve, this, r));
+
+    // open loop: a request is queued at its arrival time, whatever the state of the replicas
+    std::vector<size_t> order(requests.size());
+    for (size_t i = 0; i < order.size(); i++)
+      order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [&requests](const size_t a, const size_t b) { return requests[a].arrival_ms < requests[b].arrival_ms; });
+    for (size_t i : order)
+    {
+      std::this_thread::sleep_until(start_time_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                      std::chrono::duration<double, std::milli>(requests[i].arrival_ms)));
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        queue_.push_back(i);
+      }
+      cv_.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      done_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+    return results_;
+  }
+
+private:
+  double now_ms() const
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time_).count();
+  }
+
+  void serve(const size_t replica_id)
+  {
+    const Replica &replica = replicas_[replica_id];
+    if (replica.init_thread)
+      replica.init_thread(0);
+    while (true)
+    {
+      std::vector<size_t> batch;
+      {
+        std::unique_lock<std::mutex> lock(mu_);
+        cv_.wait(lock, [this] { return !queue_.empty() || done_; });
+        if (queue_.empty())
+          return;
+        while (!queue_.empty() && (int)batch.size() < max_batch_size_)
+        {
+          batch.push_back(queue_.front());
+          queue_.pop_front();
+        }
+      }
+
+      const double start_ms = now_ms();
+      forwardBatch(replica, batch);
+      const double finish_ms = now_ms();
+      for (size_t i : batch)
+      {
+        LoadResult &result = results_[i];
+        result.id = (int)i;
+        result.arrival_ms = requests_[i].arrival_ms;
+        result.start_ms = start_ms;
+        result.finish_ms = finish_ms;
+        result.batch_size = (int)batch.size();
+        result.prompt_len = requests_[i].prompt_len;
+        result.output_len = requests_[i].output_len;
+      }
+    }
+  }
+
+  // The prompts are padded with end_id to the longest one; the batch generates the longest output.
+  void forwardBatch(const Replica &replica, const std::vector<size_t> &batch)
+  {
+    const int batch_size = (int)batch.size();
+    int max_prompt_len = 1, max_output_len = 1;
+    for (size_t i : batch)
+    {
+      max_prompt_len = std::max(max_prompt_len, requests_[i].prompt_len);
+      max_output_len = std::max(max_output_len, requests_[i].output_len);
+    }
+    max_output_len = std::min(max_output_len, max_seq_len_ - max_prompt_len);
+    std::vector<int> start_ids((size_t)batch_size * max_prompt_len, end_id_);
+    std::vector<int> start_lengths(batch_size);
+    std::vector<int> output_lens(batch_size, max_output_len);
+    for (int b = 0; b < batch_size; b++)
+    {
+      const size_t id = batch[b];
+      start_lengths[b] = requests_[id].prompt_len;
+      for (int t = 0; t < start_lengths[b]; t++)
+        start_ids[(size_t)b * max_prompt_len + t] = (int)((id * 7919 + t * 104729) % 50000);
+    }
+    auto input_tensors = std::shared_ptr<std::vector<Tensor>>(new std::vector<Tensor>{
+        Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size, max_prompt_len}, (void *)start_ids.data()},
+        Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size}, (void *)start_lengths.data()},
+        Tensor{MEMORY_CPU, TYPE_UINT32, std::vector<int64_t>{batch_size}, (void *)output_lens.data()}});
+
+    const MetricsClock::time_point arrival_time =
+        start_time_ + std::chrono::duration_cast<MetricsClock::duration>(
+                          std::chrono::duration<double, std::milli>(requests_[batch[0]].arrival_ms));
+    std::vector<std::thread> rank_threads;
+    for (size_t rank = 1; rank < replica.instances.size(); rank++)
+    {
+      rank_threads.push_back(std::thread([&replica, &input_tensors, arrival_time, rank]() {
+        if (replica.init_thread)
+          replica.init_thread((int)rank);
+        replica.instances[rank]->set_request_arrival_time(arrival_time);
+        replica.instances[rank]->forward(input_tensors);
+      }));
+    }
+    replica.instances[0]->set_request_arrival_time(arrival_time);
+    replica.instances[0]->forward(input_tensors);
+    for (std::thread &thread : rank_threads)
+      thread.join();
+  }
+
+  const std::vector<Replica> replicas_;
+  const int max_batch_size_;
+  const int max_seq_len_;
+  const int end_id_;
+
+  std::vector<LoadRequest> requests_;
+  std::vector<LoadResult> results_;
+  std::chrono::steady_clock::time_point start_time_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<size_t> queue_;
+  bool done_ = false;
+};
+
+struct LoadSummary
+{
+  size_t request_num = 0;
+  double duration_s = 0.0;  // first arrival to last completion
+  double offered_rps = 0.0; // requests over the span of the arrivals
+  double throughput_rps = 0.0;
+  double output_tokens_per_second = 0.0; // requested output tokens
+  double mean_batch_size = 0.0;
+  double latency_p50_ms = 0.0;
+  double latency_p90_ms = 0.0;
+  double latency_p99_ms = 0.0;
+  double latency_max_ms = 0.0;
+  double queue_p50_ms = 0.0;
+  double queue_p99_ms = 0.0;
+};
+
+inline LoadSummary summarize_load(const std::vector<LoadResult> &results)
+{
+  LoadSummary summary;
+  summary.request_num = results.size();
+  if (results.empty())
+    return summary;
+  std::vector<double> latencies, queue_times;
+  double first_arrival_ms = results[0].arrival_ms, last_arrival_ms = results[0].arrival_ms, last_finish_ms = 0.0;
+  size_t output_tokens = 0, batch_size_sum = 0;
+  for (const LoadResult &result : results)
+  {
+    latencies.push_back(result.finish_ms - result.arrival_ms);
+    queue_times.push_back(std::max(0.0, result.start_ms - result.arrival_ms));
+    first_arrival_ms = std::min(first_arrival_ms, result.arrival_ms);
+    last_arrival_ms = std::max(last_arrival_ms, result.arrival_ms);
+    last_finish_ms = std::max(last_finish_ms, result.finish_ms);
+    output_tokens += result.output_len;
+    batch_size_sum += result.batch_size;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::sort(queue_times.begin(), queue_times.end());
+  summary.duration_s = (last_finish_ms - first_arrival_ms) / 1000.0;
+  summary.offered_rps = last_arrival_ms > first_arrival_ms ? (results.size() - 1) * 1000.0 / (last_arrival_ms - first_arrival_ms) : 0.0;
+  summary.throughput_rps = summary.duration_s > 0.0 ? results.size() / summary.duration_s : 0.0;
+  summary.output_tokens_per_second = summary.duration_s > 0.0 ? output_tokens / summary.duration_s : 0.0;
+  summary.mean_batch_size = (double)batch_size_sum / results.size();
+  summary.latency_p50_ms = bench_percentile(latencies, 50);
+  summary.latency_p90_ms = bench_percentile(latencies, 90);
+  summary.latency_p99_ms = bench_percentile(latencies, 99);
+  summary.latency_max_ms = latencies.back();
+  summary.queue_p50_ms = bench_percentile(queue_times, 50);
+  summary.queue_p99_ms = bench_percentile(queue_times, 99);
+  return summary;
+}
+
+inline void print_load_summary(const LoadSummary &summary)
+{
+  printf("[INFO][load_generator] %zu requests in %.2f s, offered %.2f req/s, throughput %.2f req/s %.1f tokens/s, "
+         "mean batch size %.2f\n",
+         summary.request_num, summary.duration_s, summary.offered_rps, summary.throughput_rps,
+         summary.output_tokens_per_second, summary.mean_batch_size);
+  printf("[INFO][load_generator] latency p50 %.2f ms p90 %.2f ms p99 %.2f ms max %.2f ms, queue p50 %.2f ms p99 %.2f ms\n",
+         summary.latency_p50_ms, summary.latency_p90_ms, summary.latency_p99_ms, summary.latency_max_ms,
+         summary.queue_p50_ms, summary.queue_p99_ms);
+}
+
+inline bool write_load_results_csv(const std::string &file_name, const std::vector<LoadResult> &results)
+{
+  std::ofstream file(file_name);
+  if (!file.is_open())
+  {
+    printf("[WARNING][load_generator] Cannot write the results into %s\n", file_name.c_str());
+    return false;
+  }
+  file << "id,arrival_ms,start_ms,finish_ms,latency_ms,batch_size,prompt_len,output_len\n";
+  for (const LoadResult &result : results)
+    file << result.id << "," << result.arrival_ms << "," << result.start_ms << "," << result.finish_ms << ","
+         << result.finish_ms - result.arrival_ms << "," << result.batch_size << "," << result.prompt_len << ","
+         << result.output_len << "\n";
+  return true;
+}
+
+} // namespace fastertransformer
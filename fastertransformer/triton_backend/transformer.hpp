@@ -20,6 +20,11 @@
 #include "fastertransformer/gpt.h"
 #include "fastertransformer/utils/INIReader.h"
 #include "fastertransformer/utils/common.h"
+#include "fastertransformer/utils/generation_metrics.h"
+#include "fastertransformer/utils/gpt_tokenizer.h"
+#include "fastertransformer/utils/pinned_staging.h"
+#include "fastertransformer/utils/rendezvous.h"
+#include "fastertransformer/utils/weight_store.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
@@ -109,12 +114,32 @@ struct AbstractParamInstance
   virtual void free_model_param() = 0;
   virtual void init_nccl_from_ids(std::vector<ncclUniqueId> nccl_ids) = 0;
   virtual void init_nccl_from_comms(ncclComm_t tensor_para_nccl_comm, ncclComm_t layer_para_nccl_comm) = 0;
+  // Forms the communicators of the tensor and layer parallel groups of this rank through store,
+  // with keys that start with prefix, instead of the ids of create_nccl_ids. See utils/rendezvous.h.
+  // Returns the index of the first request that this rank serves: 0, or the one of its restart.
+  virtual int init_nccl_from_store(RendezvousStore& store, std::string prefix) = 0;
+  // Before every request, on every rank, which all serve the same requests in the same order:
+  // re-forms the groups of init_nccl_from_store in which a rank restarts at this request, and
+  // returns whether it did. The model instances then need set_param again.
+  virtual bool refresh_nccl_from_store() = 0;
+  // After a request, when this rank restarts: it still serves the next request, then exits, and
+  // its next incarnation re-forms its groups with the other ranks at the request after that.
+  virtual void leave_nccl_store() = 0;
 };
 
 struct AbstractTransformerModelInstance
 {
+  // The inputs are the start ids [batch, max_start_len], the start lengths [batch] and the output
+  // lengths [batch], or, with a tokenizer, the prompts as a TYPE_BYTES [batch] tensor in the
+  // serialization of Triton (a 4-byte length and the UTF-8 bytes per prompt) and the output lengths.
   virtual std::shared_ptr<std::vector<Tensor>> forward(std::shared_ptr<std::vector<Tensor>> input_tensors) = 0;
   virtual void set_param(AbstractParamInstance* param_instance) = 0;
+  // When the next request was received, for its queue time. Without it, the queue time is 0.
+  virtual void set_request_arrival_time(MetricsClock::time_point arrival_time) {}
+  // Metrics of the requests of this instance, nullptr if the instance does not record them.
+  virtual std::shared_ptr<GenerationMetrics> get_metrics() {return nullptr;}
+  // Metrics of the last request.
+  virtual RequestMetrics get_last_request_metrics() {return RequestMetrics();}
 };
 
 struct AbstractTransformerModel {
@@ -126,4 +151,6 @@ struct AbstractTransformerModel {
   virtual std::pair<uint32_t, uint32_t> get_max_batch_seqlen() = 0;
   virtual int get_tensor_para_size() = 0;
   virtual int get_layer_para_size() = 0;
+  // Counters and histograms of all model instances in the Prometheus text format.
+  virtual std::string get_metrics_prometheus() {return "";}
 };
@@ -21,7 +21,13 @@
 
 #include "fastertransformer/utils/common.h"
 #include "fastertransformer/utils/utils.h"
+#include <algorithm>
+#include <cstdlib>
 #include <cuda_runtime.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #ifdef GOOGLE_CUDA
@@ -44,11 +50,204 @@
 namespace fastertransformer
 {
 
+// Named sizes in bytes of the sub-buffers carved out of one allocation, in carving order.
+class MemoryFootprint
+{
+  std::vector<std::pair<std::string, size_t>> components_;
+
+public:
+  // Bytes of a name that is already there are added to it.
+  void add(const std::string &name, const size_t bytes)
+  {
+    for (auto &component : components_)
+    {
+      if (component.first == name)
+      {
+        component.second += bytes;
+        return;
+      }
+    }
+    components_.push_back(std::make_pair(name, bytes));
+  }
+
+  void add(const MemoryFootprint &other)
+  {
+    for (const auto &component : other.components_)
+      add(component.first, component.second);
+  }
+
+  size_t getBytes(const std::string &name) const
+  {
+    for (const auto &component : components_)
+      if (component.first == name)
+        return component.second;
+    return 0;
+  }
+
+  // Offset of a sub-buffer from the start of the allocation.
+  size_t getOffset(const std::string &name) const
+  {
+    size_t offset = 0;
+    for (const auto &component : components_)
+    {
+      if (component.first == name)
+        return offset;
+      offset += component.second;
+    }
+    throw std::runtime_error("[FT][ERROR] MemoryFootprint has no component " + name);
+  }
+
+  size_t getTotalBytes() const
+  {
+    size_t total = 0;
+    for (const auto &component : components_)
+      total += component.second;
+    return total;
+  }
+
+  const std::vector<std::pair<std::string, size_t>> &getComponents() const { return components_; }
+
+  void print(const char *title) const
+  {
+    printf("[INFO] %s: %.2f MB\n", title, getTotalBytes() / 1048576.0);
+    for (const auto &component : components_)
+      printf("[INFO]   %-28s %10.2f MB\n", component.first.c_str(), component.second / 1048576.0);
+  }
+};
+
 class IAllocator
 {
 public:
   virtual void *malloc(size_t size, const bool is_set_zero=true) const = 0;
   virtual void free(void *ptr) const = 0;
+  // One allocation for all the sub-buffers of footprint; the accounting allocators attribute it to their names.
+  virtual void *mallocBuffers(const MemoryFootprint &footprint, const bool is_set_zero=true) const
+  {
+    return malloc(footprint.getTotalBytes(), is_set_zero);
+  }
+};
+
+/**
+ * Decorator of another allocator that accounts the current and peak bytes per component.
+ * mallocBuffers() attributes the allocation to the components of its footprint, malloc() to
+ * "unnamed". The peak of a component is the largest current size it had; the total peak is
+ * the largest sum over all components, which is not the sum of their peaks.
+ **/
+class TrackingAllocator : public IAllocator
+{
+  struct Component
+  {
+    size_t current_bytes = 0;
+    size_t peak_bytes = 0;
+  };
+
+  const IAllocator &allocator_;
+  mutable std::mutex mu_;
+  mutable std::unordered_map<const void *, MemoryFootprint> allocations_;
+  mutable std::vector<std::pair<std::string, Component>> components_; // in the order they first appear
+  mutable size_t current_bytes_ = 0;
+  mutable size_t peak_bytes_ = 0;
+
+  Component &getComponent(const std::string &name) const
+  {
+    for (auto &component : components_)
+      if (component.first == name)
+        return component.second;
+    components_.push_back(std::make_pair(name, Component()));
+    return components_.back().second;
+  }
+
+  void account(const MemoryFootprint &footprint, const bool is_add) const
+  {
+    for (const auto &it : footprint.getComponents())
+    {
+      Component &component = getComponent(it.first);
+      if (is_add)
+      {
+        component.current_bytes += it.second;
+        component.peak_bytes = std::max(component.peak_bytes, component.current_bytes);
+        current_bytes_ += it.second;
+      }
+      else
+      {
+        component.current_bytes -= it.second;
+        current_bytes_ -= it.second;
+      }
+    }
+    peak_bytes_ = std::max(peak_bytes_, current_bytes_);
+  }
+
+public:
+  explicit TrackingAllocator(const IAllocator &allocator) : allocator_(allocator) {}
+
+  void *malloc(size_t size, const bool is_set_zero=true) const
+  {
+    MemoryFootprint footprint;
+    footprint.add("unnamed", size);
+    return mallocBuffers(footprint, is_set_zero);
+  }
+
+  void *mallocBuffers(const MemoryFootprint &footprint, const bool is_set_zero=true) const
+  {
+    void *ptr = allocator_.malloc(footprint.getTotalBytes(), is_set_zero);
+    std::lock_guard<std::mutex> lock(mu_);
+    account(footprint, true);
+    allocations_[ptr] = footprint;
+    return ptr;
+  }
+
+  void free(void *ptr) const
+  {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      auto it = allocations_.find(ptr);
+      if (it != allocations_.end())
+      {
+        account(it->second, false);
+        allocations_.erase(it);
+      }
+    }
+    allocator_.free(ptr);
+  }
+
+  size_t getCurrentBytes(const std::string &name) const
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (const auto &component : components_)
+      if (component.first == name)
+        return component.second.current_bytes;
+    return 0;
+  }
+
+  size_t getPeakBytes(const std::string &name) const
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (const auto &component : components_)
+      if (component.first == name)
+        return component.second.peak_bytes;
+    return 0;
+  }
+
+  size_t getTotalCurrentBytes() const
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    return current_bytes_;
+  }
+
+  size_t getTotalPeakBytes() const
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    return peak_bytes_;
+  }
+
+  void printReport() const
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    printf("[INFO] allocator memory: current %.2f MB peak %.2f MB\n", current_bytes_ / 1048576.0, peak_bytes_ / 1048576.0);
+    for (const auto &component : components_)
+      printf("[INFO]   %-28s current %10.2f MB peak %10.2f MB\n", component.first.c_str(),
+             component.second.current_bytes / 1048576.0, component.second.peak_bytes / 1048576.0);
+  }
 };
 
 template <AllocatorType AllocType_>
@@ -83,6 +282,28 @@ public:
   }
 };
 
+// Host memory, for the code that runs without a GPU and for checks of the sharing of buffers.
+template <>
+class Allocator<AllocatorType::CPU> : public IAllocator
+{
+public:
+  Allocator() {}
+  ~Allocator(){}
+
+  void *malloc(size_t size, const bool is_set_zero=true) const
+  {
+    void *ptr = is_set_zero ? std::calloc(size, 1) : std::malloc(size);
+    if (ptr == nullptr && size > 0)
+      throw std::runtime_error("[FT][ERROR] cannot allocate " + std::to_string(size) + " bytes of host memory");
+    return ptr;
+  }
+
+  void free(void *ptr) const
+  {
+    std::free(ptr);
+  }
+};
+
 #ifdef GOOGLE_CUDA
 using namespace tensorflow;
 template <>
@@ -98,6 +319,10 @@ public:
     allocated_tensor_vector = new std::vector<Tensor>;
   }
 
+  // An allocator kept by an op across its Compute calls allocates in the context of the current call.
+  // The tensors allocated so far are kept until they are freed.
+  void setContext(OpKernelContext *context) { context_ = context; }
+
   void *malloc(size_t size, const bool is_set_zero=true) const
   {
     Tensor buf;
@@ -119,6 +344,15 @@ public:
 #ifndef NDEBUG
     printf("call from allocator free\n");
 #endif
+    // release the tensor, so that a long-lived allocator does not keep every temporary buffer alive
+    for (auto it = allocated_tensor_vector->begin(); it != allocated_tensor_vector->end(); ++it)
+    {
+      if ((void *)it->flat<uint8>().data() == ptr)
+      {
+        allocated_tensor_vector->erase(it);
+        return;
+      }
+    }
     return;
   }
 
@@ -156,6 +390,15 @@ public:
 #ifndef NDEBUG
     printf("call from allocator free\n");
 #endif
+    // release the tensor, so that a long-lived allocator does not keep every temporary buffer alive
+    for (auto it = allocated_tensor_vector->begin(); it != allocated_tensor_vector->end(); ++it)
+    {
+      if (it->data_ptr() == ptr)
+      {
+        allocated_tensor_vector->erase(it);
+        return;
+      }
+    }
     return;
   }
 
@@ -58,7 +58,8 @@ public:
   int max_input_len;
   int *d_start_ids;
   const int *d_start_lengths;
-  const T *d_attn_mask;
+  // [batch, max_input_len, max_input_len], optional; nullptr derives the causal mask from d_start_lengths
+  const T *d_attn_mask = nullptr;
 
   virtual ~DecodingInitParam() {}
 };
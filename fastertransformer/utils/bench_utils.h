@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Benchmark harness of ft_bench
+ *
+ * A sweep spec is an ini file:
+ *   [bench]  model (gpt, decoding, encoder), backend (cuda, cpu), warmup, iterations,
+ *            output (file name, stdout when empty) and format (csv, json)
+ *   [model]  head_num, size_per_head, vocab_size, num_layer
+ *   [sweep]  comma separated lists of batch_size, input_len, output_len, beam_width,
+ *            top_k, top_p, data_type (fp32, fp16), tensor_para_size, layer_para_size,
+ *            all_reduce_chunk_num (see TensorParallelParam) and int8_comm_block_size (see
+ *            ParallelParam)
+ * Every key can be overridden with section.key=value. The harness runs the cartesian
+ * product of the [sweep] lists; it has no CUDA dependency, the backends are in sample/cpp/ft_bench.cc.
+ **/
+
+#pragma once
+
+#include "fastertransformer/utils/INIReader.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fastertransformer
+{
+
+struct BenchConfig
+{
+  std::string model;
+  std::string backend;
+  std::string data_type;
+  int head_num;
+  int size_per_head;
+  int vocab_size;
+  int num_layer;
+
+  int batch_size;
+  int input_len;
+  int output_len;
+  int beam_width;
+  int top_k;
+  float top_p;
+  int tensor_para_size;
+  int layer_para_size;
+  int all_reduce_chunk_num;
+  int int8_comm_block_size;
+
+  std::string toString() const
+  {
+    std::ostringstream os;
+    os << model << "/" << backend << " " << data_type << " batch_size " << batch_size << " input_len " << input_len
+       << " output_len " << output_len << " beam_width " << beam_width << " top_k " << top_k << " top_p " << top_p
+       << " tensor_para_size " << tensor_para_size << " layer_para_size " << layer_para_size
+       << " all_reduce_chunk_num " << all_reduce_chunk_num << " int8_comm_block_size " << int8_comm_block_size;
+    return os.str();
+  }
+};
+
+struct BenchResult
+{
+  BenchConfig config;
+  bool skipped = false;
+  std::string skip_reason;
+  int iterations = 0;
+  double mean_ms = 0.0;
+  double min_ms = 0.0;
+  double max_ms = 0.0;
+  double p50_ms = 0.0;
+  double p90_ms = 0.0;
+  double p99_ms = 0.0;
+  double tokens_per_second = 0.0;
+  double peak_memory_mb = 0.0;
+};
+
+// Nearest-rank percentile of the sorted samples.
+inline double bench_percentile(const std::vector<double> &sorted, const double p)
+{
+  if (sorted.empty())
+    return 0.0;
+  const size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+  return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+/**
+ * One backend runs one configuration at a time. setup() builds the model and the buffers,
+ * run() does one synchronous inference and returns the number of tokens it produced
+ * (generated tokens for gpt and decoding, input tokens for encoder).
+ **/
+class BenchBackend
+{
+public:
+  // Returns false with a reason when the backend cannot run the configuration.
+  virtual bool setup(const BenchConfig &config, std::string &reason) = 0;
+  virtual size_t run() = 0;
+  // Peak memory used by the configuration since setup(), in bytes.
+  virtual size_t getPeakMemory() = 0;
+  virtual void teardown() = 0;
+  // Called before every timed iteration, e.g. to align the ranks.
+  virtual void barrier() {}
+  virtual ~BenchBackend() {}
+};
+
+inline BenchResult run_bench_config(BenchBackend &backend, const BenchConfig &config,
+                                    const int warmup, const int iterations)
+{
+  BenchResult result;
+  result.config = config;
+  if (!backend.setup(config, result.skip_reason))
+  {
+    result.skipped = true;
+    return result;
+  }
+
+  for (int i = 0; i < warmup; i++)
+    backend.run();
+
+  std::vector<double> latencies;
+  size_t tokens = 0;
+  double total_ms = 0.0;
+  for (int i = 0; i < iterations; i++)
+  {
+    backend.barrier();
+    const auto start = std::chrono::steady_clock::now();
+    tokens += backend.run();
+    const auto end = std::chrono::steady_clock::now();
+    const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    latencies.push_back(ms);
+    total_ms += ms;
+  }
+  result.peak_memory_mb = backend.getPeakMemory() / 1024.0 / 1024.0;
+  backend.teardown();
+
+  std::sort(latencies.begin(), latencies.end());
+  result.iterations = iterations;
+  if (iterations > 0)
+  {
+    result.mean_ms = total_ms / iterations;
+    result.min_ms = latencies.front();
+    result.max_ms = latencies.back();
+    result.p50_ms = bench_percentile(latencies, 50);
+    result.p90_ms = bench_percentile(latencies, 90);
+    result.p99_ms = bench_percentile(latencies, 99);
+    result.tokens_per_second = total_ms > 0.0 ? tokens * 1000.0 / total_ms : 0.0;
+  }
+  return result;
+}
+
+struct BenchSpec
+{
+  std::string model;
+  std::string backend;
+  int warmup;
+  int iterations;
+  std::string output;
+  std::string format;
+  std::vector<BenchConfig> configs;
+};
+
+class BenchSpecReader
+{
+public:
+  // overrides: "section.key=value" strings, applied on top of the ini file.
+  BenchSpecReader(const std::string &ini_name, const std::vector<std::string> &overrides)
+  {
+    if (!ini_name.empty())
+    {
+      reader_ = INIReader(ini_name);
+      if (reader_.ParseError() < 0)
+      {
+        printf("[ERROR][ft_bench] Can't load '%s'\n", ini_name.c_str());
+        exit(-1);
+      }
+    }
+    for (const std::string &override_str : overrides)
+    {
+      const size_t dot = override_str.find('.');
+      const size_t eq = override_str.find('=');
+      if (dot == std::string::npos || eq == std::string::npos || dot > eq)
+      {
+        printf("[ERROR][ft_bench] override %s should be section.key=value\n", override_str.c_str());
+        exit(-1);
+      }
+      overrides_[override_str.substr(0, eq)] = override_str.substr(eq + 1);
+    }
+  }
+
+  std::string get(const std::string &section, const std::string &key, const std::string &default_value) const
+  {
+    auto it = overrides_.find(section + "." + key);
+    if (it != overrides_.end())
+      return it->second;
+    return reader_.Get(section, key, default_value);
+  }
+
+  template <typename T>
+  std::vector<T> getList(const std::string &section, const std::string &key, const std::string &default_value) const
+  {
+    std::vector<T> values;
+    std::stringstream ss(get(section, key, default_value));
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+      item.erase(0, item.find_first_not_of(" \t"));
+      item.erase(item.find_last_not_of(" \t") + 1);
+      if (item.empty())
+        continue;
+      std::istringstream is(item);
+      T value;
+      is >> value;
+      if (is.fail())
+      {
+        printf("[ERROR][ft_bench] cannot parse '%s' of %s.%s\n", item.c_str(), section.c_str(), key.c_str());
+        exit(-1);
+      }
+      values.push_back(value);
+    }
+    if (values.empty())
+    {
+      printf("[ERROR][ft_bench] %s.%s is empty\n", section.c_str(), key.c_str());
+      exit(-1);
+    }
+    return values;
+  }
+
+  BenchSpec read() const
+  {
+    BenchSpec spec;
+    spec.model = get("bench", "model", "gpt");
+    spec.backend = get("bench", "backend", "cuda");
+    spec.warmup = atoi(get("bench", "warmup", "2").c_str());
+    spec.iterations = atoi(get("bench", "iterations", "10").c_str());
+    spec.output = get("bench", "output", "");
+    spec.format = get("bench", "format", "csv");
+    if (spec.model != "gpt" && spec.model != "decoding" && spec.model != "encoder")
+    {
+      printf("[ERROR][ft_bench] bench.model should be gpt, decoding or encoder, got %s\n", spec.model.c_str());
+      exit(-1);
+    }
+    if (spec.backend != "cuda" && spec.backend != "cpu")
+    {
+      printf("[ERROR][ft_bench] bench.backend should be cuda or cpu, got %s\n", spec.backend.c_str());
+      exit(-1);
+    }
+    if (spec.format != "csv" && spec.format != "json")
+    {
+      printf("[ERROR][ft_bench] bench.format should be csv or json, got %s\n", spec.format.c_str());
+      exit(-1);
+    }
+
+    BenchConfig base;
+    base.model = spec.model;
+    base.backend = spec.backend;
+    base.head_num = atoi(get("model", "head_num", "16").c_str());
+    base.size_per_head = atoi(get("model", "size_per_head", "64").c_str());
+    base.vocab_size = atoi(get("model", "vocab_size", "50304").c_str());
+    base.num_layer = atoi(get("model", "num_layer", "24").c_str());
+
+    const auto batch_sizes = getList<int>("sweep", "batch_size", "1");
+    const auto input_lens = getList<int>("sweep", "input_len", "32");
+    const auto output_lens = getList<int>("sweep", "output_len", "32");
+    const auto beam_widths = getList<int>("sweep", "beam_width", "1");
+    const auto top_ks = getList<int>("sweep", "top_k", "1");
+    const auto top_ps = getList<float>("sweep", "top_p", "0.0");
+    const auto data_types = getList<std::string>("sweep", "data_type", "fp32");
+    const auto tensor_para_sizes = getList<int>("sweep", "tensor_para_size", "1");
+    const auto layer_para_sizes = getList<int>("sweep", "layer_para_size", "1");
+    const auto all_reduce_chunk_nums = getList<int>("sweep", "all_reduce_chunk_num", "1");
+    const auto int8_comm_block_sizes = getList<int>("sweep", "int8_comm_block_size", "0");
+
+    for (const std::string &data_type : data_types)
+      for (int tensor_para_size : tensor_para_sizes)
+        for (int layer_para_size : layer_para_sizes)
+          for (int all_reduce_chunk_num : all_reduce_chunk_nums)
+            for (int beam_width : beam_widths)
+              for (int top_k : top_ks)
+                for (float top_p : top_ps)
+                  for (int input_len : input_lens)
+                    for (int output_len : output_lens)
+                      for (int batch_size : batch_sizes)
+                      {
+                        if (data_type != "fp32" && data_type != "fp16")
+                        {
+                          printf("[ERROR][ft_bench] data_type should be fp32 or fp16, got %s\n", data_type.c_str());
+                          exit(-1);
+                        }
+                        BenchConfig config = base;
+                        config.data_type = data_type;
+                        config.batch_size = batch_size;
+                        config.input_len = input_len;
+                        config.output_len = output_len;
+                        config.beam_width = beam_width;
+                        config.top_k = top_k;
+                        config.top_p = top_p;
+                        config.tensor_para_size = tensor_para_size;
+                        config.layer_para_size = layer_para_size;
+                        config.all_reduce_chunk_num = all_reduce_chunk_num;
+                        for (int int8_comm_block_size : int8_comm_block_sizes)
+                        {
+                          config.int8_comm_block_size = int8_comm_block_size;
+                          spec.configs.push_back(config);
+                        }
+                      }
+    return spec;
+  }
+
+private:
+  INIReader reader_;
+  std::map<std::string, std::string> overrides_;
+};
+
+inline void write_bench_csv(std::ostream &os, const std::vector<BenchResult> &results)
+{
+  os << "model,backend,data_type,batch_size,input_len,output_len,beam_width,top_k,top_p,"
+        "tensor_para_size,layer_para_size,all_reduce_chunk_num,int8_comm_block_size,iterations,mean_ms,min_ms,max_ms,p50_ms,p90_ms,p99_ms,"
+        "tokens_per_second,peak_memory_mb,status\n";
+  for (const BenchResult &r : results)
+  {
+    const BenchConfig &c = r.config;
+    os << c.model << "," << c.backend << "," << c.data_type << "," << c.batch_size << "," << c.input_len << ","
+       << c.output_len << "," << c.beam_width << "," << c.top_k << "," << c.top_p << "," << c.tensor_para_size << ","
+       << c.layer_para_size << "," << c.all_reduce_chunk_num << "," << c.int8_comm_block_size << "," << r.iterations << "," << r.mean_ms << "," << r.min_ms << "," << r.max_ms << ","
+       << r.p50_ms << "," << r.p90_ms << "," << r.p99_ms << "," << r.tokens_per_second << "," << r.peak_memory_mb << ","
+       << (r.skipped ? "skipped: " + r.skip_reason : "ok") << "\n";
+  }
+}
+
+inline std::string bench_json_escape(const std::string &str)
+{
+  std::string escaped;
+  for (char c : str)
+  {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+inline void write_bench_json(std::ostream &os, const std::vector<BenchResult> &results)
+{
+  os << "[\n";
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const BenchResult &r = results[i];
+    const BenchConfig &c = r.config;
+    os << "  {\"model\": \"" << c.model << "\", \"backend\": \"" << c.backend << "\", \"data_type\": \"" << c.data_type
+       << "\", \"batch_size\": " << c.batch_size << ", \"input_len\": " << c.input_len
+       << ", \"output_len\": " << c.output_len << ", \"beam_width\": " << c.beam_width << ", \"top_k\": " << c.top_k
+       << ", \"top_p\": " << c.top_p << ", \"tensor_para_size\": " << c.tensor_para_size
+       << ", \"layer_para_size\": " << c.layer_para_size << ", \"all_reduce_chunk_num\": " << c.all_reduce_chunk_num
+       << ", \"int8_comm_block_size\": " << c.int8_comm_block_size
+       << ", \"iterations\": " << r.iterations
+       << ", \"mean_ms\": " << r.mean_ms << ", \"min_ms\": " << r.min_ms << ", \"max_ms\": " << r.max_ms
+       << ", \"p50_ms\": " << r.p50_ms << ", \"p90_ms\": " << r.p90_ms << ", \"p99_ms\": " << r.p99_ms
+       << ", \"tokens_per_second\": " << r.tokens_per_second << ", \"peak_memory_mb\": " << r.peak_memory_mb
+       << ", \"status\": \"" << (r.skipped ? "skipped: " + bench_json_escape(r.skip_reason) : "ok") << "\"}"
+       << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  os << "]\n";
+}
+
+inline void write_bench_results(const BenchSpec &spec, const std::vector<BenchResult> &results)
+{
+  std::ofstream file;
+  if (!spec.output.empty())
+  {
+    file.open(spec.output);
+    if (!file.is_open())
+    {
+      printf("[ERROR][ft_bench] cannot open %s\n", spec.output.c_str());
+      exit(-1);
+    }
+  }
+  std::ostream &os = spec.output.empty() ? std::cout : file;
+  if (spec.format == "json")
+    write_bench_json(os, results);
+  else
+    write_bench_csv(os, results);
+}
+
+} // namespace fastertransformer
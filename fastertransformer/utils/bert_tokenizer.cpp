@@ -0,0 +1,321 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "bert_tokenizer.h"
+#include "unicode_utils.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+namespace fastertransformer
+{
+
+namespace
+{
+// _is_chinese_char of tokenization.py, the CJK Unified Ideographs blocks
+bool is_cjk_ideograph(const uint32_t c)
+{
+  return (c >= 0x4E00 && c <= 0x9FFF) || (c >= 0x3400 && c <= 0x4DBF) || (c >= 0x20000 && c <= 0x2A6DF) ||
+         (c >= 0x2A700 && c <= 0x2B73F) || (c >= 0x2B740 && c <= 0x2B81F) || (c >= 0x2B820 && c <= 0x2CEAF) ||
+         (c >= 0xF900 && c <= 0xFAFF) || (c >= 0x2F800 && c <= 0x2FA1F);
+}
+
+// _is_punctuation of tokenization.py: all the non-letter, non-number ASCII and P*
+bool is_bert_punctuation(const uint32_t c)
+{
+  if ((c >= 33 && c <= 47) || (c >= 58 && c <= 64) || (c >= 91 && c <= 96) || (c >= 123 && c <= 126))
+    return true;
+  return c >= 0x80 && is_unicode_punctuation(c);
+}
+
+std::string to_utf8(const std::u32string &s)
+{
+  std::string out;
+  out.reserve(s.size());
+  for (const char32_t c : s)
+    append_utf8(out, c);
+  return out;
+}
+} // namespace
+
+BertTokenizer::BertTokenizer(const std::string &vocab_file, const bool do_lower_case, const int max_input_chars_per_word)
+    : do_lower_case_(do_lower_case), max_input_chars_per_word_(max_input_chars_per_word)
+{
+  std::ifstream file(vocab_file, std::ios::in | std::ios::binary);
+  if (!file.is_open())
+    throw std::runtime_error("[FT][ERROR] cannot open " + vocab_file);
+
+  node_ids_.push_back(-1);
+  word_root_ = 0;
+  node_ids_.push_back(-1);
+  suffix_root_ = 1;
+
+  // one token per line, the id is the line number; a repeated token keeps its last id
+  std::string line;
+  while (std::getline(file, line))
+  {
+    const size_t begin = line.find_first_not_of(" \t\r\n");
+    const size_t end = line.find_last_not_of(" \t\r\n");
+    const std::string token = begin == std::string::npos ? "" : line.substr(begin, end - begin + 1);
+    vocab_[token] = vocab_size_;
+    if (token.size() > 2 && token.compare(0, 2, "##") == 0)
+      insert(suffix_root_, token.substr(2), vocab_size_);
+    else
+      insert(word_root_, token, vocab_size_);
+    vocab_size_++;
+  }
+
+  cls_id_ = getTokenId("[CLS]");
+  sep_id_ = getTokenId("[SEP]");
+  unk_id_ = getTokenId("[UNK]");
+  if (cls_id_ < 0 || sep_id_ < 0 || unk_id_ < 0)
+    throw std::runtime_error("[FT][ERROR] " + vocab_file + " has no [CLS], [SEP] or [UNK]");
+}
+
+int BertTokenizer::getTokenId(const std::string &token) const
+{
+  auto it = vocab_.find(token);
+  return it != vocab_.end() ? it->second : -1;
+}
+
+void BertTokenizer::insert(int node, const std::string &piece, const int id)
+{
+  if (piece.empty())
+    return;
+  for (const char c : piece)
+  {
+    const uint64_t key = ((uint64_t)node << 8) | (unsigned char)c;
+    auto it = edges_.find(key);
+    if (it == edges_.end())
+    {
+      const int child = (int)node_ids_.size();
+      node_ids_.push_back(-1);
+      edges_[key] = child;
+      node = child;
+    }
+    else
+    {
+      node = it->second;
+    }
+  }
+  node_ids_[node] = id;
+}
+
+void BertTokenizer::basicTokenize(const std::string &text, std::vector<std::string> &words) const
+{
+  // _clean_text and _tokenize_chinese_chars, then the whitespace split
+  std::vector<std::u32string> tokens;
+  std::u32string token;
+  size_t i = 0;
+  while (i < text.size())
+  {
+    size_t length;
+    const uint32_t c = decode_utf8(text.data() + i, text.size() - i, length);
+    i += length;
+    const bool is_space = c == ' ' || c == '\t' || c == '\n' || c == '\r' || is_unicode_space_separator(c);
+    if (c == 0 || c == UNICODE_REPLACEMENT_CHARACTER || (!is_space && is_unicode_control(c)))
+      continue;
+    if (is_space || is_unicode_whitespace(c) || is_cjk_ideograph(c))
+    {
+      if (!token.empty())
+        tokens.push_back(token);
+      token.clear();
+      if (is_cjk_ideograph(c))
+        tokens.push_back(std::u32string(1, c));
+      continue;
+    }
+    token += c;
+  }
+  if (!token.empty())
+    tokens.push_back(token);
+
+  std::u32string lower;
+  std::u32string stripped;
+  for (std::u32string &word : tokens)
+  {
+    if (do_lower_case_)
+    {
+      lower.clear();
+      for (size_t j = 0; j < word.size(); j++)
+      {
+        // Final_Sigma: a capital sigma after a letter, at the end of a word, is the final form
+        if (word[j] == 0x3A3 && j > 0 && is_unicode_letter(word[j - 1]) &&
+            (j + 1 == word.size() || !is_unicode_letter(word[j + 1])))
+          lower += (char32_t)0x3C2;
+        else
+          append_unicode_lower(lower, word[j]);
+      }
+      stripped.clear();
+      for (const char32_t c : lower)
+        append_unicode_strip_accents(stripped, c);
+      word.swap(stripped);
+    }
+
+    // _run_split_on_punc, each punctuation is a word
+    size_t begin = 0;
+    for (size_t j = 0; j < word.size(); j++)
+    {
+      if (!is_bert_punctuation(word[j]))
+        continue;
+      if (j > begin)
+        words.push_back(to_utf8(word.substr(begin, j - begin)));
+      words.push_back(to_utf8(word.substr(j, 1)));
+      begin = j + 1;
+    }
+    if (word.size() > begin)
+      words.push_back(to_utf8(word.substr(begin)));
+  }
+}
+
+void BertTokenizer::wordpiece(const std::string &word, std::vector<int> &ids) const
+{
+  size_t char_num = 0;
+  for (const char c : word)
+    char_num += ((unsigned char)c & 0xC0) != 0x80;
+  if (char_num > (size_t)max_input_chars_per_word_)
+  {
+    ids.push_back(unk_id_);
+    return;
+  }
+
+  const size_t old_size = ids.size();
+  size_t start = 0;
+  while (start < word.size())
+  {
+    // the longest piece of the vocabulary at start
+    int node = start == 0 ? word_root_ : suffix_root_;
+    int piece_id = -1;
+    size_t piece_end = start;
+    for (size_t i = start; i < word.size(); i++)
+    {
+      auto it = edges_.find(((uint64_t)node << 8) | (unsigned char)word[i]);
+      if (it == edges_.end())
+        break;
+      node = it->second;
+      if (node_ids_[node] >= 0)
+      {
+        piece_id = node_ids_[node];
+        piece_end = i + 1;
+      }
+    }
+    if (piece_id < 0)
+    {
+      ids.resize(old_size);
+      ids.push_back(unk_id_);
+      return;
+    }
+    ids.push_back(piece_id);
+    start = piece_end;
+  }
+}
+
+std::vector<int> BertTokenizer::tokenize(const std::string &text) const
+{
+  std::vector<std::string> words;
+  basicTokenize(text, words);
+  std::vector<int> ids;
+  for (const std::string &word : words)
+    wordpiece(word, ids);
+  return ids;
+}
+
+int BertTokenizer::encode(const std::string &text_a, const std::string &text_b, const int max_seq_len,
+                          int *input_ids, int *segment_ids) const
+{
+  std::vector<int> ids_a = tokenize(text_a);
+  std::vector<int> ids_b;
+  if (!text_b.empty())
+  {
+    ids_b = tokenize(text_b);
+    while ((int)(ids_a.size() + ids_b.size()) > max_seq_len - 3)
+    {
+      if (ids_a.size() > ids_b.size())
+        ids_a.pop_back();
+      else
+        ids_b.pop_back();
+    }
+  }
+  else if ((int)ids_a.size() > max_seq_len - 2)
+  {
+    ids_a.resize(std::max(max_seq_len - 2, 0));
+  }
+
+  int length = 0;
+  input_ids[length] = cls_id_;
+  segment_ids[length++] = 0;
+  for (const int id : ids_a)
+  {
+    input_ids[length] = id;
+    segment_ids[length++] = 0;
+  }
+  input_ids[length] = sep_id_;
+  segment_ids[length++] = 0;
+  if (!text_b.empty())
+  {
+    for (const int id : ids_b)
+    {
+      input_ids[length] = id;
+      segment_ids[length++] = 1;
+    }
+    input_ids[length] = sep_id_;
+    segment_ids[length++] = 1;
+  }
+  for (int i = length; i < max_seq_len; i++)
+  {
+    input_ids[i] = 0;
+    segment_ids[i] = 0;
+  }
+  return length;
+}
+
+void BertTokenizer::encodeBatch(const std::vector<std::string> &texts_a, const std::vector<std::string> &texts_b,
+                                const int max_seq_len, int *input_ids, int *segment_ids, int *sequence_lengths,
+                                int thread_num) const
+{
+  if (!texts_b.empty() && texts_b.size() != texts_a.size())
+    throw std::runtime_error("[FT][ERROR] BertTokenizer: texts_a and texts_b have different sizes");
+  if (max_seq_len < 3)
+    throw std::runtime_error("[FT][ERROR] BertTokenizer: max_seq_len should be >= 3");
+  const int batch_size = (int)texts_a.size();
+  if (thread_num <= 0)
+    thread_num = std::max(1, (int)std::thread::hardware_concurrency());
+  thread_num = std::min(thread_num, batch_size);
+
+  auto encode_range = [&](const int begin, const int end) {
+    static const std::string empty;
+    for (int i = begin; i < end; i++)
+      sequence_lengths[i] = encode(texts_a[i], texts_b.empty() ? empty : texts_b[i], max_seq_len,
+                                   input_ids + (size_t)i * max_seq_len, segment_ids + (size_t)i * max_seq_len);
+  };
+  if (thread_num <= 1)
+  {
+    encode_range(0, batch_size);
+    return;
+  }
+
+  // contiguous slices of the batch, the calling thread takes the first one
+  std::vector<std::thread> threads;
+  const int slice = (batch_size + thread_num - 1) / thread_num;
+  for (int begin = slice; begin < batch_size; begin += slice)
+    threads.emplace_back(encode_range, begin, std::min(begin + slice, batch_size));
+  encode_range(0, std::min(slice, batch_size));
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+} // namespace fastertransformer
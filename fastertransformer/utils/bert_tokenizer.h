@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * WordPiece tokenizer of BERT, the C++ counterpart of FullTokenizer in
+ * bert-quantization/bert-tf-quantization/tokenization.py
+ *
+ * Loads the same vocab.txt and gives the same ids:
+ *   - basic tokenization: the control characters are removed, the CJK ideographs are
+ *     separated, the text is split on the whitespaces and the punctuation and, with
+ *     do_lower_case, lower cased and stripped of its accents (NFD without the nonspacing marks).
+ *   - each word is split into the longest pieces of the vocabulary from the left, the pieces
+ *     after the first one prefixed by "##". The lookup walks a byte trie of the vocabulary,
+ *     one for the first pieces and one for the "##" pieces, so each word is scanned once.
+ *
+ * encodeBatch() writes the input ids and segment ids of [CLS] a [SEP] (b [SEP]) padded to
+ * [batch_size, max_seq_len] with the sequence lengths [batch_size], the inputs of the encoder
+ * and of build_sequence_length_padding_offset_kernelLauncher for the padding removal. The
+ * tokenizer is immutable once loaded, so the batch is split across threads.
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fastertransformer
+{
+
+class BertTokenizer
+{
+public:
+  // Throws a runtime_error if vocab_file cannot be read or has no [CLS], [SEP] or [UNK].
+  BertTokenizer(const std::string &vocab_file, const bool do_lower_case = true, const int max_input_chars_per_word = 100);
+
+  // Word piece ids of text, without [CLS] and [SEP].
+  std::vector<int> tokenize(const std::string &text) const;
+
+  // Writes the max_seq_len input ids and segment ids of [CLS] a [SEP] (b [SEP]), padded with 0,
+  // and returns the sequence length. The longer of a and b is truncated first, as in extract_features.py.
+  int encode(const std::string &text_a, const std::string &text_b, const int max_seq_len,
+             int *input_ids, int *segment_ids) const;
+  // texts_b is empty for single sentences. input_ids and segment_ids are [batch_size, max_seq_len],
+  // sequence_lengths [batch_size]. thread_num <= 0 uses the hardware threads.
+  void encodeBatch(const std::vector<std::string> &texts_a, const std::vector<std::string> &texts_b,
+                   const int max_seq_len, int *input_ids, int *segment_ids, int *sequence_lengths,
+                   int thread_num = 0) const;
+
+  int getVocabSize() const { return vocab_size_; }
+  int getTokenId(const std::string &token) const;
+
+private:
+  void basicTokenize(const std::string &text, std::vector<std::string> &words) const;
+  void wordpiece(const std::string &word, std::vector<int> &ids) const;
+  void insert(int node, const std::string &piece, const int id);
+
+  const bool do_lower_case_;
+  const int max_input_chars_per_word_;
+  int vocab_size_ = 0;
+  std::unordered_map<std::string, int> vocab_;
+  int cls_id_;
+  int sep_id_;
+  int unk_id_;
+
+  // trie nodes, the id of the piece that ends at each node or -1; the edges are keyed by
+  // (node << 8 | byte)
+  std::vector<int> node_ids_;
+  std::unordered_map<uint64_t, int> edges_;
+  int word_root_;
+  int suffix_root_;
+};
+
+} // namespace fastertransformer
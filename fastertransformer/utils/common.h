@@ -60,7 +60,8 @@ enum class AllocatorType
 {
   CUDA,
   TF,
-  TH
+  TH,
+  CPU
 };
 
 #define PRINT_FUNC_NAME_()                                          \
@@ -46,6 +46,10 @@ namespace fastertransformer{
 
 enum class ActivationType{RELU, GELU};
 
+// Output of the last encoder layer: the full sequence, the first ([CLS]) token,
+// or the mean/max over the valid tokens of each sequence
+enum class PoolingType{NONE, CLS, MEAN, MAX};
+
 template<OperationType OpType_>
 class TransformerTraits;
 
@@ -0,0 +1,362 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "fastertransformer/utils/communicator.h"
+#include "fastertransformer/utils/nvtx_utils.h"
+#include "fastertransformer/utils/quantized_comm.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace fastertransformer
+{
+
+size_t getCommDataSize(const CommDataType type)
+{
+  switch (type)
+  {
+  case CommDataType::FLOAT:
+    return sizeof(float);
+  case CommDataType::HALF:
+    return sizeof(half);
+  case CommDataType::INT:
+    return sizeof(int);
+  default:
+    return sizeof(int8_t);
+  }
+}
+
+#ifdef BUILD_GPT
+
+#define NCCL_COMM_CHECK(cmd)                                                                             \
+  do                                                                                                     \
+  {                                                                                                      \
+    ncclResult_t r = cmd;                                                                                \
+    if (r != ncclSuccess)                                                                                \
+      throw std::runtime_error(std::string("[FT][ERROR] NCCL error: ") + ncclGetErrorString(r) + " " + \
+                               __FILE__ + ":" + std::to_string(__LINE__));                             \
+  } while (0)
+
+static ncclDataType_t getNcclDataType(const CommDataType type)
+{
+  switch (type)
+  {
+  case CommDataType::FLOAT:
+    return ncclFloat;
+  case CommDataType::HALF:
+    return ncclHalf;
+  case CommDataType::INT:
+    return ncclInt;
+  default:
+    return ncclInt8;
+  }
+}
+
+NcclCommunicator::NcclCommunicator(ncclComm_t comm) : comm_(comm)
+{
+  NCCL_COMM_CHECK(ncclCommUserRank(comm_, &rank_));
+  NCCL_COMM_CHECK(ncclCommCount(comm_, &world_size_));
+}
+
+void NcclCommunicator::allReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                                    const CommDataType type, cudaStream_t stream)
+{
+  PUSH_RANGE("all2all_reduce_sum", stream)
+  NCCL_COMM_CHECK(ncclAllReduce(send_buf, recv_buf, count, getNcclDataType(type), ncclSum, comm_, stream));
+  POP_RANGE
+}
+
+void NcclCommunicator::allGather(const void *send_buf, void *recv_buf, const size_t count,
+                                 const CommDataType type, cudaStream_t stream)
+{
+  PUSH_RANGE("all2all_gather", stream)
+  NCCL_COMM_CHECK(ncclAllGather(send_buf, recv_buf, count, getNcclDataType(type), comm_, stream));
+  POP_RANGE
+}
+
+void NcclCommunicator::send(const void *send_buf, const size_t count, const CommDataType type, const int peer,
+                            cudaStream_t stream)
+{
+  NCCL_COMM_CHECK(ncclSend(send_buf, count, getNcclDataType(type), peer, comm_, stream));
+}
+
+void NcclCommunicator::recv(void *recv_buf, const size_t count, const CommDataType type, const int peer,
+                            cudaStream_t stream)
+{
+  NCCL_COMM_CHECK(ncclRecv(recv_buf, count, getNcclDataType(type), peer, comm_, stream));
+}
+
+void NcclCommunicator::broadcast(void *buf, const size_t count, const CommDataType type, const int root,
+                                 cudaStream_t stream)
+{
+  PUSH_RANGE("nccl_broadcast", stream)
+  NCCL_COMM_CHECK(ncclBroadcast(buf, buf, count, getNcclDataType(type), root, comm_, stream));
+  POP_RANGE
+}
+
+void NcclCommunicator::quantizedAllReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                                             const CommDataType type, const int block_size, cudaStream_t stream)
+{
+  quantized_all_reduce_sum(send_buf, recv_buf, count, type, block_size, comm_, stream);
+}
+
+void NcclCommunicator::quantizedAllGather(const void *send_buf, void *recv_buf, const size_t count,
+                                          const CommDataType type, const int block_size, cudaStream_t stream)
+{
+  quantized_all_gather(send_buf, recv_buf, count, type, block_size, comm_, stream);
+}
+
+#endif // BUILD_GPT
+
+ThreadCommGroup::ThreadCommGroup(const int world_size) : world_size_(world_size)
+{
+  if (world_size < 1)
+    throw std::runtime_error("[FT][ERROR] ThreadCommGroup: world size " + std::to_string(world_size) + " < 1");
+  slots_[0].resize(world_size);
+  slots_[1].resize(world_size);
+}
+
+std::vector<const void *> ThreadCommGroup::exchange(const int rank, const void *ptr)
+{
+  std::unique_lock<std::mutex> lock(mu_);
+  const size_t generation = generation_;
+  std::vector<const void *> &slots = slots_[generation % 2];
+  slots[rank] = ptr;
+  if (++arrived_ == world_size_)
+  {
+    arrived_ = 0;
+    generation_++;
+    cv_.notify_all();
+  }
+  else
+  {
+    cv_.wait(lock, [&] { return generation_ != generation; });
+  }
+  return slots;
+}
+
+void ThreadCommGroup::post(const int src, const int dst, const void *buf, const size_t size)
+{
+  std::vector<char> message((const char *)buf, (const char *)buf + size);
+  std::lock_guard<std::mutex> lock(mu_);
+  mailboxes_[std::make_pair(src, dst)].push_back(std::move(message));
+  mail_cv_.notify_all();
+}
+
+void ThreadCommGroup::take(const int src, const int dst, void *buf, const size_t size)
+{
+  std::unique_lock<std::mutex> lock(mu_);
+  std::deque<std::vector<char>> &mailbox = mailboxes_[std::make_pair(src, dst)];
+  mail_cv_.wait(lock, [&] { return !mailbox.empty(); });
+  std::vector<char> message = std::move(mailbox.front());
+  mailbox.pop_front();
+  lock.unlock();
+  if (message.size() != size)
+    throw std::runtime_error("[FT][ERROR] ThreadCommunicator: rank " + std::to_string(dst) + " receives " +
+                             std::to_string(size) + " bytes but rank " + std::to_string(src) + " sent " +
+                             std::to_string(message.size()));
+  memcpy(buf, message.data(), size);
+}
+
+// out[i] = sum of in[r][i] over the ranks, in the order of the ranks so that every rank of the
+// group gets the same bits.
+template <typename T, typename Acc>
+static void reduceSum(const std::vector<const void *> &in, const size_t begin, const size_t end, void *out)
+{
+  for (size_t i = begin; i < end; i++)
+  {
+    Acc sum = (Acc)((const T *)in[0])[i];
+    for (size_t r = 1; r < in.size(); r++)
+      sum += (Acc)((const T *)in[r])[i];
+    ((T *)out)[i - begin] = (T)sum;
+  }
+}
+
+template <>
+void reduceSum<half, float>(const std::vector<const void *> &in, const size_t begin, const size_t end, void *out)
+{
+  for (size_t i = begin; i < end; i++)
+  {
+    float sum = __half2float(((const half *)in[0])[i]);
+    for (size_t r = 1; r < in.size(); r++)
+      sum += __half2float(((const half *)in[r])[i]);
+    ((half *)out)[i - begin] = __float2half(sum);
+  }
+}
+
+void ThreadCommunicator::allReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                                      const CommDataType type, cudaStream_t stream)
+{
+  const int world_size = group_.getWorldSize();
+  const size_t size = getCommDataSize(type);
+  if (world_size == 1)
+  {
+    if (send_buf != recv_buf)
+      memcpy(recv_buf, send_buf, count * size);
+    return;
+  }
+
+  PUSH_RANGE("all2all_reduce_sum")
+  // each rank reduces one slice of the buffers, then gathers the slices of the others
+  const std::vector<const void *> sends = group_.exchange(rank_, send_buf);
+  const size_t begin = count * rank_ / world_size;
+  const size_t end = count * (rank_ + 1) / world_size;
+  partial_.resize((end - begin) * size);
+  switch (type)
+  {
+  case CommDataType::FLOAT:
+    reduceSum<float, float>(sends, begin, end, partial_.data());
+    break;
+  case CommDataType::HALF:
+    reduceSum<half, float>(sends, begin, end, partial_.data());
+    break;
+  case CommDataType::INT:
+    reduceSum<int, int>(sends, begin, end, partial_.data());
+    break;
+  default:
+    reduceSum<int8_t, int>(sends, begin, end, partial_.data());
+    break;
+  }
+  // the sends are not read any more once every rank published its slice
+  const std::vector<const void *> partials = group_.exchange(rank_, partial_.data());
+  for (int r = 0; r < world_size; r++)
+  {
+    const size_t r_begin = count * r / world_size;
+    const size_t r_end = count * (r + 1) / world_size;
+    memcpy((char *)recv_buf + r_begin * size, partials[r], (r_end - r_begin) * size);
+  }
+  group_.barrier(rank_);
+  POP_RANGE
+}
+
+void ThreadCommunicator::allGather(const void *send_buf, void *recv_buf, const size_t count,
+                                   const CommDataType type, cudaStream_t stream)
+{
+  const size_t size = getCommDataSize(type);
+  PUSH_RANGE("all2all_gather")
+  const std::vector<const void *> sends = group_.exchange(rank_, send_buf);
+  for (int r = 0; r < group_.getWorldSize(); r++)
+  {
+    char *dst = (char *)recv_buf + r * count * size;
+    if (dst != sends[r])
+      memcpy(dst, sends[r], count * size);
+  }
+  group_.barrier(rank_);
+  POP_RANGE
+}
+
+void ThreadCommunicator::send(const void *send_buf, const size_t count, const CommDataType type, const int peer,
+                              cudaStream_t stream)
+{
+  group_.post(rank_, peer, send_buf, count * getCommDataSize(type));
+}
+
+void ThreadCommunicator::recv(void *recv_buf, const size_t count, const CommDataType type, const int peer,
+                              cudaStream_t stream)
+{
+  PUSH_RANGE("nccl_recv")
+  group_.take(peer, rank_, recv_buf, count * getCommDataSize(type));
+  POP_RANGE
+}
+
+void ThreadCommunicator::broadcast(void *buf, const size_t count, const CommDataType type, const int root,
+                                   cudaStream_t stream)
+{
+  PUSH_RANGE("nccl_broadcast")
+  const std::vector<const void *> bufs = group_.exchange(rank_, buf);
+  if (rank_ != root)
+    memcpy(buf, bufs[root], count * getCommDataSize(type));
+  group_.barrier(rank_);
+  POP_RANGE
+}
+
+// Each rank quantizes its input and sums its slice of the blocks, see reduce_int8_slice; the
+// slices of the sums are quantized again and every rank dequantizes all of them.
+template <typename T>
+void ThreadCommunicator::reduceInt8(const T *send_buf, T *recv_buf, const size_t count, const int block_size)
+{
+  const int world_size = group_.getWorldSize();
+  const QuantizedCommLayout layout(count, block_size, world_size);
+  q_.resize(layout.getPaddedCount());
+  scales_.resize(world_size * layout.slice_blocks);
+  quantize_int8_blocks(send_buf, count, layout.getPaddedCount(), block_size, q_.data(), scales_.data());
+
+  std::vector<const void *> ranks = group_.exchange(rank_, this);
+  std::vector<const int8_t *> q(world_size);
+  std::vector<const float *> scales(world_size);
+  for (int r = 0; r < world_size; r++)
+  {
+    q[r] = ((const ThreadCommunicator *)ranks[r])->q_.data();
+    scales[r] = ((const ThreadCommunicator *)ranks[r])->scales_.data();
+  }
+  sum_q_.resize(layout.getSliceCount());
+  sum_scales_.resize(layout.slice_blocks);
+  reduce_int8_slice(send_buf, q.data(), scales.data(), layout, rank_, sum_q_.data(), sum_scales_.data());
+
+  // the inputs are not read any more once every rank published its sums
+  ranks = group_.exchange(rank_, this);
+  for (int r = 0; r < world_size; r++)
+  {
+    const ThreadCommunicator *other = (const ThreadCommunicator *)ranks[r];
+    dequantize_int8_blocks(other->sum_q_.data(), other->sum_scales_.data(),
+                           layout.getSliceEnd(r) - layout.getSliceBegin(r), block_size, recv_buf + layout.getSliceBegin(r));
+  }
+  group_.barrier(rank_);
+}
+
+template <typename T>
+void ThreadCommunicator::gatherInt8(const T *send_buf, T *recv_buf, const size_t count, const int block_size)
+{
+  const size_t block_num = (count + block_size - 1) / block_size;
+  q_.resize(block_num * block_size);
+  scales_.resize(block_num);
+  quantize_int8_blocks(send_buf, count, block_num * block_size, block_size, q_.data(), scales_.data());
+  const std::vector<const void *> ranks = group_.exchange(rank_, this);
+  for (int r = 0; r < group_.getWorldSize(); r++)
+  {
+    const ThreadCommunicator *other = (const ThreadCommunicator *)ranks[r];
+    dequantize_int8_blocks(other->q_.data(), other->scales_.data(), count, block_size, recv_buf + r * count);
+  }
+  group_.barrier(rank_);
+}
+
+void ThreadCommunicator::quantizedAllReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                                               const CommDataType type, const int block_size, cudaStream_t stream)
+{
+  if (type != CommDataType::FLOAT && type != CommDataType::HALF)
+    throw std::runtime_error("[FT][ERROR] the int8 all-reduce only supports float and half");
+  PUSH_RANGE("all2all_reduce_sum/int8")
+  if (type == CommDataType::FLOAT)
+    reduceInt8((const float *)send_buf, (float *)recv_buf, count, block_size);
+  else
+    reduceInt8((const half *)send_buf, (half *)recv_buf, count, block_size);
+  POP_RANGE
+}
+
+void ThreadCommunicator::quantizedAllGather(const void *send_buf, void *recv_buf, const size_t count,
+                                            const CommDataType type, const int block_size, cudaStream_t stream)
+{
+  if (type != CommDataType::FLOAT && type != CommDataType::HALF)
+    throw std::runtime_error("[FT][ERROR] the int8 all-gather only supports float and half");
+  PUSH_RANGE("all2all_gather/int8")
+  if (type == CommDataType::FLOAT)
+    gatherInt8((const float *)send_buf, (float *)recv_buf, count, block_size);
+  else
+    gatherInt8((const half *)send_buf, (half *)recv_buf, count, block_size);
+  POP_RANGE
+}
+
+} // namespace fastertransformer
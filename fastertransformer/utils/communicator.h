@@ -0,0 +1,258 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Communicators of the tensor and layer parallel groups
+ *
+ * A Communicator is one rank of a group and runs the collectives and the point-to-point
+ * transfers of the parallel GPT:
+ *   NcclCommunicator:   a ncclComm_t, on device buffers and ordered on the given stream.
+ *                       Needs BUILD_GPT.
+ *   ThreadCommunicator: a rank of a ThreadCommGroup, i.e. a thread of this process, on host
+ *                       buffers. The calls return when the data is in place and ignore the
+ *                       stream, so the CPU code of a rank runs the same partitioning as the
+ *                       NCCL one without a GPU.
+ *
+ * Set ParallelParam::comm to route all2all_reduce_sum, all2all_gather, nccl_send, nccl_recv and
+ * nccl_broadcast of that param through a communicator, see utils/nccl_utils.h. The quantized
+ * collectives are the ones of ParallelParam::int8_comm_block_size, see utils/quantized_comm.h.
+ **/
+
+#pragma once
+
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#ifdef BUILD_GPT
+#include "nccl.h"
+#endif
+
+namespace fastertransformer
+{
+
+enum class CommDataType
+{
+  FLOAT,
+  HALF,
+  INT,
+  INT8 // also bool
+};
+
+template <typename T> struct CommDataTypeOf;
+template <> struct CommDataTypeOf<float> { static const CommDataType value = CommDataType::FLOAT; };
+template <> struct CommDataTypeOf<half> { static const CommDataType value = CommDataType::HALF; };
+template <> struct CommDataTypeOf<int> { static const CommDataType value = CommDataType::INT; };
+template <> struct CommDataTypeOf<bool> { static const CommDataType value = CommDataType::INT8; };
+template <> struct CommDataTypeOf<int8_t> { static const CommDataType value = CommDataType::INT8; };
+
+size_t getCommDataSize(const CommDataType type);
+
+class Communicator
+{
+public:
+  virtual ~Communicator() {}
+
+  virtual int getRank() const = 0;
+  virtual int getWorldSize() const = 0;
+
+  // recv[i] = sum of send[i] over the ranks, count elements. send and recv may be the same buffer.
+  virtual void allReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                            const CommDataType type, cudaStream_t stream) = 0;
+  // recv[r * count, (r + 1) * count) = send of rank r. send may be recv + rank * count.
+  virtual void allGather(const void *send_buf, void *recv_buf, const size_t count,
+                         const CommDataType type, cudaStream_t stream) = 0;
+  virtual void send(const void *send_buf, const size_t count, const CommDataType type, const int peer,
+                    cudaStream_t stream) = 0;
+  virtual void recv(void *recv_buf, const size_t count, const CommDataType type, const int peer,
+                    cudaStream_t stream) = 0;
+  virtual void broadcast(void *buf, const size_t count, const CommDataType type, const int root,
+                         cudaStream_t stream) = 0;
+  // allReduceSum and allGather of FLOAT or HALF data sent as int8 blocks of block_size values.
+  virtual void quantizedAllReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                                     const CommDataType type, const int block_size, cudaStream_t stream) = 0;
+  virtual void quantizedAllGather(const void *send_buf, void *recv_buf, const size_t count,
+                                  const CommDataType type, const int block_size, cudaStream_t stream) = 0;
+
+  template <typename T>
+  void allReduceSum(const T *send_buf, T *recv_buf, const size_t count, cudaStream_t stream = 0)
+  {
+    allReduceSum((const void *)send_buf, (void *)recv_buf, count, CommDataTypeOf<T>::value, stream);
+  }
+  template <typename T>
+  void allGather(const T *send_buf, T *recv_buf, const size_t count, cudaStream_t stream = 0)
+  {
+    allGather((const void *)send_buf, (void *)recv_buf, count, CommDataTypeOf<T>::value, stream);
+  }
+  template <typename T>
+  void send(const T *send_buf, const size_t count, const int peer, cudaStream_t stream = 0)
+  {
+    send((const void *)send_buf, count, CommDataTypeOf<T>::value, peer, stream);
+  }
+  template <typename T>
+  void recv(T *recv_buf, const size_t count, const int peer, cudaStream_t stream = 0)
+  {
+    recv((void *)recv_buf, count, CommDataTypeOf<T>::value, peer, stream);
+  }
+  template <typename T>
+  void broadcast(T *buf, const size_t count, const int root, cudaStream_t stream = 0)
+  {
+    broadcast((void *)buf, count, CommDataTypeOf<T>::value, root, stream);
+  }
+  template <typename T>
+  void quantizedAllReduceSum(const T *send_buf, T *recv_buf, const size_t count, const int block_size,
+                             cudaStream_t stream = 0)
+  {
+    quantizedAllReduceSum((const void *)send_buf, (void *)recv_buf, count, CommDataTypeOf<T>::value, block_size, stream);
+  }
+  template <typename T>
+  void quantizedAllGather(const T *send_buf, T *recv_buf, const size_t count, const int block_size,
+                          cudaStream_t stream = 0)
+  {
+    quantizedAllGather((const void *)send_buf, (void *)recv_buf, count, CommDataTypeOf<T>::value, block_size, stream);
+  }
+};
+
+#ifdef BUILD_GPT
+// Does not own the ncclComm_t.
+class NcclCommunicator : public Communicator
+{
+public:
+  explicit NcclCommunicator(ncclComm_t comm);
+
+  int getRank() const override { return rank_; }
+  int getWorldSize() const override { return world_size_; }
+  ncclComm_t getNcclComm() const { return comm_; }
+
+  void allReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                    const CommDataType type, cudaStream_t stream) override;
+  void allGather(const void *send_buf, void *recv_buf, const size_t count,
+                 const CommDataType type, cudaStream_t stream) override;
+  void send(const void *send_buf, const size_t count, const CommDataType type, const int peer,
+            cudaStream_t stream) override;
+  void recv(void *recv_buf, const size_t count, const CommDataType type, const int peer,
+            cudaStream_t stream) override;
+  void broadcast(void *buf, const size_t count, const CommDataType type, const int root,
+                 cudaStream_t stream) override;
+  void quantizedAllReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                             const CommDataType type, const int block_size, cudaStream_t stream) override;
+  void quantizedAllGather(const void *send_buf, void *recv_buf, const size_t count,
+                          const CommDataType type, const int block_size, cudaStream_t stream) override;
+  using Communicator::allReduceSum;
+  using Communicator::allGather;
+  using Communicator::send;
+  using Communicator::recv;
+  using Communicator::broadcast;
+  using Communicator::quantizedAllReduceSum;
+  using Communicator::quantizedAllGather;
+
+private:
+  ncclComm_t comm_;
+  int rank_;
+  int world_size_;
+};
+#endif
+
+/**
+ * The shared state of world_size ThreadCommunicators, one per thread. Every rank of the group
+ * must make the same collective calls in the same order, as with NCCL. A send is buffered and
+ * returns at once; the matching recv waits for it.
+ **/
+class ThreadCommGroup
+{
+public:
+  explicit ThreadCommGroup(const int world_size);
+
+  int getWorldSize() const { return world_size_; }
+
+private:
+  friend class ThreadCommunicator;
+
+  // Publishes the pointer of rank, waits for the other ranks to publish theirs and returns the
+  // pointers of all the ranks. Returning also means every rank finished its previous step.
+  std::vector<const void *> exchange(const int rank, const void *ptr);
+  void barrier(const int rank) { exchange(rank, nullptr); }
+
+  void post(const int src, const int dst, const void *buf, const size_t size);
+  void take(const int src, const int dst, void *buf, const size_t size);
+
+  const int world_size_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  int arrived_ = 0;
+  size_t generation_ = 0;
+  // The pointers of two consecutive exchanges: a rank can start the next exchange while the
+  // slower ones still read the pointers of this one, but not the one after.
+  std::vector<const void *> slots_[2];
+  std::map<std::pair<int, int>, std::deque<std::vector<char>>> mailboxes_;
+  std::condition_variable mail_cv_;
+};
+
+class ThreadCommunicator : public Communicator
+{
+public:
+  // The group must outlive the communicator.
+  ThreadCommunicator(ThreadCommGroup &group, const int rank) : group_(group), rank_(rank) {}
+
+  int getRank() const override { return rank_; }
+  int getWorldSize() const override { return group_.getWorldSize(); }
+
+  void allReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                    const CommDataType type, cudaStream_t stream) override;
+  void allGather(const void *send_buf, void *recv_buf, const size_t count,
+                 const CommDataType type, cudaStream_t stream) override;
+  void send(const void *send_buf, const size_t count, const CommDataType type, const int peer,
+            cudaStream_t stream) override;
+  void recv(void *recv_buf, const size_t count, const CommDataType type, const int peer,
+            cudaStream_t stream) override;
+  void broadcast(void *buf, const size_t count, const CommDataType type, const int root,
+                 cudaStream_t stream) override;
+  void quantizedAllReduceSum(const void *send_buf, void *recv_buf, const size_t count,
+                             const CommDataType type, const int block_size, cudaStream_t stream) override;
+  void quantizedAllGather(const void *send_buf, void *recv_buf, const size_t count,
+                          const CommDataType type, const int block_size, cudaStream_t stream) override;
+  using Communicator::allReduceSum;
+  using Communicator::allGather;
+  using Communicator::send;
+  using Communicator::recv;
+  using Communicator::broadcast;
+  using Communicator::quantizedAllReduceSum;
+  using Communicator::quantizedAllGather;
+
+private:
+  ThreadCommGroup &group_;
+  template <typename T>
+  void reduceInt8(const T *send_buf, T *recv_buf, const size_t count, const int block_size);
+  template <typename T>
+  void gatherInt8(const T *send_buf, T *recv_buf, const size_t count, const int block_size);
+
+  const int rank_;
+  std::vector<char> partial_; // the slice of the reduction computed by this rank
+  // the quantized input of this rank and the quantized slice of the sums, read by the other ranks
+  std::vector<int8_t> q_;
+  std::vector<float> scales_;
+  std::vector<int8_t> sum_q_;
+  std::vector<float> sum_scales_;
+};
+
+} // namespace fastertransformer
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Host side of the layer-wise early exit of the encoder
+ *
+ * An exit head is a dense layer [hidden_units, num_classes] on the [CLS] token.
+ * After a layer with a head, a sample whose softmax confidence reaches the
+ * threshold leaves the batch, and the next layers only run on the survivors.
+ * This file has no CUDA dependency: it holds the CPU reference of the heads
+ * and the bookkeeping that shrinks the compacted (padding removed) batch.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace fastertransformer
+{
+
+// logits[b, c] = sum_i cls_hidden[b, i] * kernel[i, c] + bias[c]
+// kernel is [hidden_units, num_classes] row major, as the other dense weights of the encoder.
+inline void exit_classifier_reference(const float *cls_hidden, const float *kernel, const float *bias,
+                                      const int batch_size, const int hidden_units, const int num_classes,
+                                      float *logits)
+{
+  for (int b = 0; b < batch_size; b++)
+  {
+    for (int c = 0; c < num_classes; c++)
+    {
+      float sum = bias != nullptr ? bias[c] : 0.0f;
+      for (int i = 0; i < hidden_units; i++)
+        sum += cls_hidden[b * hidden_units + i] * kernel[i * num_classes + c];
+      logits[b * num_classes + c] = sum;
+    }
+  }
+}
+
+// Largest softmax probability of the logits, the label is written into label if not null.
+inline float exit_confidence(const float *logits, const int num_classes, int *label = nullptr)
+{
+  const int arg_max = std::max_element(logits, logits + num_classes) - logits;
+  float sum = 0.0f;
+  for (int c = 0; c < num_classes; c++)
+    sum += expf(logits[c] - logits[arg_max]);
+  if (label != nullptr)
+    *label = arg_max;
+  return 1.0f / sum;
+}
+
+// Samples still in the batch, in the order of their rows in the compacted tensor.
+class EarlyExitBatch
+{
+  std::vector<int> ids_;       // index of each active sample in the original batch
+  std::vector<int> seq_lens_;  // valid length of each active sample
+  std::vector<int> row_start_; // first row of each active sample in the compacted tensor
+
+public:
+  void reset(const int *sequence_length, const int batch_size)
+  {
+    ids_.resize(batch_size);
+    seq_lens_.assign(sequence_length, sequence_length + batch_size);
+    row_start_.resize(batch_size);
+    for (int b = 0; b < batch_size; b++)
+    {
+      ids_[b] = b;
+      row_start_[b] = b == 0 ? 0 : row_start_[b - 1] + seq_lens_[b - 1];
+    }
+  }
+
+  int size() const { return ids_.size(); }
+  int getId(const int i) const { return ids_[i]; }
+  const std::vector<int> &getSeqLens() const { return seq_lens_; }
+
+  int getValidWordNum() const
+  {
+    return size() == 0 ? 0 : row_start_.back() + seq_lens_.back();
+  }
+
+  // Prefix sums of the lengths, the trt_seqlen_offset of a batch without padding.
+  void getTrtSeqlenOffset(int *trt_seqlen_offset) const
+  {
+    trt_seqlen_offset[0] = 0;
+    for (int i = 0; i < size(); i++)
+      trt_seqlen_offset[i + 1] = row_start_[i] + seq_lens_[i];
+  }
+
+  // Drop the samples with is_exit[i] set (i indexes the active samples).
+  // gather_offset[r] is set so that row r of the shrunk tensor is row r + gather_offset[r] of the
+  // current one, which is the offset format of remove_sequence_length_padding_kernelLauncher.
+  // Returns the valid word number of the shrunk batch.
+  int shrink(const std::vector<bool> &is_exit, int *gather_offset)
+  {
+    int new_size = 0;
+    int row = 0;
+    for (int i = 0; i < size(); i++)
+    {
+      if (is_exit[i])
+        continue;
+      for (int j = 0; j < seq_lens_[i]; j++)
+        gather_offset[row + j] = row_start_[i] - row;
+      ids_[new_size] = ids_[i];
+      seq_lens_[new_size] = seq_lens_[i];
+      row_start_[new_size] = row;
+      row += seq_lens_[i];
+      new_size++;
+    }
+    ids_.resize(new_size);
+    seq_lens_.resize(new_size);
+    row_start_.resize(new_size);
+    return row;
+  }
+};
+
+} // namespace fastertransformer
@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Length-bucketed dynamic batcher for encoder serving
+ *
+ * Requests are queued per sequence length bucket. A batch is formed from one
+ * bucket when it reaches the token budget (batch_size * bucket_seq_len) or
+ * max_batch_size, or when its oldest request has waited max_wait_us.
+ * The encoder itself is hidden behind IEncoderBatchRunner, so this file has
+ * no CUDA dependency and the queueing logic can run with a stub runner.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fastertransformer
+{
+
+struct EncoderBatcherConfig
+{
+  int max_batch_size = 64;
+  // token budget of a batch, counted on the padded length (batch_size * bucket_seq_len)
+  int max_tokens = 8192;
+  int max_wait_us = 2000;
+  // padded lengths of the buckets, in increasing order.
+  // The default matches the seq lengths of the trt fused multi-head attention kernels.
+  std::vector<int> seq_len_buckets = {64, 96, 128, 256, 384};
+};
+
+template <typename T>
+struct EncoderRequest
+{
+  const T *input = nullptr; // [seq_len, hidden_units]
+  T *output = nullptr;      // [seq_len, hidden_units]
+  int seq_len = 0;
+  std::chrono::steady_clock::time_point arrival_time;
+  std::promise<void> done;
+};
+
+template <typename T>
+struct EncoderBatch
+{
+  int bucket = -1;
+  int seq_len = 0; // padded length of the bucket
+  std::vector<EncoderRequest<T> *> requests;
+};
+
+struct EncoderBatcherStats
+{
+  size_t batch_num = 0;
+  size_t request_num = 0;
+  size_t valid_token_num = 0;
+  size_t padded_token_num = 0;
+};
+
+template <typename T>
+class IEncoderBatchRunner
+{
+public:
+  virtual ~IEncoderBatchRunner() {}
+  // Run the encoder on all requests of the batch, padded to batch.seq_len,
+  // and write the result of each request into its output.
+  virtual void run(const EncoderBatch<T> &batch) = 0;
+};
+
+template <typename T>
+class EncoderBatcher
+{
+  typedef std::chrono::steady_clock Clock;
+
+  const EncoderBatcherConfig config_;
+  IEncoderBatchRunner<T> *runner_;
+
+  std::vector<std::deque<EncoderRequest<T> *>> queues_; // one FIFO per bucket
+  EncoderBatcherStats stats_;
+  bool stop_ = false;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::thread worker_;
+
+public:
+  EncoderBatcher(const EncoderBatcherConfig &config, IEncoderBatchRunner<T> *runner, bool start_worker = true)
+      : config_(config), runner_(runner), queues_(config.seq_len_buckets.size())
+  {
+    if (config_.seq_len_buckets.empty() || !std::is_sorted(config_.seq_len_buckets.begin(), config_.seq_len_buckets.end()))
+      throw std::runtime_error("[FT][ERROR][EncoderBatcher] seq_len_buckets should be non-empty and sorted.");
+    if (config_.max_batch_size <= 0 || config_.max_tokens <= 0)
+      throw std::runtime_error("[FT][ERROR][EncoderBatcher] max_batch_size and max_tokens should be positive.");
+    if (start_worker)
+      worker_ = std::thread(&EncoderBatcher::workerLoop, this);
+  }
+
+  ~EncoderBatcher()
+  {
+    stop();
+  }
+
+  // Queue one request. input and output must stay valid until the returned future is ready.
+  std::future<void> enqueue(const T *input, T *output, const int seq_len)
+  {
+    const int bucket = getBucket(seq_len);
+    if (bucket < 0)
+      throw std::runtime_error("[FT][ERROR][EncoderBatcher] seq_len " + std::to_string(seq_len) +
+                               " is larger than the largest bucket " + std::to_string(config_.seq_len_buckets.back()));
+
+    EncoderRequest<T> *request = new EncoderRequest<T>;
+    request->input = input;
+    request->output = output;
+    request->seq_len = seq_len;
+    request->arrival_time = Clock::now();
+    std::future<void> future = request->done.get_future();
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (stop_)
+      {
+        delete request;
+        throw std::runtime_error("[FT][ERROR][EncoderBatcher] enqueue after stop().");
+      }
+      queues_[bucket].push_back(request);
+    }
+    cv_.notify_one();
+    return future;
+  }
+
+  // Run all pending requests, then join the worker.
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    if (worker_.joinable())
+      worker_.join();
+  }
+
+  // Index of the smallest bucket that fits seq_len, -1 if none does.
+  int getBucket(const int seq_len) const
+  {
+    if (seq_len <= 0)
+      return -1;
+    for (size_t i = 0; i < config_.seq_len_buckets.size(); i++)
+    {
+      if (seq_len <= config_.seq_len_buckets[i])
+        return (int)i;
+    }
+    return -1;
+  }
+
+  // Largest number of requests in one batch of the bucket.
+  int getBatchCapacity(const int bucket) const
+  {
+    const int by_tokens = config_.max_tokens / config_.seq_len_buckets[bucket];
+    return std::max(1, std::min(config_.max_batch_size, by_tokens));
+  }
+
+  // Take the next batch out of the queues.
+  // A bucket is ready when it is full, when its oldest request has waited max_wait_us, or when stopping.
+  // Among the ready buckets, the one with the oldest request goes first.
+  // When no bucket is ready, returns false and sets next_deadline to the earliest time one will be
+  // (Clock::time_point::max() if all queues are empty).
+  // The worker calls it under the lock; it is public so that the policy can be driven by hand.
+  bool formBatch(const Clock::time_point now, EncoderBatch<T> &batch, Clock::time_point &next_deadline)
+  {
+    const auto max_wait = std::chrono::microseconds(config_.max_wait_us);
+    int ready_bucket = -1;
+    next_deadline = Clock::time_point::max();
+    for (size_t i = 0; i < queues_.size(); i++)
+    {
+      if (queues_[i].empty())
+        continue;
+      const Clock::time_point head_arrival = queues_[i].front()->arrival_time;
+      const bool ready = stop_ || (int)queues_[i].size() >= getBatchCapacity(i) || now - head_arrival >= max_wait;
+      if (ready)
+      {
+        if (ready_bucket == -1 || head_arrival < queues_[ready_bucket].front()->arrival_time)
+          ready_bucket = i;
+      }
+      else
+      {
+        next_deadline = std::min(next_deadline, head_arrival + max_wait);
+      }
+    }
+    if (ready_bucket == -1)
+      return false;
+
+    std::deque<EncoderRequest<T> *> &queue = queues_[ready_bucket];
+    const int batch_size = std::min((int)queue.size(), getBatchCapacity(ready_bucket));
+    batch.bucket = ready_bucket;
+    batch.seq_len = config_.seq_len_buckets[ready_bucket];
+    batch.requests.assign(queue.begin(), queue.begin() + batch_size);
+    queue.erase(queue.begin(), queue.begin() + batch_size);
+
+    stats_.batch_num++;
+    stats_.request_num += batch_size;
+    stats_.padded_token_num += (size_t)batch_size * batch.seq_len;
+    for (auto request : batch.requests)
+      stats_.valid_token_num += request->seq_len;
+    return true;
+  }
+
+  // Run the batch on the runner and complete its requests.
+  void runBatch(EncoderBatch<T> &batch)
+  {
+    std::exception_ptr error = nullptr;
+    try
+    {
+      runner_->run(batch);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    for (auto request : batch.requests)
+    {
+      if (error)
+        request->done.set_exception(error);
+      else
+        request->done.set_value();
+      delete request;
+    }
+    batch.requests.clear();
+  }
+
+  size_t getPendingNum()
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    size_t num = 0;
+    for (auto &queue : queues_)
+      num += queue.size();
+    return num;
+  }
+
+  EncoderBatcherStats getStats()
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    return stats_;
+  }
+
+private:
+  void workerLoop()
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (true)
+    {
+      EncoderBatch<T> batch;
+      Clock::time_point next_deadline;
+      if (formBatch(Clock::now(), batch, next_deadline))
+      {
+        lock.unlock();
+        runBatch(batch);
+        lock.lock();
+        continue;
+      }
+      if (stop_)
+        break;
+      if (next_deadline == Clock::time_point::max())
+        cv_.wait(lock);
+      else
+        cv_.wait_until(lock, next_deadline);
+    }
+  }
+};
+
+} // namespace fastertransformer
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Per-request metrics of the generation
+ *
+ * GenerationTrace is filled by DecodingGpt::forward at the host synchronization it already
+ * does every step to check the finished flags, so tracing adds no synchronization in the loop.
+ * With layer parallelism it reads the flags two steps late, and the times of the tokens with them.
+ * GenerationMetrics aggregates the per-request numbers into counters and histograms, which can
+ * be read from C++ or exported in the Prometheus text format.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fastertransformer
+{
+
+typedef std::chrono::steady_clock MetricsClock;
+
+// Host-side timeline of one forward of DecodingGpt.
+struct GenerationTrace
+{
+  int first_step = 0;
+  // step_done_time[0] is the end of the context phase, step_done_time[i] (i > 0) is when the
+  // tokens of step first_step + i - 1 were known on the host. finished_num[i] is the number of
+  // finished sequences at that time.
+  std::vector<MetricsClock::time_point> step_done_time;
+  std::vector<int> finished_num;
+
+  void reset(const int step)
+  {
+    first_step = step;
+    step_done_time.clear();
+    finished_num.clear();
+  }
+};
+
+struct RequestMetrics
+{
+  int batch_size = 0;
+  double queue_ms = 0.0;       // arrival to the start of the forward
+  double context_ms = 0.0;     // start of the forward to the end of the context phase
+  double first_token_ms = 0.0; // arrival to the first generated token
+  std::vector<double> inter_token_ms;
+  double total_ms = 0.0;       // arrival to the last token
+  size_t input_tokens = 0;
+  size_t generated_tokens = 0;
+  double tokens_per_second = 0.0;
+  std::vector<double> batch_occupancy; // unfinished sequences / max batch size, per step
+  double padding_ratio = 0.0;          // padded input tokens / all input tokens
+};
+
+// Prometheus style histogram: cumulative counts for a fixed list of upper bounds.
+class MetricsHistogram
+{
+  std::vector<double> bounds_;
+  std::vector<size_t> counts_; // one more than bounds_ for +Inf
+  size_t count_ = 0;
+  double sum_ = 0.0;
+
+public:
+  explicit MetricsHistogram(const std::vector<double> &bounds = {}) : bounds_(bounds), counts_(bounds.size() + 1, 0) {}
+
+  void add(const double value)
+  {
+    const size_t i = std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin();
+    counts_[i]++;
+    count_++;
+    sum_ += value;
+  }
+
+  size_t getCount() const { return count_; }
+  double getSum() const { return sum_; }
+
+  // Linear interpolation inside the bucket holding the p-th percentile, as histogram_quantile() does.
+  double getPercentile(const double p) const
+  {
+    if (count_ == 0)
+      return 0.0;
+    const double rank = p / 100.0 * count_;
+    size_t seen = 0;
+    for (size_t i = 0; i < counts_.size(); i++)
+    {
+      if (counts_[i] > 0 && seen + counts_[i] >= rank)
+      {
+        if (i == bounds_.size())
+          return bounds_.empty() ? 0.0 : bounds_.back();
+        const double lower = i == 0 ? 0.0 : bounds_[i - 1];
+        return lower + (bounds_[i] - lower) * (rank - seen) / counts_[i];
+      }
+      seen += counts_[i];
+    }
+    return bounds_.empty() ? 0.0 : bounds_.back();
+  }
+
+  void writePrometheus(std::ostream &os, const std::string &name, const std::string &labels) const
+  {
+    size_t cumulative = 0;
+    for (size_t i = 0; i < counts_.size(); i++)
+    {
+      cumulative += counts_[i];
+      os << name << "_bucket{" << labels << (labels.empty() ? "" : ",") << "le=\"";
+      if (i == bounds_.size())
+        os << "+Inf";
+      else
+        os << bounds_[i];
+      os << "\"} " << cumulative << "\n";
+    }
+    const std::string label_set = labels.empty() ? "" : "{" + labels + "}";
+    os << name << "_sum" << label_set << " " << sum_ << "\n";
+    os << name << "_count" << label_set << " " << count_ << "\n";
+  }
+};
+
+class GenerationMetrics
+{
+public:
+  GenerationMetrics(const std::string &prefix = "ft_gpt", const std::string &labels = "")
+      : prefix_(prefix), labels_(labels)
+  {
+    const std::vector<double> ms_bounds = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 60000};
+    const std::vector<double> ratio_bounds = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9, 1.0};
+    histograms_["queue_time_ms"] = MetricsHistogram(ms_bounds);
+    histograms_["context_time_ms"] = MetricsHistogram(ms_bounds);
+    histograms_["time_to_first_token_ms"] = MetricsHistogram(ms_bounds);
+    histograms_["inter_token_latency_ms"] = MetricsHistogram(ms_bounds);
+    histograms_["request_latency_ms"] = MetricsHistogram(ms_bounds);
+    histograms_["tokens_per_second"] = MetricsHistogram({1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000});
+    histograms_["batch_occupancy"] = MetricsHistogram(ratio_bounds);
+    histograms_["padding_ratio"] = MetricsHistogram(ratio_bounds);
+  }
+
+  void record(const RequestMetrics &request)
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    request_num_++;
+    input_token_num_ += request.input_tokens;
+    generated_token_num_ += request.generated_tokens;
+    histograms_["queue_time_ms"].add(request.queue_ms);
+    histograms_["context_time_ms"].add(request.context_ms);
+    histograms_["time_to_first_token_ms"].add(request.first_token_ms);
+    for (double ms : request.inter_token_ms)
+      histograms_["inter_token_latency_ms"].add(ms);
+    histograms_["request_latency_ms"].add(request.total_ms);
+    histograms_["tokens_per_second"].add(request.tokens_per_second);
+    for (double occupancy : request.batch_occupancy)
+      histograms_["batch_occupancy"].add(occupancy);
+    histograms_["padding_ratio"].add(request.padding_ratio);
+    last_request_ = request;
+  }
+
+  RequestMetrics getLastRequest()
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    return last_request_;
+  }
+
+  // Copy of the histogram of a metric, e.g. "time_to_first_token_ms".
+  MetricsHistogram getHistogram(const std::string &name)
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = histograms_.find(name);
+    return it == histograms_.end() ? MetricsHistogram() : it->second;
+  }
+
+  // Prometheus text exposition format.
+  std::string toPrometheus()
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::ostringstream os;
+    writeCounter(os, "requests_total", "Number of forward requests", request_num_);
+    writeCounter(os, "input_tokens_total", "Number of input tokens", input_token_num_);
+    writeCounter(os, "generated_tokens_total", "Number of generated tokens", generated_token_num_);
+    for (auto &it : histograms_)
+    {
+      const std::string name = prefix_ + "_" + it.first;
+      os << "# TYPE " << name << " histogram\n";
+      it.second.writePrometheus(os, name, labels_);
+    }
+    return os.str();
+  }
+
+private:
+  void writeCounter(std::ostream &os, const std::string &name, const std::string &help, const size_t value) const
+  {
+    const std::string full_name = prefix_ + "_" + name;
+    os << "# HELP " << full_name << " " << help << "\n";
+    os << "# TYPE " << full_name << " counter\n";
+    os << full_name << (labels_.empty() ? "" : "{" + labels_ + "}") << " " << value << "\n";
+  }
+
+  const std::string prefix_;
+  const std::string labels_;
+  std::mutex mu_;
+  size_t request_num_ = 0;
+  size_t input_token_num_ = 0;
+  size_t generated_token_num_ = 0;
+  std::map<std::string, MetricsHistogram> histograms_;
+  RequestMetrics last_request_;
+};
+
+inline double elapsed_ms(const MetricsClock::time_point start, const MetricsClock::time_point end)
+{
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+ * Per-request metrics from the trace of one forward.
+ * input_lengths: [batch_size] lengths of the inputs, padded to max_input_len.
+ * The first token is the one of step max_input_len, when no sequence is still reading its input.
+ **/
+inline RequestMetrics compute_request_metrics(const GenerationTrace &trace,
+                                              const MetricsClock::time_point arrival_time,
+                                              const MetricsClock::time_point forward_start_time,
+                                              const int *input_lengths, const int batch_size,
+                                              const int max_input_len, const int max_batch_size)
+{
+  RequestMetrics metrics;
+  metrics.batch_size = batch_size;
+  metrics.queue_ms = elapsed_ms(arrival_time, forward_start_time);
+  for (int i = 0; i < batch_size; i++)
+    metrics.input_tokens += input_lengths[i];
+  const size_t padded_tokens = (size_t)batch_size * max_input_len;
+  metrics.padding_ratio = padded_tokens == 0 ? 0.0 : 1.0 - (double)metrics.input_tokens / padded_tokens;
+  if (trace.step_done_time.empty())
+    return metrics;
+
+  // the first synchronization of the loop happens before any token is sampled, at the end of the context phase
+  metrics.context_ms = elapsed_ms(forward_start_time, trace.step_done_time[0]);
+  for (size_t i = 1; i < trace.step_done_time.size(); i++)
+  {
+    const int step = trace.first_step + (int)i - 1;
+    if (step < max_input_len)
+      continue;
+    // sequences unfinished before this step generated one token
+    const int active = batch_size - trace.finished_num[i - 1];
+    metrics.generated_tokens += active;
+    metrics.batch_occupancy.push_back((double)active / max_batch_size);
+    if (step == max_input_len)
+      metrics.first_token_ms = elapsed_ms(arrival_time, trace.step_done_time[i]);
+    else
+      metrics.inter_token_ms.push_back(elapsed_ms(trace.step_done_time[i - 1], trace.step_done_time[i]));
+  }
+  metrics.total_ms = elapsed_ms(arrival_time, trace.step_done_time.back());
+  const double generation_ms = elapsed_ms(forward_start_time, trace.step_done_time.back());
+  metrics.tokens_per_second = generation_ms > 0.0 ? metrics.generated_tokens * 1000.0 / generation_ms : 0.0;
+  return metrics;
+}
+
+} // namespace fastertransformer
@@ -0,0 +1,461 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "gpt_tokenizer.h"
+#include "unicode_utils.h"
+#include <climits>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace fastertransformer
+{
+
+namespace
+{
+std::string read_file(const std::string &file_name)
+{
+  std::ifstream file(file_name, std::ios::in | std::ios::binary);
+  if (!file.is_open())
+    throw std::runtime_error("[FT][ERROR] cannot open " + file_name);
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  return buffer.str();
+}
+
+// bytes_to_unicode() of gpt_token_encoder.py: the printable bytes map to themselves, the
+// others to 256, 257, ... in order, so that no symbol is a whitespace or control character.
+void get_byte_encoder(uint32_t (&byte_encoder)[256])
+{
+  uint32_t n = 0;
+  for (uint32_t b = 0; b < 256; b++)
+  {
+    const bool printable = (b >= '!' && b <= '~') || (b >= 0xA1 && b <= 0xAC) || (b >= 0xAE && b <= 0xFF);
+    byte_encoder[b] = printable ? b : 256 + n++;
+  }
+}
+
+// The flat {"token": id, ...} object of the vocabulary.
+class VocabParser
+{
+public:
+  VocabParser(const std::string &json, const std::string &file_name) : json_(json), file_name_(file_name) {}
+
+  std::vector<std::pair<std::string, int>> parse()
+  {
+    std::vector<std::pair<std::string, int>> vocab;
+    expect('{');
+    skipSpaces();
+    if (pos_ < json_.size() && json_[pos_] == '}')
+      return vocab;
+    while (true)
+    {
+      std::string token = parseString();
+      expect(':');
+      vocab.emplace_back(token, parseInt());
+      skipSpaces();
+      if (pos_ < json_.size() && json_[pos_] == ',')
+      {
+        pos_++;
+        continue;
+      }
+      expect('}');
+      return vocab;
+    }
+  }
+
+private:
+  void fail(const std::string &what)
+  {
+    throw std::runtime_error("[FT][ERROR] " + file_name_ + ": " + what + " at offset " + std::to_string(pos_));
+  }
+
+  void skipSpaces()
+  {
+    while (pos_ < json_.size() && (json_[pos_] == ' ' || json_[pos_] == '\n' || json_[pos_] == '\r' || json_[pos_] == '\t'))
+      pos_++;
+  }
+
+  void expect(const char c)
+  {
+    skipSpaces();
+    if (pos_ >= json_.size() || json_[pos_] != c)
+      fail(std::string("expected '") + c + "'");
+    pos_++;
+  }
+
+  uint32_t parseHex4()
+  {
+    if (pos_ + 4 > json_.size())
+      fail("truncated \\u escape");
+    uint32_t c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+      const char h = json_[pos_++];
+      c <<= 4;
+      if (h >= '0' && h <= '9')
+        c |= h - '0';
+      else if (h >= 'a' && h <= 'f')
+        c |= h - 'a' + 10;
+      else if (h >= 'A' && h <= 'F')
+        c |= h - 'A' + 10;
+      else
+        fail("invalid \\u escape");
+    }
+    return c;
+  }
+
+  std::string parseString()
+  {
+    expect('"');
+    std::string s;
+    while (true)
+    {
+      if (pos_ >= json_.size())
+        fail("unterminated string");
+      const char c = json_[pos_++];
+      if (c == '"')
+        return s;
+      if (c != '\\')
+      {
+        s += c;
+        continue;
+      }
+      if (pos_ >= json_.size())
+        fail("unterminated string");
+      const char e = json_[pos_++];
+      switch (e)
+      {
+      case '"': s += '"'; break;
+      case '\\': s += '\\'; break;
+      case '/': s += '/'; break;
+      case 'b': s += '\b'; break;
+      case 'f': s += '\f'; break;
+      case 'n': s += '\n'; break;
+      case 'r': s += '\r'; break;
+      case 't': s += '\t'; break;
+      case 'u':
+      {
+        uint32_t code_point = parseHex4();
+        if (code_point >= 0xD800 && code_point <= 0xDBFF && pos_ + 6 <= json_.size() &&
+            json_[pos_] == '\\' && json_[pos_ + 1] == 'u')
+        {
+          pos_ += 2;
+          const uint32_t low = parseHex4();
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+        }
+        append_utf8(s, code_point);
+        break;
+      }
+      default:
+        fail("invalid escape");
+      }
+    }
+  }
+
+  int parseInt()
+  {
+    skipSpaces();
+    const size_t begin = pos_;
+    if (pos_ < json_.size() && json_[pos_] == '-')
+      pos_++;
+    while (pos_ < json_.size() && json_[pos_] >= '0' && json_[pos_] <= '9')
+      pos_++;
+    if (pos_ == begin)
+      fail("expected an id");
+    return std::stoi(json_.substr(begin, pos_ - begin));
+  }
+
+  const std::string &json_;
+  const std::string &file_name_;
+  size_t pos_ = 0;
+};
+
+enum class CharClass
+{
+  LETTER,
+  NUMBER,
+  WHITESPACE,
+  OTHER
+};
+
+CharClass get_char_class(const uint32_t c)
+{
+  if (is_unicode_letter(c))
+    return CharClass::LETTER;
+  if (is_unicode_number(c))
+    return CharClass::NUMBER;
+  if (is_unicode_whitespace(c))
+    return CharClass::WHITESPACE;
+  return CharClass::OTHER;
+}
+} // namespace
+
+GptTokenizer::GptTokenizer(const std::string &vocab_file, const std::string &merges_file, const size_t cache_size)
+    : cache_size_(cache_size)
+{
+  uint32_t byte_encoder[256];
+  get_byte_encoder(byte_encoder);
+  std::unordered_map<uint32_t, int> byte_decoder;
+  for (int b = 0; b < 256; b++)
+    byte_decoder[byte_encoder[b]] = b;
+
+  const std::string json = read_file(vocab_file);
+  const std::vector<std::pair<std::string, int>> vocab = VocabParser(json, vocab_file).parse();
+  for (const auto &token : vocab)
+  {
+    if (token.second < 0)
+      throw std::runtime_error("[FT][ERROR] " + vocab_file + ": negative id of " + token.first);
+    if ((size_t)token.second >= id_bytes_.size())
+      id_bytes_.resize(token.second + 1);
+    const int symbol = getSymbol(token.first);
+    symbol_vocab_ids_[symbol] = token.second;
+
+    std::string bytes;
+    size_t i = 0;
+    while (i < token.first.size())
+    {
+      size_t length;
+      const uint32_t c = decode_utf8(token.first.data() + i, token.first.size() - i, length);
+      auto it = byte_decoder.find(c);
+      if (it == byte_decoder.end())
+        throw std::runtime_error("[FT][ERROR] " + vocab_file + ": " + token.first + " is not byte-level BPE");
+      bytes += (char)it->second;
+      i += length;
+    }
+    id_bytes_[token.second] = bytes;
+  }
+
+  for (int b = 0; b < 256; b++)
+  {
+    std::string symbol;
+    append_utf8(symbol, byte_encoder[b]);
+    byte_symbols_[b] = getSymbol(symbol);
+  }
+
+  // "#version: ..." and then one "first second" per line, by rank
+  std::istringstream merges(read_file(merges_file));
+  std::string line;
+  int rank = 0;
+  while (std::getline(merges, line))
+  {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line.compare(0, 8, "#version") == 0)
+      continue;
+    const size_t space = line.find(' ');
+    if (space == std::string::npos || space == 0 || space + 1 == line.size())
+      throw std::runtime_error("[FT][ERROR] " + merges_file + ": invalid merge '" + line + "'");
+    const std::string first = line.substr(0, space);
+    const std::string second = line.substr(space + 1);
+    const uint64_t key = ((uint64_t)getSymbol(first) << 32) | (uint32_t)getSymbol(second);
+    const int merged = getSymbol(first + second);
+    // as dict(zip(bpe_merges, range(len(bpe_merges)))), a repeated pair keeps its last rank
+    merges_[key] = MergeRule{rank, merged};
+    rank++;
+  }
+}
+
+int GptTokenizer::getSymbol(const std::string &symbol)
+{
+  auto it = symbol_ids_.find(symbol);
+  if (it != symbol_ids_.end())
+    return it->second;
+  const int id = (int)symbol_vocab_ids_.size();
+  symbol_ids_[symbol] = id;
+  symbol_vocab_ids_.push_back(-1);
+  return id;
+}
+
+std::vector<std::pair<size_t, size_t>> GptTokenizer::pretokenize(const std::string &text)
+{
+  std::vector<uint32_t> chars;
+  std::vector<size_t> offsets;
+  size_t i = 0;
+  while (i < text.size())
+  {
+    size_t length;
+    chars.push_back(decode_utf8(text.data() + i, text.size() - i, length));
+    offsets.push_back(i);
+    i += length;
+  }
+  offsets.push_back(text.size());
+  const size_t n = chars.size();
+
+  std::vector<std::pair<size_t, size_t>> pieces;
+  size_t begin = 0;
+  while (begin < n)
+  {
+    const uint32_t c = chars[begin];
+    size_t end = begin;
+
+    // 's|'t|'re|'ve|'m|'ll|'d
+    if (c == '\'' && begin + 1 < n)
+    {
+      const uint32_t c1 = chars[begin + 1];
+      const uint32_t c2 = begin + 2 < n ? chars[begin + 2] : 0;
+      if (c1 == 's' || c1 == 't' || c1 == 'm' || c1 == 'd')
+        end = begin + 2;
+      else if ((c1 == 'r' && c2 == 'e') || (c1 == 'v' && c2 == 'e') || (c1 == 'l' && c2 == 'l'))
+        end = begin + 3;
+    }
+
+    if (end == begin)
+    {
+      // ' ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+', the optional space is only a literal space
+      const size_t first = c == ' ' && begin + 1 < n ? begin + 1 : begin;
+      const CharClass char_class = get_char_class(chars[first]);
+      if (char_class != CharClass::WHITESPACE)
+      {
+        end = first;
+        while (end < n && get_char_class(chars[end]) == char_class)
+          end++;
+      }
+      else
+      {
+        // '\s+(?!\S)|\s+': a run of spaces leaves its last one to the next piece, unless it
+        // ends the text or is a single space
+        end = begin;
+        while (end < n && is_unicode_whitespace(chars[end]))
+          end++;
+        if (end < n && end - begin > 1)
+          end--;
+      }
+    }
+    pieces.push_back(std::make_pair(offsets[begin], offsets[end]));
+    begin = end;
+  }
+  return pieces;
+}
+
+void GptTokenizer::bpe(const char *piece, const size_t size, std::vector<int> &ids) const
+{
+  std::vector<int> word(size);
+  for (size_t i = 0; i < size; i++)
+    word[i] = byte_symbols_[(unsigned char)piece[i]];
+
+  std::vector<int> merged_word;
+  while (word.size() > 1)
+  {
+    int best_rank = INT_MAX;
+    uint64_t best_key = 0;
+    int best_merged = -1;
+    for (size_t i = 0; i + 1 < word.size(); i++)
+    {
+      const uint64_t key = ((uint64_t)word[i] << 32) | (uint32_t)word[i + 1];
+      auto it = merges_.find(key);
+      if (it != merges_.end() && it->second.rank < best_rank)
+      {
+        best_rank = it->second.rank;
+        best_key = key;
+        best_merged = it->second.merged;
+      }
+    }
+    if (best_merged < 0)
+      break;
+
+    // merge every occurrence of the pair, from the left
+    const int first = (int)(best_key >> 32);
+    const int second = (int)(uint32_t)best_key;
+    merged_word.clear();
+    size_t i = 0;
+    while (i < word.size())
+    {
+      if (i + 1 < word.size() && word[i] == first && word[i + 1] == second)
+      {
+        merged_word.push_back(best_merged);
+        i += 2;
+      }
+      else
+      {
+        merged_word.push_back(word[i]);
+        i++;
+      }
+    }
+    word.swap(merged_word);
+  }
+
+  for (const int symbol : word)
+  {
+    const int id = symbol_vocab_ids_[symbol];
+    if (id < 0)
+    {
+      for (const auto &it : symbol_ids_)
+      {
+        if (it.second == symbol)
+          throw std::runtime_error("[FT][ERROR] GptTokenizer: " + it.first + " is not in the vocabulary");
+      }
+    }
+    ids.push_back(id);
+  }
+}
+
+std::vector<int> GptTokenizer::encode(const std::string &text)
+{
+  std::vector<int> ids;
+  for (const auto &span : pretokenize(text))
+  {
+    const char *piece = text.data() + span.first;
+    const size_t size = span.second - span.first;
+    if (cache_size_ == 0)
+    {
+      bpe(piece, size, ids);
+      continue;
+    }
+
+    std::string key(piece, size);
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex_);
+      auto it = cache_map_.find(key);
+      if (it != cache_map_.end())
+      {
+        cache_list_.splice(cache_list_.begin(), cache_list_, it->second);
+        ids.insert(ids.end(), it->second->second.begin(), it->second->second.end());
+        cache_hit_num_++;
+        continue;
+      }
+      cache_miss_num_++;
+    }
+
+    const size_t old_size = ids.size();
+    bpe(piece, size, ids);
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (cache_map_.find(key) != cache_map_.end())
+      continue;
+    cache_list_.emplace_front(key, std::vector<int>(ids.begin() + old_size, ids.end()));
+    cache_map_[key] = cache_list_.begin();
+    if (cache_list_.size() > cache_size_)
+    {
+      cache_map_.erase(cache_list_.back().first);
+      cache_list_.pop_back();
+    }
+  }
+  return ids;
+}
+
+std::string GptTokenizer::decode(const int *ids, const size_t size) const
+{
+  std::string bytes;
+  for (size_t i = 0; i < size; i++)
+  {
+    if (ids[i] >= 0 && (size_t)ids[i] < id_bytes_.size())
+      bytes += id_bytes_[ids[i]];
+  }
+  return sanitize_utf8(bytes);
+}
+
+} // namespace fastertransformer
@@ -0,0 +1,88 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Byte-level BPE tokenizer of GPT-2, the C++ counterpart of sample/pytorch/utils/gpt_token_encoder.py
+ *
+ * Loads the same gpt2-vocab.json and gpt2-merges.txt and gives the same ids:
+ *   - the text is split by a hand-written scanner equivalent to the pattern
+ *       's|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+ *   - each piece is mapped byte by byte to its symbol, and the pair of adjacent symbols with
+ *     the lowest merge rank is merged until no pair has a rank. The ranks are in a hash table
+ *     keyed by the pair of symbol ids.
+ *   - the ids of the pieces are kept in an LRU cache of cache_size pieces (0 disables it),
+ *     shared by the threads that use the tokenizer.
+ **/
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fastertransformer
+{
+
+class GptTokenizer
+{
+public:
+  // Throws a runtime_error if a file cannot be read or parsed.
+  GptTokenizer(const std::string &vocab_file, const std::string &merges_file, const size_t cache_size = 65536);
+
+  std::vector<int> encode(const std::string &text);
+  // Ids outside of the vocabulary, such as the padding of the embedding table, are skipped.
+  std::string decode(const int *ids, const size_t size) const;
+  std::string decode(const std::vector<int> &ids) const { return decode(ids.data(), ids.size()); }
+
+  // Byte offsets [begin, end) of the pieces of text, before the BPE.
+  static std::vector<std::pair<size_t, size_t>> pretokenize(const std::string &text);
+
+  int getVocabSize() const { return (int)id_bytes_.size(); }
+  size_t getCacheHitNum() const { return cache_hit_num_; }
+  size_t getCacheMissNum() const { return cache_miss_num_; }
+
+private:
+  struct MergeRule
+  {
+    int rank;
+    int merged;
+  };
+
+  int getSymbol(const std::string &symbol);
+  void bpe(const char *piece, const size_t size, std::vector<int> &ids) const;
+
+  // the symbols are the vocabulary tokens and the pieces of the merges, in byte-encoded form
+  std::unordered_map<std::string, int> symbol_ids_;
+  std::vector<int> symbol_vocab_ids_;
+  std::unordered_map<uint64_t, MergeRule> merges_;
+  int byte_symbols_[256];
+  // the bytes of each vocabulary id
+  std::vector<std::string> id_bytes_;
+
+  typedef std::list<std::pair<std::string, std::vector<int>>> CacheList;
+  const size_t cache_size_;
+  CacheList cache_list_;
+  std::unordered_map<std::string, CacheList::iterator> cache_map_;
+  std::mutex cache_mutex_;
+  size_t cache_hit_num_ = 0;
+  size_t cache_miss_num_ = 0;
+};
+
+} // namespace fastertransformer
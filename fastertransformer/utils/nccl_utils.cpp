@@ -15,6 +15,15 @@
 */
 
 #include "fastertransformer/utils/nccl_utils.h"
+#include "fastertransformer/utils/nvtx_utils.h"
+#include "fastertransformer/utils/quantized_comm.h"
+
+// The collectives of float and half data go as int8 blocks when the param asks for it.
+template<typename T>
+static bool is_int8_comm(const ParallelParam& param)
+{
+    return param.int8_comm_block_size > 0 && (std::is_same<T, float>::value || std::is_same<T, half>::value);
+}
 
 #ifdef BUILD_GPT
 
@@ -37,6 +46,20 @@ void all2all_reduce_sum(const T* send_buf, T* recv_buf, const int data_size,
                         ParallelParam param, cudaStream_t stream)
 {
     if(param.world_size <= 1) return;
+    if(is_int8_comm<T>(param))
+    {
+        if(param.comm != nullptr)
+            param.comm->quantizedAllReduceSum(send_buf, recv_buf, data_size, param.int8_comm_block_size, stream);
+        else
+            fastertransformer::quantized_all_reduce_sum(send_buf, recv_buf, data_size, fastertransformer::CommDataTypeOf<T>::value,
+                                                        param.int8_comm_block_size, param.nccl_comm, stream);
+        return;
+    }
+    if(param.comm != nullptr)
+    {
+        param.comm->allReduceSum(send_buf, recv_buf, data_size, stream);
+        return;
+    }
 
     ncclDataType_t nccl_data_type;
     if(std::is_same<T, float>::value) nccl_data_type = ncclFloat;
@@ -47,10 +70,12 @@ void all2all_reduce_sum(const T* send_buf, T* recv_buf, const int data_size,
         printf("[ERROR] reduce sum only support float, half and int. \n");
         exit(-1);
     }
+    PUSH_RANGE("all2all_reduce_sum", stream)
     NCCLCHECK(ncclGroupStart());
     NCCLCHECK(ncclAllReduce((const void*)send_buf, (void*)recv_buf, data_size, 
                              nccl_data_type, ncclSum, param.nccl_comm, stream));
     NCCLCHECK(ncclGroupEnd());
+    POP_RANGE
 
 #ifndef NDEBUG
     cudaDeviceSynchronize();
@@ -63,6 +88,21 @@ void all2all_gather(const T* send_buf, T* recv_buf, const int data_size,
                     ParallelParam param, cudaStream_t stream)
 {
     if(param.world_size <= 1) return;
+    if(is_int8_comm<T>(param))
+    {
+        if(param.comm != nullptr)
+            param.comm->quantizedAllGather(send_buf + param.rank * data_size, recv_buf, data_size, param.int8_comm_block_size, stream);
+        else
+            fastertransformer::quantized_all_gather(send_buf + param.rank * data_size, recv_buf, data_size,
+                                                    fastertransformer::CommDataTypeOf<T>::value, param.int8_comm_block_size,
+                                                    param.nccl_comm, stream);
+        return;
+    }
+    if(param.comm != nullptr)
+    {
+        param.comm->allGather(send_buf + param.rank * data_size, recv_buf, data_size, stream);
+        return;
+    }
     ncclDataType_t nccl_data_type;
     if(std::is_same<T, float>::value) nccl_data_type = ncclFloat;
     else if(std::is_same<T, half>::value) nccl_data_type = ncclHalf;
@@ -72,9 +112,11 @@ void all2all_gather(const T* send_buf, T* recv_buf, const int data_size,
         printf("[ERROR] all2all gather only support float, half and int. \n");
         exit(-1);
     }
+    PUSH_RANGE("all2all_gather", stream)
     NCCLCHECK(ncclGroupStart());
     NCCLCHECK(ncclAllGather(send_buf + param.rank * data_size, recv_buf, data_size, nccl_data_type, param.nccl_comm, stream));
     NCCLCHECK(ncclGroupEnd());
+    POP_RANGE
 
 #ifndef NDEBUG
     cudaDeviceSynchronize();
@@ -82,6 +124,16 @@ void all2all_gather(const T* send_buf, T* recv_buf, const int data_size,
 #endif
 }
 
+void nccl_group_start()
+{
+    NCCLCHECK(ncclGroupStart());
+}
+
+void nccl_group_end()
+{
+    NCCLCHECK(ncclGroupEnd());
+}
+
 template<typename T>
 void nccl_send(const T* send_buf, const int data_size, const int peer, ncclComm_t comm, cudaStream_t stream)
 {
@@ -101,7 +153,6 @@ void nccl_send(const T* send_buf, const int data_size, const int peer, ncclComm_
     cudaDeviceSynchronize();
     CUDACHECK(cudaGetLastError());
 #endif
-    cudaDeviceSynchronize();
 }
 
 template void nccl_send(const float* send_buf, const int data_size, const int peer, ncclComm_t comm, cudaStream_t stream);
@@ -128,7 +179,6 @@ void nccl_recv(T* recv_buf, const int data_size, const int peer, ncclComm_t comm
     cudaDeviceSynchronize();
     CUDACHECK(cudaGetLastError());
 #endif
-    cudaDeviceSynchronize();
 }
 
 template void nccl_recv(float* recv_buf, const int data_size, const int peer, ncclComm_t comm, cudaStream_t stream);
@@ -139,6 +189,11 @@ template void nccl_recv(bool* recv_buf, const int data_size, const int peer, ncc
 template<typename T>
 void nccl_broadcast(T* buff, const int data_size, const int root, ParallelParam param, cudaStream_t stream)
 {
+    if(param.comm != nullptr)
+    {
+        param.comm->broadcast(buff, data_size, root, stream);
+        return;
+    }
     ncclDataType_t nccl_data_type;
     if(std::is_same<T, bool>::value) nccl_data_type = ncclInt8;
     else
@@ -146,28 +201,88 @@ void nccl_broadcast(T* buff, const int data_size, const int root, ParallelParam
         printf("[ERROR] nccl_broadcast only support bool. \n");
         exit(-1);
     }
+    PUSH_RANGE("nccl_broadcast", stream)
     NCCLCHECK(ncclBcast(buff, data_size, nccl_data_type, root, param.nccl_comm, stream));
+    POP_RANGE
     
 #ifndef NDEBUG
     cudaDeviceSynchronize();
     CUDACHECK(cudaGetLastError());
 #endif
-    cudaDeviceSynchronize();
 }
 
 template void nccl_broadcast(bool* buff, const int data_size, const int root, ParallelParam param, cudaStream_t stream);
 
+template<typename T>
+void nccl_send(const T* send_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream)
+{
+    if(param.comm != nullptr) param.comm->send(send_buf, data_size, peer, stream);
+    else nccl_send(send_buf, data_size, peer, param.nccl_comm, stream);
+}
+
+template<typename T>
+void nccl_recv(T* recv_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream)
+{
+    if(param.comm != nullptr) param.comm->recv(recv_buf, data_size, peer, stream);
+    else nccl_recv(recv_buf, data_size, peer, param.nccl_comm, stream);
+}
+
 #else // BUILD_GPT
 
+// Without NCCL, only the params with a communicator exchange data.
 template<typename T>
 void all2all_reduce_sum(const T* send_buf, T* recv_buf, const int data_size,
-                        ParallelParam param, cudaStream_t stream){}
+                        ParallelParam param, cudaStream_t stream)
+{
+    if(param.world_size <= 1 || param.comm == nullptr) return;
+    if(is_int8_comm<T>(param))
+        param.comm->quantizedAllReduceSum(send_buf, recv_buf, data_size, param.int8_comm_block_size, stream);
+    else
+        param.comm->allReduceSum(send_buf, recv_buf, data_size, stream);
+}
 
 template<typename T>
 void all2all_gather(const T* send_buf, T* recv_buf, const int data_size,
-                    ParallelParam param, cudaStream_t stream){}
+                    ParallelParam param, cudaStream_t stream)
+{
+    if(param.world_size <= 1 || param.comm == nullptr) return;
+    if(is_int8_comm<T>(param))
+        param.comm->quantizedAllGather(send_buf + param.rank * data_size, recv_buf, data_size, param.int8_comm_block_size, stream);
+    else
+        param.comm->allGather(send_buf + param.rank * data_size, recv_buf, data_size, stream);
+}
+
+template<typename T>
+void nccl_broadcast(T* buff, const int data_size, const int root, ParallelParam param, cudaStream_t stream)
+{
+    if(param.comm != nullptr) param.comm->broadcast(buff, data_size, root, stream);
+}
+
+template<typename T>
+void nccl_send(const T* send_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream)
+{
+    if(param.comm != nullptr) param.comm->send(send_buf, data_size, peer, stream);
+}
+
+template<typename T>
+void nccl_recv(T* recv_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream)
+{
+    if(param.comm != nullptr) param.comm->recv(recv_buf, data_size, peer, stream);
+}
+
+template void nccl_broadcast(bool* buff, const int data_size, const int root, ParallelParam param, cudaStream_t stream);
 #endif
 
+template void nccl_send(const float* send_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+template void nccl_send(const half* send_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+template void nccl_send(const int* send_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+template void nccl_send(const bool* send_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+
+template void nccl_recv(float* recv_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+template void nccl_recv(half* recv_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+template void nccl_recv(int* recv_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+template void nccl_recv(bool* recv_buf, const int data_size, const int peer, ParallelParam param, cudaStream_t stream);
+
 template void all2all_reduce_sum(const float* send_buf, float* recv_buf, const int data_size,
                                  ParallelParam param, cudaStream_t stream);
 
@@ -179,3 +294,9 @@ template void all2all_gather(const float* send_buf, float* recv_buf, const int d
 
 template void all2all_gather(const half* send_buf, half* recv_buf, const int data_size,
                              ParallelParam param, cudaStream_t stream);
+
+template void all2all_reduce_sum(const int* send_buf, int* recv_buf, const int data_size,
+                                 ParallelParam param, cudaStream_t stream);
+
+template void all2all_gather(const int* send_buf, int* recv_buf, const int data_size,
+                             ParallelParam param, cudaStream_t stream);
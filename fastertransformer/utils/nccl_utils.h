@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <iostream>
 #include "fastertransformer/utils/common.h"
+#include "fastertransformer/utils/communicator.h"
 
 #ifdef BUILD_GPT
 #include "nccl.h"
@@ -34,13 +35,21 @@ struct ParallelParam : AbstractParam
 #ifdef BUILD_GPT
     ncclComm_t nccl_comm;
 #endif
-
+    // When set, the functions below that take this param use it instead of nccl_comm,
+    // e.g. a ThreadCommunicator for ranks that are threads of one process.
+    fastertransformer::Communicator* comm{nullptr};
+    // > 0: all2all_reduce_sum and all2all_gather of float and half data send int8 blocks of that
+    // many values with a scale each, see utils/quantized_comm.h. 0 sends the values.
+    int int8_comm_block_size{0};
 };
 
 struct TensorParallelParam : public ParallelParam
 {
   int local_head_num_{0};
   int local_hidden_units_{0};
+  // Splits the rows of the GEMM before each all-reduce of the decoder in that many chunks, so
+  // the all-reduce of a chunk overlaps the GEMM of the next one. 1 runs them one after the other.
+  int all_reduce_chunk_num{1};
 };
 
 struct LayerParallelParam : public ParallelParam
@@ -108,6 +117,11 @@ void nccl_broadcast(T* buff, const int data_size, const int root, ParallelParam
 
 #ifdef BUILD_GPT
 
+// The sends and receives between them progress together, e.g. a send that waits for its peer does
+// not hold back a receive from another one.
+void nccl_group_start();
+void nccl_group_end();
+
 template<typename T>
 void nccl_recv(T* recv_buf, const int data_size, const int peer, ncclComm_t comm, cudaStream_t stream);
 
@@ -16,23 +16,15 @@
 
 #pragma once
 
-#ifdef USE_NVTX
+#include "fastertransformer/utils/profiler.h"
 
-#include "nvToolsExt.h"
+// PUSH_RANGE(name) or PUSH_RANGE(name, stream). The stream is the one the work of the range
+// runs on; the CUDA_EVENT mode records its events there. See utils/profiler.h for the modes.
+// With USE_NVTX, the default mode is NVTX. FT_TIMELINE=<file> also writes the ranges as a
+// Chrome trace, see utils/timeline.h.
+#define PUSH_RANGE(...) fastertransformer::profilerPush(__VA_ARGS__);
 
-#define PUSH_RANGE(name) {\
-    cudaDeviceSynchronize();\
-    nvtxRangePush(name);\
-}
+// A range repeated with an index, e.g. the layers, which the timeline shows as "name index".
+#define PUSH_RANGE_INDEX(name, stream, index) fastertransformer::profilerPush(name, stream, index);
 
-#define POP_RANGE {\
-    cudaDeviceSynchronize();\
-    nvtxRangePop();\
-}
-
-#else
-
-#define PUSH_RANGE(name)
-#define POP_RANGE
-
-#endif
+#define POP_RANGE fastertransformer::profilerPop();
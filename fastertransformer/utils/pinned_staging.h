@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * Ring of pinned host buffers for the host-to-device copies of the requests
+ *
+ * A copy from pageable memory is staged by the driver and blocks the host, a copy from
+ * pinned memory is a DMA that runs asynchronously on the stream. The slots are allocated
+ * once; a slot is only reused when the copies that read it in its last round are done,
+ * which an event recorded on the stream tells, so the host can pack the next request while
+ * the previous one is still copied.
+ **/
+
+#pragma once
+
+#include "fastertransformer/utils/common.h"
+#include <cuda_runtime.h>
+#include <vector>
+
+namespace fastertransformer
+{
+
+class PinnedStagingRing
+{
+public:
+  PinnedStagingRing(const size_t slot_bytes, const int slot_num = 2) : slot_bytes_(slot_bytes)
+  {
+    slots_.resize(slot_num);
+    events_.resize(slot_num);
+    for (int i = 0; i < slot_num; i++)
+    {
+      check_cuda_error(cudaHostAlloc(&slots_[i], slot_bytes_, cudaHostAllocPortable));
+      check_cuda_error(cudaEventCreateWithFlags(&events_[i], cudaEventDisableTiming));
+    }
+  }
+
+  ~PinnedStagingRing()
+  {
+    for (size_t i = 0; i < slots_.size(); i++)
+    {
+      cudaEventSynchronize(events_[i]);
+      cudaEventDestroy(events_[i]);
+      cudaFreeHost(slots_[i]);
+    }
+  }
+
+  PinnedStagingRing(const PinnedStagingRing &) = delete;
+  PinnedStagingRing &operator=(const PinnedStagingRing &) = delete;
+
+  // The next slot, once the copies of its last round are done.
+  void *acquire()
+  {
+    current_ = (current_ + 1) % (int)slots_.size();
+    check_cuda_error(cudaEventSynchronize(events_[current_]));
+    return slots_[current_];
+  }
+
+  // Marks the end of the copies that read the acquired slot, after they are enqueued on stream.
+  void release(cudaStream_t stream)
+  {
+    check_cuda_error(cudaEventRecord(events_[current_], stream));
+  }
+
+  size_t getSlotBytes() const { return slot_bytes_; }
+
+private:
+  const size_t slot_bytes_;
+  std::vector<void *> slots_;
+  std::vector<cudaEvent_t> events_;
+  int current_ = -1;
+};
+
+} // namespace fastertransformer
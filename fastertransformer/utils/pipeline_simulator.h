@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Timeline model of the layer parallel generation of DecodingGpt
+ *
+ * simulate_pipeline() predicts how long the stages of the pipeline idle, the bubbles, for a
+ * layer_para_size and a layer_para_batch_size (the micro-batch), from the cost of the work of one
+ * stage. It builds the dependencies of every operation of the generation loop, without running
+ * anything, for one of two schedules:
+ *   BLOCKING:  one stream per stage, as DecodingGpt::forward ran before the pipeline schedule. The
+ *              transfers are on the compute stream, a receive waits for the sender, each transfer
+ *              is followed by a device synchronization, the last stage broadcasts the finished
+ *              flags of each micro-batch and every stage checks them on the host each step.
+ *   PIPELINED: the schedule of DecodingGpt::forward. A group on the comm stream sends the previous
+ *              micro-batch and receives the next one, the flags go with the data, and the host
+ *              checks the flags of two steps before.
+ * With layer_para_size 1 there are no transfers and forward() runs the BLOCKING schedule. The
+ * tensor parallel ranks of a stage are one rank for the model.
+ *
+ * A send ends transfer_us after it starts, as NCCL sends the tokens, the flags and the hidden states
+ * of a micro-batch of usual size into the buffer of the receiver (NCCL_BUFFSIZE) without waiting
+ * for it; a receive ends transfer_us after both sides started. A schedule that deadlocks has a
+ * cyclic dependency, or a transfer without a peer, which simulate_pipeline() reports with a
+ * runtime_error.
+ **/
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fastertransformer
+{
+
+enum class PipelineSchedule
+{
+  BLOCKING,
+  PIPELINED
+};
+
+// Costs in microseconds. A micro-batch of b sequences takes stage_us + stage_row_us * b in the
+// layers of a stage, and sampling_us + sampling_row_us * b more in the last one (logits GEMM and
+// sampling). They can be read from the "layer" and "After Transformer" ranges of the profiler.
+struct PipelineCosts
+{
+  double stage_us = 1000.0;
+  double stage_row_us = 10.0;
+  double sampling_us = 200.0;
+  double sampling_row_us = 5.0;
+  double transfer_us = 20.0; // a transfer between two stages, once both are ready
+  double sync_us = 20.0;     // for the host to launch work again after it waited for the device
+};
+
+struct PipelineSimulation
+{
+  double total_us = 0.0;        // until the first stage has the tokens of the last step
+  double busy_us = 0.0;         // compute, summed over the stages
+  double bubble_fraction = 0.0; // 1 - busy_us / (layer_para_size * total_us)
+};
+
+/**
+ * Operations with a duration, which start after the start or the end of others and may end after
+ * them too, e.g. a transfer ends after both sides started. The times are the longest paths.
+ **/
+class PipelineGraph
+{
+public:
+  enum Time
+  {
+    START,
+    END
+  };
+
+  int add(const double duration)
+  {
+    nodes_.push_back(Node());
+    nodes_.back().duration = duration;
+    return (int)nodes_.size() - 1;
+  }
+
+  // node starts delay after the time of dep
+  void startAfter(const int node, const int dep, const Time time, const double delay = 0.0)
+  {
+    nodes_[node].deps[START].push_back(Dep{dep * 2 + time, delay});
+  }
+
+  // node ends delay after the time of dep, or its duration after its start if that is later
+  void endAfter(const int node, const int dep, const Time time, const double delay = 0.0)
+  {
+    nodes_[node].deps[END].push_back(Dep{dep * 2 + time, delay});
+  }
+
+  double getTime(const int node, const Time time) const { return times_[node * 2 + time]; }
+
+  // Throws if the dependencies are cyclic.
+  void evaluate()
+  {
+    const size_t var_num = nodes_.size() * 2;
+    times_.assign(var_num, 0.0);
+    std::vector<char> state(var_num, 0); // 0: new, 1: on the stack, 2: done
+    std::vector<std::pair<int, size_t>> stack;
+    for (size_t root = 0; root < var_num; root++)
+    {
+      if (state[root] != 0)
+        continue;
+      stack.push_back(std::make_pair((int)root, (size_t)0));
+      state[root] = 1;
+      while (!stack.empty())
+      {
+        const int var = stack.back().first;
+        const std::vector<Dep> &deps = getDeps(var);
+        // the start of a node comes before its end
+        const size_t dep_num = deps.size() + (var % 2 == END ? 1 : 0);
+        size_t &next = stack.back().second;
+        if (next < dep_num)
+        {
+          const int dep = next < deps.size() ? deps[next].var : var - 1;
+          next++;
+          if (state[dep] == 1)
+            throw std::runtime_error("[FT][ERROR] PipelineGraph: the dependencies are cyclic, the schedule deadlocks");
+          if (state[dep] == 0)
+          {
+            state[dep] = 1;
+            stack.push_back(std::make_pair(dep, (size_t)0));
+          }
+          continue;
+        }
+        double time = 0.0;
+        for (const Dep &dep : deps)
+          time = std::max(time, times_[dep.var] + dep.delay);
+        if (var % 2 == END)
+          time = std::max(time, times_[var - 1] + nodes_[var / 2].duration);
+        times_[var] = time;
+        state[var] = 2;
+        stack.pop_back();
+      }
+    }
+  }
+
+private:
+  struct Dep
+  {
+    int var; // node * 2 + time
+    double delay;
+  };
+  struct Node
+  {
+    double duration = 0.0;
+    std::vector<Dep> deps[2];
+  };
+
+  const std::vector<Dep> &getDeps(const int var) const { return nodes_[var / 2].deps[var % 2]; }
+
+  std::vector<Node> nodes_;
+  std::vector<double> times_;
+};
+
+/**
+ * Predicts step_num generation steps of batch_size sequences in micro-batches of local_batch_size
+ * on layer_para_size stages. Throws if local_batch_size does not divide batch_size.
+ **/
+inline PipelineSimulation simulate_pipeline(const PipelineSchedule schedule, const int layer_para_size, const int batch_size,
+                                            const int local_batch_size, const int step_num, const PipelineCosts &costs)
+{
+  if (layer_para_size < 1 || batch_size < 1 || local_batch_size < 1 || step_num < 1 || batch_size % local_batch_size != 0)
+    throw std::runtime_error("[FT][ERROR] simulate_pipeline: layer_para_size " + std::to_string(layer_para_size) +
+                             ", batch_size " + std::to_string(batch_size) + ", local_batch_size " +
+                             std::to_string(local_batch_size) + ", step_num " + std::to_string(step_num));
+  typedef PipelineGraph G;
+  const int L = layer_para_size;
+  const int last = L - 1;
+  const int n = batch_size / local_batch_size; // micro-batches per step
+  const int slot_num = step_num * n;
+  const double transfer = costs.transfer_us;
+  const double stage = costs.stage_us + costs.stage_row_us * local_batch_size;
+  const double sampling = costs.sampling_us + costs.sampling_row_us * local_batch_size;
+
+  G graph;
+  std::vector<std::vector<int>> computes(L, std::vector<int>(slot_num));
+  // the sending and the receiving nodes of each transfer: the receivers end after the sender started
+  std::map<std::vector<int>, std::pair<std::vector<int>, std::vector<int>>> transfers;
+  auto send = [&](const std::vector<int> &key, const int node) { transfers[key].first.push_back(node); };
+  auto recv = [&](const std::vector<int> &key, const int node) { transfers[key].second.push_back(node); };
+  enum
+  {
+    ACTIVATION,
+    TOKEN,
+    BROADCAST
+  };
+
+  for (int r = 0; r < L; r++)
+  {
+    if (schedule == PipelineSchedule::BLOCKING)
+    {
+      // the operations of the stage one after the other, as enqueued on its stream
+      int prev = -1;
+      double prev_delay = 0.0;
+      auto append = [&](const double duration, const double delay_after) {
+        const int node = graph.add(duration);
+        if (prev >= 0)
+          graph.startAfter(node, prev, G::END, prev_delay);
+        prev = node;
+        prev_delay = delay_after;
+        return node;
+      };
+      for (int k = 0; k < slot_num; k++)
+      {
+        const int step = k / n, ite = k % n;
+        if (r == 0 && L > 1 && step > 0)
+          recv({TOKEN, step - 1, ite}, append(transfer, costs.sync_us));
+        if (r < last && step > 0)
+          recv({BROADCAST, step - 1, ite}, append(transfer, costs.sync_us));
+        if (ite == 0)
+          prev_delay += costs.sync_us; // the host checks the flags
+        if (r > 0)
+          recv({ACTIVATION, r, step, ite}, append(transfer, costs.sync_us));
+        computes[r][k] = append(r == last ? stage + sampling : stage, 0.0);
+        if (r < last)
+          send({ACTIVATION, r + 1, step, ite}, append(transfer, costs.sync_us));
+        if (r == last && L > 1)
+        {
+          send({TOKEN, step, ite}, append(transfer, costs.sync_us));
+          if (step < step_num - 1)
+            send({BROADCAST, step, ite}, append(transfer, costs.sync_us));
+        }
+      }
+      if (r == 0 && L > 1)
+        for (int ite = 0; ite < n; ite++)
+          recv({TOKEN, step_num - 1, ite}, append(transfer, costs.sync_us));
+    }
+    else
+    {
+      // group k sends the output of slot k - 1 and receives the input of slot k, the last group
+      // sends the last output and, on the first stage, receives the tokens of the last step
+      std::vector<int> groups(slot_num + 1);
+      for (int k = 0; k <= slot_num; k++)
+      {
+        const int step = k / n, ite = k % n;
+        const bool has_send = k > 0 && L > 1;
+        const bool has_recv = k < slot_num && (r > 0 || step > 0) && L > 1;
+        groups[k] = graph.add(has_send || has_recv || (k == slot_num && r == 0 && L > 1) ? transfer : 0.0);
+        if (k > 0)
+        {
+          graph.startAfter(groups[k], groups[k - 1], G::END);
+          graph.startAfter(groups[k], computes[r][k - 1], G::END);
+        }
+        if (has_send)
+        {
+          const int sent = k - 1;
+          if (r < last)
+            send({ACTIVATION, r + 1, sent / n, sent % n}, groups[k]);
+          else
+            send({TOKEN, sent / n, sent % n}, groups[k]);
+        }
+        if (has_recv)
+        {
+          if (r > 0)
+            recv({ACTIVATION, r, step, ite}, groups[k]);
+          else
+            recv({TOKEN, step - 1, ite}, groups[k]);
+        }
+        if (k == slot_num && r == 0 && L > 1)
+          for (int i = 0; i < n; i++)
+            recv({TOKEN, step_num - 1, i}, groups[k]);
+        if (k == slot_num)
+          break;
+
+        computes[r][k] = graph.add(r == last ? stage + sampling : stage);
+        graph.startAfter(computes[r][k], groups[k], G::END);
+        if (k > 0)
+          graph.startAfter(computes[r][k], computes[r][k - 1], G::END);
+        if (ite == 0 && step >= 2)
+        {
+          // the host enqueues the step once the step before the previous one is done
+          const int checked = computes[r][(step - 1) * n - 1];
+          graph.startAfter(groups[k], checked, G::END, costs.sync_us);
+          graph.startAfter(computes[r][k], checked, G::END, costs.sync_us);
+        }
+      }
+    }
+  }
+
+  for (const auto &entry : transfers)
+  {
+    const std::vector<int> &senders = entry.second.first;
+    const std::vector<int> &receivers = entry.second.second;
+    if (senders.size() != 1 || receivers.size() != (size_t)(entry.first[0] == BROADCAST ? L - 1 : 1))
+      throw std::runtime_error("[FT][ERROR] simulate_pipeline: a transfer has " + std::to_string(senders.size()) +
+                               " senders and " + std::to_string(receivers.size()) + " receivers, the schedule deadlocks");
+    for (const int node : receivers)
+      graph.endAfter(node, senders[0], G::START, transfer);
+  }
+  graph.evaluate();
+
+  PipelineSimulation simulation;
+  for (int r = 0; r < L; r++)
+    for (int k = 0; k < slot_num; k++)
+    {
+      simulation.total_us = std::max(simulation.total_us, graph.getTime(computes[r][k], G::END));
+      simulation.busy_us += graph.getTime(computes[r][k], G::END) - graph.getTime(computes[r][k], G::START);
+    }
+  // the transfers after the last compute, e.g. the tokens of the last step
+  for (const auto &entry : transfers)
+    for (const int node : entry.second.second)
+      simulation.total_us = std::max(simulation.total_us, graph.getTime(node, G::END));
+  simulation.bubble_fraction = 1.0 - simulation.busy_us / (L * simulation.total_us);
+  return simulation;
+}
+
+} // namespace fastertransformer
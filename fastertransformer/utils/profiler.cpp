@@ -0,0 +1,324 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+#ifdef USE_NVTX
+#include "nvToolsExt.h"
+#endif
+
+namespace fastertransformer
+{
+
+namespace
+{
+// Ranges are not timed while this many event pairs of the thread are still pending.
+const size_t MAX_PENDING_EVENTS = 4096;
+
+int getBucket(const double us)
+{
+  const int bucket = (int)(4.0 * log2(1.0 + std::max(us, 0.0)));
+  return std::min(bucket, RangeHistogram::BUCKET_NUM - 1);
+}
+} // namespace
+
+void RangeHistogram::add(const double us)
+{
+  min_ = count_ == 0 ? us : std::min(min_, us);
+  max_ = std::max(max_, us);
+  count_++;
+  sum_ += us;
+  buckets_[getBucket(us)]++;
+}
+
+void RangeHistogram::merge(const RangeHistogram &other)
+{
+  if (other.count_ == 0)
+    return;
+  min_ = count_ == 0 ? other.min_ : std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  count_ += other.count_;
+  sum_ += other.sum_;
+  for (int i = 0; i < BUCKET_NUM; i++)
+    buckets_[i] += other.buckets_[i];
+}
+
+double RangeHistogram::getPercentile(const double p) const
+{
+  if (count_ == 0)
+    return 0.0;
+  const size_t rank = std::max((size_t)1, (size_t)ceil(p / 100.0 * count_));
+  size_t seen = 0;
+  for (int i = 0; i < BUCKET_NUM; i++)
+  {
+    seen += buckets_[i];
+    if (seen >= rank)
+      return std::min(max_, exp2((i + 1) / 4.0) - 1.0);
+  }
+  return max_;
+}
+
+struct Profiler::ThreadState
+{
+  struct Range
+  {
+    const char *name;
+    bool timed;
+    cudaStream_t stream;
+    cudaEvent_t start_event;
+    std::chrono::steady_clock::time_point start_time;
+  };
+  struct PendingRange
+  {
+    const char *name;
+    cudaEvent_t start_event;
+    cudaEvent_t stop_event;
+  };
+
+  std::mutex mu;
+  std::vector<Range> stack;
+  std::deque<PendingRange> pending;
+  std::vector<cudaEvent_t> free_events;
+  size_t outermost_num = 0;
+  bool sampled = false;
+
+  cudaEvent_t getEvent()
+  {
+    if (free_events.empty())
+    {
+      cudaEvent_t event;
+      cudaEventCreate(&event);
+      return event;
+    }
+    cudaEvent_t event = free_events.back();
+    free_events.pop_back();
+    return event;
+  }
+};
+
+namespace
+{
+thread_local std::shared_ptr<Profiler::ThreadState> tls_state;
+} // namespace
+
+Profiler &Profiler::instance()
+{
+  static Profiler profiler;
+  return profiler;
+}
+
+Profiler::Profiler()
+{
+#ifdef USE_NVTX
+  ProfilerMode mode = ProfilerMode::NVTX;
+#else
+  ProfilerMode mode = ProfilerMode::OFF;
+#endif
+  const char *env_mode = getenv("FT_PROFILER");
+  if (env_mode != nullptr)
+  {
+    if (strcmp(env_mode, "nvtx") == 0)
+      mode = ProfilerMode::NVTX;
+    else if (strcmp(env_mode, "event") == 0)
+      mode = ProfilerMode::CUDA_EVENT;
+    else if (strcmp(env_mode, "cpu") == 0)
+      mode = ProfilerMode::CPU;
+    else if (strcmp(env_mode, "off") == 0)
+      mode = ProfilerMode::OFF;
+    else
+      printf("[WARNING][Profiler] unknown FT_PROFILER %s, should be one of off, nvtx, event, cpu\n", env_mode);
+  }
+  const char *env_interval = getenv("FT_PROFILER_SAMPLE_INTERVAL");
+  mode_ = (int)mode;
+  sample_interval_ = env_interval != nullptr ? std::max(1, atoi(env_interval)) : 1;
+  dropped_num_ = 0;
+}
+
+void Profiler::setMode(const ProfilerMode mode)
+{
+  mode_ = (int)mode;
+}
+
+void Profiler::setSampleInterval(const int sample_interval)
+{
+  sample_interval_ = std::max(1, sample_interval);
+}
+
+void Profiler::push(const char *name, cudaStream_t stream)
+{
+  const ProfilerMode mode = getMode();
+  if (mode == ProfilerMode::NVTX)
+  {
+#ifdef USE_NVTX
+    nvtxRangePush(name);
+#endif
+    return;
+  }
+
+  if (tls_state == nullptr)
+  {
+    tls_state = std::make_shared<ThreadState>();
+    std::lock_guard<std::mutex> lock(mu_);
+    thread_states_.push_back(tls_state);
+  }
+  ThreadState &state = *tls_state;
+  std::lock_guard<std::mutex> lock(state.mu);
+  if (state.stack.empty())
+  {
+    state.sampled = state.outermost_num++ % sample_interval_.load() == 0;
+    if (mode == ProfilerMode::CUDA_EVENT)
+      collect(state, false);
+  }
+
+  ThreadState::Range range;
+  range.name = name;
+  range.timed = state.sampled;
+  range.stream = stream;
+  range.start_event = nullptr;
+  if (range.timed && mode == ProfilerMode::CUDA_EVENT)
+  {
+    if (state.pending.size() >= MAX_PENDING_EVENTS)
+    {
+      range.timed = false;
+      dropped_num_++;
+    }
+    else
+    {
+      range.start_event = state.getEvent();
+      cudaEventRecord(range.start_event, stream);
+    }
+  }
+  else if (range.timed && mode == ProfilerMode::CPU)
+  {
+    range.start_time = std::chrono::steady_clock::now();
+  }
+  state.stack.push_back(range);
+}
+
+void Profiler::pop()
+{
+  if (getMode() == ProfilerMode::NVTX)
+  {
+#ifdef USE_NVTX
+    nvtxRangePop();
+#endif
+    return;
+  }
+  if (tls_state == nullptr)
+    return;
+  ThreadState &state = *tls_state;
+  std::unique_lock<std::mutex> lock(state.mu);
+  if (state.stack.empty())
+    return;
+  const ThreadState::Range range = state.stack.back();
+  state.stack.pop_back();
+  if (!range.timed)
+    return;
+
+  if (range.start_event != nullptr)
+  {
+    ThreadState::PendingRange pending;
+    pending.name = range.name;
+    pending.start_event = range.start_event;
+    pending.stop_event = state.getEvent();
+    cudaEventRecord(pending.stop_event, range.stream);
+    state.pending.push_back(pending);
+  }
+  else
+  {
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - range.start_time).count();
+    lock.unlock();
+    record(range.name, us);
+  }
+}
+
+void Profiler::collect(ThreadState &state, const bool wait)
+{
+  // keep the order of recording: stop at the first range that is not done yet
+  while (!state.pending.empty())
+  {
+    ThreadState::PendingRange &pending = state.pending.front();
+    if (wait)
+      cudaEventSynchronize(pending.stop_event);
+    else if (cudaEventQuery(pending.stop_event) != cudaSuccess)
+      break;
+    float ms = 0.0f;
+    if (cudaEventElapsedTime(&ms, pending.start_event, pending.stop_event) == cudaSuccess)
+      record(pending.name, ms * 1000.0);
+    state.free_events.push_back(pending.start_event);
+    state.free_events.push_back(pending.stop_event);
+    state.pending.pop_front();
+  }
+}
+
+void Profiler::record(const std::string &name, const double us)
+{
+  std::lock_guard<std::mutex> lock(mu_);
+  histograms_[name].add(us);
+}
+
+void Profiler::flush()
+{
+  std::vector<std::shared_ptr<ThreadState>> states;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    states = thread_states_;
+  }
+  for (auto &state : states)
+  {
+    std::lock_guard<std::mutex> lock(state->mu);
+    collect(*state, true);
+  }
+}
+
+std::map<std::string, RangeHistogram> Profiler::getHistograms()
+{
+  std::lock_guard<std::mutex> lock(mu_);
+  return histograms_;
+}
+
+void Profiler::reset()
+{
+  flush();
+  std::lock_guard<std::mutex> lock(mu_);
+  histograms_.clear();
+  dropped_num_ = 0;
+}
+
+void Profiler::printReport(FILE *file)
+{
+  flush();
+  std::map<std::string, RangeHistogram> histograms = getHistograms();
+  fprintf(file, "[INFO][Profiler] %-48s %10s %10s %10s %10s %10s %10s\n",
+          "range", "count", "mean(ms)", "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+  for (auto &it : histograms)
+  {
+    const RangeHistogram &h = it.second;
+    fprintf(file, "[INFO][Profiler] %-48s %10zu %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+            it.first.c_str(), h.getCount(), h.getMean() / 1000.0, h.getPercentile(50) / 1000.0,
+            h.getPercentile(90) / 1000.0, h.getPercentile(99) / 1000.0, h.getMax() / 1000.0);
+  }
+  if (getDroppedNum() > 0)
+    fprintf(file, "[WARNING][Profiler] %zu ranges were dropped because too many events were pending\n", getDroppedNum());
+}
+
+} // namespace fastertransformer
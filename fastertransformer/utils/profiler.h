@@ -0,0 +1,144 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Range profiler behind PUSH_RANGE / POP_RANGE
+ *
+ * Modes:
+ *   OFF        - the ranges cost one atomic load.
+ *   NVTX       - nvtx ranges for nsys, without synchronization (needs USE_NVTX).
+ *   CUDA_EVENT - a pair of cudaEvents recorded on the stream of the range. The elapsed
+ *                times are collected later, when the events are done, so the host never waits.
+ *   CPU        - std::chrono::steady_clock on the host, for host-side code.
+ * The times of each range name are aggregated into a histogram.
+ * With a sample interval N, only one out of N outermost ranges (with the ranges nested
+ * in it) is timed, which keeps the CUDA_EVENT mode cheap enough to stay on in production.
+ *
+ * The mode and the interval can also be set with the FT_PROFILER (off, nvtx, event, cpu)
+ * and FT_PROFILER_SAMPLE_INTERVAL environment variables.
+ *
+ * The ranges also go to the Timeline (utils/timeline.h) when it is enabled.
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cuda_runtime.h>
+#include "fastertransformer/utils/timeline.h"
+
+namespace fastertransformer
+{
+
+enum class ProfilerMode
+{
+  OFF,
+  NVTX,
+  CUDA_EVENT,
+  CPU
+};
+
+// Histogram of the durations of one range, with 4 log-spaced buckets per power of 2 microseconds.
+class RangeHistogram
+{
+public:
+  static const int BUCKET_NUM = 128;
+
+  void add(const double us);
+  void merge(const RangeHistogram &other);
+  // Upper bound of the bucket holding the p-th percentile (0 < p <= 100), in microseconds.
+  double getPercentile(const double p) const;
+
+  size_t getCount() const { return count_; }
+  double getMean() const { return count_ == 0 ? 0.0 : sum_ / count_; }
+  double getMin() const { return count_ == 0 ? 0.0 : min_; }
+  double getMax() const { return max_; }
+
+private:
+  size_t count_ = 0;
+  double sum_ = 0.0;
+  double min_ = 0.0;
+  double max_ = 0.0;
+  size_t buckets_[BUCKET_NUM] = {0};
+};
+
+class Profiler
+{
+public:
+  static Profiler &instance();
+
+  bool isOff() const { return mode_.load(std::memory_order_relaxed) == (int)ProfilerMode::OFF; }
+  ProfilerMode getMode() const { return (ProfilerMode)mode_.load(std::memory_order_relaxed); }
+  // Change the mode when no range is open.
+  void setMode(const ProfilerMode mode);
+  // Time one out of sample_interval outermost ranges, per thread.
+  void setSampleInterval(const int sample_interval);
+
+  void push(const char *name, cudaStream_t stream);
+  void pop();
+
+  // Wait for the pending events of all threads and add them to the histograms.
+  void flush();
+  std::map<std::string, RangeHistogram> getHistograms();
+  // Number of ranges dropped because too many events were pending.
+  size_t getDroppedNum() const { return dropped_num_.load(); }
+  void reset();
+  // flush() and print count, mean, p50, p90, p99 and max of each range, in ms.
+  void printReport(FILE *file = stdout);
+
+  struct ThreadState;
+
+private:
+  Profiler();
+
+  void record(const std::string &name, const double us);
+  void collect(ThreadState &state, const bool wait);
+
+  std::atomic<int> mode_;
+  std::atomic<int> sample_interval_;
+  std::atomic<size_t> dropped_num_;
+  std::mutex mu_;
+  std::map<std::string, RangeHistogram> histograms_;
+  std::vector<std::shared_ptr<ThreadState>> thread_states_;
+};
+
+// index >= 0 tells the timeline spans of the same name apart, e.g. the layers.
+inline void profilerPush(const char *name, cudaStream_t stream = 0, const int index = -1)
+{
+  Profiler &profiler = Profiler::instance();
+  if (!profiler.isOff())
+    profiler.push(name, stream);
+  Timeline &timeline = Timeline::instance();
+  if (timeline.isEnabled())
+    timeline.push(name, stream, index);
+}
+
+inline void profilerPop()
+{
+  Profiler &profiler = Profiler::instance();
+  if (!profiler.isOff())
+    profiler.pop();
+  Timeline &timeline = Timeline::instance();
+  if (timeline.isEnabled())
+    timeline.pop();
+}
+
+} // namespace fastertransformer
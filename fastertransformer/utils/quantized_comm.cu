@@ -0,0 +1,277 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "fastertransformer/utils/quantized_comm.h"
+#include "fastertransformer/utils/common.h"
+#include "fastertransformer/utils/nccl_utils.h"
+#include "fastertransformer/utils/nvtx_utils.h"
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+namespace fastertransformer
+{
+
+static const int QUANTIZED_COMM_THREADS = 256;
+
+__inline__ __device__ float quantized_comm_warp_max(float val)
+{
+  for (int mask = 16; mask > 0; mask >>= 1)
+    val = fmaxf(val, __shfl_xor_sync(0xffffffff, val, mask, 32));
+  return val;
+}
+
+// The maximum of val over the thread block, in all its threads.
+__inline__ __device__ float quantized_comm_block_max(float val)
+{
+  __shared__ float shared[32];
+  __shared__ float result;
+  const int lane = threadIdx.x & 0x1f;
+  const int wid = threadIdx.x >> 5;
+  val = quantized_comm_warp_max(val);
+  if (lane == 0)
+    shared[wid] = val;
+  __syncthreads();
+  if (wid == 0)
+  {
+    val = threadIdx.x < (blockDim.x >> 5) ? shared[lane] : 0.0f;
+    val = quantized_comm_warp_max(val);
+    if (lane == 0)
+      result = val;
+  }
+  __syncthreads();
+  return result;
+}
+
+// One thread block per quantization block, see quantize_int8_blocks.
+template <typename T>
+__global__ void quantize_int8_blocks_kernel(const T *x, const size_t count, const int block_size, int8_t *q, float *scales)
+{
+  const size_t begin = (size_t)blockIdx.x * block_size;
+  float amax = 0.0f;
+  for (int j = threadIdx.x; j < block_size; j += blockDim.x)
+    if (begin + j < count)
+      amax = fmaxf(amax, fabsf(quantized_comm_to_float(x[begin + j])));
+  amax = quantized_comm_block_max(amax);
+  const float inv_scale = get_int8_inv_scale(amax);
+  if (threadIdx.x == 0)
+    scales[blockIdx.x] = get_int8_scale(amax);
+  for (int j = threadIdx.x; j < block_size; j += blockDim.x)
+    q[begin + j] = begin + j < count ? quantize_int8(quantized_comm_to_float(x[begin + j]), inv_scale) : 0;
+}
+
+// blockIdx.y dequantizes the count values at q + blockIdx.y * q_stride into x + blockIdx.y * count.
+template <typename T>
+__global__ void dequantize_int8_blocks_kernel(const int8_t *q, const size_t q_stride, const float *scales,
+                                              const size_t scale_stride, const size_t count, const int block_size, T *x)
+{
+  q += blockIdx.y * q_stride;
+  scales += blockIdx.y * scale_stride;
+  x += blockIdx.y * count;
+  for (size_t i = (size_t)blockIdx.x * blockDim.x + threadIdx.x; i < count; i += (size_t)gridDim.x * blockDim.x)
+    quantized_comm_from_float((float)q[i] * scales[i / block_size], &x[i]);
+}
+
+// The sum of value j of the slice of rank, in rank order; slice_q holds the slice of each rank.
+template <typename T>
+__device__ float quantized_comm_slice_sum(const T *x, const int8_t *slice_q, const float *slice_scales,
+                                          const QuantizedCommLayout &layout, const int rank, const size_t j)
+{
+  const size_t slice_count = layout.getSliceCount();
+  float sum = 0.0f;
+  for (int r = 0; r < layout.world_size; r++)
+    sum += r == rank ? quantized_comm_to_float(x[rank * slice_count + j]) :
+                       (float)slice_q[r * slice_count + j] * slice_scales[r * layout.slice_blocks + j / layout.block_size];
+  return sum;
+}
+
+// One thread block per quantization block of the slice of rank, see reduce_int8_slice.
+template <typename T>
+__global__ void reduce_int8_slice_kernel(const T *x, const int8_t *slice_q, const float *slice_scales,
+                                         const QuantizedCommLayout layout, const int rank, int8_t *out_q, float *out_scales)
+{
+  const size_t begin = (size_t)blockIdx.x * layout.block_size;
+  const size_t end = layout.getSliceEnd(rank) - layout.getSliceBegin(rank);
+  float amax = 0.0f;
+  for (int j = threadIdx.x; j < layout.block_size; j += blockDim.x)
+    if (begin + j < end)
+      amax = fmaxf(amax, fabsf(quantized_comm_slice_sum(x, slice_q, slice_scales, layout, rank, begin + j)));
+  amax = quantized_comm_block_max(amax);
+  const float inv_scale = get_int8_inv_scale(amax);
+  if (threadIdx.x == 0)
+    out_scales[blockIdx.x] = get_int8_scale(amax);
+  for (int j = threadIdx.x; j < layout.block_size; j += blockDim.x)
+    out_q[begin + j] = begin + j < end ?
+        quantize_int8(quantized_comm_slice_sum(x, slice_q, slice_scales, layout, rank, begin + j), inv_scale) : 0;
+}
+
+#ifdef BUILD_GPT
+
+// Two pairs of int8 and scale buffers.
+struct QuantizedCommBuffers
+{
+  int8_t *q[2] = {nullptr, nullptr};
+  float *scales[2] = {nullptr, nullptr};
+  size_t q_size = 0;
+  size_t scale_size = 0;
+};
+
+typedef std::map<std::pair<ncclComm_t, cudaStream_t>, QuantizedCommBuffers> QuantizedCommBufferMap;
+
+static std::mutex quantized_comm_buffers_mu;
+
+static QuantizedCommBufferMap &get_quantized_comm_buffer_map()
+{
+  static QuantizedCommBufferMap buffers;
+  return buffers;
+}
+
+static QuantizedCommBuffers &get_quantized_comm_buffers(ncclComm_t comm, cudaStream_t stream, const size_t q_size,
+                                                        const size_t scale_size)
+{
+  std::lock_guard<std::mutex> lock(quantized_comm_buffers_mu);
+  QuantizedCommBuffers &b = get_quantized_comm_buffer_map()[std::make_pair(comm, stream)];
+  if (b.q_size < q_size || b.scale_size < scale_size)
+  {
+    // the calls before on the stream may still read them
+    check_cuda_error(cudaStreamSynchronize(stream));
+    b.q_size = std::max(b.q_size, q_size);
+    b.scale_size = std::max(b.scale_size, scale_size);
+    for (int i = 0; i < 2; i++)
+    {
+      check_cuda_error(cudaFree(b.q[i]));
+      check_cuda_error(cudaFree(b.scales[i]));
+      check_cuda_error(cudaMalloc(&b.q[i], b.q_size));
+      check_cuda_error(cudaMalloc(&b.scales[i], sizeof(float) * b.scale_size));
+    }
+  }
+  return b;
+}
+
+void release_quantized_comm_buffers(ncclComm_t comm)
+{
+  std::lock_guard<std::mutex> lock(quantized_comm_buffers_mu);
+  QuantizedCommBufferMap &buffers = get_quantized_comm_buffer_map();
+  for (auto it = buffers.begin(); it != buffers.end();)
+  {
+    if (it->first.first != comm)
+    {
+      ++it;
+      continue;
+    }
+    // the calls before on the stream may still read them
+    check_cuda_error(cudaStreamSynchronize(it->first.second));
+    for (int i = 0; i < 2; i++)
+    {
+      check_cuda_error(cudaFree(it->second.q[i]));
+      check_cuda_error(cudaFree(it->second.scales[i]));
+    }
+    it = buffers.erase(it);
+  }
+}
+
+template <typename T>
+static void quantized_all_reduce_sum(const T *send_buf, T *recv_buf, const size_t count, const int block_size,
+                                     ncclComm_t comm, cudaStream_t stream)
+{
+  int rank, world_size;
+  NCCLCHECK(ncclCommUserRank(comm, &rank));
+  NCCLCHECK(ncclCommCount(comm, &world_size));
+  const QuantizedCommLayout layout(count, block_size, world_size);
+  if (layout.slice_blocks == 0)
+    return;
+  const size_t slice_count = layout.getSliceCount();
+  const size_t slice_blocks = layout.slice_blocks;
+  // q[0]: the input, then the sums of all the ranks; q[1]: the slice of rank of the inputs of all the ranks
+  QuantizedCommBuffers &b = get_quantized_comm_buffers(comm, stream, layout.getPaddedCount(), world_size * slice_blocks);
+
+  PUSH_RANGE("all2all_reduce_sum/int8", stream)
+  quantize_int8_blocks_kernel<<<world_size * slice_blocks, QUANTIZED_COMM_THREADS, 0, stream>>>(
+      send_buf, count, block_size, b.q[0], b.scales[0]);
+  NCCLCHECK(ncclGroupStart());
+  for (int r = 0; r < world_size; r++)
+  {
+    if (r == rank)
+      continue;
+    NCCLCHECK(ncclSend(b.q[0] + r * slice_count, slice_count, ncclInt8, r, comm, stream));
+    NCCLCHECK(ncclSend(b.scales[0] + r * slice_blocks, slice_blocks, ncclFloat, r, comm, stream));
+    NCCLCHECK(ncclRecv(b.q[1] + r * slice_count, slice_count, ncclInt8, r, comm, stream));
+    NCCLCHECK(ncclRecv(b.scales[1] + r * slice_blocks, slice_blocks, ncclFloat, r, comm, stream));
+  }
+  NCCLCHECK(ncclGroupEnd());
+  reduce_int8_slice_kernel<<<slice_blocks, QUANTIZED_COMM_THREADS, 0, stream>>>(
+      send_buf, b.q[1], b.scales[1], layout, rank, b.q[0] + rank * slice_count, b.scales[0] + rank * slice_blocks);
+  NCCLCHECK(ncclGroupStart());
+  NCCLCHECK(ncclAllGather(b.q[0] + rank * slice_count, b.q[0], slice_count, ncclInt8, comm, stream));
+  NCCLCHECK(ncclAllGather(b.scales[0] + rank * slice_blocks, b.scales[0], slice_blocks, ncclFloat, comm, stream));
+  NCCLCHECK(ncclGroupEnd());
+  dequantize_int8_blocks_kernel<<<dim3((count + QUANTIZED_COMM_THREADS - 1) / QUANTIZED_COMM_THREADS, 1),
+                                  QUANTIZED_COMM_THREADS, 0, stream>>>(b.q[0], 0, b.scales[0], 0, count, block_size, recv_buf);
+  POP_RANGE
+}
+
+template <typename T>
+static void quantized_all_gather(const T *send_buf, T *recv_buf, const size_t count, const int block_size,
+                                 ncclComm_t comm, cudaStream_t stream)
+{
+  int rank, world_size;
+  NCCLCHECK(ncclCommUserRank(comm, &rank));
+  NCCLCHECK(ncclCommCount(comm, &world_size));
+  const size_t block_num = (count + block_size - 1) / block_size;
+  if (block_num == 0)
+    return;
+  const size_t padded_count = block_num * block_size;
+  QuantizedCommBuffers &b = get_quantized_comm_buffers(comm, stream, world_size * padded_count, world_size * block_num);
+
+  PUSH_RANGE("all2all_gather/int8", stream)
+  quantize_int8_blocks_kernel<<<block_num, QUANTIZED_COMM_THREADS, 0, stream>>>(
+      send_buf, count, block_size, b.q[0] + rank * padded_count, b.scales[0] + rank * block_num);
+  NCCLCHECK(ncclGroupStart());
+  NCCLCHECK(ncclAllGather(b.q[0] + rank * padded_count, b.q[0], padded_count, ncclInt8, comm, stream));
+  NCCLCHECK(ncclAllGather(b.scales[0] + rank * block_num, b.scales[0], block_num, ncclFloat, comm, stream));
+  NCCLCHECK(ncclGroupEnd());
+  dequantize_int8_blocks_kernel<<<dim3((count + QUANTIZED_COMM_THREADS - 1) / QUANTIZED_COMM_THREADS, world_size),
+                                  QUANTIZED_COMM_THREADS, 0, stream>>>(b.q[0], padded_count, b.scales[0], block_num, count,
+                                                                       block_size, recv_buf);
+  POP_RANGE
+}
+
+void quantized_all_reduce_sum(const void *send_buf, void *recv_buf, const size_t count, const CommDataType type,
+                              const int block_size, ncclComm_t comm, cudaStream_t stream)
+{
+  if (type == CommDataType::FLOAT)
+    quantized_all_reduce_sum((const float *)send_buf, (float *)recv_buf, count, block_size, comm, stream);
+  else if (type == CommDataType::HALF)
+    quantized_all_reduce_sum((const half *)send_buf, (half *)recv_buf, count, block_size, comm, stream);
+  else
+    throw std::runtime_error("[FT][ERROR] the int8 all-reduce only supports float and half");
+}
+
+void quantized_all_gather(const void *send_buf, void *recv_buf, const size_t count, const CommDataType type,
+                          const int block_size, ncclComm_t comm, cudaStream_t stream)
+{
+  if (type == CommDataType::FLOAT)
+    quantized_all_gather((const float *)send_buf, (float *)recv_buf, count, block_size, comm, stream);
+  else if (type == CommDataType::HALF)
+    quantized_all_gather((const half *)send_buf, (half *)recv_buf, count, block_size, comm, stream);
+  else
+    throw std::runtime_error("[FT][ERROR] the int8 all-gather only supports float and half");
+}
+
+#endif // BUILD_GPT
+
+} // namespace fastertransformer
@@ -0,0 +1,162 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Block-wise INT8 compression of the tensor parallel collectives
+ *
+ * With ParallelParam::int8_comm_block_size > 0, all2all_reduce_sum and all2all_gather of float and
+ * half data send int8 values: each block of int8_comm_block_size values is scaled by max|x| / 127
+ * and rounded to the nearest integer, so a value moves by at most half the scale of its block.
+ *
+ * The all-reduce is a reduce-scatter and an all-gather of int8 blocks. The blocks are split in one
+ * slice per rank; rank r receives slice r of the other ranks, sums it in float with its own exact
+ * values in rank order, quantizes the sums and all the ranks gather the quantized slices. Every
+ * rank dequantizes the same blocks, so they all get the same bits. A sum is off by at most half
+ * the scale of its block on each other rank, plus half the scale of its block of sums.
+ * The all-gather quantizes the share of each rank, and every rank dequantizes all of them, its
+ * own included.
+ *
+ * A rank sends about 2 (world_size - 1) / world_size bytes per value, half of what the ring
+ * all-reduce of half data sends. The host functions below are the implementation of
+ * ThreadCommunicator and the reference of the kernels of quantized_comm.cu.
+ **/
+
+#pragma once
+
+#include "fastertransformer/utils/communicator.h"
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef BUILD_GPT
+#include "nccl.h"
+#endif
+
+namespace fastertransformer
+{
+
+__host__ __device__ inline float quantized_comm_to_float(const float x) { return x; }
+__host__ __device__ inline float quantized_comm_to_float(const half x) { return __half2float(x); }
+__host__ __device__ inline void quantized_comm_from_float(const float x, float *y) { *y = x; }
+__host__ __device__ inline void quantized_comm_from_float(const float x, half *y) { *y = __float2half(x); }
+
+// The scale of a block and its inverse, 0 for a block of zeros.
+__host__ __device__ inline float get_int8_scale(const float amax) { return amax / 127.0f; }
+__host__ __device__ inline float get_int8_inv_scale(const float amax) { return amax > 0.0f ? 127.0f / amax : 0.0f; }
+
+__host__ __device__ inline int8_t quantize_int8(const float x, const float inv_scale)
+{
+  return (int8_t)fmaxf(-127.0f, fminf(127.0f, rintf(x * inv_scale)));
+}
+
+/**
+ * The blocks of count values split in world_size slices of slice_blocks blocks, the last ones
+ * padded with zeros, so that every rank sends and gathers the same number of bytes.
+ **/
+struct QuantizedCommLayout
+{
+  QuantizedCommLayout(const size_t count, const int block_size, const int world_size)
+      : count(count), block_size(block_size), world_size(world_size)
+  {
+    block_num = (count + block_size - 1) / block_size;
+    slice_blocks = (block_num + world_size - 1) / world_size;
+  }
+
+  // the values of the blocks of all the slices, padding included
+  __host__ __device__ size_t getPaddedCount() const { return (size_t)world_size * slice_blocks * block_size; }
+  __host__ __device__ size_t getSliceCount() const { return slice_blocks * block_size; }
+  __host__ __device__ size_t getSliceBegin(const int rank) const { return clamp((size_t)rank * getSliceCount()); }
+  __host__ __device__ size_t getSliceEnd(const int rank) const { return clamp((size_t)(rank + 1) * getSliceCount()); }
+  __host__ __device__ size_t clamp(const size_t i) const { return i < count ? i : count; }
+
+  size_t count;
+  int block_size;
+  int world_size;
+  size_t block_num;
+  size_t slice_blocks;
+};
+
+// q and scales get the blocks of the count values of x, padded with zeros up to padded_count.
+template <typename T>
+void quantize_int8_blocks(const T *x, const size_t count, const size_t padded_count, const int block_size,
+                          int8_t *q, float *scales)
+{
+  for (size_t begin = 0; begin < padded_count; begin += block_size)
+  {
+    const size_t end = std::min(count, begin + block_size);
+    float amax = 0.0f;
+    for (size_t i = begin; i < end; i++)
+      amax = std::max(amax, fabsf(quantized_comm_to_float(x[i])));
+    const float inv_scale = get_int8_inv_scale(amax);
+    scales[begin / block_size] = get_int8_scale(amax);
+    for (size_t i = begin; i < begin + block_size; i++)
+      q[i] = i < end ? quantize_int8(quantized_comm_to_float(x[i]), inv_scale) : 0;
+  }
+}
+
+// x[i] = q[i] * the scale of its block, for the first count values of the blocks.
+template <typename T>
+void dequantize_int8_blocks(const int8_t *q, const float *scales, const size_t count, const int block_size, T *x)
+{
+  for (size_t i = 0; i < count; i++)
+    quantized_comm_from_float((float)q[i] * scales[i / block_size], &x[i]);
+}
+
+/**
+ * The reduction of rank in the all-reduce: out gets the slice of rank of the sums, quantized.
+ * x is the exact input of rank, q and scales the quantized inputs of all the ranks (the blocks
+ * of layout.getPaddedCount() values each; the one of rank is not read).
+ **/
+template <typename T>
+void reduce_int8_slice(const T *x, const int8_t *const *q, const float *const *scales, const QuantizedCommLayout &layout,
+                       const int rank, int8_t *out_q, float *out_scales)
+{
+  const size_t begin = layout.getSliceBegin(rank);
+  const size_t end = layout.getSliceEnd(rank);
+  const size_t slice_count = layout.getSliceCount();
+  std::vector<float> sums(slice_count);
+  for (size_t i = begin; i < end; i++)
+  {
+    float sum = 0.0f;
+    for (int r = 0; r < layout.world_size; r++)
+      sum += r == rank ? quantized_comm_to_float(x[i]) : (float)q[r][i] * scales[r][i / layout.block_size];
+    sums[i - begin] = sum;
+  }
+  quantize_int8_blocks(sums.data(), end - begin, slice_count, layout.block_size, out_q, out_scales);
+}
+
+/**
+ * The NCCL versions, on device buffers and ordered on stream; the collectives of all2all_reduce_sum
+ * and all2all_gather for a ParallelParam without a communicator. type is FLOAT or HALF. They keep
+ * device buffers per communicator and stream, grown to the largest call and kept until
+ * release_quantized_comm_buffers is called for the communicator.
+ **/
+#ifdef BUILD_GPT
+void quantized_all_reduce_sum(const void *send_buf, void *recv_buf, const size_t count, const CommDataType type,
+                              const int block_size, ncclComm_t comm, cudaStream_t stream);
+// recv[r * count, (r + 1) * count) = send of rank r
+void quantized_all_gather(const void *send_buf, void *recv_buf, const size_t count, const CommDataType type,
+                          const int block_size, ncclComm_t comm, cudaStream_t stream);
+// Frees the buffers of comm, once its streams are done with them. Call it before ncclCommDestroy,
+// since a new communicator may get the same handle.
+void release_quantized_comm_buffers(ncclComm_t comm);
+#endif
+
+} // namespace fastertransformer
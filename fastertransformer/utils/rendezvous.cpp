@@ -0,0 +1,297 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "fastertransformer/utils/rendezvous.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fastertransformer
+{
+
+std::string RendezvousStore::get(const std::string &key, const int timeout_ms)
+{
+  // a restarted rank waits for its peers, so poll often at first
+  const auto start = std::chrono::steady_clock::now();
+  int sleep_us = 100;
+  std::string value;
+  while (!tryGet(key, &value))
+  {
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() >= timeout_ms)
+      throw std::runtime_error("[FT][ERROR] rendezvous: no value for " + key + " after " +
+                               std::to_string(timeout_ms) + " ms");
+    std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+    sleep_us = std::min(2 * sleep_us, 20000);
+  }
+  return value;
+}
+
+static void make_dirs(const std::string &path)
+{
+  for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1))
+  {
+    const std::string dir = path.substr(0, pos);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      throw std::runtime_error("[FT][ERROR] rendezvous: cannot create " + dir + ": " + strerror(errno));
+    if (pos == std::string::npos)
+      break;
+  }
+}
+
+FileStore::FileStore(const std::string &dir) : dir_(dir)
+{
+  if (dir_.empty())
+    throw std::runtime_error("[FT][ERROR] rendezvous: empty FileStore directory");
+  while (dir_.size() > 1 && dir_.back() == '/')
+    dir_.pop_back();
+  make_dirs(dir_);
+}
+
+std::string FileStore::getPath(const std::string &key) const
+{
+  if (key.empty() || key.front() == '/' || key.back() == '/' || key.find("..") != std::string::npos)
+    throw std::runtime_error("[FT][ERROR] rendezvous: invalid key " + key);
+  return dir_ + "/" + key;
+}
+
+bool FileStore::add(const std::string &key, const std::string &value)
+{
+  static std::atomic<unsigned long> temp_count(0);
+  const std::string path = getPath(key);
+  make_dirs(path.substr(0, path.rfind('/')));
+  const std::string temp_path = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(temp_count++);
+
+  const int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    throw std::runtime_error("[FT][ERROR] rendezvous: cannot create " + temp_path + ": " + strerror(errno));
+  size_t written = 0;
+  while (written < value.size())
+  {
+    const ssize_t n = write(fd, value.data() + written, value.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      const int error = errno;
+      close(fd);
+      unlink(temp_path.c_str());
+      throw std::runtime_error("[FT][ERROR] rendezvous: cannot write " + temp_path + ": " + strerror(error));
+    }
+    written += n;
+  }
+  close(fd);
+
+  // link fails on an existing file, unlike rename
+  const bool added = link(temp_path.c_str(), path.c_str()) == 0;
+  const int error = errno;
+  unlink(temp_path.c_str());
+  if (!added && error != EEXIST)
+    throw std::runtime_error("[FT][ERROR] rendezvous: cannot link " + path + ": " + strerror(error));
+  return added;
+}
+
+bool FileStore::tryGet(const std::string &key, std::string *value)
+{
+  const std::string path = getPath(key);
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    if (errno == ENOENT)
+      return false;
+    throw std::runtime_error("[FT][ERROR] rendezvous: cannot open " + path + ": " + strerror(errno));
+  }
+  value->clear();
+  char buf[4096];
+  while (true)
+  {
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      const int error = errno;
+      close(fd);
+      throw std::runtime_error("[FT][ERROR] rendezvous: cannot read " + path + ": " + strerror(error));
+    }
+    if (n == 0)
+      break;
+    value->append(buf, n);
+  }
+  close(fd);
+  return true;
+}
+
+CommRendezvous::CommRendezvous(RendezvousStore &store, const std::string &group, const int world_size,
+                               const int rank, const int timeout_ms)
+    : store_(store), group_(group), world_size_(world_size), rank_(rank), timeout_ms_(timeout_ms)
+{
+  if (world_size < 1 || rank < 0 || rank >= world_size)
+    throw std::runtime_error("[FT][ERROR] rendezvous: rank " + std::to_string(rank) + " of " + group +
+                             " should be in [0, " + std::to_string(world_size) + ")");
+}
+
+std::string CommRendezvous::getKey(const int generation, const std::string &name) const
+{
+  return group_ + "/" + std::to_string(generation) + "/" + name;
+}
+
+std::string CommRendezvous::getGenerationKey(const int generation) const
+{
+  return group_ + "/generation/" + std::to_string(generation);
+}
+
+int CommRendezvous::getLatestGeneration()
+{
+  std::string value;
+  while (store_.tryGet(getGenerationKey(known_generation_ + 1), &value))
+    known_generation_++;
+  return known_generation_;
+}
+
+bool CommRendezvous::getGenerationStep(const int generation, int *step)
+{
+  std::string value;
+  if (!store_.tryGet(getGenerationKey(generation), &value))
+    return false;
+  char *end = nullptr;
+  const long parsed = strtol(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || parsed < 0)
+    throw std::runtime_error("[FT][ERROR] rendezvous: invalid step " + value + " of " + group_ + " generation " +
+                             std::to_string(generation));
+  *step = (int)parsed;
+  return true;
+}
+
+int CommRendezvous::getStartedGeneration()
+{
+  int generation = generation_;
+  int step;
+  while (getGenerationStep(generation + 1, &step) && step <= step_)
+    generation++;
+  return generation;
+}
+
+int CommRendezvous::getNextIncarnationGeneration()
+{
+  std::string value;
+  for (int generation = getLatestGeneration(); generation >= 0; generation--)
+    if (store_.tryGet(getKey(generation, "rank/" + std::to_string(rank_)), &value))
+      return generation + 1;
+  return 0;
+}
+
+std::string CommRendezvous::join(const std::function<std::string()> &create_id)
+{
+  int generation, step;
+  if (generation_ < 0)
+  {
+    generation = getNextIncarnationGeneration();
+    if (!getGenerationStep(generation, &step))
+    {
+      // the first generation, or the previous incarnation exited without leave()
+      int previous_step = 0;
+      if (generation > 0)
+        getGenerationStep(generation - 1, &previous_step);
+      store_.add(getGenerationKey(generation), std::to_string(previous_step));
+      getGenerationStep(generation, &step);
+    }
+  }
+  else
+  {
+    generation = getStartedGeneration();
+    if (generation == generation_)
+      throw std::runtime_error("[FT][ERROR] rendezvous: no generation of " + group_ + " starts at step " +
+                               std::to_string(step_));
+    getGenerationStep(generation, &step);
+  }
+  if (!store_.add(getKey(generation, "rank/" + std::to_string(rank_)), ""))
+    throw std::runtime_error("[FT][ERROR] rendezvous: rank " + std::to_string(rank_) + " already joined " + group_ +
+                             " generation " + std::to_string(generation));
+  known_generation_ = std::max(known_generation_, generation);
+
+  if (rank_ == 0 && !store_.add(getKey(generation, "id"), create_id()))
+    throw std::runtime_error("[FT][ERROR] rendezvous: the id of " + group_ + " generation " +
+                             std::to_string(generation) + " was already published");
+  const std::string id = store_.get(getKey(generation, "id"), timeout_ms_);
+  for (int r = 0; r < world_size_; r++)
+    store_.get(getKey(generation, "rank/" + std::to_string(r)), timeout_ms_);
+  generation_ = generation;
+  step_ = std::max(step_, step);
+  return id;
+}
+
+void CommRendezvous::leave()
+{
+  // the other ranks may have started the request getStep() before they could see the generation
+  const int step = step_ + 1;
+  for (int generation = generation_ + 1;; generation++)
+  {
+    int start;
+    if (!getGenerationStep(generation, &start))
+    {
+      store_.add(getGenerationKey(generation), std::to_string(step));
+      // or the step of a rank that asked first
+      getGenerationStep(generation, &start);
+    }
+    if (start == step)
+      return;
+    if (start > step)
+      throw std::runtime_error("[FT][ERROR] rendezvous: " + group_ + " generation " + std::to_string(generation) +
+                               " starts at step " + std::to_string(start) + ", after this rank leaves at " +
+                               std::to_string(step));
+  }
+}
+
+#ifdef BUILD_GPT
+
+#define RENDEZVOUS_NCCL_CHECK(cmd)                                                                       \
+  do                                                                                                     \
+  {                                                                                                      \
+    ncclResult_t r = cmd;                                                                                \
+    if (r != ncclSuccess)                                                                                \
+      throw std::runtime_error(std::string("[FT][ERROR] NCCL error: ") + ncclGetErrorString(r) + " " + \
+                               __FILE__ + ":" + std::to_string(__LINE__));                             \
+  } while (0)
+
+ncclComm_t rendezvous_nccl_comm(CommRendezvous &rendezvous)
+{
+  const std::string id = rendezvous.join([] {
+    ncclUniqueId uid;
+    RENDEZVOUS_NCCL_CHECK(ncclGetUniqueId(&uid));
+    return std::string((const char *)&uid, sizeof(uid));
+  });
+  if (id.size() != sizeof(ncclUniqueId))
+    throw std::runtime_error("[FT][ERROR] rendezvous: the id has " + std::to_string(id.size()) + " bytes instead of " +
+                             std::to_string(sizeof(ncclUniqueId)));
+  ncclUniqueId uid;
+  memcpy(&uid, id.data(), sizeof(uid));
+  ncclComm_t comm;
+  RENDEZVOUS_NCCL_CHECK(ncclCommInitRank(&comm, rendezvous.getWorldSize(), uid, rendezvous.getRank()));
+  return comm;
+}
+
+#endif
+
+} // namespace fastertransformer
@@ -0,0 +1,154 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Rendezvous of the communicator ids of the tensor and layer parallel groups
+ *
+ * get_nccl_uid and the ids of AbstractTransformerModel::create_nccl_ids go through MPI_Bcast on
+ * MPI_COMM_WORLD: all the ranks of the job take part, and a rank that restarts restarts the job.
+ * A CommRendezvous shares the id of one group through a RendezvousStore instead, so a rank only
+ * waits for the ranks of its own groups, and a group re-forms without the other ones.
+ *
+ * The ranks of a group form generations 0, 1, ... of its communicator, and serve the same requests
+ * in order, with a collective of the group in each one. A generation starts at a request, its step,
+ * that every rank reads from the store before that request, so the ranks re-form a group between
+ * the same two requests and never run a collective with different communicators.
+ *
+ * leave() asks for a generation that starts after the next request, before a rank exits, e.g. for
+ * a rolling upgrade: the rank serves that request with the others, which may have started it
+ * already, then exits. The others see the new generation with isStale() before the request after
+ * it, and join() it with the next incarnation of the rank, which joins the generation after the
+ * last one that its previous incarnations joined. A rank that exits without leave(), or dies
+ * while the others create their communicators, leaves them in a collective or ncclCommInitRank.
+ *
+ * The keys of a group are
+ *   <group>/generation/<g>    the step of generation g, from the rank that asked for it
+ *   <group>/<g>/rank/<r>      rank r joined generation g
+ *   <group>/<g>/id            the id of generation g, from the rank 0
+ * and are never removed: use a store, e.g. a directory, per job.
+ **/
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#ifdef BUILD_GPT
+#include "nccl.h"
+#endif
+
+namespace fastertransformer
+{
+
+/**
+ * A key-value store that the ranks of a job share. The values of the keys never change, so a
+ * rank that reads a value reads the one of every other rank.
+ **/
+class RendezvousStore
+{
+public:
+  virtual ~RendezvousStore() {}
+
+  // key = value if key has no value yet; returns whether this call set it.
+  virtual bool add(const std::string &key, const std::string &value) = 0;
+  // The value of key, false if it has none yet.
+  virtual bool tryGet(const std::string &key, std::string *value) = 0;
+
+  // Waits for the value of key; throws after timeout_ms.
+  std::string get(const std::string &key, const int timeout_ms);
+};
+
+/**
+ * A file per key below dir, a directory of this host or of a file system that the hosts share.
+ * A value is written to a temporary file and linked to the file of its key, so that the first
+ * add wins and a reader never sees part of a value. The '/' of the keys are subdirectories.
+ **/
+class FileStore : public RendezvousStore
+{
+public:
+  // Creates dir if it does not exist.
+  explicit FileStore(const std::string &dir);
+
+  bool add(const std::string &key, const std::string &value) override;
+  bool tryGet(const std::string &key, std::string *value) override;
+
+private:
+  std::string getPath(const std::string &key) const;
+
+  std::string dir_;
+};
+
+class CommRendezvous
+{
+public:
+  // Rank rank of the world_size ranks of the group, whose keys start with group, e.g.
+  // "gpt/tensor/0". The waits of join() throw after timeout_ms.
+  CommRendezvous(RendezvousStore &store, const std::string &group, const int world_size, const int rank,
+                 const int timeout_ms = 300000);
+
+  int getRank() const { return rank_; }
+  int getWorldSize() const { return world_size_; }
+  // The generation that this rank joined last, -1 before join().
+  int getGeneration() const { return generation_; }
+  // The request that this rank serves next: the step of the generation it joined first, plus the
+  // calls of nextStep() since.
+  int getStep() const { return step_; }
+
+  // The latest generation that a rank asked for, -1 before the first one.
+  int getLatestGeneration();
+  // Before the request getStep(): whether a generation after the one this rank joined starts at
+  // that request. Then the communicator of this rank is stale, and join() forms the new one. All
+  // the ranks of the group see the same before the same request.
+  bool isStale() { return getStartedGeneration() > generation_; }
+  // After isStale() and join() before the request getStep(): the next request is the one after it.
+  void nextStep() { step_++; }
+
+  // Forms the generation that starts at getStep(), or the first generation of this incarnation of
+  // the rank, with create_id() of the rank 0 of the group, and returns that id once all the ranks
+  // joined.
+  std::string join(const std::function<std::string()> &create_id);
+  // Asks for a generation that starts after the request getStep(), which this rank still serves
+  // before it exits: the other ranks then join it with the next incarnation of this rank.
+  void leave();
+
+private:
+  std::string getKey(const int generation, const std::string &name) const;
+  std::string getGenerationKey(const int generation) const;
+  // The step of generation, false if no rank asked for it.
+  bool getGenerationStep(const int generation, int *step);
+  // The latest generation that starts at getStep() or before.
+  int getStartedGeneration();
+  // The generation after the last one that a previous incarnation of this rank joined.
+  int getNextIncarnationGeneration();
+
+  RendezvousStore &store_;
+  std::string group_;
+  int world_size_;
+  int rank_;
+  int timeout_ms_;
+  int generation_{-1};
+  int step_{0};
+  // the generations up to this one were asked for, getLatestGeneration() looks after it
+  int known_generation_{-1};
+};
+
+#ifdef BUILD_GPT
+// join() of rendezvous with the ncclUniqueId of a ncclGetUniqueId, and the communicator of this
+// rank in that generation. Throws on a NCCL error.
+ncclComm_t rendezvous_nccl_comm(CommRendezvous &rendezvous);
+#endif
+
+} // namespace fastertransformer
@@ -0,0 +1,346 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "timeline.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+
+namespace fastertransformer
+{
+
+namespace
+{
+const size_t DROPPED_SPAN = (size_t)-1;
+
+// steady_clock is CLOCK_MONOTONIC, shared by the processes of a node, so their traces line up.
+double now_us()
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+} // namespace
+
+struct Timeline::ThreadBuffer
+{
+  struct Span
+  {
+    const char *name;
+    int index;
+    int rank;
+    cudaStream_t stream;
+    bool use_events;
+    cudaEvent_t start_event;
+    cudaEvent_t stop_event;
+    double begin_us;
+    double end_us;
+    bool resolved;
+    std::atomic<bool> done;
+  };
+
+  // Only the owner thread appends; size is published with release, so that write() can read the spans.
+  std::unique_ptr<Span[]> spans;
+  std::atomic<size_t> size;
+  // spans [0, resolved_num) have their host times, or failed to get them
+  size_t resolved_num = 0;
+  std::vector<size_t> stack;
+  std::vector<cudaEvent_t> free_events;
+  cudaEvent_t ref_event = nullptr;
+  double ref_us = 0.0;
+  int thread_index = 0;
+  ThreadBuffer *next = nullptr;
+
+  explicit ThreadBuffer(const size_t capacity) : spans(new Span[capacity]), size(0) {}
+
+  ~ThreadBuffer()
+  {
+    for (cudaEvent_t event : free_events)
+      cudaEventDestroy(event);
+    if (ref_event != nullptr)
+      cudaEventDestroy(ref_event);
+  }
+
+  cudaEvent_t getEvent()
+  {
+    if (free_events.empty())
+    {
+      cudaEvent_t event;
+      cudaEventCreate(&event);
+      return event;
+    }
+    cudaEvent_t event = free_events.back();
+    free_events.pop_back();
+    return event;
+  }
+};
+
+namespace
+{
+thread_local Timeline::ThreadBuffer *tls_buffer = nullptr;
+thread_local int tls_rank = 0;
+} // namespace
+
+Timeline &Timeline::instance()
+{
+  static Timeline timeline;
+  return timeline;
+}
+
+Timeline::Timeline() : enabled_(false), clock_((int)TimelineClock::CUDA_EVENT), dropped_num_(0),
+                       buffers_(nullptr), thread_num_(0)
+{
+  const char *env_capacity = getenv("FT_TIMELINE_MAX_EVENTS");
+  capacity_ = env_capacity != nullptr ? std::max(1L, atol(env_capacity)) : 65536;
+  const char *env_clock = getenv("FT_TIMELINE_CLOCK");
+  TimelineClock clock = TimelineClock::CUDA_EVENT;
+  if (env_clock != nullptr)
+  {
+    if (strcmp(env_clock, "cpu") == 0)
+      clock = TimelineClock::CPU;
+    else if (strcmp(env_clock, "event") != 0)
+      printf("[WARNING][Timeline] unknown FT_TIMELINE_CLOCK %s, should be event or cpu\n", env_clock);
+  }
+  const char *env_file = getenv("FT_TIMELINE");
+  if (env_file != nullptr && strlen(env_file) > 0)
+    enable(env_file, clock);
+}
+
+Timeline::~Timeline()
+{
+  if (isEnabled() && !written_)
+    write();
+  ThreadBuffer *buffer = buffers_.load();
+  while (buffer != nullptr)
+  {
+    ThreadBuffer *next = buffer->next;
+    delete buffer;
+    buffer = next;
+  }
+}
+
+void Timeline::enable(const std::string &file_name, const TimelineClock clock)
+{
+  file_name_ = file_name;
+  const size_t pos = file_name_.find("%p");
+  if (pos != std::string::npos)
+    file_name_.replace(pos, 2, std::to_string(getpid()));
+  written_ = false;
+  clock_ = (int)clock;
+  enabled_ = true;
+}
+
+void Timeline::setClock(const TimelineClock clock)
+{
+  clock_ = (int)clock;
+}
+
+void Timeline::setThreadRank(const int rank)
+{
+  tls_rank = rank;
+}
+
+Timeline::ThreadBuffer *Timeline::getThreadBuffer()
+{
+  if (tls_buffer == nullptr)
+  {
+    ThreadBuffer *buffer = new ThreadBuffer(capacity_);
+    buffer->thread_index = thread_num_++;
+    buffer->next = buffers_.load(std::memory_order_relaxed);
+    while (!buffers_.compare_exchange_weak(buffer->next, buffer, std::memory_order_release, std::memory_order_relaxed))
+      ;
+    tls_buffer = buffer;
+  }
+  return tls_buffer;
+}
+
+void Timeline::push(const char *name, cudaStream_t stream, const int index)
+{
+  ThreadBuffer &buffer = *getThreadBuffer();
+  const size_t i = buffer.size.load(std::memory_order_relaxed);
+  if (i >= capacity_)
+  {
+    buffer.stack.push_back(DROPPED_SPAN);
+    dropped_num_++;
+    return;
+  }
+
+  ThreadBuffer::Span &span = buffer.spans[i];
+  span.name = name;
+  span.index = index;
+  span.rank = tls_rank;
+  span.stream = stream;
+  span.use_events = (TimelineClock)clock_.load(std::memory_order_relaxed) == TimelineClock::CUDA_EVENT;
+  span.resolved = false;
+  span.done.store(false, std::memory_order_relaxed);
+  if (span.use_events)
+  {
+    if (buffer.ref_event == nullptr)
+    {
+      // the origin of the event times of this thread, in host time
+      cudaEventCreate(&buffer.ref_event);
+      cudaEventRecord(buffer.ref_event, 0);
+      cudaEventSynchronize(buffer.ref_event);
+      buffer.ref_us = now_us();
+    }
+    span.start_event = buffer.getEvent();
+    span.stop_event = buffer.getEvent();
+    cudaEventRecord(span.start_event, stream);
+  }
+  else
+  {
+    span.begin_us = now_us();
+  }
+  buffer.stack.push_back(i);
+  buffer.size.store(i + 1, std::memory_order_release);
+}
+
+void Timeline::pop()
+{
+  ThreadBuffer *buffer = tls_buffer;
+  if (buffer == nullptr || buffer->stack.empty())
+    return;
+  const size_t i = buffer->stack.back();
+  buffer->stack.pop_back();
+  if (i != DROPPED_SPAN)
+  {
+    ThreadBuffer::Span &span = buffer->spans[i];
+    if (span.use_events)
+      cudaEventRecord(span.stop_event, span.stream);
+    else
+      span.end_us = now_us();
+    span.done.store(true, std::memory_order_release);
+  }
+  if (buffer->stack.empty())
+    resolve(*buffer, false);
+}
+
+void Timeline::resolve(ThreadBuffer &buffer, const bool wait)
+{
+  // spans are in push order; stop at the first one that is open or whose events are not done yet
+  const size_t size = buffer.size.load(std::memory_order_acquire);
+  while (buffer.resolved_num < size)
+  {
+    ThreadBuffer::Span &span = buffer.spans[buffer.resolved_num];
+    if (!span.done.load(std::memory_order_acquire))
+      break;
+    if (span.use_events)
+    {
+      cudaError_t status = wait ? cudaEventSynchronize(span.stop_event) : cudaEventQuery(span.stop_event);
+      if (status == cudaErrorNotReady)
+        break;
+      float begin_ms = 0.0f, end_ms = 0.0f;
+      span.resolved = status == cudaSuccess &&
+                      cudaEventElapsedTime(&begin_ms, buffer.ref_event, span.start_event) == cudaSuccess &&
+                      cudaEventElapsedTime(&end_ms, buffer.ref_event, span.stop_event) == cudaSuccess;
+      span.begin_us = buffer.ref_us + begin_ms * 1000.0;
+      span.end_us = buffer.ref_us + end_ms * 1000.0;
+      buffer.free_events.push_back(span.start_event);
+      buffer.free_events.push_back(span.stop_event);
+    }
+    else
+    {
+      span.resolved = true;
+    }
+    if (!span.resolved)
+      dropped_num_++;
+    buffer.resolved_num++;
+  }
+}
+
+bool Timeline::write()
+{
+  if (!isEnabled())
+    return true;
+  FILE *file = fopen(file_name_.c_str(), "w");
+  if (file == nullptr)
+  {
+    printf("[ERROR][Timeline] cannot open %s\n", file_name_.c_str());
+    return false;
+  }
+
+  // one lane per stream of each rank for the event spans, one per thread for the cpu spans
+  std::map<std::pair<int, cudaStream_t>, int> stream_lanes;
+  std::map<std::pair<int, int>, std::string> lane_names;
+  fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  bool first = true;
+  for (ThreadBuffer *buffer = buffers_.load(std::memory_order_acquire); buffer != nullptr; buffer = buffer->next)
+  {
+    resolve(*buffer, true);
+    for (size_t i = 0; i < buffer->resolved_num; i++)
+    {
+      const ThreadBuffer::Span &span = buffer->spans[i];
+      if (!span.resolved)
+        continue;
+      int lane;
+      if (span.use_events)
+      {
+        auto it = stream_lanes.find(std::make_pair(span.rank, span.stream));
+        if (it == stream_lanes.end())
+        {
+          lane = (int)stream_lanes.size();
+          stream_lanes[std::make_pair(span.rank, span.stream)] = lane;
+          char lane_name[64];
+          snprintf(lane_name, sizeof(lane_name), "stream %p", (void *)span.stream);
+          lane_names[std::make_pair(span.rank, lane)] = lane_name;
+        }
+        else
+          lane = it->second;
+      }
+      else
+      {
+        lane = 1000 + buffer->thread_index;
+        lane_names[std::make_pair(span.rank, lane)] = "thread " + std::to_string(buffer->thread_index);
+      }
+      std::string name = span.name;
+      if (span.index >= 0)
+        name += " " + std::to_string(span.index);
+      fprintf(file, "%s{\"name\": \"%s\", \"cat\": \"ft\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                    "\"pid\": %d, \"tid\": %d, \"args\": {\"stream\": \"%p\"}}",
+              first ? "" : ",\n", name.c_str(), span.begin_us, span.end_us - span.begin_us,
+              span.rank, lane, (void *)span.stream);
+      first = false;
+    }
+  }
+  for (auto &it : lane_names)
+  {
+    fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+            first ? "" : ",\n", it.first.first, it.first.second, it.second.c_str());
+    first = false;
+  }
+  std::map<int, bool> ranks;
+  for (auto &it : lane_names)
+    ranks[it.first.first] = true;
+  for (auto &it : ranks)
+  {
+    fprintf(file, "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"rank %d\"}}",
+            first ? "" : ",\n", it.first, it.first);
+    first = false;
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  written_ = true;
+  if (getDroppedNum() > 0)
+    printf("[WARNING][Timeline] %zu spans were dropped, FT_TIMELINE_MAX_EVENTS is %zu per thread\n",
+           getDroppedNum(), capacity_);
+  return true;
+}
+
+} // namespace fastertransformer
@@ -0,0 +1,92 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Timeline of the PUSH_RANGE / POP_RANGE ranges, written as Chrome trace JSON
+ *
+ * Enabled by FT_TIMELINE=<file> (a %p in the name is replaced by the process id) or by
+ * enable(). Each thread appends its spans to its own fixed-size buffer, without locks; the
+ * spans after FT_TIMELINE_MAX_EVENTS (default 65536) per thread are dropped. Each span
+ * carries the rank set by setThreadRank() and its stream.
+ *
+ * Clocks:
+ *   CUDA_EVENT - the default. A span records a pair of cudaEvents on its stream, so it shows
+ *                when the GPU ran the work. The events are converted to host time when an
+ *                outermost span is popped and they are done, or by write(); the first span
+ *                of a thread waits once for the device, to align the clocks.
+ *   CPU        - std::chrono::steady_clock when the span is pushed and popped, for host code
+ *                such as the cpu backend of ft_bench. FT_TIMELINE_CLOCK=cpu selects it.
+ *
+ * The file is written by write(), or at exit. Open it in chrome://tracing or Perfetto;
+ * the files of several processes can be merged with
+ *   jq -s '{traceEvents: map(.traceEvents) | add}' trace.*.json > trace.json
+ **/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cuda_runtime.h>
+
+namespace fastertransformer
+{
+
+enum class TimelineClock
+{
+  CUDA_EVENT,
+  CPU
+};
+
+class Timeline
+{
+public:
+  static Timeline &instance();
+
+  bool isEnabled() const { return enabled_.load(std::memory_order_relaxed); }
+  // Start recording, the trace is written to file_name. Call it before any range is open.
+  void enable(const std::string &file_name, const TimelineClock clock = TimelineClock::CUDA_EVENT);
+  void setClock(const TimelineClock clock);
+  // Rank of the spans of the calling thread, the process id of the trace.
+  static void setThreadRank(const int rank);
+
+  // index >= 0 is appended to the name, e.g. "layer 3".
+  void push(const char *name, cudaStream_t stream, const int index = -1);
+  void pop();
+
+  // Write the spans recorded so far, when no range is open. Returns false if the file cannot be written.
+  bool write();
+  size_t getDroppedNum() const { return dropped_num_.load(); }
+
+  struct ThreadBuffer;
+
+private:
+  Timeline();
+  ~Timeline();
+
+  ThreadBuffer *getThreadBuffer();
+  void resolve(ThreadBuffer &buffer, const bool wait);
+
+  std::atomic<bool> enabled_;
+  std::atomic<int> clock_;
+  std::atomic<size_t> dropped_num_;
+  std::atomic<ThreadBuffer *> buffers_;
+  std::atomic<int> thread_num_;
+  std::string file_name_;
+  size_t capacity_;
+  bool written_ = false;
+};
+
+} // namespace fastertransformer
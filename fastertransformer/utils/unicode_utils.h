@@ -0,0 +1,54 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * UTF-8 and Unicode character classes for the host-side tokenizers, without ICU.
+ **/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace fastertransformer
+{
+
+const uint32_t UNICODE_REPLACEMENT_CHARACTER = 0xFFFD;
+
+// \p{L}, \p{N} and \s of the regular expressions.
+bool is_unicode_letter(const uint32_t c);
+bool is_unicode_number(const uint32_t c);
+bool is_unicode_whitespace(const uint32_t c);
+// the general categories P*, C*, Zs and Mn
+bool is_unicode_punctuation(const uint32_t c);
+bool is_unicode_control(const uint32_t c);
+bool is_unicode_space_separator(const uint32_t c);
+bool is_unicode_nonspacing_mark(const uint32_t c);
+
+// Appends str.lower() of c, without the context of Final_Sigma.
+void append_unicode_lower(std::u32string &s, const uint32_t c);
+// Appends the NFD decomposition of c without its nonspacing marks, e.g. nothing for U+0301
+// and "e" for U+00E9, as the accent stripping of the BERT tokenizer.
+void append_unicode_strip_accents(std::u32string &s, const uint32_t c);
+
+// The code point at s, of at most size bytes. An invalid sequence gives U+FFFD with length 1.
+uint32_t decode_utf8(const char *s, const size_t size, size_t &length);
+void append_utf8(std::string &s, const uint32_t c);
+// s with each invalid byte replaced by U+FFFD, close to bytes.decode('utf-8', errors='replace').
+std::string sanitize_utf8(const std::string &s);
+
+} // namespace fastertransformer
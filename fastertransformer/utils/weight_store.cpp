@@ -0,0 +1,116 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "fastertransformer/utils/weight_store.h"
+#include <stdexcept>
+#include <tuple>
+
+namespace fastertransformer
+{
+
+bool WeightKey::operator<(const WeightKey &other) const
+{
+  return std::tie(model_path, device_id, tensor_para_rank, tensor_para_size, layer_para_rank, layer_para_size,
+                  data_type) < std::tie(other.model_path, other.device_id, other.tensor_para_rank,
+                                        other.tensor_para_size, other.layer_para_rank, other.layer_para_size,
+                                        other.data_type);
+}
+
+std::string WeightKey::toString() const
+{
+  return model_path + " " + data_type + " on device " + std::to_string(device_id) + ", tensor rank " +
+         std::to_string(tensor_para_rank) + "/" + std::to_string(tensor_para_size) + ", layer rank " +
+         std::to_string(layer_para_rank) + "/" + std::to_string(layer_para_size);
+}
+
+WeightBuffers::~WeightBuffers()
+{
+  for (auto &buffer : buffers_)
+    allocator_->free(buffer.second.first);
+}
+
+void *WeightBuffers::allocate(const std::string &name, const size_t bytes)
+{
+  if (buffers_.count(name))
+    throw std::runtime_error("[FT][ERROR] weight " + name + " is already allocated");
+  void *ptr = allocator_->malloc(bytes, false);
+  buffers_[name] = std::make_pair(ptr, bytes);
+  total_bytes_ += bytes;
+  return ptr;
+}
+
+void *WeightBuffers::find(const std::string &name) const
+{
+  auto it = buffers_.find(name);
+  return it == buffers_.end() ? nullptr : it->second.first;
+}
+
+WeightStore &WeightStore::getInstance()
+{
+  static WeightStore store;
+  return store;
+}
+
+std::shared_ptr<const WeightBuffers> WeightStore::acquire(const WeightKey &key,
+                                                          std::shared_ptr<const IAllocator> allocator,
+                                                          const std::function<void(WeightBuffers &)> &load)
+{
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [&] { return loading_.count(key) == 0; });
+    auto it = weights_.find(key);
+    if (it != weights_.end())
+    {
+      std::shared_ptr<const WeightBuffers> weights = it->second.lock();
+      if (weights != nullptr)
+        return weights;
+      weights_.erase(it);
+    }
+    loading_.insert(key);
+  }
+
+  std::shared_ptr<WeightBuffers> weights;
+  try
+  {
+    weights = std::make_shared<WeightBuffers>(allocator);
+    load(*weights);
+  }
+  catch (...)
+  {
+    weights.reset();
+    std::lock_guard<std::mutex> lock(mu_);
+    loading_.erase(key);
+    cv_.notify_all();
+    throw;
+  }
+
+  std::lock_guard<std::mutex> lock(mu_);
+  weights_[key] = weights;
+  loading_.erase(key);
+  cv_.notify_all();
+  return weights;
+}
+
+size_t WeightStore::getLiveNum()
+{
+  std::lock_guard<std::mutex> lock(mu_);
+  size_t num = 0;
+  for (const auto &it : weights_)
+    num += it.second.expired() ? 0 : 1;
+  return num;
+}
+
+} // namespace fastertransformer
@@ -0,0 +1,107 @@
+/*
+* Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+/**
+ * Weights shared by the model instances of a device
+ *
+ * The weights of a model never change once loaded, so the instances that run the same model
+ * files on the same device and rank, e.g. several GptModelInstances per GPU for concurrency, can
+ * read one copy. WeightStore::acquire() returns the WeightBuffers of a WeightKey: the ones that
+ * another holder of the key already has, or new ones that the caller loads. The last holder to
+ * release them frees them. The buffers that an instance writes, its stream and its cuBLAS handle
+ * stay per instance.
+ **/
+
+#pragma once
+
+#include "fastertransformer/utils/allocator.h"
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace fastertransformer
+{
+
+// The weights of a rank of a model, in one data type, on one device.
+struct WeightKey
+{
+  std::string model_path;
+  int device_id{0};
+  int tensor_para_rank{0};
+  int tensor_para_size{1};
+  int layer_para_rank{0};
+  int layer_para_size{1};
+  std::string data_type; // e.g. "fp16"
+
+  bool operator<(const WeightKey &other) const;
+  std::string toString() const;
+};
+
+/**
+ * Named buffers allocated with allocator and freed with it when the WeightBuffers are destroyed.
+ **/
+class WeightBuffers
+{
+public:
+  explicit WeightBuffers(std::shared_ptr<const IAllocator> allocator) : allocator_(allocator) {}
+  ~WeightBuffers();
+  WeightBuffers(const WeightBuffers &) = delete;
+  WeightBuffers &operator=(const WeightBuffers &) = delete;
+
+  // A new buffer of bytes; throws if name already has one.
+  void *allocate(const std::string &name, const size_t bytes);
+  // The buffer of name, nullptr if it has none.
+  void *find(const std::string &name) const;
+
+  size_t getBufferNum() const { return buffers_.size(); }
+  size_t getTotalBytes() const { return total_bytes_; }
+
+private:
+  std::shared_ptr<const IAllocator> allocator_;
+  std::map<std::string, std::pair<void *, size_t>> buffers_;
+  size_t total_bytes_ = 0;
+};
+
+class WeightStore
+{
+public:
+  // The store of the model instances of this process.
+  static WeightStore &getInstance();
+
+  /**
+   * The weights of key. If no holder has them, load fills in new WeightBuffers of allocator and
+   * they are kept while a holder has them. Concurrent calls for one key load once; the others
+   * wait for it. If load throws, nothing is kept and the exception goes to the caller.
+   **/
+  std::shared_ptr<const WeightBuffers> acquire(const WeightKey &key, std::shared_ptr<const IAllocator> allocator,
+                                               const std::function<void(WeightBuffers &)> &load);
+
+  // The keys whose weights a holder has.
+  size_t getLiveNum();
+
+private:
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::map<WeightKey, std::weak_ptr<const WeightBuffers>> weights_;
+  std::set<WeightKey> loading_;
+};
+
+} // namespace fastertransformer
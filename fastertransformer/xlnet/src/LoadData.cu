@@ -16,6 +16,7 @@
 
 
 #include "LoadData.h"
+#include <algorithm>
 
 /**********************LoadDataInput***********************************/
 // InputData
@@ -47,6 +48,19 @@ void InputDataHost::fillInputData(std::string file_name){
     setByNpz(my_npz, "segment_ids:0", seg_id, batch_size * seq_len);
 }
 
+int InputDataHost::getMaxLength(){
+    //input_mask is 1 on the padding, which is before the tokens
+    int max_length=0;
+    for(int i=0;i<batch_size;i++){
+        int num_pad=0;
+        while(num_pad<seq_len&&input_mask[i*seq_len+num_pad]!=0){
+            num_pad++;
+        }
+        max_length=std::max(max_length, seq_len-num_pad);
+    }
+    return max_length;
+}
+
 // InputDataDevice
 InputDataDevice::InputDataDevice(cudaStream_t stream,int batch_size, int seq_len):InputData(batch_size,seq_len){
     //std::cout<<"Construct InputDataDevice: "<<this->batch_size<<" "<<this->seq_len<<std::endl;
@@ -58,9 +72,23 @@ InputDataDevice::InputDataDevice(cudaStream_t stream,int batch_size, int seq_len
 
 
 void InputDataDevice::copyFromHost(InputDataHost& inputDataHost){
-    ck(cudaMemcpyAsync(inp_k, inputDataHost.inp_k,batch_size * seq_len*sizeof(int),cudaMemcpyHostToDevice,stream)); 
-    ck(cudaMemcpyAsync(input_mask, inputDataHost.input_mask,batch_size * seq_len*sizeof(float),cudaMemcpyHostToDevice,stream)); 
-    ck(cudaMemcpyAsync(seg_id, inputDataHost.seg_id,batch_size * seq_len*sizeof(int),cudaMemcpyHostToDevice,stream)); 
+    copyFromHost(inputDataHost, batch_size, seq_len);
+}
+
+void InputDataDevice::copyFromHost(InputDataHost& inputDataHost, int batch_size, int seq_len){
+    if(batch_size>inputDataHost.batch_size||seq_len>inputDataHost.seq_len
+            ||batch_size*seq_len>this->batch_size*this->seq_len){
+        throw std::runtime_error("InputDataDevice: cannot copy the input of shape ["
+                +std::to_string(batch_size)+", "+std::to_string(seq_len)+"]");
+    }
+    int offset=inputDataHost.seq_len-seq_len;
+    int host_pitch=inputDataHost.seq_len;
+    ck(cudaMemcpy2DAsync(inp_k, seq_len*sizeof(int), inputDataHost.inp_k+offset, host_pitch*sizeof(int),
+                seq_len*sizeof(int), batch_size, cudaMemcpyHostToDevice, stream)); 
+    ck(cudaMemcpy2DAsync(input_mask, seq_len*sizeof(float), inputDataHost.input_mask+offset, host_pitch*sizeof(float),
+                seq_len*sizeof(float), batch_size, cudaMemcpyHostToDevice, stream)); 
+    ck(cudaMemcpy2DAsync(seg_id, seq_len*sizeof(int), inputDataHost.seg_id+offset, host_pitch*sizeof(int),
+                seq_len*sizeof(int), batch_size, cudaMemcpyHostToDevice, stream)); 
 }
 
 
@@ -116,7 +144,12 @@ PreWeightHost<T>::PreWeightHost<T>(int hidden_dim, int num_token)
 
 template <typename T>
 void PreWeightHost<T>::fillPreWeight(std::string file_name){
-    cnpy::npz_t params_npz= cnpy::npz_load(file_name);
+    cnpy::NpzIndex params_npz(file_name);
+    fillPreWeight(params_npz);
+}
+
+template <typename T>
+void PreWeightHost<T>::fillPreWeight(cnpy::NpzIndex& params_npz){
     setByNpz(params_npz, "model/transformer/word_embedding/lookup_table:0", 
             this->params_word_emb_k, this->num_token* this->hidden_dim);
 }
@@ -308,7 +341,12 @@ LayerWeightHost<T>::LayerWeightHost(LayerWeightHost<T> const& layer_weight_host)
 
 template <typename T>
 void LayerWeightHost<T>::fillLayerWeight(int i_layer,std::string file_name){
-    cnpy::npz_t params_npz= cnpy::npz_load(file_name);
+    cnpy::NpzIndex params_npz(file_name);
+    fillLayerWeight(i_layer, params_npz);
+}
+
+template <typename T>
+void LayerWeightHost<T>::fillLayerWeight(int i_layer,cnpy::NpzIndex& params_npz){
     std::string str;
 
     str=paraName(i_layer, "/rel_attn/q/kernel:0");
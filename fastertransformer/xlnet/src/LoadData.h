@@ -37,6 +37,8 @@ class InputData{
 
     public:
         InputData(int batch_size, int seq_len);
+        int getBatchSize(){return batch_size;}
+        int getSeqLen(){return seq_len;}
         virtual ~InputData()=0;
  };
 class InputDataHost;
@@ -46,6 +48,10 @@ class InputDataDevice: public InputData{
     public:
         InputDataDevice(cudaStream_t stream,int batch_size, int seq_len);
         void copyFromHost(InputDataHost& input_data_host);
+        //Copies the last seq_len tokens of the first batch_size sequences of the host data, packed
+        //as [batch_size, seq_len]. The inputs are padded on the left, so these hold all the tokens
+        //of sequences no longer than seq_len.
+        void copyFromHost(InputDataHost& input_data_host, int batch_size, int seq_len);
         ~InputDataDevice();
 
         template <typename T>
@@ -56,9 +62,11 @@ class InputDataHost: public InputData{
     public:
         InputDataHost(int batch_size, int seq_len);
         void fillInputData(std::string file_name);
+        //The length of the longest sequence without its padding
+        int getMaxLength();
         ~InputDataHost();
 
-        friend void InputDataDevice::copyFromHost(InputDataHost& input_data_host);
+        friend void InputDataDevice::copyFromHost(InputDataHost& input_data_host, int batch_size, int seq_len);
 };
 
 /*************************Pre********************************/
@@ -98,6 +106,7 @@ class PreWeightHost: public PreWeight<T>{
         //PreWeightHost(PreWeightHost<T> const& pre_weight_host); 
 
         void fillPreWeight(std::string file_name);
+        void fillPreWeight(cnpy::NpzIndex& params_npz);
         ~PreWeightHost<T>();
         friend void PreWeightDevice<T>::copyFromHost(PreWeightHost<T>& pre_weight_host);
 };
@@ -164,7 +173,9 @@ template <typename T>
 class LayerWeightHost: public LayerWeight<T>{
     public:
         LayerWeightHost(int hidden_dim, int hidden_dim_ff);
+        //Loading from one NpzIndex of the parameters, the archive is only parsed once for all the layers
         void fillLayerWeight(int i_layer,std::string file_name);
+        void fillLayerWeight(int i_layer,cnpy::NpzIndex& params_npz);
         ~LayerWeightHost();
         friend void LayerWeightDevice<T>::copyFromHost(LayerWeightHost<T>& layer_weight_host);
         LayerWeightHost(LayerWeightHost<T> const& layer_weight_host); 
@@ -18,6 +18,7 @@
 
 
 #include "Xlnet.h"
+#include <algorithm>
 /*************Device Function**************/
 template<typename T> T __device__ cast(float v){
     return (T)v;
@@ -164,10 +165,57 @@ void __global__  relativePosition(T* attr_k_head_r, int hidden_dim, int seq_len)
 
 }
 
+/***********************Shape************************/
+template<typename T>
+void Xlnet<T>::setShape(int batch_size, int seq_len){
+    if(batch_size<=0||seq_len<=0||batch_size>max_batch_size||seq_len>max_seq_len){
+        throw std::runtime_error("Xlnet: the shape ["+std::to_string(batch_size)+", "+std::to_string(seq_len)
+                +"] is out of ["+std::to_string(max_batch_size)+", "+std::to_string(max_seq_len)+"]");
+    }
+    std::pair<int,int> shape(batch_size,seq_len);
+    auto it=gemm_algo_cache.find(shape);
+    if(it==gemm_algo_cache.end()){
+        //First run of the shape, the first layer finds its algorithms in the gemm file or
+        //profiles them, all the layers have the same gemms
+        arr_xlnet_layer[0].setShape(batch_size,seq_len);
+        std::vector<int> algo(arr_xlnet_layer[0].getCublasAlgo(), arr_xlnet_layer[0].getCublasAlgo()+NUM_CUBLAS_FUNC);
+        algo.insert(algo.end(), arr_xlnet_layer[0].getCublasFunc(), arr_xlnet_layer[0].getCublasFunc()+NUM_CUBLAS_FUNC);
+        it=gemm_algo_cache.insert(std::make_pair(shape,algo)).first;
+    }
+    for(int i=0;i<num_layers;i++){
+        arr_xlnet_layer[i].setShape(batch_size,seq_len,it->second.data(),it->second.data()+NUM_CUBLAS_FUNC);
+    }
+    this->batch_size=batch_size;
+    this->seq_len=seq_len;
+}
+
+template<typename T>
+int Xlnet<T>::getSeqLenBucket(int length){
+    for(size_t i=0;i<seq_len_buckets.size();i++){
+        if(length<=seq_len_buckets[i]){
+            return seq_len_buckets[i];
+        }
+    }
+    throw std::runtime_error("Xlnet: the sequence length "+std::to_string(length)
+            +" is larger than "+std::to_string(max_seq_len));
+}
+
+template<typename T>
+void Xlnet<T>::setSeqLenBuckets(std::vector<int> buckets){
+    buckets.push_back(max_seq_len);
+    std::sort(buckets.begin(),buckets.end());
+    buckets.erase(std::unique(buckets.begin(),buckets.end()),buckets.end());
+    if(buckets[0]<=0||buckets.back()>max_seq_len){
+        throw std::runtime_error("Xlnet: the sequence length buckets should be in [1, "
+                +std::to_string(max_seq_len)+"]");
+    }
+    seq_len_buckets=buckets;
+}
+
 /***********************Input Process************************/
 template<typename T>
 void Xlnet<T>::setInput(InputDataHost & input_data_host){
-    input_data_device.copyFromHost(input_data_host);
+    input_data_device.copyFromHost(input_data_host,batch_size,seq_len);
 }
 
 /***********************Pre-Process************************/
@@ -234,12 +282,14 @@ Xlnet<T>::Xlnet(cudaStream_t stream, cublasHandle_t cublas_handle,
         int hidden_dim, int hidden_dim_ff,int num_token, float epsilon,
         PreWeightHost<T> & pre_weight_host,
         std::vector<LayerWeightHost<T> > & arr_layer_weight_host,
-        std::string gemm_file_name):
+        std::string gemm_file_name, int ifCheck):
     stream(stream),
     cublas_handle(cublas_handle),
     num_layers(num_layers),
     batch_size(batch_size),
     seq_len(seq_len),
+    max_batch_size(batch_size),
+    max_seq_len(seq_len),
     head_num(head_num),
     size_per_head(size_per_head),
     hidden_dim(hidden_dim),
@@ -249,7 +299,7 @@ Xlnet<T>::Xlnet(cudaStream_t stream, cublasHandle_t cublas_handle,
     pre_weight_device(stream,hidden_dim,num_token),
     arr_xlnet_layer(num_layers, XlnetLayer<T>(batch_size,seq_len,head_num,
                 size_per_head,hidden_dim,hidden_dim_ff,epsilon,stream,
-                cublas_handle,gemm_file_name))
+                cublas_handle,gemm_file_name,"./",ifCheck))
 {
     // Set metadata
     //std::cout<<"Construct XLNet "<<std::endl; 
@@ -259,6 +309,26 @@ Xlnet<T>::Xlnet(cudaStream_t stream, cublasHandle_t cublas_handle,
     deviceMalloc(&seg_mat, batch_size*seq_len*seq_len*2);
     deviceMalloc(&attr_k_head_r, seq_len*2*hidden_dim);
 
+    //Activations, the layer i writes hidden_buf[i%2]
+    workspace_size=arr_xlnet_layer[0].getWorkspaceSize();
+    deviceMalloc(&workspace, workspace_size/sizeof(T));
+    deviceMalloc(&hidden_buf[0], batch_size*seq_len*hidden_dim);
+    deviceMalloc(&hidden_buf[1], batch_size*seq_len*hidden_dim);
+    for(int i=0;i<num_layers;i++){
+        arr_xlnet_layer[i].setWorkspace(workspace, hidden_buf[i%2]);
+    }
+
+    //The layers have read or profiled the algorithms of the largest shape
+    std::vector<int> algo(arr_xlnet_layer[0].getCublasAlgo(), arr_xlnet_layer[0].getCublasAlgo()+NUM_CUBLAS_FUNC);
+    algo.insert(algo.end(), arr_xlnet_layer[0].getCublasFunc(), arr_xlnet_layer[0].getCublasFunc()+NUM_CUBLAS_FUNC);
+    gemm_algo_cache[std::make_pair(batch_size,seq_len)]=algo;
+
+    std::vector<int> buckets;
+    for(int len=32;len<seq_len;len*=2){
+        buckets.push_back(len);
+    }
+    setSeqLenBuckets(buckets);
+
     //Set weight
     pre_weight_device.copyFromHost(pre_weight_host);
 
@@ -272,11 +342,19 @@ Xlnet<T>::Xlnet(cudaStream_t stream, cublasHandle_t cublas_handle,
 
 template <typename T>
 void Xlnet<T>::run(InputDataHost& input_data_host){
+    int bucket=getSeqLenBucket(input_data_host.getMaxLength());
+    setShape(input_data_host.getBatchSize(), std::min(bucket,input_data_host.getSeqLen()));
+
     setInput(input_data_host);
     preProcess();
     runAttentionLayers();
 }
 
+template <typename T>
+T* Xlnet<T>::getOutput(){
+    return hidden_buf[(num_layers-1)%2];
+}
+
 
 template <typename T>
 Xlnet<T>::~Xlnet() {
@@ -285,6 +363,9 @@ Xlnet<T>::~Xlnet() {
     deviceFree(attn_mask);
     deviceFree(seg_mat);
     deviceFree(attr_k_head_r);
+    deviceFree(workspace);
+    deviceFree(hidden_buf[0]);
+    deviceFree(hidden_buf[1]);
 
 }
 
@@ -20,6 +20,7 @@
 #pragma once
 
 #include "XlnetLayer.h"
+#include <map>
 #include <vector>
 
 template <typename T>
@@ -31,6 +32,12 @@ class Xlnet{
 
         std::string gemm_file_name;
 
+        //The cuBLAS algorithms and functions of each [batch_size, seq_len] run so far
+        std::map<std::pair<int,int>, std::vector<int> > gemm_algo_cache;
+
+        //The sequence lengths the inputs are cut to, ascending and ending with max_seq_len
+        std::vector<int> seq_len_buckets;
+
         //Configure block
         void blockAttnMask(dim3 &grid, dim3& block);
 
@@ -39,10 +46,12 @@ class Xlnet{
         cudaStream_t stream;
         cublasHandle_t cublas_handle;
 
-        //Metadata 
+        //Metadata, batch_size and seq_len are the shape of the current run
         int num_layers;
         int batch_size;
         int seq_len;
+        int max_batch_size;
+        int max_seq_len;
 
         int head_num;
         int size_per_head;
@@ -61,6 +70,12 @@ class Xlnet{
         //Layers 
         std::vector< XlnetLayer<T> > arr_xlnet_layer;
 
+        //Activations of the layers, shared since they run in sequence; only the hidden
+        //state between two layers is double-buffered
+        T* workspace;
+        size_t workspace_size;
+        T* hidden_buf[2];
+
 
 
     public:
@@ -69,13 +84,27 @@ class Xlnet{
         int hidden_dim,int hidden_dim_ff,int num_token, float epsilon,
         PreWeightHost<T> & pre_weight_host,
         std::vector<LayerWeightHost<T> >& arr_layer_weight_host,
-        std::string gemm_file_name);
+        std::string gemm_file_name, int ifCheck=0);
+
+        //batch_size and seq_len are the largest shape to run, the buffers are allocated for it.
+        //Any smaller shape runs on the same buffers.
+        void setShape(int batch_size, int seq_len);
+        int getBatchSize(){return batch_size;}
+        int getSeqLen(){return seq_len;}
+
+        //The smallest bucket that holds length. By default the buckets are the powers of two
+        //from 32 and max_seq_len; the fp16 kernels need the powers of two from 32 to 512.
+        int getSeqLenBucket(int length);
+        void setSeqLenBuckets(std::vector<int> buckets);
 
         void setInput(InputDataHost& input_data_host);
         void preProcess();
         void runAttentionLayers();
 
+        //Runs the batch of the input cut to the bucket of its longest sequence, the output
+        //is [batch_size, seq_len, hidden_dim] for the last seq_len tokens of each sequence
         void run(InputDataHost& input_data_host);
+        T* getOutput();
 
         ~Xlnet();
 };
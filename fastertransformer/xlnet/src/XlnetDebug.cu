@@ -112,7 +112,7 @@ XlnetDebug<T>::XlnetDebug(cudaStream_t stream, cublasHandle_t cublas_handle,
         std::string gemm_file_name):
     Xlnet<T>(stream,cublas_handle,num_layers,batch_size,seq_len, 
         head_num,size_per_head,hidden_dim,hidden_dim_ff,num_token,epsilon,
-        pre_weight_host,arr_layer_weight_host,gemm_file_name)
+        pre_weight_host,arr_layer_weight_host,gemm_file_name,1)
 
 {
     //std::cout << "Object XlnetDebug is being created" <<std::endl;
@@ -121,41 +121,10 @@ XlnetDebug<T>::XlnetDebug(cudaStream_t stream, cublasHandle_t cublas_handle,
     this->buf_size = this->batch_size * this->seq_len*this->head_num * this->size_per_head;
     this->qk_buf_size = this->batch_size * this->seq_len * this->head_num * this->seq_len;
 
-    //report required device memory
-    long long int total_mem=0;
-    total_mem+=this->seq_len*2*this->hidden_dim;
-    total_mem+=buf_size*3;
-
-    total_mem+=buf_size;
-    total_mem+=buf_size;
-    total_mem+=qk_buf_size;
-
-    total_mem+=buf_size;
-    total_mem+=this->batch_size*this->seq_len*2*this->hidden_dim;
-    total_mem+=this->batch_size*this->seq_len*head_num*this->seq_len*2;
-    total_mem+=this->batch_size*this->seq_len*head_num*this->seq_len;
-
-    total_mem+=buf_size;
-    total_mem+=this->batch_size*2*this->hidden_dim;
-
-    total_mem+=this->batch_size*head_num*this->seq_len*2;
-    total_mem+=this->batch_size*head_num*this->seq_len*2;
-    total_mem+=this->batch_size*head_num*this->seq_len*this->seq_len;
-    total_mem+=this->batch_size*head_num*this->seq_len*this->seq_len;
-
-    total_mem+=this->batch_size*head_num*this->seq_len*this->seq_len;
-    total_mem+=buf_size;
-    total_mem+=this->batch_size*head_num*this->seq_len*size_per_head;
-    total_mem+=this->batch_size*head_num*this->seq_len*size_per_head;
-
-    total_mem+=this->batch_size*this->hidden_dim*this->seq_len;
-    total_mem+=this->batch_size*this->hidden_dim*this->seq_len;
-
-    total_mem+=this->batch_size*this->seq_len*this->hidden_dim_ff;
-    total_mem+=this->batch_size*this->seq_len*this->hidden_dim;
-    total_mem+=this->batch_size*this->seq_len*this->hidden_dim;
-
-    total_mem=total_mem*this->num_layers;
+    //report required device memory: the shared workspace of the layers, the two hidden
+    //buffers and the preprocessed inputs
+    long long int total_mem=this->workspace_size/sizeof(T);
+    total_mem+=2*this->batch_size*this->seq_len*this->hidden_dim;
 
     total_mem+=(this->batch_size+2)*this->seq_len*this->hidden_dim;
     total_mem+=this->batch_size*this->seq_len*this->seq_len*2;
@@ -780,24 +780,32 @@ void XlnetLayer<T>:: setCublasAlgo(){
     int t_seq_len=0;
     int t_batch=0;
     int t_gpu_id=-1;
+    int t_algo[NUM_CUBLAS_FUNC];
+    int t_func[NUM_CUBLAS_FUNC];
     int ifFound=0;
     if(fd != NULL)
     {
         while(!feof(fd)){
             int res=fscanf(fd, "%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,%d ,",
                     &t_gpu_id, &t_seq_len, &t_batch, 
-                    &cublas_algo[0], &cublas_algo[1], &cublas_algo[2],&cublas_algo[3], &cublas_algo[4], &cublas_algo[5],
-                    &cublas_algo[6], &cublas_algo[7], &cublas_algo[8],&cublas_algo[9], 
-                    &cublas_func[0], &cublas_func[1], &cublas_func[2],&cublas_func[3], &cublas_func[4], &cublas_func[5],
-                    &cublas_func[6], &cublas_func[7], &cublas_func[8],&cublas_func[9]);
-            if(t_seq_len==seq_len&&t_batch==batch_size&&gpu_id==t_gpu_id&&res==FULL_GEMM_LENGTH){
+                    &t_algo[0], &t_algo[1], &t_algo[2],&t_algo[3], &t_algo[4], &t_algo[5],
+                    &t_algo[6], &t_algo[7], &t_algo[8],&t_algo[9], 
+                    &t_func[0], &t_func[1], &t_func[2],&t_func[3], &t_func[4], &t_func[5],
+                    &t_func[6], &t_func[7], &t_func[8],&t_func[9]);
+            if(res!=FULL_GEMM_LENGTH){
+                break;
+            }
+            if(t_seq_len==seq_len&&t_batch==batch_size&&gpu_id==t_gpu_id){
+                copyCublasAlgo(t_algo,t_func);
                 ifFound=1;
                 break;
             }
         }
         fclose(fd);
-    }else if(fd == NULL && ifFound == 0){
-        printf("Can not find the cublas configuration data. Run profiling code to find the best cublas function.\n");
+    }
+    if(ifFound == 0){
+        printf("Can not find the cublas configuration of batch_size=%d, seq_len=%d. Run profiling code to find the best cublas function.\n",
+                batch_size, seq_len);
         profileCublasAlgo();
         recordCublasGemm();
     }
@@ -818,6 +826,8 @@ XlnetLayer<T>::XlnetLayer(int batch_size, int seq_len,
         std::string gemm_file,std::string dir,int ifCheck):
     batch_size(batch_size),
     seq_len(seq_len),
+    max_batch_size(batch_size),
+    max_seq_len(seq_len),
     head_num(head_num),
     size_per_head(size_per_head),
     stream(stream),
@@ -838,8 +848,6 @@ XlnetLayer<T>::XlnetLayer(int batch_size, int seq_len,
         setCublas();
         setCublasAlgo();
 
-        //set device variable
-        allocDeviceMem();
         //Sync
         cudaDeviceSynchronize();
         ck(cudaGetLastError());
@@ -849,6 +857,8 @@ template <typename T>
 XlnetLayer<T>::XlnetLayer(XlnetLayer<T> const& xlnet_layer):
     batch_size(xlnet_layer.batch_size),
     seq_len(xlnet_layer.seq_len),
+    max_batch_size(xlnet_layer.max_batch_size),
+    max_seq_len(xlnet_layer.max_seq_len),
     head_num(xlnet_layer.head_num),
     size_per_head(xlnet_layer.size_per_head),
     stream(xlnet_layer.stream),
@@ -867,52 +877,102 @@ XlnetLayer<T>::XlnetLayer(XlnetLayer<T> const& xlnet_layer):
         cudaGetDevice(&gpu_id);
         setCublas();
         copyCublasAlgo(xlnet_layer.cublas_algo,xlnet_layer.cublas_func);
+    }
 
-        //set device variable
-        allocDeviceMem();
 
-    }
+//The buffers of forward() with the steps of their first write and last read: 1 QKV, 2 k_head_r,
+//3 prepareMatrixes, 4-6 ac/bd/ef, 7 transpose102, 8 ef*seg_mat, 9 transpose201, 10 relShiftBd,
+//11 calAttnScore, 12 attn_vec, 13 transpose102v2, 14 attn_out, 15 layerNorm, 16 fc1, 17 gelu,
+//18 fc2, 19 layerNormv2. With ifCheck, the buffers verified by XlnetDebug live to the end.
+//The buffers are sized for the largest shape, a smaller shape uses the beginning of each.
+template <typename T>
+size_t XlnetLayer<T>::planLayerWorkspace(std::vector<T**>& ptrs, std::vector<BufferLife>& buffers){
+    const int end=19;
+    auto add=[&](T** ptr, size_t size, int first, int last, bool is_checked){
+        ptrs.push_back(ptr);
+        buffers.push_back(BufferLife{size*sizeof(T), first, (ifCheck&&is_checked)?end:last, 0});
+    };
+    const int batch_size=max_batch_size;
+    const int seq_len=max_seq_len;
+    size_t buf_elems=(size_t)batch_size*seq_len*head_num*size_per_head;
+    size_t qk_elems=(size_t)batch_size*seq_len*head_num*seq_len;
+
+    add(&qkv_buf, buf_elems*3, 1, 11, true);
+    add(&k_head_r, (size_t)seq_len*2*hidden_dim, 2, 3, true);
+
+    add(&q_buf, buf_elems, 3, 4, false);
+    add(&k_buf, buf_elems, 3, 4, false);
+    add(&q_buf_bd, buf_elems, 3, 5, false);
+    add(&k_buf_bd, (size_t)batch_size*seq_len*2*hidden_dim, 3, 5, false);
+    add(&q_buf_ef, buf_elems, 3, 6, false);
+    add(&k_buf_ef, (size_t)batch_size*2*hidden_dim, 3, 6, false);
+
+    add(&qk_buf, qk_elems, 4, 11, false);
+    add(&qk_buf_bd, qk_elems*2, 5, 10, false);
+    add(&qk_buf_ef, (size_t)batch_size*head_num*seq_len*2, 6, 7, false);
+    add(&qk_buf_ef_trans, (size_t)batch_size*head_num*seq_len*2, 7, 8, false);
+    add(&qk_buf_ef_seg, qk_elems, 8, 9, false);
+    add(&qk_buf_ef_seg_trans, qk_elems, 9, 11, false);
+    add(&qk_buf_bd_shift, qk_elems, 10, 11, false);
+
+    add(&attn_score, qk_elems, 11, 12, false);
+    add(&value_buf_trans, buf_elems, 11, 12, false);
+    add(&attn_vec, buf_elems, 12, 13, false);
+    add(&attn_vec_trans, buf_elems, 13, 14, true);
+
+    add(&attn_out, (size_t)batch_size*seq_len*hidden_dim, 14, 15, false);
+    add(&attn_layernorm, (size_t)batch_size*seq_len*hidden_dim, 15, 19, true);
+
+    add(&output_fc1, (size_t)batch_size*seq_len*hidden_dim_ff, 16, 18, true);
+    add(&output_fc2, (size_t)batch_size*seq_len*hidden_dim, 18, 19, false);
+
+    return planWorkspace(buffers);
+}
 
+template <typename T>
+size_t XlnetLayer<T>::getWorkspaceSize(){
+    std::vector<T**> ptrs;
+    std::vector<BufferLife> buffers;
+    return planLayerWorkspace(ptrs, buffers);
+}
 
 template <typename T>
-void XlnetLayer<T>::allocDeviceMem() {
-    deviceMalloc(&k_head_r, seq_len*2*hidden_dim);
-    deviceMalloc(&qkv_buf,buf_size*3);
+void XlnetLayer<T>::setWorkspace(T* workspace, T* output){
+    std::vector<T**> ptrs;
+    std::vector<BufferLife> buffers;
+    planLayerWorkspace(ptrs, buffers);
+    for(size_t i=0;i<ptrs.size();i++){
+        *ptrs[i]=(T*)((char*)workspace+buffers[i].offset);
+    }
     query_buf=qkv_buf;
     key_buf=qkv_buf+buf_size;
     value_buf=qkv_buf+2*buf_size;
 
-    deviceMalloc(&q_buf,buf_size);
-    deviceMalloc(&k_buf,buf_size);
-
-    deviceMalloc(&qk_buf,qk_buf_size);
-
-    deviceMalloc(&q_buf_bd, buf_size);
-    deviceMalloc(&k_buf_bd, batch_size*seq_len*2*hidden_dim);
-    deviceMalloc(&qk_buf_bd, batch_size*seq_len*head_num*seq_len*2);
-    deviceMalloc(&qk_buf_bd_shift, batch_size*seq_len*head_num*seq_len);
-
-    deviceMalloc(&q_buf_ef, buf_size);
-    deviceMalloc(&k_buf_ef, batch_size*2*hidden_dim);
-
-    deviceMalloc(&qk_buf_ef, batch_size*head_num*seq_len*2);
-    deviceMalloc(&qk_buf_ef_trans, batch_size*head_num*seq_len*2);
-    deviceMalloc(&qk_buf_ef_seg, batch_size*head_num*seq_len*seq_len);
-    deviceMalloc(&qk_buf_ef_seg_trans, batch_size*head_num*seq_len*seq_len);
-
-    deviceMalloc(&attn_score, batch_size*head_num*seq_len*seq_len);
-    deviceMalloc(&value_buf_trans,buf_size);
-    deviceMalloc(&attn_vec, batch_size*head_num*seq_len*size_per_head);
-    deviceMalloc(&attn_vec_trans, batch_size*head_num*seq_len*size_per_head);
+    output_layernorm=output;
+}
 
-    deviceMalloc(&attn_out, batch_size*hidden_dim*seq_len);
-    deviceMalloc(&attn_layernorm, batch_size*hidden_dim*seq_len);
+template <typename T>
+void XlnetLayer<T>::setShape(int batch_size, int seq_len, const int* cublas_algo, const int* cublas_func){
+    if(batch_size<=0||seq_len<=0||batch_size>max_batch_size||seq_len>max_seq_len){
+        throw std::runtime_error("XlnetLayer: the shape ["+std::to_string(batch_size)+", "+std::to_string(seq_len)
+                +"] is out of ["+std::to_string(max_batch_size)+", "+std::to_string(max_seq_len)+"]");
+    }
+    this->batch_size=batch_size;
+    this->seq_len=seq_len;
+    this->buf_size = batch_size * seq_len*head_num * size_per_head;
+    this->qk_buf_size = batch_size * seq_len * head_num * seq_len;
 
-    deviceMalloc(&output_fc1, batch_size*seq_len*hidden_dim_ff);
-    deviceMalloc(&output_fc2, batch_size*seq_len*hidden_dim);
-    deviceMalloc(&output_layernorm, batch_size*seq_len*hidden_dim);
-} 
+    //q, k and v are packed in qkv_buf
+    query_buf=qkv_buf;
+    key_buf=qkv_buf+buf_size;
+    value_buf=qkv_buf+2*buf_size;
 
+    if(cublas_algo!=NULL&&cublas_func!=NULL){
+        copyCublasAlgo(cublas_algo,cublas_func);
+    }else{
+        setCublasAlgo();
+    }
+}
 
 template <typename T>
 void XlnetLayer<T>::setLayerWeight(LayerWeightHost<T> & layer_weight_host){
@@ -922,42 +982,6 @@ void XlnetLayer<T>::setLayerWeight(LayerWeightHost<T> & layer_weight_host){
 template <typename T>
 XlnetLayer<T>::~XlnetLayer() {
     //std::cout << "Deconstruct XlnetLayer" <<std::endl;
-
-    deviceFree(k_head_r);
-    deviceFree(qkv_buf);
-
-    deviceFree(q_buf);
-    deviceFree(k_buf);
-    deviceFree(qk_buf);
-
-
-    deviceFree(q_buf_bd);
-    deviceFree(k_buf_bd);
-    deviceFree(qk_buf_bd);
-    deviceFree(qk_buf_bd_shift);
-
-    deviceFree(q_buf_ef);
-    deviceFree(k_buf_ef);
-
-
-    deviceFree(qk_buf_ef);
-    deviceFree(qk_buf_ef_trans);
-    deviceFree(qk_buf_ef_seg);
-    deviceFree(qk_buf_ef_seg_trans);
-
-    deviceFree(attn_score);
-    deviceFree(value_buf_trans);
-
-    deviceFree(attn_vec);
-    deviceFree(attn_vec_trans);
-
-    deviceFree(attn_out);
-    deviceFree(attn_layernorm);
-
-    deviceFree(output_fc1);
-    deviceFree(output_fc2);
-    deviceFree(output_layernorm);
-
 }
 
 
@@ -28,9 +28,12 @@ class XlnetDebug;
 template <typename T>
 class XlnetLayer{
     private:
-        //metadata
+        //metadata, batch_size and seq_len are the shape of the current run, at most the
+        //shape the layer is built for
         int batch_size;
         int seq_len;
+        int max_batch_size;
+        int max_seq_len;
         int head_num;
         int size_per_head;
 
@@ -68,7 +71,7 @@ class XlnetLayer{
         LayerWeightDevice<T>  layer_weight_device;
     
 
-        void allocDeviceMem();
+        size_t planLayerWorkspace(std::vector<T**>& ptrs, std::vector<BufferLife>& buffers);
         void setCublas();
 
         float profileCublasGemmEx(cublasOperation_t transa, cublasOperation_t transb,
@@ -148,6 +151,18 @@ class XlnetLayer{
 
         void setLayerWeight(LayerWeightHost<T> & layer_weight_host);
 
+        //The activations live in a workspace shared by all the layers, which run one after
+        //the other. The output is written to output, which must not be the input of the layer.
+        size_t getWorkspaceSize();
+        void setWorkspace(T* workspace, T* output);
+
+        //Runs the next forwards on [batch_size, seq_len], within the shape given at construction.
+        //The cuBLAS algorithms are copied if given, otherwise read from the gemm file, or
+        //profiled and appended to it if the shape is not there.
+        void setShape(int batch_size, int seq_len, const int* cublas_algo=NULL, const int* cublas_func=NULL);
+        const int* getCublasAlgo(){return cublas_algo;}
+        const int* getCublasFunc(){return cublas_func;}
+
         T* forward(T* to_tensor,T* attn_mask,T* seg_mat,T* attr_k_head_r);
 
         ~XlnetLayer();
@@ -11,6 +11,13 @@
 #include<stdint.h>
 #include<stdexcept>
 #include <regex>
+#include<atomic>
+#include<mutex>
+#include<thread>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
 
 char cnpy::BigEndianTest() {
     int x = 1;
@@ -63,7 +70,9 @@ void cnpy::parse_npy_header(unsigned char* buffer,size_t& word_size, std::vector
     //std::string magic_string(buffer,6);
     uint8_t major_version = *reinterpret_cast<uint8_t*>(buffer+6);
     uint8_t minor_version = *reinterpret_cast<uint8_t*>(buffer+7);
-    uint16_t header_len = *reinterpret_cast<uint16_t*>(buffer+8);
+    //the buffer can be unaligned in the mapping of an NpzIndex
+    uint16_t header_len;
+    memcpy(&header_len,buffer+8,sizeof(header_len));
     std::string header(reinterpret_cast<char*>(buffer+9),header_len);
 
     size_t loc1, loc2;
@@ -325,6 +334,176 @@ cnpy::NpyArray cnpy::npz_load(std::string fname, std::string varname) {
     throw std::runtime_error("npz_load: Variable name "+varname+" not found in "+fname);
 }
 
+namespace {
+    template<typename T> T read_le(const unsigned char* p) {
+        T v;
+        memcpy(&v,p,sizeof(T));
+        return v;
+    }
+}
+
+struct cnpy::NpzIndex::Member {
+    uint16_t compr_method;
+    size_t compr_bytes;
+    size_t uncompr_bytes;
+    const unsigned char* compr_data;
+    std::vector<unsigned char> inflated;
+    NpyView view;
+    std::once_flag loaded;
+};
+
+cnpy::NpzIndex::NpzIndex(std::string fname) : fname(fname), mapping(NULL), mapping_size(0) {
+    int fd = open(fname.c_str(),O_RDONLY);
+    if(fd < 0) throw std::runtime_error("NpzIndex: Unable to open file "+fname);
+    struct stat st;
+    if(fstat(fd,&st) != 0 || st.st_size < 22) {
+        close(fd);
+        throw std::runtime_error("NpzIndex: "+fname+" is not a zip file");
+    }
+    mapping_size = st.st_size;
+    void* ptr = mmap(NULL,mapping_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(ptr == MAP_FAILED) throw std::runtime_error("NpzIndex: Unable to map file "+fname);
+    mapping = (const unsigned char*)ptr;
+
+    try {
+        //the end of central directory record, followed by a comment of at most 64 KB
+        size_t eocd = mapping_size - 22;
+        const size_t eocd_min = mapping_size > 22 + 65535 ? mapping_size - 22 - 65535 : 0;
+        while(read_le<uint32_t>(mapping+eocd) != 0x06054b50) {
+            if(eocd == eocd_min) {
+                throw std::runtime_error("NpzIndex: "+fname+" has no zip central directory");
+            }
+            eocd--;
+        }
+        const uint16_t nrecs = read_le<uint16_t>(mapping+eocd+10);
+        const uint32_t cd_offset = read_le<uint32_t>(mapping+eocd+16);
+        if(cd_offset == 0xFFFFFFFF || nrecs == 0xFFFF) {
+            throw std::runtime_error("NpzIndex: zip64 archives are not supported, "+fname);
+        }
+
+        size_t p = cd_offset;
+        for(uint16_t i = 0; i < nrecs; i++) {
+            if(p + 46 > mapping_size || read_le<uint32_t>(mapping+p) != 0x02014b50)
+                throw std::runtime_error("NpzIndex: corrupted central directory in "+fname);
+            const uint16_t name_len = read_le<uint16_t>(mapping+p+28);
+            const uint16_t extra_len = read_le<uint16_t>(mapping+p+30);
+            const uint16_t comment_len = read_le<uint16_t>(mapping+p+32);
+            const uint32_t local_offset = read_le<uint32_t>(mapping+p+42);
+            std::string varname(reinterpret_cast<const char*>(mapping+p+46),name_len);
+            if(varname.size() > 4 && varname.compare(varname.size()-4,4,".npy") == 0)
+                varname.erase(varname.size()-4);
+
+            std::unique_ptr<Member> member(new Member());
+            member->compr_method = read_le<uint16_t>(mapping+p+10);
+            member->compr_bytes = read_le<uint32_t>(mapping+p+20);
+            member->uncompr_bytes = read_le<uint32_t>(mapping+p+24);
+
+            //the data follows the local header, whose extra field can differ from the central one
+            if(local_offset + 30 > mapping_size || read_le<uint32_t>(mapping+local_offset) != 0x04034b50)
+                throw std::runtime_error("NpzIndex: corrupted local header of "+varname+" in "+fname);
+            const size_t data_offset = local_offset + 30 + read_le<uint16_t>(mapping+local_offset+26)
+                + read_le<uint16_t>(mapping+local_offset+28);
+            if(data_offset + member->compr_bytes > mapping_size)
+                throw std::runtime_error("NpzIndex: truncated member "+varname+" in "+fname);
+            if(member->compr_method != 0 && member->compr_method != 8)
+                throw std::runtime_error("NpzIndex: unsupported compression of "+varname+" in "+fname);
+            member->compr_data = mapping + data_offset;
+
+            members[varname] = std::move(member);
+            p += 46 + name_len + extra_len + comment_len;
+        }
+    } catch(...) {
+        munmap((void*)mapping,mapping_size);
+        throw;
+    }
+}
+
+cnpy::NpzIndex::~NpzIndex() {
+    if(mapping != NULL) munmap((void*)mapping,mapping_size);
+}
+
+void cnpy::NpzIndex::load(Member& member) {
+    const unsigned char* npy = member.compr_data;
+    if(member.compr_method == 8) {
+        member.inflated.resize(member.uncompr_bytes);
+        z_stream d_stream;
+        d_stream.zalloc = Z_NULL;
+        d_stream.zfree = Z_NULL;
+        d_stream.opaque = Z_NULL;
+        d_stream.avail_in = 0;
+        d_stream.next_in = Z_NULL;
+        if(inflateInit2(&d_stream, -MAX_WBITS) != Z_OK)
+            throw std::runtime_error("NpzIndex: inflateInit2 failed");
+        d_stream.avail_in = member.compr_bytes;
+        d_stream.next_in = const_cast<unsigned char*>(member.compr_data);
+        d_stream.avail_out = member.uncompr_bytes;
+        d_stream.next_out = member.inflated.data();
+        const int err = inflate(&d_stream, Z_FINISH);
+        inflateEnd(&d_stream);
+        if(err != Z_STREAM_END)
+            throw std::runtime_error("NpzIndex: inflate failed in "+fname);
+        npy = member.inflated.data();
+    }
+
+    NpyView& view = member.view;
+    cnpy::parse_npy_header(const_cast<unsigned char*>(npy),view.word_size,view.shape,view.fortran_order);
+    //'descr': '<f4', the kind follows the byte order
+    const std::string header(reinterpret_cast<const char*>(npy+10),read_le<uint16_t>(npy+8));
+    const size_t descr = header.find("descr");
+    if(descr == std::string::npos || descr+10 >= header.size())
+        throw std::runtime_error("NpzIndex: no descr in the header of an array in "+fname);
+    view.type = header[descr+10];
+    view.num_vals = 1;
+    for(size_t i = 0; i < view.shape.size(); i++) view.num_vals *= view.shape[i];
+    //the array is at the end of the npy file, after the header and its padding
+    const size_t num_bytes = view.num_vals*view.word_size;
+    if(num_bytes > member.uncompr_bytes)
+        throw std::runtime_error("NpzIndex: truncated array in "+fname);
+    view.data = reinterpret_cast<const char*>(npy + member.uncompr_bytes - num_bytes);
+}
+
+bool cnpy::NpzIndex::contains(const std::string& varname) const {
+    return members.find(varname) != members.end();
+}
+
+const cnpy::NpyView& cnpy::NpzIndex::get(const std::string& varname) {
+    auto it = members.find(varname);
+    if(it == members.end())
+        throw std::runtime_error("NpzIndex: Variable name "+varname+" not found in "+fname);
+    Member& member = *it->second;
+    std::call_once(member.loaded,[&]() { load(member); });
+    return member.view;
+}
+
+void cnpy::NpzIndex::inflateAll(int thread_num) {
+    std::vector<std::string> varnames = names();
+    if(thread_num <= 0) thread_num = std::max(1,(int)std::thread::hardware_concurrency());
+    thread_num = std::min(thread_num,(int)varnames.size());
+
+    std::atomic<size_t> next(0);
+    std::vector<std::exception_ptr> errors(thread_num);
+    auto work = [&](int t) {
+        try {
+            for(size_t i = next++; i < varnames.size(); i = next++) get(varnames[i]);
+        } catch(...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    for(int t = 1; t < thread_num; t++) threads.emplace_back(work,t);
+    if(thread_num > 0) work(0);
+    for(auto& thread : threads) thread.join();
+    for(auto& error : errors)
+        if(error) std::rethrow_exception(error);
+}
+
+std::vector<std::string> cnpy::NpzIndex::names() const {
+    std::vector<std::string> varnames;
+    for(auto& member : members) varnames.push_back(member.first);
+    return varnames;
+}
+
 cnpy::NpyArray cnpy::npy_load(std::string fname) {
 
     FILE* fp = fopen(fname.c_str(), "rb");
@@ -67,6 +67,45 @@ namespace cnpy {
    
     using npz_t = std::map<std::string, NpyArray>; 
 
+    //An array of an npz archive indexed by NpzIndex; the data belongs to the index and may be
+    //unaligned in the mapping, so read it with memcpy
+    struct NpyView {
+        const char* data;
+        std::vector<size_t> shape;
+        char type; //the kind of the descr, as map_type() returns it
+        size_t word_size;
+        bool fortran_order;
+        size_t num_vals;
+    };
+
+    //Index of an npz archive, built from its central directory in one pass over a read-only
+    //mmap of the file. The stored members are read in place from the mapping; the compressed
+    //members are inflated on their first get(), or all at once by inflateAll() on several
+    //threads. get() can be called from several threads.
+    class NpzIndex {
+        public:
+            explicit NpzIndex(std::string fname);
+            ~NpzIndex();
+            NpzIndex(const NpzIndex&) = delete;
+            NpzIndex& operator=(const NpzIndex&) = delete;
+
+            bool contains(const std::string& varname) const;
+            //Throws a runtime_error if the archive has no varname
+            const NpyView& get(const std::string& varname);
+            //thread_num<=0 uses the hardware threads
+            void inflateAll(int thread_num=0);
+            std::vector<std::string> names() const;
+
+        private:
+            struct Member;
+            void load(Member& member);
+
+            std::string fname;
+            const unsigned char* mapping;
+            size_t mapping_size;
+            std::map<std::string, std::unique_ptr<Member> > members;
+    };
+
     char BigEndianTest();
     char map_type(const std::type_info& t);
     template<typename T> std::vector<char> create_npy_header(const std::vector<size_t>& shape);
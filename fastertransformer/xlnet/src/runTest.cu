@@ -89,15 +89,18 @@ void layerRes(cudaStream_t stream, cublasHandle_t cublas_handle,
     InputDataHost input_data_host(batch_size,seq_len);
     input_data_host.fillInputData(input_file);
 
-    //Load Host Weight Data
+    //Load Host Weight Data, the parameters are parsed once and inflated in parallel
+    cnpy::NpzIndex params_npz(para_file);
+    params_npz.inflateAll();
+
     PreWeightHost<T> pre_weight_host(hidden_dim,num_token);
-    pre_weight_host.fillPreWeight(para_file);
+    pre_weight_host.fillPreWeight(params_npz);
 
     std::vector<LayerWeightHost<T> > arr_layer_weight_host(num_layers, 
             LayerWeightHost<T>(hidden_dim,hidden_dim_ff));
 
     for(int i=0;i<num_layers;i++){
-        arr_layer_weight_host[i].fillLayerWeight(i,para_file);
+        arr_layer_weight_host[i].fillLayerWeight(i,params_npz);
     }
 
     //Construct Debug Class
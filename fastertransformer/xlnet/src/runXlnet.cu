@@ -82,15 +82,19 @@ int main(int argc, char* argv[]) {
     InputDataHost input_data_host(batch_size,seq_len);
     input_data_host.fillInputData(input_file);
 
+    //Parse the parameters once and inflate them in parallel
+    cnpy::NpzIndex params_npz(para_file);
+    params_npz.inflateAll();
+
     PreWeightHost<DATA_TYPE> pre_weight_host(hidden_dim,num_token);
-    pre_weight_host.fillPreWeight(para_file);
+    pre_weight_host.fillPreWeight(params_npz);
 
     std::vector<LayerWeightHost<DATA_TYPE> > arr_layer_weight_host(num_layers, 
             LayerWeightHost<DATA_TYPE>(hidden_dim,hidden_dim_ff));
 
     for(int i=0;i<num_layers;i++){
         std::cout<<"Run layer "<<i<<std::endl;
-        arr_layer_weight_host[i].fillLayerWeight(i,para_file);
+        arr_layer_weight_host[i].fillLayerWeight(i,params_npz);
     }
 
     Xlnet<DATA_TYPE> xlnet(stream,cublas_handle,num_layers,batch_size,seq_len,
@@ -99,6 +103,7 @@ int main(int argc, char* argv[]) {
 
 
     xlnet.run(input_data_host);
+    std::cout<<"Run batch_size="<<xlnet.getBatchSize()<<", seq_len="<<xlnet.getSeqLen()<<std::endl;
 
     std::cout<<"END"<<std::endl;
     return 0;
@@ -16,6 +16,7 @@
 
 
 #include "utils.h"
+#include <algorithm>
 
 
 using namespace std;
@@ -129,6 +130,45 @@ void deviceFree(T* & ptr){
 
 }
 
+//Greedy placement, the largest buffers first, each at the lowest offset that does not
+//overlap the placed buffers whose lives intersect its life
+size_t planWorkspace(std::vector<BufferLife>& buffers, size_t alignment){
+    std::vector<int> order(buffers.size());
+    for(size_t i=0;i<order.size();i++){
+        order[i]=i;
+    }
+    std::stable_sort(order.begin(),order.end(),[&](int a, int b){
+            return buffers[a].size>buffers[b].size;});
+
+    size_t total=0;
+    std::vector<int> placed;
+    for(int i: order){
+        BufferLife& buffer=buffers[i];
+        size_t size=(buffer.size+alignment-1)/alignment*alignment;
+
+        std::vector<std::pair<size_t,size_t> > used;
+        for(int j: placed){
+            if(buffers[j].first<=buffer.last&&buffer.first<=buffers[j].last){
+                size_t used_size=(buffers[j].size+alignment-1)/alignment*alignment;
+                used.push_back(std::make_pair(buffers[j].offset,buffers[j].offset+used_size));
+            }
+        }
+        std::sort(used.begin(),used.end());
+
+        size_t offset=0;
+        for(auto& range: used){
+            if(offset+size<=range.first){
+                break;
+            }
+            offset=std::max(offset,range.second);
+        }
+        buffer.offset=offset;
+        placed.push_back(i);
+        total=std::max(total,offset+size);
+    }
+    return total;
+}
+
     template <typename T>
 void deviceMemcpyHtoD(cudaStream_t stream, T* d_ptr,T* h_ptr, int size)
 {
@@ -193,6 +233,38 @@ void setByNpz<__half>(cnpy::npz_t & my_npz, std::string name, __half* h_ptr, int
     free(half_data);
 }
 
+//The array of name, checked to hold values of type and word_size, in slices of size values, e.g.
+//the biases of all the layers, of which offset is one
+static const cnpy::NpyView& getNpyView(cnpy::NpzIndex & npz_index, const std::string& name,
+                                       char type, size_t word_size, int size, int offset){
+    const cnpy::NpyView& arr = npz_index.get(name);
+    if(arr.type != type || arr.word_size != word_size){
+        throw std::runtime_error("setByNpz: "+name+" holds "+std::string(1,arr.type)+std::to_string(arr.word_size)+
+                                 " values, expected "+std::string(1,type)+std::to_string(word_size));
+    }
+    if(size <= 0 || offset < 0 || offset%size != 0 || arr.num_vals%size != 0 || (size_t)(offset+size) > arr.num_vals){
+        throw std::runtime_error("setByNpz: "+name+" has "+std::to_string(arr.num_vals)+" values, expected "+
+                                 std::to_string(size)+" at "+std::to_string(offset)+" in slices of "+std::to_string(size));
+    }
+    return arr;
+}
+
+template <typename T>
+void setByNpz(cnpy::NpzIndex & npz_index, std::string name, T* h_ptr, int size, int offset){
+    const cnpy::NpyView& arr = getNpyView(npz_index, name, cnpy::map_type(typeid(T)), sizeof(T), size, offset);
+    memcpy (h_ptr, arr.data+sizeof(T)*offset, sizeof(T)*size);
+}
+template<>
+void setByNpz<__half>(cnpy::NpzIndex & npz_index, std::string name, __half* h_ptr, int size, int offset){
+    //the archives hold fp32 values
+    const cnpy::NpyView& arr = getNpyView(npz_index, name, 'f', sizeof(float), size, offset);
+    const char* loaded_data = arr.data+sizeof(float)*offset;
+    for(int i=0;i<size;i++){
+        float value;
+        memcpy(&value, loaded_data+sizeof(float)*i, sizeof(float));
+        h_ptr[i]=__float2half_rn(value);
+    }
+}
 
 void printKey(cnpy::npz_t & npz){
     std::map<std::string,cnpy::NpyArray>::iterator iter;
@@ -477,6 +549,8 @@ template  void deviceMemcpyHtoD<__half>(cudaStream_t stream, __half* d_ptr,__hal
 template  void setByNpz<int>(cnpy::npz_t & my_npz, std::string name, int* h_ptr, int size, int offset);
 template  void setByNpz<float>(cnpy::npz_t & my_npz, std::string name, float* h_ptr, int size, int offset);
 template  void setByNpz<__half>(cnpy::npz_t & my_npz, std::string name, __half* h_ptr, int size, int offset);
+template  void setByNpz<int>(cnpy::NpzIndex & npz_index, std::string name, int* h_ptr, int size, int offset);
+template  void setByNpz<float>(cnpy::NpzIndex & npz_index, std::string name, float* h_ptr, int size, int offset);
 
 template bool checkByNpz<float>(cnpy::npz_t& data_npz,cudaStream_t stream,std::string name, float* d_ptr, int size);
 template bool checkByNpz<__half>(cnpy::npz_t& data_npz,cudaStream_t stream,std::string name, __half* d_ptr, int size);
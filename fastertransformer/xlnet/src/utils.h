@@ -36,6 +36,7 @@
 #include <nvml.h>
 #include <string>
 #include <iomanip>
+#include <vector>
 #include "string.h"
 
 /*************MACRO FUNCTION**************/
@@ -92,6 +93,18 @@ template <typename T> void deviceMemset(T* ptr, int value, int size);
 template <typename T> void deviceFree(T* & ptr);
 template <typename T> void deviceMemcpyHtoD(cudaStream_t stream, T* d_ptr,T* h_ptr, int size);
 template <typename T> float castToFloat(T input);
+
+/*********************Workspace planning***********************/
+//A buffer of bytes, live from the step of its first write to the step of its last read
+struct BufferLife{
+    size_t size;
+    int first;
+    int last;
+    size_t offset;
+};
+//Sets the offsets of the buffers in one workspace so that buffers that are live at the
+//same step do not overlap, and returns the size of the workspace
+size_t planWorkspace(std::vector<BufferLife>& buffers, size_t alignment=256);
  
 /*********************Npz &Npy File Process functions***********************/
 std::string paraName(int i_layer, std::string sub_para);
@@ -103,6 +116,7 @@ void setByNpy(cudaStream_t stream, float* d_ptr, int size,std::string dir="./",
 void setByNpy(cudaStream_t stream, __half* d_ptr, int size,std::string dir="./", std::string fname="tmp.npy");
 
 template <typename T> void setByNpz(cnpy::npz_t & my_npz, std::string name, T* h_ptr, int size, int offset=0);
+template <typename T> void setByNpz(cnpy::NpzIndex & npz_index, std::string name, T* h_ptr, int size, int offset=0);
 
 void checkByNpy(cudaStream_t stream, float* d_ptr, int size,std::string dir="./", std::string fname="tmp.npy");
 void checkByNpy(cudaStream_t stream, __half* d_ptr, int size,std::string dir="./", std::string fname="tmp.npy");
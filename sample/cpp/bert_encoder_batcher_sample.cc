@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Serves requests of random lengths with the length-bucketed encoder batcher and
+// BertEncoderBatchRunner (fastertransformer/bert_encoder_batcher.h) on the GPU, with random
+// weights shared by all layers. Every request must get the output of a batch of only that
+// request, padded to the same bucket, so the packing, the padding removal and the scatter
+// keep the requests apart.
+
+#include "fastertransformer/bert_encoder_batcher.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cuda_fp16.h>
+#include <random>
+#include <sys/time.h>
+
+using namespace fastertransformer;
+
+template <typename T>
+void device_malloc(T **ptr, int size, float scale)
+{
+  check_cuda_error(cudaMalloc((void **)ptr, sizeof(T) * size));
+  std::vector<T> tmp(size);
+  for (int i = 0; i < size; i++)
+    tmp[i] = (T)(((rand() % 100) / 50.0f - 1.0f) * scale);
+  check_cuda_error(cudaMemcpy(*ptr, tmp.data(), sizeof(T) * size, cudaMemcpyHostToDevice));
+}
+
+template <typename T>
+int bert_encoder_batcher_sample(int request_num, int max_batch_size, int num_layers, int head_num, int size_per_head);
+
+int main(int argc, char *argv[])
+{
+  if (argc != 7)
+  {
+    printf("[ERROR] bert_encoder_batcher_sample request_num max_batch_size num_layers head_num size_per_head is_fp16\n");
+    printf("e.g., ./bin/bert_encoder_batcher_sample 200 32 12 12 64 0\n");
+    return 0;
+  }
+  struct cudaDeviceProp prop;
+  check_cuda_error(cudaGetDeviceProperties(&prop, 0));
+  printf("Device %s\n", prop.name);
+
+  const int request_num = atoi(argv[1]);
+  const int max_batch_size = atoi(argv[2]);
+  const int num_layers = atoi(argv[3]);
+  const int head_num = atoi(argv[4]);
+  const int size_per_head = atoi(argv[5]);
+  if (atoi(argv[6]) == 0)
+    return bert_encoder_batcher_sample<float>(request_num, max_batch_size, num_layers, head_num, size_per_head);
+  else if (atoi(argv[6]) == 1)
+    return bert_encoder_batcher_sample<half>(request_num, max_batch_size, num_layers, head_num, size_per_head);
+  printf("[ERROR] is_fp16 should be 0 (use float) or 1 (use half). \n");
+  return -1;
+}
+
+template <typename T>
+int bert_encoder_batcher_sample(int request_num, int max_batch_size, int num_layers, int head_num, int size_per_head)
+{
+  const int hidden_dim = head_num * size_per_head;
+  EncoderBatcherConfig config;
+  config.max_batch_size = max_batch_size;
+  config.max_tokens = max_batch_size * config.seq_len_buckets.back();
+  const int max_seq_len = config.seq_len_buckets.back();
+
+  BertInitParam<T> param;
+  T *d_qkv_kernel, *d_qkv_bias;
+  device_malloc(&d_qkv_kernel, hidden_dim * hidden_dim * 3, 0.05f);
+  device_malloc(&d_qkv_bias, hidden_dim * 3, 0.05f);
+  param.self_attention.query_weight.kernel = d_qkv_kernel;
+  param.self_attention.key_weight.kernel = d_qkv_kernel + hidden_dim * hidden_dim;
+  param.self_attention.value_weight.kernel = d_qkv_kernel + 2 * hidden_dim * hidden_dim;
+  param.self_attention.query_weight.bias = d_qkv_bias;
+  param.self_attention.key_weight.bias = d_qkv_bias + hidden_dim;
+  param.self_attention.value_weight.bias = d_qkv_bias + 2 * hidden_dim;
+  T *d_attr_output_kernel, *d_attr_output_bias, *d_attr_beta, *d_attr_gamma;
+  device_malloc(&d_attr_output_kernel, hidden_dim * hidden_dim, 0.05f);
+  device_malloc(&d_attr_output_bias, hidden_dim, 0.05f);
+  device_malloc(&d_attr_beta, hidden_dim, 0.1f);
+  device_malloc(&d_attr_gamma, hidden_dim, 1.0f);
+  param.self_attention.attention_output_weight.kernel = d_attr_output_kernel;
+  param.self_attention.attention_output_weight.bias = d_attr_output_bias;
+  param.self_layernorm.beta = d_attr_beta;
+  param.self_layernorm.gamma = d_attr_gamma;
+  T *d_inter_kernel, *d_inter_bias, *d_output_kernel, *d_output_bias, *d_output_beta, *d_output_gamma;
+  device_malloc(&d_inter_kernel, hidden_dim * hidden_dim * 4, 0.05f);
+  device_malloc(&d_inter_bias, hidden_dim * 4, 0.05f);
+  device_malloc(&d_output_kernel, hidden_dim * hidden_dim * 4, 0.05f);
+  device_malloc(&d_output_bias, hidden_dim, 0.05f);
+  device_malloc(&d_output_beta, hidden_dim, 0.1f);
+  device_malloc(&d_output_gamma, hidden_dim, 1.0f);
+  param.ffn.intermediate_weight.kernel = d_inter_kernel;
+  param.ffn.intermediate_weight.bias = d_inter_bias;
+  param.ffn.output_weight.kernel = d_output_kernel;
+  param.ffn.output_weight.bias = d_output_bias;
+  param.ffn_layernorm.beta = d_output_beta;
+  param.ffn_layernorm.gamma = d_output_gamma;
+  std::vector<BertInitParam<T>> layer_params(num_layers, param);
+
+  cublasHandle_t cublas_handle;
+  cublasLtHandle_t cublaslt_handle;
+  check_cuda_error(cublasCreate(&cublas_handle));
+  check_cuda_error(cublasLtCreate(&cublaslt_handle));
+  cudaStream_t stream;
+  check_cuda_error(cudaStreamCreate(&stream));
+
+  const fastertransformer::OperationType type = sizeof(T) == sizeof(float) ? OperationType::FP32 : OperationType::FP16;
+  typedef BertEncoderTransformerTraits<type, cuda::OpenMultiHeadAttention> EncoderTraits_;
+  fastertransformer::Allocator<AllocatorType::CUDA> allocator(0);
+  int wrong_num = 0;
+  {
+    BertEncoderBatchRunner<EncoderTraits_> runner(&allocator, layer_params, head_num, size_per_head,
+                                                  max_batch_size, max_seq_len,
+                                                  cublas_handle, cublaslt_handle, stream);
+    EncoderBatcher<T> batcher(config, &runner);
+
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<int> seq_len_dist(1, max_seq_len);
+    std::uniform_real_distribution<float> value_dist(-1.0f, 1.0f);
+    std::vector<std::vector<T>> inputs(request_num), outputs(request_num);
+    std::vector<std::future<void>> futures;
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < request_num; i++)
+    {
+      const int seq_len = seq_len_dist(gen);
+      inputs[i].resize(seq_len * hidden_dim);
+      for (T &value : inputs[i])
+        value = (T)value_dist(gen);
+      outputs[i].resize(seq_len * hidden_dim);
+      futures.push_back(batcher.enqueue(inputs[i].data(), outputs[i].data(), seq_len));
+    }
+    for (auto &future : futures)
+      future.get();
+    gettimeofday(&end, NULL);
+    batcher.stop();
+
+    EncoderBatcherStats stats = batcher.getStats();
+    printf("[INFO] requests %zu batches %zu avg batch size %.2f\n",
+           stats.request_num, stats.batch_num, (float)stats.request_num / stats.batch_num);
+    printf("[INFO] valid tokens %zu padded tokens %zu padding ratio %.2f%%\n",
+           stats.valid_token_num, stats.padded_token_num,
+           100.0f * (stats.padded_token_num - stats.valid_token_num) / stats.padded_token_num);
+    printf("[INFO] total time %.2f ms\n", (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) * 0.001);
+
+    // each request alone, padded to its bucket
+    const float tolerance = sizeof(T) == sizeof(float) ? 1e-3f : 5e-2f;
+    std::vector<T> reference;
+    for (int i = 0; i < request_num; i++)
+    {
+      EncoderRequest<T> request;
+      request.input = inputs[i].data();
+      request.seq_len = inputs[i].size() / hidden_dim;
+      reference.resize(inputs[i].size());
+      request.output = reference.data();
+      EncoderBatch<T> batch;
+      batch.bucket = batcher.getBucket(request.seq_len);
+      batch.seq_len = config.seq_len_buckets[batch.bucket];
+      batch.requests.push_back(&request);
+      runner.run(batch);
+      for (size_t j = 0; j < reference.size(); j++)
+      {
+        const float diff = fabsf((float)outputs[i][j] - (float)reference[j]);
+        if (!(diff <= tolerance * (1.0f + fabsf((float)reference[j]))))
+        {
+          if (wrong_num < 10)
+            printf("[ERROR] request %d (seq_len %d), element %zu: %f instead of %f\n", i, request.seq_len, j,
+                   (float)outputs[i][j], (float)reference[j]);
+          wrong_num++;
+          break;
+        }
+      }
+    }
+  }
+
+  check_cuda_error(cudaStreamDestroy(stream));
+  check_cuda_error(cublasLtDestroy(cublaslt_handle));
+  check_cuda_error(cublasDestroy(cublas_handle));
+  for (T *ptr : {d_qkv_kernel, d_qkv_bias, d_attr_output_kernel, d_attr_output_bias, d_attr_beta, d_attr_gamma,
+                 d_inter_kernel, d_inter_bias, d_output_kernel, d_output_bias, d_output_beta, d_output_gamma})
+    check_cuda_error(cudaFree(ptr));
+
+  if (wrong_num != 0)
+  {
+    printf("[ERROR] %d requests got a wrong output\n", wrong_num);
+    return -1;
+  }
+  printf("[INFO] all outputs are correct\n");
+  return 0;
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Runs BertEncoderEarlyExit (fastertransformer/bert_encoder_early_exit.h) on the GPU with random
+// weights shared by all layers, and a random exit head after every other layer and the last one.
+// Prints the time of a batch and the layers the samples exit after. Every sample must exit after
+// the same layer, with the same logits, as in a batch of only that sample; with FP16, the
+// mismatches are only counted, since a confidence close to the threshold may round either way.
+
+#include "fastertransformer/bert_encoder_early_exit.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cuda_fp16.h>
+#include <sys/time.h>
+
+using namespace fastertransformer;
+
+template <typename T>
+void device_malloc(T **ptr, int size, float scale)
+{
+  check_cuda_error(cudaMalloc((void **)ptr, sizeof(T) * size));
+  std::vector<T> tmp(size);
+  for (int i = 0; i < size; i++)
+    tmp[i] = (T)(((rand() % 100) / 50.0f - 1.0f) * scale);
+  check_cuda_error(cudaMemcpy(*ptr, tmp.data(), sizeof(T) * size, cudaMemcpyHostToDevice));
+}
+
+template <typename T>
+int bert_encoder_early_exit_sample(int batch_size, int num_layers, int seq_len, int head_num, int size_per_head,
+                                   float threshold);
+
+int main(int argc, char *argv[])
+{
+  if (argc != 8)
+  {
+    printf("[ERROR] bert_encoder_early_exit_sample batch_size num_layers seq_len head_num size_per_head is_fp16 threshold\n");
+    printf("e.g., ./bin/bert_encoder_early_exit_sample 32 12 128 12 64 0 0.9\n");
+    return 0;
+  }
+  struct cudaDeviceProp prop;
+  check_cuda_error(cudaGetDeviceProperties(&prop, 0));
+  printf("Device %s\n", prop.name);
+
+  const int batch_size = atoi(argv[1]);
+  const int num_layers = atoi(argv[2]);
+  const int seq_len = atoi(argv[3]);
+  const int head_num = atoi(argv[4]);
+  const int size_per_head = atoi(argv[5]);
+  const float threshold = atof(argv[7]);
+  if (atoi(argv[6]) == 0)
+    return bert_encoder_early_exit_sample<float>(batch_size, num_layers, seq_len, head_num, size_per_head, threshold);
+  else if (atoi(argv[6]) == 1)
+    return bert_encoder_early_exit_sample<half>(batch_size, num_layers, seq_len, head_num, size_per_head, threshold);
+  printf("[ERROR] is_fp16 should be 0 (use float) or 1 (use half). \n");
+  return -1;
+}
+
+template <typename T>
+int bert_encoder_early_exit_sample(int batch_size, int num_layers, int seq_len, int head_num, int size_per_head,
+                                   float threshold)
+{
+  const int hidden_dim = head_num * size_per_head;
+  const int num_classes = 2;
+
+  BertInitParam<T> param;
+  T *d_qkv_kernel, *d_qkv_bias;
+  device_malloc(&d_qkv_kernel, hidden_dim * hidden_dim * 3, 0.05f);
+  device_malloc(&d_qkv_bias, hidden_dim * 3, 0.05f);
+  param.self_attention.query_weight.kernel = d_qkv_kernel;
+  param.self_attention.key_weight.kernel = d_qkv_kernel + hidden_dim * hidden_dim;
+  param.self_attention.value_weight.kernel = d_qkv_kernel + 2 * hidden_dim * hidden_dim;
+  param.self_attention.query_weight.bias = d_qkv_bias;
+  param.self_attention.key_weight.bias = d_qkv_bias + hidden_dim;
+  param.self_attention.value_weight.bias = d_qkv_bias + 2 * hidden_dim;
+  T *d_attr_output_kernel, *d_attr_output_bias, *d_attr_beta, *d_attr_gamma;
+  device_malloc(&d_attr_output_kernel, hidden_dim * hidden_dim, 0.05f);
+  device_malloc(&d_attr_output_bias, hidden_dim, 0.05f);
+  device_malloc(&d_attr_beta, hidden_dim, 0.1f);
+  device_malloc(&d_attr_gamma, hidden_dim, 1.0f);
+  param.self_attention.attention_output_weight.kernel = d_attr_output_kernel;
+  param.self_attention.attention_output_weight.bias = d_attr_output_bias;
+  param.self_layernorm.beta = d_attr_beta;
+  param.self_layernorm.gamma = d_attr_gamma;
+  T *d_inter_kernel, *d_inter_bias, *d_output_kernel, *d_output_bias, *d_output_beta, *d_output_gamma;
+  device_malloc(&d_inter_kernel, hidden_dim * hidden_dim * 4, 0.05f);
+  device_malloc(&d_inter_bias, hidden_dim * 4, 0.05f);
+  device_malloc(&d_output_kernel, hidden_dim * hidden_dim * 4, 0.05f);
+  device_malloc(&d_output_bias, hidden_dim, 0.05f);
+  device_malloc(&d_output_beta, hidden_dim, 0.1f);
+  device_malloc(&d_output_gamma, hidden_dim, 1.0f);
+  param.ffn.intermediate_weight.kernel = d_inter_kernel;
+  param.ffn.intermediate_weight.bias = d_inter_bias;
+  param.ffn.output_weight.kernel = d_output_kernel;
+  param.ffn.output_weight.bias = d_output_bias;
+  param.ffn_layernorm.beta = d_output_beta;
+  param.ffn_layernorm.gamma = d_output_gamma;
+  std::vector<BertInitParam<T>> layer_params(num_layers, param);
+
+  // a head after every other layer and the last one
+  std::vector<EarlyExitHead<T>> heads(num_layers);
+  std::vector<T *> d_head_kernels;
+  std::vector<std::vector<float>> head_biases(num_layers, std::vector<float>(num_classes));
+  for (int layer = 0; layer < num_layers; layer++)
+  {
+    if (layer % 2 == 0 && layer != num_layers - 1)
+      continue;
+    T *d_head_kernel;
+    device_malloc(&d_head_kernel, hidden_dim * num_classes, 0.2f);
+    d_head_kernels.push_back(d_head_kernel);
+    for (float &bias : head_biases[layer])
+      bias = (rand() % 100) / 50.0f - 1.0f;
+    heads[layer].kernel = d_head_kernel;
+    heads[layer].bias = head_biases[layer].data();
+  }
+
+  std::vector<int> sequence_length(batch_size);
+  for (int &len : sequence_length)
+    len = 1 + rand() % seq_len;
+  T *d_from_tensor;
+  device_malloc(&d_from_tensor, batch_size * seq_len * hidden_dim, 1.0f);
+
+  cublasHandle_t cublas_handle;
+  cublasLtHandle_t cublaslt_handle;
+  check_cuda_error(cublasCreate(&cublas_handle));
+  check_cuda_error(cublasLtCreate(&cublaslt_handle));
+  cudaStream_t stream;
+  check_cuda_error(cudaStreamCreate(&stream));
+
+  const fastertransformer::OperationType type = sizeof(T) == sizeof(float) ? OperationType::FP32 : OperationType::FP16;
+  typedef BertEncoderTransformerTraits<type, cuda::OpenMultiHeadAttention> EncoderTraits_;
+  fastertransformer::Allocator<AllocatorType::CUDA> allocator(0);
+  int wrong_num = 0;
+  {
+    BertEncoderEarlyExit<EncoderTraits_> encoder(&allocator, layer_params, heads, num_classes, threshold,
+                                                 head_num, size_per_head, batch_size, seq_len,
+                                                 cublas_handle, cublaslt_handle, stream);
+    std::vector<float> logits(batch_size * num_classes);
+    std::vector<int> exit_layer(batch_size);
+
+    const int ite = 50;
+    for (int i = 0; i < ite; i++)
+      encoder.forward(d_from_tensor, sequence_length.data(), batch_size, seq_len, logits.data(), exit_layer.data());
+    struct timeval start, end;
+    cudaDeviceSynchronize();
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < ite; i++)
+      encoder.forward(d_from_tensor, sequence_length.data(), batch_size, seq_len, logits.data(), exit_layer.data());
+    gettimeofday(&end, NULL);
+
+    std::vector<int> exit_num(num_layers, 0);
+    for (int b = 0; b < batch_size; b++)
+      exit_num[exit_layer[b]]++;
+    printf("[INFO] batch_size %d seq_len %d layer %d threshold %.2f FT-CPP-time %.2f ms ( %d iterations) \n",
+           batch_size, seq_len, num_layers, threshold,
+           ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) * 0.001) / ite, ite);
+    printf("[INFO] samples exiting after each layer:");
+    for (int layer = 0; layer < num_layers; layer++)
+      printf(" %d", exit_num[layer]);
+    printf("\n");
+
+    // each sample alone
+    const float tolerance = sizeof(T) == sizeof(float) ? 1e-3f : 5e-2f;
+    for (int b = 0; b < batch_size; b++)
+    {
+      float sample_logits[num_classes];
+      int sample_exit_layer;
+      encoder.forward(d_from_tensor + (size_t)b * seq_len * hidden_dim, &sequence_length[b], 1, seq_len,
+                      sample_logits, &sample_exit_layer);
+      bool same = sample_exit_layer == exit_layer[b];
+      for (int c = 0; c < num_classes; c++)
+        same = same && fabsf(sample_logits[c] - logits[b * num_classes + c]) <= tolerance * (1.0f + fabsf(sample_logits[c]));
+      if (!same)
+      {
+        if (wrong_num < 10)
+          printf("[%s] sample %d exits after layer %d with logits %f %f in the batch, after %d with %f %f alone\n",
+                 sizeof(T) == sizeof(float) ? "ERROR" : "WARNING", b, exit_layer[b], logits[b * num_classes],
+                 logits[b * num_classes + 1], sample_exit_layer, sample_logits[0], sample_logits[1]);
+        wrong_num++;
+      }
+    }
+  }
+
+  check_cuda_error(cudaStreamDestroy(stream));
+  check_cuda_error(cublasLtDestroy(cublaslt_handle));
+  check_cuda_error(cublasDestroy(cublas_handle));
+  for (T *ptr : {d_qkv_kernel, d_qkv_bias, d_attr_output_kernel, d_attr_output_bias, d_attr_beta, d_attr_gamma,
+                 d_inter_kernel, d_inter_bias, d_output_kernel, d_output_bias, d_output_beta, d_output_gamma,
+                 d_from_tensor})
+    check_cuda_error(cudaFree(ptr));
+  for (T *ptr : d_head_kernels)
+    check_cuda_error(cudaFree(ptr));
+
+  if (wrong_num != 0 && sizeof(T) == sizeof(float))
+  {
+    printf("[ERROR] %d samples differ from their batch of one\n", wrong_num);
+    return -1;
+  }
+  printf("[INFO] %d samples differ from their batch of one\n", wrong_num);
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Encodes a file of queries, one per line with an optional second sentence after a tab,
+ * with the C++ WordPiece tokenizer in batches, and reports the throughput for 1 and
+ * thread_num threads. The input ids of each query, without the padding, can be written to
+ * a file, to compare them with the Python tokenizer.
+ *
+ * ./bin/bert_tokenizer_sample vocab.txt queries.txt [max_seq_len] [batch_size] [thread_num] [do_lower_case] [input_ids.csv]
+ *
+ * sample/tensorflow/tensorflow_bert/bert_tokenizer_bench.py times tokenization.py on the same file
+ * and checks that the ids are the same.
+ **/
+
+#include "fastertransformer/utils/bert_tokenizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fastertransformer;
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    printf("[ERROR] bert_tokenizer_sample vocab.txt queries.txt [max_seq_len] [batch_size] [thread_num] [do_lower_case] [input_ids.csv]\n");
+    printf("e.g., ./bin/bert_tokenizer_sample vocab.txt queries.txt 128 32 8 1 input_ids.csv\n");
+    return 0;
+  }
+  const int max_seq_len = argc >= 4 ? atoi(argv[3]) : 128;
+  const int batch_size = argc >= 5 ? atoi(argv[4]) : 32;
+  const int thread_num = argc >= 6 ? atoi(argv[5]) : (int)std::thread::hardware_concurrency();
+  const bool do_lower_case = argc >= 7 ? atoi(argv[6]) != 0 : true;
+  const std::string output = argc >= 8 ? argv[7] : "";
+
+  auto load_begin = std::chrono::steady_clock::now();
+  BertTokenizer tokenizer(argv[1], do_lower_case);
+  const double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_begin).count();
+  printf("[INFO] vocab size %d, loaded in %.2f ms\n", tokenizer.getVocabSize(), load_ms);
+
+  std::ifstream query_file(argv[2], std::ios::in);
+  if (!query_file.is_open())
+  {
+    printf("[ERROR] Cannot open the file '%s'. \n", argv[2]);
+    exit(-1);
+  }
+  std::vector<std::string> texts_a, texts_b;
+  bool has_pairs = false;
+  std::string line;
+  while (std::getline(query_file, line))
+  {
+    const size_t tab = line.find('\t');
+    texts_a.push_back(line.substr(0, tab));
+    texts_b.push_back(tab == std::string::npos ? "" : line.substr(tab + 1));
+    has_pairs |= tab != std::string::npos;
+  }
+  if (!has_pairs)
+    texts_b.clear();
+  const int query_num = (int)texts_a.size();
+
+  std::vector<int> input_ids((size_t)query_num * max_seq_len);
+  std::vector<int> segment_ids((size_t)query_num * max_seq_len);
+  std::vector<int> sequence_lengths(query_num);
+  for (const int threads : {1, thread_num})
+  {
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < query_num; i += batch_size)
+    {
+      const int end = std::min(i + batch_size, query_num);
+      std::vector<std::string> batch_a(texts_a.begin() + i, texts_a.begin() + end);
+      std::vector<std::string> batch_b;
+      if (has_pairs)
+        batch_b.assign(texts_b.begin() + i, texts_b.begin() + end);
+      tokenizer.encodeBatch(batch_a, batch_b, max_seq_len, input_ids.data() + (size_t)i * max_seq_len,
+                            segment_ids.data() + (size_t)i * max_seq_len, sequence_lengths.data() + i, threads);
+    }
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    printf("[INFO] %d queries, batch size %d, %d threads: %.3f ms, %.2f us per query\n",
+           query_num, batch_size, threads, ms, ms * 1000.0 / std::max(query_num, 1));
+  }
+
+  if (!output.empty())
+  {
+    std::ofstream out_file(output, std::ios::out);
+    if (!out_file.is_open())
+    {
+      printf("[ERROR] Cannot write the file '%s'. \n", output.c_str());
+      exit(-1);
+    }
+    for (int i = 0; i < query_num; i++)
+    {
+      for (int j = 0; j < sequence_lengths[i]; j++)
+        out_file << (j == 0 ? "" : ", ") << input_ids[(size_t)i * max_seq_len + j];
+      out_file << std::endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the host side of the early exit of fastertransformer/utils/early_exit.h: the heads
+// against logits computed by hand, and the shrinking batch of BertEncoderEarlyExit. The rows of a
+// padded batch hold the id of their sample and their position; the padding is removed, then the
+// samples that exit (none, all, every other one, or at random) are dropped, and the survivors are
+// gathered with the offsets of shrink() the way remove_sequence_length_padding does. The offsets
+// must match the ones recomputed from the lengths, and the gathered rows the survivors in order.
+// Needs no GPU; returns 1 on a failure.
+
+#include "fastertransformer/utils/early_exit.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace fastertransformer;
+
+static const int hidden_units = 2;
+
+struct Check
+{
+  int failures = 0;
+  void expect(const bool ok, const char *what)
+  {
+    printf("%-64s %s\n", what, ok ? "ok" : "FAILED");
+    failures += ok ? 0 : 1;
+  }
+};
+
+static float get_value(const int id, const int position, const int h) { return id * 1000.0f + position + 0.5f * h; }
+
+// [batch_size, seq_len, hidden_units], the padding rows hold -1
+static std::vector<float> make_padded_tensor(const std::vector<int> &seq_lens, const int seq_len)
+{
+  std::vector<float> tensor(seq_lens.size() * seq_len * hidden_units, -1.0f);
+  for (size_t b = 0; b < seq_lens.size(); b++)
+    for (int i = 0; i < seq_lens[b]; i++)
+      for (int h = 0; h < hidden_units; h++)
+        tensor[(b * seq_len + i) * hidden_units + h] = get_value(b, i, h);
+  return tensor;
+}
+
+// The offsets of build_sequence_length_padding_offset: row r without padding is the padded row r + offset[r].
+static std::vector<int> get_padding_offset(const std::vector<int> &seq_lens, const int seq_len)
+{
+  std::vector<int> offset;
+  int padding = 0;
+  for (size_t b = 0; b < seq_lens.size(); b++)
+  {
+    for (int i = 0; i < seq_lens[b]; i++)
+      offset.push_back(padding);
+    padding += seq_len - seq_lens[b];
+  }
+  return offset;
+}
+
+// remove_sequence_length_padding: dst row r is src row r + offset[r]
+static std::vector<float> gather(const std::vector<float> &src, const int *offset, const int row_num)
+{
+  std::vector<float> dst(row_num * hidden_units);
+  for (int r = 0; r < row_num; r++)
+    for (int h = 0; h < hidden_units; h++)
+      dst[r * hidden_units + h] = src[(r + offset[r]) * hidden_units + h];
+  return dst;
+}
+
+// Whether the rows of tensor are the ones of the active samples of batch, in order, and the
+// offsets of the trt fused mha their first rows.
+static bool has_rows(const EarlyExitBatch &batch, const std::vector<float> &tensor)
+{
+  std::vector<int> trt_seqlen_offset(batch.size() + 1);
+  batch.getTrtSeqlenOffset(trt_seqlen_offset.data());
+  int row = 0;
+  for (int i = 0; i < batch.size(); i++)
+  {
+    if (trt_seqlen_offset[i] != row)
+      return false;
+    for (int j = 0; j < batch.getSeqLens()[i]; j++, row++)
+      for (int h = 0; h < hidden_units; h++)
+        if (tensor[row * hidden_units + h] != get_value(batch.getId(i), j, h))
+          return false;
+  }
+  return trt_seqlen_offset[batch.size()] == row && batch.getValidWordNum() == row &&
+         (int)tensor.size() == row * hidden_units;
+}
+
+// Drops the samples of is_exit from batch and gathers the rows of tensor. Returns whether the
+// offsets match the naive ones, recomputed from the lengths before the shrink, and the rows the
+// survivors.
+static bool shrink(EarlyExitBatch &batch, std::vector<float> &tensor, const std::vector<bool> &is_exit)
+{
+  std::vector<int> expected_offset;
+  int src_row = 0;
+  for (int i = 0; i < batch.size(); i++)
+  {
+    if (!is_exit[i])
+      for (int j = 0; j < batch.getSeqLens()[i]; j++)
+        expected_offset.push_back(src_row + j - (int)expected_offset.size());
+    src_row += batch.getSeqLens()[i];
+  }
+  std::vector<int> gather_offset(src_row + 1, -1);
+  const int valid_word_num = batch.shrink(is_exit, gather_offset.data());
+  bool ok = valid_word_num == (int)expected_offset.size();
+  for (int r = 0; ok && r < valid_word_num; r++)
+    ok = gather_offset[r] == expected_offset[r];
+  tensor = gather(tensor, gather_offset.data(), valid_word_num);
+  return ok && has_rows(batch, tensor);
+}
+
+// A batch of seq_lens after the padding removal, and its tensor.
+static bool reset(EarlyExitBatch &batch, std::vector<float> &tensor, const std::vector<int> &seq_lens,
+                  const int seq_len)
+{
+  batch.reset(seq_lens.data(), seq_lens.size());
+  const std::vector<int> offset = get_padding_offset(seq_lens, seq_len);
+  tensor = gather(make_padded_tensor(seq_lens, seq_len), offset.data(), offset.size());
+  return has_rows(batch, tensor);
+}
+
+int main(int argc, char *argv[])
+{
+  const int trial_num = argc >= 2 ? atoi(argv[1]) : 1000;
+  Check check;
+
+  // logits[b, c] = sum_i cls[b, i] * kernel[i, c] + bias[c], computed by hand
+  const float cls[2 * 2] = {1.0f, 1.0f, 2.0f, -1.0f};
+  const float kernel[2 * 3] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f};
+  const float bias[3] = {0.5f, -1.0f, 0.0f};
+  const float expected_logits[2 * 3] = {5.5f, 6.0f, 9.0f, -1.5f, -2.0f, 0.0f};
+  float logits[2 * 3];
+  exit_classifier_reference(cls, kernel, bias, 2, 2, 3, logits);
+  bool same = true;
+  for (int i = 0; i < 2 * 3; i++)
+    same = same && logits[i] == expected_logits[i];
+  check.expect(same, "exit_classifier_reference matches a head computed by hand");
+  exit_classifier_reference(cls, kernel, nullptr, 2, 2, 3, logits);
+  same = true;
+  for (int i = 0; i < 2 * 3; i++)
+    same = same && logits[i] == expected_logits[i] - bias[i % 3];
+  check.expect(same, "and without a bias");
+  // softmax([0, log 3, log 2]) = [1/6, 1/2, 1/3]
+  const float confidence_logits[3] = {0.0f, logf(3.0f), logf(2.0f)};
+  int label = -1;
+  const float confidence = exit_confidence(confidence_logits, 3, &label);
+  check.expect(fabsf(confidence - 0.5f) < 1e-6f && label == 1, "exit_confidence is the largest softmax probability");
+
+  // a batch with padding: 8 samples of lengths 1 to 16, padded to 16
+  const std::vector<int> seq_lens = {3, 16, 1, 7, 16, 2, 9, 5};
+  const int seq_len = 16;
+  const int batch_size = seq_lens.size();
+  EarlyExitBatch batch;
+  std::vector<float> tensor;
+  check.expect(reset(batch, tensor, seq_lens, seq_len), "the padding removal keeps the rows of every sample");
+
+  bool ok = shrink(batch, tensor, std::vector<bool>(batch_size, false));
+  check.expect(ok && batch.size() == batch_size, "no exit keeps the batch, with zero offsets");
+
+  std::vector<bool> is_exit(batch_size);
+  for (int i = 0; i < batch_size; i++)
+    is_exit[i] = i % 2 == 1;
+  ok = shrink(batch, tensor, is_exit);
+  check.expect(ok && batch.size() == batch_size / 2 && batch.getId(1) == 2,
+               "every other sample exits, the others are gathered in order");
+  ok = shrink(batch, tensor, {true, false, false, true});
+  check.expect(ok && batch.size() == 2 && batch.getId(0) == 2 && batch.getId(1) == 4,
+               "then the first and the last ones");
+  ok = shrink(batch, tensor, {true, true});
+  check.expect(ok && batch.size() == 0 && batch.getValidWordNum() == 0, "then all of them");
+
+  ok = reset(batch, tensor, seq_lens, seq_len) && shrink(batch, tensor, std::vector<bool>(batch_size, true));
+  check.expect(ok && batch.size() == 0, "all the samples exit at once");
+
+  // random batches, with and without padding, shrunk until they are empty
+  std::mt19937 gen(0);
+  int failed_trials = 0;
+  for (int trial = 0; trial < trial_num; trial++)
+  {
+    const int trial_seq_len = 1 + gen() % 32;
+    std::vector<int> trial_seq_lens(1 + gen() % 32);
+    for (int &len : trial_seq_lens)
+      len = trial % 4 == 0 ? trial_seq_len : 1 + gen() % trial_seq_len;
+    ok = reset(batch, tensor, trial_seq_lens, trial_seq_len);
+    while (ok && batch.size() > 0)
+    {
+      const int exit_percent = gen() % 101;
+      std::vector<bool> trial_is_exit(batch.size());
+      for (int i = 0; i < batch.size(); i++)
+        trial_is_exit[i] = (int)(gen() % 100) < exit_percent;
+      ok = shrink(batch, tensor, trial_is_exit);
+    }
+    failed_trials += ok ? 0 : 1;
+  }
+  check.expect(failed_trials == 0, "random batches shrink like the naive recompute");
+
+  printf("%s\n", check.failures == 0 ? "[INFO] all the checks passed" : "[ERROR] some checks failed");
+  return check.failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Drives the length-bucketed encoder batcher with a stub encoder on the CPU.
+// The stub writes input + 1 into the output of every request, so the sample
+// checks that the batcher scatters the results back to the right requests.
+// bert_encoder_batcher_sample serves BERT on the GPU with BertEncoderBatchRunner
+// (fastertransformer/bert_encoder_batcher.h) instead of the stub.
+
+#include "fastertransformer/utils/encoder_batcher.h"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sys/time.h>
+
+using namespace fastertransformer;
+
+class StubEncoderRunner : public IEncoderBatchRunner<float>
+{
+  const int hidden_units_;
+  const int us_per_token_;
+
+public:
+  int max_batch_size = 0;
+
+  StubEncoderRunner(int hidden_units, int us_per_token) : hidden_units_(hidden_units), us_per_token_(us_per_token) {}
+
+  void run(const EncoderBatch<float> &batch) override
+  {
+    const int batch_size = batch.requests.size();
+    max_batch_size = std::max(max_batch_size, batch_size);
+    for (auto request : batch.requests)
+    {
+      for (int i = 0; i < request->seq_len * hidden_units_; i++)
+        request->output[i] = request->input[i] + 1.0f;
+    }
+    // the cost of the batch scales with the padded tokens, as for the real encoder
+    std::this_thread::sleep_for(std::chrono::microseconds((size_t)us_per_token_ * batch_size * batch.seq_len));
+  }
+};
+
+int main(int argc, char *argv[])
+{
+  if (argc != 5)
+  {
+    printf("[ERROR] encoder_batcher_sample request_num max_batch_size max_tokens max_wait_us\n");
+    printf("e.g., ./bin/encoder_batcher_sample 1000 32 4096 2000\n");
+    return 0;
+  }
+  const int request_num = atoi(argv[1]);
+  const int hidden_units = 16;
+
+  EncoderBatcherConfig config;
+  config.max_batch_size = atoi(argv[2]);
+  config.max_tokens = atoi(argv[3]);
+  config.max_wait_us = atoi(argv[4]);
+
+  StubEncoderRunner runner(hidden_units, 1);
+  EncoderBatcher<float> batcher(config, &runner);
+
+  std::mt19937 gen(0);
+  std::uniform_int_distribution<int> seq_len_dist(1, config.seq_len_buckets.back());
+  std::vector<std::vector<float>> inputs(request_num), outputs(request_num);
+  std::vector<std::future<void>> futures;
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  for (int i = 0; i < request_num; i++)
+  {
+    const int seq_len = seq_len_dist(gen);
+    inputs[i].assign(seq_len * hidden_units, (float)(i % 1000));
+    outputs[i].assign(seq_len * hidden_units, 0.0f);
+    futures.push_back(batcher.enqueue(inputs[i].data(), outputs[i].data(), seq_len));
+  }
+  for (auto &future : futures)
+    future.get();
+  gettimeofday(&end, NULL);
+
+  int wrong_num = 0;
+  for (int i = 0; i < request_num; i++)
+  {
+    for (size_t j = 0; j < outputs[i].size(); j++)
+    {
+      if (outputs[i][j] != inputs[i][j] + 1.0f)
+      {
+        wrong_num++;
+        break;
+      }
+    }
+  }
+
+  EncoderBatcherStats stats = batcher.getStats();
+  printf("[INFO] requests %zu batches %zu avg batch size %.2f max batch size %d\n",
+         stats.request_num, stats.batch_num, (float)stats.request_num / stats.batch_num, runner.max_batch_size);
+  printf("[INFO] valid tokens %zu padded tokens %zu padding ratio %.2f%%\n",
+         stats.valid_token_num, stats.padded_token_num,
+         100.0f * (stats.padded_token_num - stats.valid_token_num) / stats.padded_token_num);
+  printf("[INFO] total time %.2f ms\n", (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) * 0.001);
+  if (wrong_num != 0)
+  {
+    printf("[ERROR] %d requests got a wrong output\n", wrong_num);
+    return -1;
+  }
+  printf("[INFO] all outputs are correct\n");
+  return 0;
+}
@@ -0,0 +1,1230 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * ft_bench sweep.ini [section.key=value ...]
+ *
+ * Runs warmup and timed iterations for every configuration of the sweep (see
+ * fastertransformer/utils/bench_utils.h) and writes p50/p90/p99 latency, tokens/s and
+ * peak memory as CSV or JSON.
+ *   backend = cuda: DecodingGpt (gpt), DecodingSampling/DecodingBeamsearch (decoding) and
+ *                   BertEncoderTransformer (encoder) with random weights. With tensor or layer
+ *                   parallelism, run it with mpirun; configurations whose
+ *                   tensor_para_size * layer_para_size differs from the world size are skipped.
+ *   backend = cpu:  a host reference with the same shapes, which needs no GPU, to test the
+ *                   harness and the sweep specs. It runs fp32 only, in one process; the ranks of
+ *                   tensor and layer parallelism are threads.
+ **/
+
+#include "fastertransformer/bert_encoder_transformer.h"
+#include "fastertransformer/decoding_beamsearch.h"
+#include "fastertransformer/decoding_sampling.h"
+#include "fastertransformer/open_decoder.h"
+#include "fastertransformer/utils/bench_utils.h"
+#include "fastertransformer/utils/communicator.h"
+#include "fastertransformer/utils/nccl_utils.h"
+#include "fastertransformer/utils/nvtx_utils.h"
+#include "fastertransformer/utils/quantized_comm.h"
+#ifdef BUILD_GPT
+#include "fastertransformer/gpt.h"
+#endif
+#include <cuda_fp16.h>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fastertransformer;
+
+/**
+ * One rank of the host reference of the transformer layers, with the shapes of the
+ * configuration: pre-layernorm, fused QKV, multi-head attention, GELU FFN and the vocabulary
+ * projection followed by the top-k/top-p sampling. The token is drawn from the candidates with
+ * a generator seeded at each run, or is the most likely one with beam search; no token ends a
+ * sequence, so each run generates batch_size * output_len tokens.
+ *
+ * The ranks are partitioned as in the parallel GPT. A tensor rank holds head_num /
+ * tensor_para_size heads and the same share of the FFN, and sums the outputs of the attention
+ * and the FFN with all2all_reduce_sum. A layer group holds num_layer / layer_para_size layers;
+ * it sends its share of the hidden states to the next group, which gathers them with
+ * all2all_gather, and the last group sends the tokens back to the first one.
+ *
+ * With all_reduce_chunk_num > 1 the GEMM before each all-reduce is split in row chunks, and a
+ * thread of the rank reduces a chunk while the rank computes the next one, as the comm stream
+ * of OpenDecoder does. The sums are taken in rank order, so the output does not depend on it.
+ * With int8_comm_block_size > 0 the all-reduces and the all-gathers of the hidden states are
+ * quantized as on the GPU, see utils/quantized_comm.h.
+ **/
+class CpuBenchRank
+{
+public:
+  // The full weights of each layer are sliced for the rank, so the parallel configurations
+  // compute the same values as the single rank one, up to the order of the sums.
+  CpuBenchRank(const BenchConfig &config, const int tensor_rank, const int layer_rank,
+               Communicator &tensor_comm, Communicator &layer_comm,
+               const std::vector<std::vector<float>> &full_weights, const std::vector<float> &embedding,
+               const std::vector<float> &memory, const std::vector<float> &input)
+      : config_(config), embedding_(embedding), memory_(memory), input_(input)
+  {
+    tensor_param_.rank = tensor_rank;
+    tensor_param_.world_size = config.tensor_para_size;
+    tensor_param_.comm = &tensor_comm;
+    tensor_param_.int8_comm_block_size = config.int8_comm_block_size;
+    layer_param_.rank = layer_rank;
+    layer_param_.world_size = config.layer_para_size;
+    layer_param_.comm = &layer_comm;
+
+    hidden_ = config.head_num * config.size_per_head;
+    local_head_num_ = config.head_num / config.tensor_para_size;
+    local_hidden_ = local_head_num_ * config.size_per_head;
+    local_num_layer_ = config.num_layer / config.layer_para_size;
+    rows_ = config.model == "encoder" ? config.batch_size : config.batch_size * config.beam_width;
+    if (config.model == "gpt")
+      max_len_ = config.input_len + config.output_len;
+    else if (config.model == "decoding")
+      max_len_ = config.output_len;
+    else
+      max_len_ = config.input_len;
+    const int tokens = rows_ * std::max(max_len_, 1);
+
+    const int h = hidden_;
+    const int lh = local_hidden_;
+    const int h0 = tensor_rank * lh;
+    weights_.resize(local_num_layer_ * 4);
+    k_cache_.resize(local_num_layer_);
+    v_cache_.resize(local_num_layer_);
+    memory_kv_.resize(local_num_layer_);
+    for (int l = 0; l < local_num_layer_; l++)
+    {
+      const std::vector<float> *full = &full_weights[(layer_rank * local_num_layer_ + l) * 4];
+      // the q, k and v columns of the local heads
+      alloc(weights_[l * 4 + 0], (size_t)h * 3 * lh);
+      for (int i = 0; i < h; i++)
+        for (int p = 0; p < 3; p++)
+          std::copy(&full[0][(size_t)i * 3 * h + p * h + h0], &full[0][(size_t)i * 3 * h + p * h + h0 + lh],
+                    &weights_[l * 4 + 0][(size_t)i * 3 * lh + p * lh]);
+      // the rows of the attention output and of the second FFN GEMM, the columns of the first
+      alloc(weights_[l * 4 + 1], (size_t)lh * h);
+      std::copy(&full[1][(size_t)h0 * h], &full[1][(size_t)(h0 + lh) * h], weights_[l * 4 + 1].begin());
+      alloc(weights_[l * 4 + 2], (size_t)h * 4 * lh);
+      for (int i = 0; i < h; i++)
+        std::copy(&full[2][(size_t)i * 4 * h + 4 * h0], &full[2][(size_t)i * 4 * h + 4 * (h0 + lh)],
+                  &weights_[l * 4 + 2][(size_t)i * 4 * lh]);
+      alloc(weights_[l * 4 + 3], (size_t)4 * lh * h);
+      std::copy(&full[3][(size_t)4 * h0 * h], &full[3][(size_t)4 * (h0 + lh) * h], weights_[l * 4 + 3].begin());
+
+      alloc(k_cache_[l], (size_t)rows_ * max_len_ * lh);
+      alloc(v_cache_[l], (size_t)rows_ * max_len_ * lh);
+      if (config.model == "decoding")
+        alloc(memory_kv_[l], (size_t)rows_ * config.input_len * 3 * lh);
+    }
+    if (config.model != "encoder")
+    {
+      alloc(logits_, config.vocab_size);
+      alloc(probs_, config.vocab_size);
+      alloc(last_, (size_t)rows_ * h);
+    }
+    alloc(x_, (size_t)tokens * h);
+    alloc(normed_, (size_t)tokens * h);
+    alloc(qkv_, (size_t)tokens * 3 * lh);
+    alloc(attn_, (size_t)tokens * lh);
+    alloc(tmp_, (size_t)tokens * h);
+    alloc(inter_, (size_t)tokens * 4 * lh);
+    tokens_.assign(rows_, 0);
+
+    if (config.tensor_para_size > 1 && config.all_reduce_chunk_num > 1)
+      comm_thread_ = std::thread(&CpuBenchRank::commLoop, this);
+  }
+
+  ~CpuBenchRank()
+  {
+    if (comm_thread_.joinable())
+    {
+      {
+        std::lock_guard<std::mutex> lock(comm_mu_);
+        comm_stop_ = true;
+      }
+      comm_cv_.notify_all();
+      comm_thread_.join();
+    }
+  }
+
+  size_t run()
+  {
+    const int input_len = config_.input_len;
+    sample_gen_.seed(1);
+    if (config_.model == "encoder")
+    {
+      if (isFirstGroup())
+        std::copy(input_.begin(), input_.begin() + (size_t)rows_ * input_len * hidden_, x_.begin());
+      forwardLayers(input_len, 0, false);
+      return (size_t)config_.batch_size * input_len;
+    }
+
+    int start = 0;
+    if (config_.model == "gpt")
+    {
+      // context phase, its last position gives the first token
+      if (isFirstGroup())
+        std::copy(input_.begin(), input_.begin() + (size_t)rows_ * input_len * hidden_, x_.begin());
+      forwardLayers(input_len, 0, true);
+      if (isLastGroup())
+      {
+        for (int r = 0; r < rows_; r++)
+          std::copy(&x_[((size_t)r * input_len + input_len - 1) * hidden_],
+                    &x_[((size_t)r * input_len + input_len) * hidden_], &last_[(size_t)r * hidden_]);
+        selectTokens();
+      }
+      passTokens();
+      start = input_len;
+    }
+    else
+    {
+      // the memory keys and values of the local layers are computed once per request
+      for (int l = 0; l < local_num_layer_; l++)
+        cpu_gemm(memory_.data(), weights_[l * 4].data(), memory_kv_[l].data(), rows_ * input_len, 3 * local_hidden_, hidden_);
+      std::fill(tokens_.begin(), tokens_.end(), 0);
+    }
+
+    const int step_num = config_.model == "gpt" ? config_.output_len - 1 : config_.output_len;
+    for (int step = 0; step < step_num; step++)
+    {
+      if (isFirstGroup())
+        for (int r = 0; r < rows_; r++)
+          std::copy(&embedding_[(size_t)tokens_[r] * hidden_], &embedding_[(size_t)(tokens_[r] + 1) * hidden_],
+                    &x_[(size_t)r * hidden_]);
+      forwardLayers(1, start + step, true);
+      if (isLastGroup())
+      {
+        std::copy(x_.begin(), x_.begin() + (size_t)rows_ * hidden_, last_.begin());
+        selectTokens();
+      }
+      passTokens();
+    }
+    return (size_t)config_.batch_size * config_.output_len;
+  }
+
+  size_t getAllocatedBytes() const { return allocated_bytes_; }
+
+private:
+  bool isFirstGroup() const { return layer_param_.rank == 0; }
+  bool isLastGroup() const { return layer_param_.rank == layer_param_.world_size - 1; }
+
+  // C[m, n] = A[m, k] * B[k, n]
+  static void cpu_gemm(const float *A, const float *B, float *C, const int m, const int n, const int k)
+  {
+    for (int i = 0; i < m; i++)
+    {
+      float *c = C + (size_t)i * n;
+      std::fill(c, c + n, 0.0f);
+      for (int p = 0; p < k; p++)
+      {
+        const float a = A[(size_t)i * k + p];
+        const float *b = B + (size_t)p * n;
+        for (int j = 0; j < n; j++)
+          c[j] += a * b[j];
+      }
+    }
+  }
+
+  static void layernorm(const float *x, float *out, const int m, const int n)
+  {
+    for (int i = 0; i < m; i++)
+    {
+      const float *row = x + (size_t)i * n;
+      float mean = 0.0f, var = 0.0f;
+      for (int j = 0; j < n; j++)
+        mean += row[j];
+      mean /= n;
+      for (int j = 0; j < n; j++)
+        var += (row[j] - mean) * (row[j] - mean);
+      const float scale = 1.0f / sqrtf(var / n + 1e-6f);
+      for (int j = 0; j < n; j++)
+        out[(size_t)i * n + j] = (row[j] - mean) * scale;
+    }
+  }
+
+  // out += softmax(q k^T / sqrt(d)) v for each local head; k and v rows are kv_stride apart.
+  void attend(const float *q, const float *k, const float *v, const int kv_stride, const int kv_len, float *out)
+  {
+    const int d = config_.size_per_head;
+    std::vector<float> &scores = scores_;
+    scores.resize(kv_len);
+    for (int h = 0; h < local_head_num_; h++)
+    {
+      float max_score = -1e20f;
+      for (int j = 0; j < kv_len; j++)
+      {
+        float s = 0.0f;
+        for (int i = 0; i < d; i++)
+          s += q[h * d + i] * k[(size_t)j * kv_stride + h * d + i];
+        scores[j] = s / sqrtf((float)d);
+        max_score = std::max(max_score, scores[j]);
+      }
+      float sum = 0.0f;
+      for (int j = 0; j < kv_len; j++)
+      {
+        scores[j] = expf(scores[j] - max_score);
+        sum += scores[j];
+      }
+      for (int j = 0; j < kv_len; j++)
+        for (int i = 0; i < d; i++)
+          out[h * d + i] += scores[j] / sum * v[(size_t)j * kv_stride + h * d + i];
+    }
+  }
+
+  // C[m, n] = A[m, k] * B[k, n] summed over the tensor ranks. The reduction of a chunk of rows
+  // runs on comm_thread_ while the next chunk is computed; returns when all of them are summed.
+  void gemmAllReduceSum(const float *A, const float *B, float *C, const int m, const int n, const int k)
+  {
+    const int chunk_num = comm_thread_.joinable() ? std::min(config_.all_reduce_chunk_num, m) : 1;
+    if (chunk_num == 1)
+    {
+      cpu_gemm(A, B, C, m, n, k);
+      all2all_reduce_sum(C, C, m * n, tensor_param_, 0);
+      return;
+    }
+    for (int c = 0; c < chunk_num; c++)
+    {
+      const int row = m * c / chunk_num;
+      const int rows = m * (c + 1) / chunk_num - row;
+      cpu_gemm(A + (size_t)row * k, B, C + (size_t)row * n, rows, n, k);
+      std::lock_guard<std::mutex> lock(comm_mu_);
+      comm_queue_.push_back(std::make_pair(C + (size_t)row * n, rows * n));
+      comm_cv_.notify_all();
+    }
+    std::unique_lock<std::mutex> lock(comm_mu_);
+    comm_cv_.wait(lock, [this] { return comm_queue_.empty() && !comm_busy_; });
+  }
+
+  void commLoop()
+  {
+    std::unique_lock<std::mutex> lock(comm_mu_);
+    while (true)
+    {
+      comm_cv_.wait(lock, [this] { return comm_stop_ || !comm_queue_.empty(); });
+      if (comm_queue_.empty())
+        return;
+      const std::pair<float *, int> chunk = comm_queue_.front();
+      comm_queue_.pop_front();
+      comm_busy_ = true;
+      lock.unlock();
+      all2all_reduce_sum(chunk.first, chunk.first, chunk.second, tensor_param_, 0);
+      lock.lock();
+      comm_busy_ = false;
+      comm_cv_.notify_all();
+    }
+  }
+
+  // Runs the layers of the group on the rows_ * len tokens of x_. The groups after the first
+  // one receive them from the previous group, one share per tensor rank.
+  void forwardLayers(const int len, const int start, const bool causal)
+  {
+    const int size = rows_ * len * hidden_ / tensor_param_.world_size;
+    if (!isFirstGroup())
+    {
+      nccl_recv(x_.data() + size * tensor_param_.rank, size, layer_param_.rank - 1, layer_param_, 0);
+      all2all_gather(x_.data(), x_.data(), size, tensor_param_, 0);
+    }
+    for (int l = 0; l < local_num_layer_; l++)
+      forwardLayer(l, len, start, causal);
+    if (!isLastGroup())
+      nccl_send(x_.data() + size * tensor_param_.rank, size, layer_param_.rank + 1, layer_param_, 0);
+  }
+
+  // The first group embeds the tokens that the last group selected.
+  void passTokens()
+  {
+    if (layer_param_.world_size == 1)
+      return;
+    if (isLastGroup())
+      nccl_send(tokens_.data(), rows_, 0, layer_param_, 0);
+    else if (isFirstGroup())
+      nccl_recv(tokens_.data(), rows_, layer_param_.world_size - 1, layer_param_, 0);
+  }
+
+  // x_ holds rows_ * len tokens at the positions [start, start + len) of each row.
+  void forwardLayer(const int l, const int len, const int start, const bool causal)
+  {
+    PUSH_RANGE_INDEX("layer", 0, layer_param_.rank * local_num_layer_ + l)
+    const int m = rows_ * len;
+    const int h = hidden_;
+    const int lh = local_hidden_;
+    PUSH_RANGE("attention")
+    layernorm(x_.data(), normed_.data(), m, h);
+    cpu_gemm(normed_.data(), weights_[l * 4].data(), qkv_.data(), m, 3 * lh, h);
+    for (int r = 0; r < rows_; r++)
+      for (int t = 0; t < len; t++)
+      {
+        const float *qkv = &qkv_[((size_t)r * len + t) * 3 * lh];
+        std::copy(qkv + lh, qkv + 2 * lh, &k_cache_[l][((size_t)r * max_len_ + start + t) * lh]);
+        std::copy(qkv + 2 * lh, qkv + 3 * lh, &v_cache_[l][((size_t)r * max_len_ + start + t) * lh]);
+      }
+    std::fill(attn_.begin(), attn_.begin() + (size_t)m * lh, 0.0f);
+    for (int r = 0; r < rows_; r++)
+      for (int t = 0; t < len; t++)
+      {
+        const float *q = &qkv_[((size_t)r * len + t) * 3 * lh];
+        float *out = &attn_[((size_t)r * len + t) * lh];
+        const int kv_len = causal ? start + t + 1 : start + len;
+        attend(q, &k_cache_[l][(size_t)r * max_len_ * lh], &v_cache_[l][(size_t)r * max_len_ * lh], lh, kv_len, out);
+        if (config_.model == "decoding")
+        {
+          const float *memory_kv = &memory_kv_[l][(size_t)r * config_.input_len * 3 * lh];
+          attend(q, memory_kv + lh, memory_kv + 2 * lh, 3 * lh, config_.input_len, out);
+        }
+      }
+    gemmAllReduceSum(attn_.data(), weights_[l * 4 + 1].data(), tmp_.data(), m, h, lh);
+    for (size_t i = 0; i < (size_t)m * h; i++)
+      x_[i] += tmp_[i];
+    POP_RANGE
+
+    PUSH_RANGE("ffn")
+    layernorm(x_.data(), normed_.data(), m, h);
+    cpu_gemm(normed_.data(), weights_[l * 4 + 2].data(), inter_.data(), m, 4 * lh, h);
+    for (size_t i = 0; i < (size_t)m * 4 * lh; i++)
+    {
+      const float v = inter_[i];
+      inter_[i] = 0.5f * v * (1.0f + tanhf(0.7978845608f * (v + 0.044715f * v * v * v)));
+    }
+    gemmAllReduceSum(inter_.data(), weights_[l * 4 + 3].data(), tmp_.data(), m, h, 4 * lh);
+    for (size_t i = 0; i < (size_t)m * h; i++)
+      x_[i] += tmp_[i];
+    POP_RANGE
+    POP_RANGE
+  }
+
+  // Logits of last_ against the embedding table, then top-k/top-p candidates of each row.
+  void selectTokens()
+  {
+    PUSH_RANGE("sampling")
+    const int vocab_size = config_.vocab_size;
+    layernorm(last_.data(), last_.data(), rows_, hidden_);
+    candidates_.resize(vocab_size);
+    for (int r = 0; r < rows_; r++)
+    {
+      const float *x = &last_[(size_t)r * hidden_];
+      for (int v = 0; v < vocab_size; v++)
+      {
+        const float *e = &embedding_[(size_t)v * hidden_];
+        float s = 0.0f;
+        for (int i = 0; i < hidden_; i++)
+          s += x[i] * e[i];
+        logits_[v] = s;
+      }
+      // top-p alone sorts the whole vocabulary
+      const int k = config_.top_k > 0 ? std::min(vocab_size, std::max(config_.top_k, config_.beam_width)) : vocab_size;
+      std::iota(candidates_.begin(), candidates_.end(), 0);
+      std::partial_sort(candidates_.begin(), candidates_.begin() + k, candidates_.end(),
+                        [this](const int a, const int b) { return logits_[a] > logits_[b]; });
+      float sum = 0.0f;
+      for (int i = 0; i < k; i++)
+      {
+        probs_[i] = expf(logits_[candidates_[i]] - logits_[candidates_[0]]);
+        sum += probs_[i];
+      }
+      int candidate_num = k;
+      if (config_.top_p > 0.0f)
+      {
+        // keep the smallest prefix whose probability reaches top_p
+        float cumulative = 0.0f;
+        for (candidate_num = 0; candidate_num < k && cumulative < config_.top_p; candidate_num++)
+          cumulative += probs_[candidate_num] / sum;
+      }
+      // beam search keeps the most likely candidate, sampling draws one of the candidate_num candidates
+      tokens_[r] = candidates_[0];
+      if (config_.beam_width == 1 && candidate_num > 1)
+      {
+        float kept = 0.0f;
+        for (int i = 0; i < candidate_num; i++)
+          kept += probs_[i];
+        float u = std::uniform_real_distribution<float>(0.0f, kept)(sample_gen_);
+        for (int i = 0; i < candidate_num; i++)
+        {
+          tokens_[r] = candidates_[i];
+          u -= probs_[i];
+          if (u < 0.0f)
+            break;
+        }
+      }
+    }
+    POP_RANGE
+  }
+
+  void alloc(std::vector<float> &buf, const size_t size)
+  {
+    buf.assign(size, 0.0f);
+    allocated_bytes_ += size * sizeof(float);
+  }
+
+  const BenchConfig config_;
+  ParallelParam tensor_param_, layer_param_;
+  int hidden_ = 0;
+  int local_head_num_ = 0;
+  int local_hidden_ = 0;
+  int local_num_layer_ = 0;
+  int rows_ = 0;
+  int max_len_ = 0;
+  size_t allocated_bytes_ = 0;
+  // shared by the ranks and read only
+  const std::vector<float> &embedding_, &memory_, &input_;
+  std::vector<std::vector<float>> weights_; // qkv, attention output, ffn1, ffn2 of each local layer
+  std::vector<std::vector<float>> k_cache_, v_cache_, memory_kv_;
+  std::vector<float> logits_, probs_, last_;
+  std::vector<float> x_, normed_, qkv_, attn_, tmp_, inter_, scores_;
+  std::vector<int> candidates_, tokens_;
+  // the same seed on all the ranks, so the tensor ranks of the last group draw the same tokens
+  std::mt19937 sample_gen_;
+  // the chunks queued for commLoop, the only user of tensor_param_ while they are not summed
+  std::thread comm_thread_;
+  std::mutex comm_mu_;
+  std::condition_variable comm_cv_;
+  std::deque<std::pair<float *, int>> comm_queue_;
+  bool comm_busy_ = false;
+  bool comm_stop_ = false;
+};
+
+/**
+ * The host reference, see CpuBenchRank. With tensor_para_size * layer_para_size ranks, each
+ * rank runs in its own thread and the ranks communicate through ThreadCommunicators, so the
+ * parallel configurations run in one process without MPI or NCCL. The peak memory is the sum
+ * over the ranks.
+ **/
+class CpuBenchBackend : public BenchBackend
+{
+public:
+  bool setup(const BenchConfig &config, std::string &reason) override
+  {
+    if (config.data_type != "fp32")
+    {
+      reason = "the cpu backend runs fp32 only";
+      return false;
+    }
+    if (config.model == "gpt" && config.beam_width != 1)
+    {
+      reason = "gpt does not support beam search";
+      return false;
+    }
+    if (config.tensor_para_size < 1 || config.head_num % config.tensor_para_size != 0)
+    {
+      reason = "head_num is not a multiple of tensor_para_size";
+      return false;
+    }
+    if (config.layer_para_size < 1 || config.num_layer % config.layer_para_size != 0)
+    {
+      reason = "num_layer is not a multiple of layer_para_size";
+      return false;
+    }
+    const int hidden = config.head_num * config.size_per_head;
+    const int rows = config.model == "encoder" ? config.batch_size : config.batch_size * config.beam_width;
+    int max_len = config.input_len;
+    if (config.model == "gpt")
+      max_len = config.input_len + config.output_len;
+    else if (config.model == "decoding")
+      max_len = config.output_len;
+
+    allocated_bytes_ = 0;
+    std::mt19937 gen(0);
+    std::vector<std::vector<float>> full_weights(config.num_layer * 4);
+    for (int l = 0; l < config.num_layer; l++)
+    {
+      random(full_weights[l * 4 + 0], (size_t)hidden * 3 * hidden, gen);
+      random(full_weights[l * 4 + 1], (size_t)hidden * hidden, gen);
+      random(full_weights[l * 4 + 2], (size_t)hidden * 4 * hidden, gen);
+      random(full_weights[l * 4 + 3], (size_t)4 * hidden * hidden, gen);
+    }
+    if (config.model != "encoder")
+      allocRandom(embedding_, (size_t)config.vocab_size * hidden, gen);
+    if (config.model == "decoding")
+      allocRandom(memory_, (size_t)rows * config.input_len * hidden, gen);
+    allocRandom(input_, (size_t)rows * std::max(max_len, 1) * hidden, gen);
+
+    tensor_groups_.clear();
+    layer_groups_.clear();
+    for (int l = 0; l < config.layer_para_size; l++)
+      tensor_groups_.emplace_back(new ThreadCommGroup(config.tensor_para_size));
+    for (int t = 0; t < config.tensor_para_size; t++)
+      layer_groups_.emplace_back(new ThreadCommGroup(config.layer_para_size));
+    comms_.clear();
+    ranks_.clear();
+    for (int l = 0; l < config.layer_para_size; l++)
+      for (int t = 0; t < config.tensor_para_size; t++)
+      {
+        comms_.emplace_back(new ThreadCommunicator(*tensor_groups_[l], t));
+        comms_.emplace_back(new ThreadCommunicator(*layer_groups_[t], l));
+        ranks_.emplace_back(new CpuBenchRank(config, t, l, *comms_[comms_.size() - 2], *comms_.back(),
+                                             full_weights, embedding_, memory_, input_));
+      }
+    return true;
+  }
+
+  // The ranks run in threads started for each run.
+  size_t run() override
+  {
+    if (ranks_.size() == 1)
+      return ranks_[0]->run();
+    std::vector<size_t> tokens(ranks_.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < ranks_.size(); i++)
+      threads.emplace_back([this, &tokens, i]() { tokens[i] = ranks_[i]->run(); });
+    for (std::thread &thread : threads)
+      thread.join();
+    return tokens[0];
+  }
+
+  size_t getPeakMemory() override
+  {
+    size_t bytes = allocated_bytes_;
+    for (const std::unique_ptr<CpuBenchRank> &rank : ranks_)
+      bytes += rank->getAllocatedBytes();
+    return bytes;
+  }
+
+  void teardown() override
+  {
+    ranks_.clear();
+    comms_.clear();
+    tensor_groups_.clear();
+    layer_groups_.clear();
+    for (std::vector<float> *buf : {&embedding_, &memory_, &input_})
+      std::vector<float>().swap(*buf);
+  }
+
+private:
+  static void random(std::vector<float> &buf, const size_t size, std::mt19937 &gen)
+  {
+    std::uniform_real_distribution<float> dist(-0.02f, 0.02f);
+    buf.resize(size);
+    for (size_t i = 0; i < size; i++)
+      buf[i] = dist(gen);
+  }
+
+  void allocRandom(std::vector<float> &buf, const size_t size, std::mt19937 &gen)
+  {
+    random(buf, size, gen);
+    allocated_bytes_ += size * sizeof(float);
+  }
+
+  size_t allocated_bytes_ = 0;
+  std::vector<float> embedding_, memory_, input_;
+  std::vector<std::unique_ptr<ThreadCommGroup>> tensor_groups_, layer_groups_;
+  std::vector<std::unique_ptr<Communicator>> comms_;
+  std::vector<std::unique_ptr<CpuBenchRank>> ranks_;
+};
+
+/**
+ * Shared parts of the CUDA backends: the stream, the cuBLAS handles, the device buffers and the
+ * allocator of FT. The peak memory is the peak of allocator_, since FT also allocates and frees
+ * buffers within a forward (e.g. the context buffers of DecodingGpt::forward_context), plus the
+ * weights and inputs from deviceMalloc, which are held throughout. The cuBLAS workspaces are not
+ * counted.
+ **/
+class CudaBenchBackend : public BenchBackend
+{
+public:
+  CudaBenchBackend()
+  {
+    check_cuda_error(cudaGetDevice(&device_));
+    check_cuda_error(cudaStreamCreate(&stream_));
+    check_cuda_error(cublasCreate(&cublas_handle_));
+    check_cuda_error(cublasLtCreate(&cublaslt_handle_));
+    check_cuda_error(cublasSetStream(cublas_handle_, stream_));
+    cuda_allocator_.reset(new Allocator<AllocatorType::CUDA>(device_));
+    allocator_.reset(new TrackingAllocator(*cuda_allocator_));
+  }
+
+  ~CudaBenchBackend()
+  {
+    cublasLtDestroy(cublaslt_handle_);
+    cublasDestroy(cublas_handle_);
+    cudaStreamDestroy(stream_);
+  }
+
+  size_t getPeakMemory() override
+  {
+    return allocator_->getTotalPeakBytes() + buffer_bytes_;
+  }
+
+  void teardown() override
+  {
+    for (void *ptr : buffers_)
+      check_cuda_error(cudaFree(ptr));
+    buffers_.clear();
+    buffer_bytes_ = 0;
+  }
+
+protected:
+  // A new count for each configuration, called by setup() before anything is allocated.
+  void startMemoryCount()
+  {
+    allocator_.reset(new TrackingAllocator(*cuda_allocator_));
+    buffer_bytes_ = 0;
+  }
+
+  template <typename T>
+  T *deviceMalloc(const size_t size)
+  {
+    T *ptr;
+    check_cuda_error(cudaMalloc((void **)&ptr, sizeof(T) * size));
+    buffers_.push_back(ptr);
+    buffer_bytes_ += sizeof(T) * size;
+    return ptr;
+  }
+
+  template <typename T>
+  T *deviceRandom(const size_t size)
+  {
+    T *ptr = deviceMalloc<T>(size);
+    cuda_random_uniform_kernelLauncher(ptr, (int)size);
+    return ptr;
+  }
+
+  template <typename T>
+  T *deviceCopy(const std::vector<T> &host)
+  {
+    T *ptr = deviceMalloc<T>(host.size());
+    check_cuda_error(cudaMemcpy(ptr, host.data(), sizeof(T) * host.size(), cudaMemcpyHostToDevice));
+    return ptr;
+  }
+
+  int device_;
+  cudaStream_t stream_;
+  cublasHandle_t cublas_handle_;
+  cublasLtHandle_t cublaslt_handle_;
+  std::unique_ptr<Allocator<AllocatorType::CUDA>> cuda_allocator_;
+  std::unique_ptr<TrackingAllocator> allocator_;
+  std::vector<void *> buffers_;
+  size_t buffer_bytes_ = 0;
+};
+
+template <OperationType OpType_>
+class EncoderBenchBackend : public CudaBenchBackend
+{
+  typedef BertEncoderTransformerTraits<OpType_, cuda::OpenMultiHeadAttention> EncoderTraits_;
+  typedef typename EncoderTraits_::DataType DataType_;
+
+public:
+  bool setup(const BenchConfig &config, std::string &reason) override
+  {
+    if (config.tensor_para_size != 1 || config.layer_para_size != 1)
+    {
+      reason = "the encoder runs on one GPU";
+      return false;
+    }
+    startMemoryCount();
+    config_ = config;
+    const int batch_size = config.batch_size;
+    const int seq_len = config.input_len;
+    const int hidden_dim = config.head_num * config.size_per_head;
+
+    // without padding removal: trt_seqlen_offset holds the offsets of the valid and padded parts
+    std::vector<int> h_trt_seqlen_offset(batch_size * 2 + 1, 0);
+    for (int i = 1; i < (int)h_trt_seqlen_offset.size(); i++)
+      h_trt_seqlen_offset[i] = h_trt_seqlen_offset[i - 1] + (i % 2 == 1 ? seq_len : 0);
+    std::vector<DataType_> h_attr_mask((size_t)batch_size * seq_len * seq_len, (DataType_)1.0f);
+
+    param_.from_tensor = deviceRandom<DataType_>((size_t)batch_size * seq_len * hidden_dim);
+    param_.to_tensor = param_.from_tensor;
+    param_.transformer_out = deviceMalloc<DataType_>((size_t)batch_size * seq_len * hidden_dim);
+    param_.attr_mask = deviceCopy(h_attr_mask);
+    param_.self_attention.query_weight.kernel = deviceRandom<DataType_>((size_t)hidden_dim * hidden_dim * 3);
+    param_.self_attention.key_weight.kernel = param_.self_attention.query_weight.kernel + hidden_dim * hidden_dim;
+    param_.self_attention.value_weight.kernel = param_.self_attention.key_weight.kernel + hidden_dim * hidden_dim;
+    param_.self_attention.query_weight.bias = deviceRandom<DataType_>(hidden_dim);
+    param_.self_attention.key_weight.bias = deviceRandom<DataType_>(hidden_dim);
+    param_.self_attention.value_weight.bias = deviceRandom<DataType_>(hidden_dim);
+    param_.self_attention.attention_output_weight.kernel = deviceRandom<DataType_>((size_t)hidden_dim * hidden_dim);
+    param_.self_attention.attention_output_weight.bias = deviceRandom<DataType_>(hidden_dim);
+    param_.self_layernorm.beta = deviceRandom<DataType_>(hidden_dim);
+    param_.self_layernorm.gamma = deviceRandom<DataType_>(hidden_dim);
+    param_.ffn.intermediate_weight.kernel = deviceRandom<DataType_>((size_t)hidden_dim * hidden_dim * 4);
+    param_.ffn.intermediate_weight.bias = deviceRandom<DataType_>(hidden_dim * 4);
+    param_.ffn.output_weight.kernel = deviceRandom<DataType_>((size_t)hidden_dim * hidden_dim * 4);
+    param_.ffn.output_weight.bias = deviceRandom<DataType_>(hidden_dim);
+    param_.ffn_layernorm.beta = deviceRandom<DataType_>(hidden_dim);
+    param_.ffn_layernorm.gamma = deviceRandom<DataType_>(hidden_dim);
+    param_.amaxList = deviceRandom<float>(ACTIVATION_AMAX_NUM + 9 * hidden_dim + INT8O_GEMM_NUM + TRT_FUSED_MHA_AMAX_NUM);
+    param_.cublas_handle = cublas_handle_;
+    param_.cublaslt_handle = cublaslt_handle_;
+    param_.stream = stream_;
+    param_.layer_idx = 0;
+    param_.layer_num = config.num_layer;
+    param_.trt_seqlen_offset = deviceCopy(h_trt_seqlen_offset);
+    param_.trt_seqlen_size = (int)h_trt_seqlen_offset.size();
+    param_.valid_word_num = batch_size * seq_len;
+
+    encoder_ = new BertEncoderTransformer<EncoderTraits_>(0, false);
+    encoder_->allocateBuffer(allocator_.get(), batch_size, seq_len, seq_len, config.head_num, config.size_per_head);
+    check_cuda_error(cudaDeviceSynchronize());
+    return true;
+  }
+
+  size_t run() override
+  {
+    for (int i = 0; i < config_.num_layer; i++)
+    {
+      encoder_->initialize(param_);
+      encoder_->forward();
+    }
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    return (size_t)config_.batch_size * config_.input_len;
+  }
+
+  void teardown() override
+  {
+    delete encoder_;
+    encoder_ = nullptr;
+    CudaBenchBackend::teardown();
+  }
+
+private:
+  BenchConfig config_;
+  BertInitParam<DataType_> param_;
+  BertEncoderTransformer<EncoderTraits_> *encoder_ = nullptr;
+};
+
+template <OperationType OpType_>
+class DecodingBenchBackend : public CudaBenchBackend
+{
+  typedef DecoderTransformerTraits<OpType_> Traits_;
+  typedef typename Traits_::DataType DataType_;
+
+public:
+  bool setup(const BenchConfig &config, std::string &reason) override
+  {
+    if (config.tensor_para_size != 1 || config.layer_para_size != 1)
+    {
+      reason = "decoding runs on one GPU";
+      return false;
+    }
+    if (config.beam_width == 1 && config.top_k == 0 && config.top_p == 0.0f)
+    {
+      reason = "sampling needs top_k > 0 or top_p > 0";
+      return false;
+    }
+    startMemoryCount();
+    config_ = config;
+    // the encoder output of input_len tokens is the memory, output_len tokens are generated
+    const int rows = config.batch_size * config.beam_width;
+    const int hidden_units = config.head_num * config.size_per_head;
+    const int memory_max_seq_len = config.input_len;
+    const int max_seq_len = config.output_len;
+    const int start_id = 1;
+    const int end_id = 2;
+
+    param_.resize(config.num_layer);
+    for (int i = 0; i < config.num_layer; i++)
+    {
+      DecoderInitParam<DataType_> &param = param_[i];
+      param.request_batch_size = config.batch_size;
+      param.request_max_mem_seq_len = memory_max_seq_len;
+      param.stream = stream_;
+      param.cublas_handle = cublas_handle_;
+      param.cublaslt_handle = cublaslt_handle_;
+      param.self_attention.query_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units * 3);
+      param.self_attention.query_weight.bias = deviceRandom<DataType_>(hidden_units * 3);
+      param.self_attention.attention_output_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units);
+      param.self_attention.attention_output_weight.bias = deviceRandom<DataType_>(hidden_units);
+      param.cross_attention.query_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units);
+      param.cross_attention.key_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units);
+      param.cross_attention.value_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units);
+      param.cross_attention.attention_output_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units);
+      param.cross_attention.query_weight.bias = deviceRandom<DataType_>(hidden_units);
+      param.cross_attention.key_weight.bias = deviceRandom<DataType_>(hidden_units);
+      param.cross_attention.value_weight.bias = deviceRandom<DataType_>(hidden_units);
+      param.cross_attention.attention_output_weight.bias = deviceRandom<DataType_>(hidden_units);
+      param.self_layernorm.gamma = deviceRandom<DataType_>(hidden_units);
+      param.self_layernorm.beta = deviceRandom<DataType_>(hidden_units);
+      param.cross_layernorm.gamma = deviceRandom<DataType_>(hidden_units);
+      param.cross_layernorm.beta = deviceRandom<DataType_>(hidden_units);
+      param.ffn_layernorm.gamma = deviceRandom<DataType_>(hidden_units);
+      param.ffn_layernorm.beta = deviceRandom<DataType_>(hidden_units);
+      param.ffn.intermediate_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units * 4);
+      param.ffn.intermediate_weight.bias = deviceRandom<DataType_>(hidden_units * 4);
+      param.ffn.output_weight.kernel = deviceRandom<DataType_>((size_t)hidden_units * hidden_units * 4);
+      param.ffn.output_weight.bias = deviceRandom<DataType_>(hidden_units);
+    }
+
+    decoding_params_.cublas_handle = cublas_handle_;
+    decoding_params_.cublaslt_handle = cublaslt_handle_;
+    decoding_params_.stream = stream_;
+    decoding_params_.memory_tensor = deviceRandom<DataType_>((size_t)rows * memory_max_seq_len * hidden_units);
+    decoding_params_.embedding_table = deviceRandom<DataType_>((size_t)config.vocab_size * hidden_units);
+    decoding_params_.embedding_kernel = deviceRandom<DataType_>((size_t)config.vocab_size * hidden_units);
+    decoding_params_.embedding_bias = deviceRandom<DataType_>(config.vocab_size);
+    decoding_params_.position_encoding_table = deviceRandom<DataType_>((size_t)max_seq_len * hidden_units);
+    decoding_params_.output_ids = deviceMalloc<int>((size_t)max_seq_len * rows);
+    decoding_params_.parent_ids = deviceMalloc<int>((size_t)max_seq_len * rows);
+    decoding_params_.sequence_length = deviceMalloc<int>(rows);
+    decoding_params_.memory_sequence_length = deviceCopy(std::vector<int>(rows, memory_max_seq_len));
+    decoding_params_.layernorm.gamma = deviceRandom<DataType_>(hidden_units);
+    decoding_params_.layernorm.beta = deviceRandom<DataType_>(hidden_units);
+
+    if (config.beam_width > 1)
+      beamsearch_ = new DecodingBeamsearch<OpType_>(*allocator_, config.batch_size, config.beam_width,
+                                                    max_seq_len, config.head_num, config.size_per_head,
+                                                    config.vocab_size, config.num_layer,
+                                                    hidden_units, memory_max_seq_len,
+                                                    start_id, end_id, -0.0f, true, true);
+    else
+      sampling_ = new DecodingSampling<OpType_>(*allocator_, config.batch_size,
+                                                max_seq_len, config.head_num, config.size_per_head,
+                                                config.vocab_size, config.num_layer,
+                                                hidden_units, memory_max_seq_len,
+                                                start_id, end_id,
+                                                config.top_k, config.top_p, true);
+    check_cuda_error(cudaDeviceSynchronize());
+    return true;
+  }
+
+  size_t run() override
+  {
+    if (beamsearch_ != nullptr)
+      beamsearch_->forward(param_.data(), decoding_params_);
+    else
+      sampling_->forward(param_.data(), decoding_params_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    return (size_t)config_.batch_size * config_.output_len;
+  }
+
+  void teardown() override
+  {
+    delete beamsearch_;
+    delete sampling_;
+    beamsearch_ = nullptr;
+    sampling_ = nullptr;
+    param_.clear();
+    CudaBenchBackend::teardown();
+  }
+
+private:
+  BenchConfig config_;
+  std::vector<DecoderInitParam<DataType_>> param_;
+  DecodingInitParam<DataType_> decoding_params_;
+  DecodingBeamsearch<OpType_> *beamsearch_ = nullptr;
+  DecodingSampling<OpType_> *sampling_ = nullptr;
+};
+
+#ifdef BUILD_GPT
+/**
+ * DecodingGpt on all the MPI ranks. The NCCL communicators of each (tensor_para_size,
+ * layer_para_size) pair are created once. The generated tokens are counted from the
+ * GenerationTrace, so sequences stopping at end_id are not counted.
+ **/
+template <OperationType OpType_>
+class GptBenchBackend : public CudaBenchBackend
+{
+  typedef DecoderTransformerTraits<OpType_> Traits_;
+  typedef typename Traits_::DataType DataType_;
+
+public:
+  GptBenchBackend(const int rank, const int world_size) : rank_(rank), world_size_(world_size) {}
+
+  ~GptBenchBackend()
+  {
+    for (auto &it : comms_)
+    {
+      release_quantized_comm_buffers(it.second.first);
+      release_quantized_comm_buffers(it.second.second);
+      ncclCommDestroy(it.second.first);
+      ncclCommDestroy(it.second.second);
+    }
+  }
+
+  bool setup(const BenchConfig &config, std::string &reason) override
+  {
+    const int tensor_para_size = config.tensor_para_size;
+    const int layer_para_size = config.layer_para_size;
+    if (tensor_para_size * layer_para_size != world_size_)
+    {
+      reason = "tensor_para_size * layer_para_size should equal to the number of ranks";
+      return false;
+    }
+    if (config.head_num % tensor_para_size != 0 || config.num_layer % layer_para_size != 0)
+    {
+      reason = "head_num and num_layer should be divisible by tensor_para_size and layer_para_size";
+      return false;
+    }
+    if (config.beam_width != 1)
+    {
+      reason = "gpt does not support beam search";
+      return false;
+    }
+    if (config.top_k == 0 && config.top_p == 0.0f)
+    {
+      reason = "gpt needs top_k > 0 or top_p > 0";
+      return false;
+    }
+    startMemoryCount();
+    config_ = config;
+
+    const int tensor_para_rank = rank_ % tensor_para_size;
+    const int layer_para_rank = rank_ / tensor_para_size;
+    const int local_head_num = config.head_num / tensor_para_size;
+    const int global_hidden_units = config.head_num * config.size_per_head;
+    const int local_hidden_units = local_head_num * config.size_per_head;
+    const int local_inner_size = local_hidden_units * 4;
+    const int max_seq_len = config.input_len + config.output_len;
+    const int batch_size = config.batch_size;
+    const int end_id = 50256;
+    const std::pair<ncclComm_t, ncclComm_t> comms = getComms(tensor_para_size, layer_para_size);
+
+    TensorParallelParam tensor_parallel_param;
+    tensor_parallel_param.rank = tensor_para_rank;
+    tensor_parallel_param.world_size = tensor_para_size;
+    tensor_parallel_param.nccl_comm = comms.first;
+    tensor_parallel_param.local_head_num_ = local_head_num;
+    tensor_parallel_param.local_hidden_units_ = local_hidden_units;
+    tensor_parallel_param.all_reduce_chunk_num = config.all_reduce_chunk_num;
+    tensor_parallel_param.int8_comm_block_size = config.int8_comm_block_size;
+
+    LayerParallelParam layer_parallel_param;
+    layer_parallel_param.rank = layer_para_rank;
+    layer_parallel_param.world_size = layer_para_size;
+    layer_parallel_param.nccl_comm = comms.second;
+    layer_parallel_param.layers_per_group = config.num_layer / layer_para_size;
+    layer_parallel_param.local_batch_size = batch_size;
+
+    param_.resize(config.num_layer);
+    for (int i = 0; i < config.num_layer; i++)
+    {
+      if (layer_parallel_param.is_valid(i) == false)
+        continue;
+      DecoderInitParam<DataType_> &param = param_[i];
+      param.request_batch_size = batch_size;
+      param.stream = stream_;
+      param.cublas_handle = cublas_handle_;
+      param.cublaslt_handle = cublaslt_handle_;
+      param.self_attention.query_weight.kernel = deviceRandom<DataType_>((size_t)global_hidden_units * local_hidden_units * 3);
+      param.self_attention.key_weight.kernel = param.self_attention.query_weight.kernel + global_hidden_units * local_hidden_units;
+      param.self_attention.value_weight.kernel = param.self_attention.key_weight.kernel + global_hidden_units * local_hidden_units;
+      param.self_attention.query_weight.bias = deviceRandom<DataType_>(local_hidden_units * 3);
+      param.self_attention.key_weight.bias = param.self_attention.query_weight.bias + local_hidden_units;
+      param.self_attention.value_weight.bias = param.self_attention.key_weight.bias + local_hidden_units;
+      param.self_attention.attention_output_weight.kernel = deviceRandom<DataType_>((size_t)local_hidden_units * global_hidden_units);
+      param.self_attention.attention_output_weight.bias = deviceRandom<DataType_>(global_hidden_units);
+      param.self_layernorm.gamma = deviceRandom<DataType_>(global_hidden_units);
+      param.self_layernorm.beta = deviceRandom<DataType_>(global_hidden_units);
+      param.ffn_layernorm.gamma = deviceRandom<DataType_>(global_hidden_units);
+      param.ffn_layernorm.beta = deviceRandom<DataType_>(global_hidden_units);
+      param.ffn.intermediate_weight.kernel = deviceRandom<DataType_>((size_t)global_hidden_units * local_inner_size);
+      param.ffn.intermediate_weight.bias = deviceRandom<DataType_>(local_inner_size);
+      param.ffn.output_weight.kernel = deviceRandom<DataType_>((size_t)local_inner_size * global_hidden_units);
+      param.ffn.output_weight.bias = deviceRandom<DataType_>(global_hidden_units);
+    }
+
+    // random start ids below end_id, the context attention is causal over the start lengths
+    std::vector<int> h_start_ids((size_t)batch_size * config.input_len);
+    for (size_t i = 0; i < h_start_ids.size(); i++)
+      h_start_ids[i] = rand() % std::min(config.vocab_size, end_id);
+    start_lengths_.assign(batch_size, config.input_len);
+
+    decoding_params_.cublas_handle = cublas_handle_;
+    decoding_params_.cublaslt_handle = cublaslt_handle_;
+    decoding_params_.stream = stream_;
+    decoding_params_.embedding_table = deviceRandom<DataType_>((size_t)config.vocab_size * global_hidden_units);
+    decoding_params_.embedding_kernel = decoding_params_.embedding_table;
+    decoding_params_.position_encoding_table = deviceRandom<DataType_>((size_t)max_seq_len * global_hidden_units);
+    decoding_params_.output_ids = deviceMalloc<int>((size_t)max_seq_len * batch_size);
+    decoding_params_.layernorm.gamma = deviceRandom<DataType_>(global_hidden_units);
+    decoding_params_.layernorm.beta = deviceRandom<DataType_>(global_hidden_units);
+    decoding_params_.request_batch_size = batch_size;
+    decoding_params_.request_input_len = config.input_len;
+    decoding_params_.request_output_len = config.output_len;
+    decoding_params_.max_input_len = config.input_len;
+    decoding_params_.d_start_ids = deviceCopy(h_start_ids);
+    decoding_params_.d_start_lengths = deviceCopy(start_lengths_);
+    decoding_params_.d_attn_mask = nullptr;
+
+    decoding_ = new DecodingGpt<OpType_>(*allocator_, batch_size, max_seq_len,
+                                         config.head_num, config.size_per_head,
+                                         config.vocab_size, config.num_layer,
+                                         end_id, end_id, config.top_k, config.top_p, 1.0f,
+                                         tensor_para_size, layer_para_size, true);
+    decoding_->set_tensor_parallel_param(tensor_parallel_param);
+    decoding_->set_layer_parallel_param(layer_parallel_param);
+    decoding_->set_generation_trace(&trace_);
+    check_cuda_error(cudaDeviceSynchronize());
+    return true;
+  }
+
+  size_t run() override
+  {
+    decoding_->forward_context(param_.data(), decoding_params_);
+    decoding_->forward(param_.data(), decoding_params_);
+    check_cuda_error(cudaStreamSynchronize(stream_));
+    const MetricsClock::time_point now = MetricsClock::now();
+    return compute_request_metrics(trace_, now, now, start_lengths_.data(), config_.batch_size,
+                                   config_.input_len, config_.batch_size).generated_tokens;
+  }
+
+  void barrier() override
+  {
+    MPICHECK(MPI_Barrier(MPI_COMM_WORLD));
+  }
+
+  void teardown() override
+  {
+    delete decoding_;
+    decoding_ = nullptr;
+    param_.clear();
+    CudaBenchBackend::teardown();
+  }
+
+private:
+  // Rank 0 creates the ids of all the groups, as the triton backend lays them out.
+  std::pair<ncclComm_t, ncclComm_t> getComms(const int tensor_para_size, const int layer_para_size)
+  {
+    const auto key = std::make_pair(tensor_para_size, layer_para_size);
+    auto it = comms_.find(key);
+    if (it != comms_.end())
+      return it->second;
+
+    std::vector<ncclUniqueId> nccl_ids(world_size_ / tensor_para_size + tensor_para_size);
+    if (rank_ == 0)
+      for (ncclUniqueId &id : nccl_ids)
+        NCCLCHECK(ncclGetUniqueId(&id));
+    MPICHECK(MPI_Bcast(nccl_ids.data(), (int)(nccl_ids.size() * sizeof(ncclUniqueId)), MPI_BYTE, 0, MPI_COMM_WORLD));
+
+    std::pair<ncclComm_t, ncclComm_t> comms;
+    NCCLCHECK(ncclCommInitRank(&comms.first, tensor_para_size, nccl_ids[rank_ / tensor_para_size], rank_ % tensor_para_size));
+    NCCLCHECK(ncclCommInitRank(&comms.second, layer_para_size, nccl_ids[world_size_ / tensor_para_size + rank_ % tensor_para_size],
+                               rank_ / tensor_para_size));
+    comms_[key] = comms;
+    return comms;
+  }
+
+  const int rank_;
+  const int world_size_;
+  BenchConfig config_;
+  std::map<std::pair<int, int>, std::pair<ncclComm_t, ncclComm_t>> comms_;
+  std::vector<DecoderInitParam<DataType_>> param_;
+  DecodingInitParam<DataType_> decoding_params_;
+  std::vector<int> start_lengths_;
+  GenerationTrace trace_;
+  DecodingGpt<OpType_> *decoding_ = nullptr;
+};
+#endif
+
+// One backend per data type, created the first time a configuration needs it.
+class BackendSet
+{
+public:
+  BackendSet(const int rank, const int world_size) : rank_(rank), world_size_(world_size) {}
+
+  BenchBackend *get(const BenchConfig &config)
+  {
+    const std::string key = config.backend == "cpu" ? "cpu" : config.model + "/" + config.data_type;
+    std::unique_ptr<BenchBackend> &backend = backends_[key];
+    if (backend == nullptr)
+      backend.reset(create(config));
+    return backend.get();
+  }
+
+private:
+  BenchBackend *create(const BenchConfig &config)
+  {
+    const bool is_half = config.data_type == "fp16";
+    if (config.backend == "cpu")
+      return new CpuBenchBackend();
+    if (config.model == "encoder")
+      return is_half ? (BenchBackend *)new EncoderBenchBackend<OperationType::FP16>() :
+                       (BenchBackend *)new EncoderBenchBackend<OperationType::FP32>();
+    if (config.model == "decoding")
+      return is_half ? (BenchBackend *)new DecodingBenchBackend<OperationType::FP16>() :
+                       (BenchBackend *)new DecodingBenchBackend<OperationType::FP32>();
+#ifdef BUILD_GPT
+    return is_half ? (BenchBackend *)new GptBenchBackend<OperationType::FP16>(rank_, world_size_) :
+                     (BenchBackend *)new GptBenchBackend<OperationType::FP32>(rank_, world_size_);
+#else
+    printf("[ERROR][ft_bench] the gpt model needs BUILD_GPT\n");
+    exit(-1);
+#endif
+  }
+
+  const int rank_;
+  const int world_size_;
+  std::map<std::string, std::unique_ptr<BenchBackend>> backends_;
+};
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    printf("[ERROR] ft_bench sweep.ini [section.key=value ...]\n");
+    printf("e.g., ./bin/ft_bench ../sample/cpp/ft_bench_sweep.ini bench.backend=cpu model.num_layer=2\n");
+    return 0;
+  }
+  int rank = 0, world_size = 1;
+#ifdef BUILD_GPT
+  MPICHECK(MPI_Init(&argc, &argv));
+  MPICHECK(MPI_Comm_rank(MPI_COMM_WORLD, &rank));
+  MPICHECK(MPI_Comm_size(MPI_COMM_WORLD, &world_size));
+#endif
+  srand(0);
+
+  const BenchSpec spec = BenchSpecReader(argv[1], std::vector<std::string>(argv + 2, argv + argc)).read();
+  if (spec.backend == "cuda")
+  {
+    int device_count;
+    check_cuda_error(cudaGetDeviceCount(&device_count));
+    check_cuda_error(cudaSetDevice(rank % device_count));
+  }
+  else if (world_size > 1)
+  {
+    printf("[ERROR][ft_bench] the cpu backend runs in one process, its ranks are threads\n");
+    exit(-1);
+  }
+  else
+  {
+    // no device work to time, the spans of the cpu backend use the host clock
+    Timeline::instance().setClock(TimelineClock::CPU);
+  }
+
+  BackendSet backends(rank, world_size);
+  std::vector<BenchResult> results;
+  for (const BenchConfig &config : spec.configs)
+  {
+    BenchResult result = run_bench_config(*backends.get(config), config, spec.warmup, spec.iterations);
+    if (rank == 0)
+    {
+      if (result.skipped)
+        printf("[WARNING][ft_bench] skip %s: %s\n", config.toString().c_str(), result.skip_reason.c_str());
+      else
+        printf("[INFO][ft_bench] %s p50 %.2f ms p90 %.2f ms p99 %.2f ms %.1f tokens/s peak memory %.1f MB\n",
+               config.toString().c_str(), result.p50_ms, result.p90_ms, result.p99_ms,
+               result.tokens_per_second, result.peak_memory_mb);
+    }
+    results.push_back(result);
+  }
+  if (rank == 0)
+    write_bench_results(spec, results);
+  Timeline::instance().write();
+
+#ifdef BUILD_GPT
+  MPI_Finalize();
+#endif
+  return 0;
+}
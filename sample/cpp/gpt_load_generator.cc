@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Replays a request trace, or synthetic Poisson / bursty arrivals, against the GPT model of the
+ * triton backend under open-loop load, and reports the throughput and latency percentiles.
+ *
+ * ./bin/gpt_load_generator ../sample/cpp/gpt_load_config.ini [../sample/cpp/gpt_config.ini]
+ *
+ * With mock=1 in [load], the model instances are MockModelInstance and no GPU is used.
+ **/
+
+#include "fastertransformer/triton_backend/gpt_triton_backend.hpp"
+#include "fastertransformer/triton_backend/load_generator.h"
+
+using namespace fastertransformer;
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    printf("[ERROR] gpt_load_generator load_config.ini [gpt_config.ini]\n");
+    printf("e.g., ./bin/gpt_load_generator ../sample/cpp/gpt_load_config.ini ../sample/cpp/gpt_config.ini\n");
+    return 0;
+  }
+  const std::string load_ini_name = argv[1];
+  const std::string gpt_ini_name = argc >= 3 ? argv[2] : "../sample/cpp/gpt_config.ini";
+  const LoadSpec spec = read_load_spec(load_ini_name);
+  INIReader reader = INIReader(load_ini_name);
+  const bool use_mock = reader.GetInteger("load", "mock", 0) != 0;
+  const std::string output = reader.Get("load", "output", "");
+
+  std::shared_ptr<AbstractTransformerModel> model;
+  std::vector<std::unique_ptr<AbstractTransformerModelInstance>> instances;
+  std::vector<std::unique_ptr<AbstractParamInstance>> param_instances;
+  std::vector<cudaStream_t> streams;
+  std::vector<LoadGenerator::Replica> replicas;
+  int max_batch_size, max_seq_len;
+
+  if (use_mock)
+  {
+    const int replica_num = reader.GetInteger("load", "mock_instances", 1);
+    max_batch_size = reader.GetInteger("load", "mock_max_batch_size", 8);
+    max_seq_len = reader.GetInteger("load", "mock_max_seq_len", 1024);
+    const double context_us_per_token = reader.GetFloat("load", "mock_context_us_per_token", 10.0);
+    const double step_ms = reader.GetFloat("load", "mock_step_ms", 5.0);
+    for (int r = 0; r < replica_num; r++)
+    {
+      instances.push_back(std::unique_ptr<AbstractTransformerModelInstance>(
+          new MockModelInstance(max_seq_len, context_us_per_token, step_ms)));
+      replicas.push_back(LoadGenerator::Replica{{instances.back().get()}, nullptr});
+    }
+    printf("[INFO] %d mock instances, max_batch_size %d, %.1f us per context token, %.2f ms per step\n",
+           replica_num, max_batch_size, context_us_per_token, step_ms);
+  }
+  else
+  {
+    // one node, all the ranks of the model in this process, as gpt_thread_sample
+    model = AbstractTransformerModel::createGptModel(gpt_ini_name);
+    std::cout << model->to_string();
+    const int tensor_para_size = model->get_tensor_para_size();
+    const int layer_para_size = model->get_layer_para_size();
+    const int gpu_size = tensor_para_size * layer_para_size;
+    int device_count;
+    CUDACHECK(cudaGetDeviceCount(&device_count));
+    if (gpu_size > device_count)
+    {
+      printf("[ERROR] the model needs %d GPUs, only %d are visible\n", gpu_size, device_count);
+      exit(-1);
+    }
+    max_batch_size = (int)model->get_max_batch_seqlen().first;
+    max_seq_len = (int)model->get_max_batch_seqlen().second;
+
+    // the replicas of a GPU share the weights of its rank, each has its communicators and streams
+    const int replica_num = reader.GetInteger("load", "instances_per_gpu", 1);
+    for (int r = 0; r < replica_num; r++)
+    {
+      std::vector<ncclUniqueId> nccl_ids = model->create_nccl_ids(gpu_size);
+      std::vector<ncclComm_t> tensor_nccl_comms(gpu_size), layer_nccl_comms(gpu_size);
+      NCCLCHECK(ncclGroupStart());
+      for (int rank = 0; rank < gpu_size; rank++)
+      {
+        ncclUniqueId tensor_para_nccl_uid = nccl_ids[rank / tensor_para_size];
+        ncclUniqueId layer_para_nccl_uid = nccl_ids[gpu_size / tensor_para_size + rank % tensor_para_size];
+        CUDACHECK(cudaSetDevice(rank));
+        NCCLCHECK(ncclCommInitRank(&tensor_nccl_comms[rank], tensor_para_size, tensor_para_nccl_uid, rank % tensor_para_size));
+        NCCLCHECK(ncclCommInitRank(&layer_nccl_comms[rank], layer_para_size, layer_para_nccl_uid, rank / tensor_para_size));
+      }
+      NCCLCHECK(ncclGroupEnd());
+
+      LoadGenerator::Replica replica;
+      for (int rank = 0; rank < gpu_size; rank++)
+      {
+        CUDACHECK(cudaSetDevice(rank));
+        cudaStream_t stream;
+        check_cuda_error(cudaStreamCreate(&stream));
+        streams.push_back(stream);
+        instances.push_back(model->createModelInstance(0, rank, gpu_size, stream));
+        param_instances.push_back(model->createParamInstance(0, rank, gpu_size, stream, nccl_ids));
+        param_instances.back()->init_nccl_from_comms(tensor_nccl_comms[rank], layer_nccl_comms[rank]);
+        instances.back()->set_param(param_instances.back().get());
+        replica.instances.push_back(instances.back().get());
+      }
+      replica.init_thread = [](const int rank) { CUDACHECK(cudaSetDevice(rank)); };
+      replicas.push_back(replica);
+    }
+  }
+
+  const std::vector<LoadRequest> requests = generate_load_trace(spec);
+  printf("[INFO] %zu requests, mode %s\n", requests.size(), spec.mode.c_str());
+
+  LoadGenerator generator(replicas, max_batch_size, max_seq_len);
+  const std::vector<LoadResult> results = generator.run(requests);
+  print_load_summary(summarize_load(results));
+  if (!output.empty())
+    write_load_results_csv(output, results);
+  if (model != nullptr)
+    printf("%s", model->get_metrics_prometheus().c_str());
+
+  instances.clear();
+  param_instances.clear();
+  for (cudaStream_t stream : streams)
+    cudaStreamDestroy(stream);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Predicts the bubbles of the layer parallel GPT generation for every layer_para_batch_size
+// that divides the batch, with the blocking and the pipelined schedules (see
+// fastertransformer/utils/pipeline_simulator.h). Needs no GPU.
+
+#include "fastertransformer/utils/pipeline_simulator.h"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace fastertransformer;
+
+int main(int argc, char *argv[])
+{
+  if (argc != 4 && argc != 10)
+  {
+    printf("[ERROR] gpt_pipeline_sim layer_para_size batch_size step_num "
+           "[stage_us stage_row_us sampling_us sampling_row_us transfer_us sync_us]\n");
+    printf("e.g., ./bin/gpt_pipeline_sim 4 32 32 1000 10 200 5 20 20\n");
+    return 0;
+  }
+  const int layer_para_size = atoi(argv[1]);
+  const int batch_size = atoi(argv[2]);
+  const int step_num = atoi(argv[3]);
+  PipelineCosts costs;
+  if (argc == 10)
+  {
+    costs.stage_us = atof(argv[4]);
+    costs.stage_row_us = atof(argv[5]);
+    costs.sampling_us = atof(argv[6]);
+    costs.sampling_row_us = atof(argv[7]);
+    costs.transfer_us = atof(argv[8]);
+    costs.sync_us = atof(argv[9]);
+  }
+
+  printf("layer_para_size %d, batch_size %d, %d steps\n", layer_para_size, batch_size, step_num);
+  printf("%22s %16s %16s %16s %16s\n", "layer_para_batch_size", "blocking ms", "blocking bubble", "pipelined ms",
+         "pipelined bubble");
+  for (int local_batch_size = 1; local_batch_size <= batch_size; local_batch_size++)
+  {
+    if (batch_size % local_batch_size != 0)
+      continue;
+    const PipelineSimulation blocking =
+        simulate_pipeline(PipelineSchedule::BLOCKING, layer_para_size, batch_size, local_batch_size, step_num, costs);
+    const PipelineSimulation pipelined =
+        simulate_pipeline(PipelineSchedule::PIPELINED, layer_para_size, batch_size, local_batch_size, step_num, costs);
+    printf("%22d %16.2f %15.1f%% %16.2f %15.1f%%\n", local_batch_size, blocking.total_us / 1000.0,
+           blocking.bubble_fraction * 100.0, pipelined.total_us / 1000.0, pipelined.bubble_fraction * 100.0);
+  }
+  return 0;
+}
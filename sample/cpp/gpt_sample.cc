@@ -17,6 +17,7 @@
 #include "fastertransformer/open_decoder.h"
 #include "fastertransformer/gpt.h"
 #include "fastertransformer/utils/INIReader.h"
+#include "fastertransformer/utils/gpt_tokenizer.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
@@ -27,6 +28,7 @@
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <memory>
 #include <vector>
 #include "fastertransformer/utils/nvtx_utils.h"
 
@@ -261,36 +263,64 @@ int init_device_from_file(T **ptr, std::vector<int> shape, std::string filename,
   return 0;
 }
 
+// With a tokenizer, the prompts are the lines of start_text_file instead of the ids of start_ids.csv.
 int read_start_ids(int batch_size, std::vector<int>*v_start_lengths, std::vector<int>*v_start_ids, 
-                   int& max_input_len, const int end_id)
+                   int& max_input_len, const int end_id,
+                   GptTokenizer* tokenizer = nullptr, const std::string start_text_file = "")
 {
   std::vector<std::vector<int>> tmp_start_ids;
 
-  std::ifstream start_id_file("../sample/cpp/start_ids.csv", std::ios::in);
-  if (start_id_file.is_open())
+  if (tokenizer != nullptr)
   {
+    std::ifstream start_text(start_text_file.c_str(), std::ios::in);
+    if (!start_text.is_open())
+    {
+      printf("[ERROR] Cannot open the file '%s'. \n", start_text_file.c_str());
+      exit(-1);
+    }
     std::string line;
-    int i0 = 0;
-    while (std::getline(start_id_file, line))
+    while (std::getline(start_text, line))
     {
-      std::stringstream lineStream(line);
-      std::string vals;
-      int i1 = 0;
-      std::vector<int> tmp_vec; 
-      while (std::getline(lineStream, vals, ','))
-      {
-        tmp_vec.push_back(std::stoi(vals));
-        i1++;
-      }
+      std::vector<int> tmp_vec = tokenizer->encode(line);
+      if (tmp_vec.empty())
+        continue;
+      v_start_lengths->push_back((int)tmp_vec.size());
       tmp_start_ids.push_back(tmp_vec);
-      v_start_lengths->push_back(i1);
-      i0++;
+    }
+    if (tmp_start_ids.empty())
+    {
+      printf("[ERROR] No prompt in the file '%s'. \n", start_text_file.c_str());
+      exit(-1);
     }
   }
   else
   {
-    printf("[ERROR] Cannot open the file '../sample/cpp/start_ids.csv'. \n");
-    exit(-1);
+    std::ifstream start_id_file("../sample/cpp/start_ids.csv", std::ios::in);
+    if (start_id_file.is_open())
+    {
+      std::string line;
+      int i0 = 0;
+      while (std::getline(start_id_file, line))
+      {
+        std::stringstream lineStream(line);
+        std::string vals;
+        int i1 = 0;
+        std::vector<int> tmp_vec; 
+        while (std::getline(lineStream, vals, ','))
+        {
+          tmp_vec.push_back(std::stoi(vals));
+          i1++;
+        }
+        tmp_start_ids.push_back(tmp_vec);
+        v_start_lengths->push_back(i1);
+        i0++;
+      }
+    }
+    else
+    {
+      printf("[ERROR] Cannot open the file '../sample/cpp/start_ids.csv'. \n");
+      exit(-1);
+    }
   }
 
   max_input_len = v_start_lengths->data()[0];
@@ -340,6 +370,8 @@ void decoding_sample(const INIReader reader)
   const int layer_para_size = reader.GetInteger("ft_instance_hyperparameter", "layer_para_size");
   const int layer_para_batch_size = reader.GetInteger("ft_instance_hyperparameter", "layer_para_batch_size");
   const bool is_fuse_QKV = (bool)(reader.GetInteger("ft_instance_hyperparameter", "is_fuse_QKV"));
+  const int all_reduce_chunk_num = reader.GetInteger("ft_instance_hyperparameter", "all_reduce_chunk_num", 1);
+  const int int8_comm_block_size = reader.GetInteger("ft_instance_hyperparameter", "int8_comm_block_size", 0);
 
   const int head_num = reader.GetInteger(model_name, "head_num");
   const int size_per_head = reader.GetInteger(model_name, "size_per_head");
@@ -357,12 +389,17 @@ void decoding_sample(const INIReader reader)
   const int start_id = 50256;
   const int end_id = 50256;
 
-  // Read ids of request from file.
+  // Read ids of request from file, or encode the prompts of start_text_file.
+  const std::string start_text_file = reader.Get("request", "start_text_file", "");
+  std::unique_ptr<GptTokenizer> tokenizer;
+  if(!start_text_file.empty())
+    tokenizer.reset(new GptTokenizer(reader.Get("tokenizer", "vocab_file", "../models/gpt2-vocab.json"),
+                                     reader.Get("tokenizer", "merges_file", "../models/gpt2-merges.txt")));
   std::vector<int> v_start_lengths;
   std::vector<int> v_start_ids;
   int max_input_len = -1;
   read_start_ids(request_batch_size, &v_start_lengths, &v_start_ids, 
-                 max_input_len, end_id);
+                 max_input_len, end_id, tokenizer.get(), start_text_file);
   int* start_lengths = v_start_lengths.data();
   int* start_ids = v_start_ids.data();
   for(int i = 0; i < request_batch_size; i++)
@@ -494,6 +531,8 @@ void decoding_sample(const INIReader reader)
   tensor_parallel_param.nccl_comm = tensor_para_nccl_comm;
   tensor_parallel_param.local_head_num_ = local_head_num;
   tensor_parallel_param.local_hidden_units_ = local_hidden_units;
+  tensor_parallel_param.all_reduce_chunk_num = all_reduce_chunk_num;
+  tensor_parallel_param.int8_comm_block_size = int8_comm_block_size;
 
   LayerParallelParam layer_parallel_param;
   layer_parallel_param.rank = layer_para_rank;
@@ -502,7 +541,9 @@ void decoding_sample(const INIReader reader)
   layer_parallel_param.layers_per_group = layers_per_group;
   layer_parallel_param.local_batch_size = layer_para_batch_size;
 
-  fastertransformer::Allocator<AllocatorType::CUDA> allocator(device);
+  fastertransformer::Allocator<AllocatorType::CUDA> cuda_allocator(device);
+  // accounts the current and peak bytes of each buffer of DecodingGpt
+  fastertransformer::TrackingAllocator allocator(cuda_allocator);
   DecoderInitParam<T> *decoder_param = new DecoderInitParam<T>[decoder_layers];
 
   for (int i = 0; i < decoder_layers; i++)
@@ -596,6 +637,20 @@ void decoding_sample(const INIReader reader)
 
   const fastertransformer::OperationType type = std::is_same<T, float>::value ? OperationType::FP32 : OperationType::FP16;
 
+  GptArguments footprint_args;
+  footprint_args.batch_size_ = max_batch_size;
+  footprint_args.seq_len_ = max_seq_len;
+  footprint_args.head_num_ = global_head_num;
+  footprint_args.size_per_head_ = size_per_head;
+  footprint_args.decoder_layers_ = decoder_layers;
+  footprint_args.vocab_size_ = vocab_size;
+  footprint_args.start_id_ = start_id;
+  footprint_args.end_id_ = end_id;
+  footprint_args.candidate_num_ = candidate_num;
+  footprint_args.probability_threshold_ = probability_threshold;
+  const MemoryFootprint predicted_footprint = DecodingGpt<type>::predict_footprint(footprint_args, tensor_para_size,
+                                                                                    layer_para_size, max_input_len);
+
   DecodingGpt<type> *decoding = new DecodingGpt<type>(allocator, max_batch_size, 
                                                         max_seq_len, global_head_num, size_per_head,
                                                         vocab_size, decoder_layers,
@@ -613,24 +668,10 @@ void decoding_sample(const INIReader reader)
   cudaMalloc((void **)&d_start_lengths, sizeof(int) * request_batch_size);
   cudaMemcpyAsync(d_start_lengths, start_lengths, sizeof(int) * request_batch_size, cudaMemcpyHostToDevice, stream);
 
-  T* h_attn_mask = new T[request_batch_size * request_input_len * request_input_len];
-  memset(h_attn_mask, 0, sizeof(T) * request_batch_size * request_input_len * request_input_len);
-  for(int i = 0; i < request_batch_size; i++)
-  {
-    for(int j = 0; j < request_input_len; j++)
-    {
-      for(int k = 0; k <= j; k++)
-      {
-        h_attn_mask[i * request_input_len * request_input_len + j * request_input_len + k] = (T)1.0f;
-      }
-    }
-  }
-  T* d_attn_mask;
-  cudaMalloc((void **)&d_attn_mask, sizeof(T) * request_batch_size * request_input_len * request_input_len);
-  cudaMemcpyAsync(d_attn_mask, h_attn_mask, sizeof(T) * request_batch_size * request_input_len * request_input_len, cudaMemcpyHostToDevice, stream);
   decoding_params.d_start_ids = d_start_ids;
   decoding_params.d_start_lengths = d_start_lengths;
-  decoding_params.d_attn_mask = d_attn_mask;
+  // no d_attn_mask, the context attention is causal over d_start_lengths
+  decoding_params.d_attn_mask = nullptr;
   
   cudaDeviceSynchronize();
   check_cuda_error(cudaGetLastError());
@@ -645,7 +686,7 @@ void decoding_sample(const INIReader reader)
   cudaProfilerStart();
   // warm up
   ite = 1;
-  PUSH_RANGE("warmup time")
+  PUSH_RANGE("warmup time", decoding_params.stream)
   for (int i = 0; i < ite; ++i)
   {
     decoding->forward_context(decoder_param, decoding_params);
@@ -661,7 +702,7 @@ void decoding_sample(const INIReader reader)
   MPI_Barrier(MPI_COMM_WORLD);
   gettimeofday(&start, NULL);
 
-  PUSH_RANGE("total time")
+  PUSH_RANGE("total time", decoding_params.stream)
   for (int i = 0; i < ite; ++i)
   {
     gettimeofday(&context_start, NULL);
@@ -685,6 +726,15 @@ void decoding_sample(const INIReader reader)
          request_batch_size, head_num, size_per_head, total_output_len, decoder_layers, vocab_size,
          ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) * 0.001) / ite,
          ((context_end.tv_sec - context_start.tv_sec) * 1000 + (context_end.tv_usec - context_start.tv_usec) * 0.001) / ite);
+  if(rank == 0 && (Profiler::instance().getMode() == ProfilerMode::CUDA_EVENT || Profiler::instance().getMode() == ProfilerMode::CPU))
+    Profiler::instance().printReport();
+  if(rank == 0)
+  {
+    predicted_footprint.print("predicted memory of a rank");
+    allocator.printReport();
+  }
+  // every rank writes its own trace, FT_TIMELINE should contain %p
+  Timeline::instance().write();
     
   if(rank == 0)
   {
@@ -717,6 +767,21 @@ void decoding_sample(const INIReader reader)
         }
         std::cout << std::endl << "zerroCount = " << zerroCount << std::endl;
       }
+      if(tokenizer != nullptr)
+      {
+        // hBuf is [total_output_len, request_batch_size]; the generated text stops at the first end id
+        for(int i = 0; i < request_batch_size; i++)
+        {
+          std::vector<int> ids;
+          for(int j = 0; j < total_output_len; j++)
+          {
+            const int id = hBuf[j * request_batch_size + i];
+            if(j >= v_start_lengths[i] && id == end_id) break;
+            ids.push_back(id);
+          }
+          printf("[INFO] batch %d: %s\n", i, tokenizer->decode(ids).c_str());
+        }
+      }
       delete [] hBuf;
     }
   }
@@ -724,7 +789,6 @@ void decoding_sample(const INIReader reader)
   ncclCommDestroy(tensor_para_nccl_comm);
   ncclCommDestroy(layer_para_nccl_comm);
   delete [] decoder_param;
-  delete [] h_attn_mask;
   delete decoding;
   return;
 }
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Encodes a text file, one prompt per line, with the C++ GPT-2 tokenizer, writes the ids in
+ * the format of start_ids.csv and reports the encoding throughput.
+ *
+ * ./bin/gpt_tokenizer_sample vocab.json merges.txt prompts.txt [start_ids.csv] [iterations] [cache_size]
+ *
+ * sample/pytorch/utils/gpt_token_encoder_bench.py times gpt_token_encoder.py on the same file
+ * and checks that the ids are the same.
+ **/
+
+#include "fastertransformer/utils/gpt_tokenizer.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace fastertransformer;
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4)
+  {
+    printf("[ERROR] gpt_tokenizer_sample vocab.json merges.txt prompts.txt [start_ids.csv] [iterations] [cache_size]\n");
+    printf("e.g., ./bin/gpt_tokenizer_sample ../models/gpt2-vocab.json ../models/gpt2-merges.txt prompts.txt start_ids.csv 10\n");
+    return 0;
+  }
+  const std::string output = argc >= 5 ? argv[4] : "";
+  const int iterations = argc >= 6 ? atoi(argv[5]) : 1;
+  const size_t cache_size = argc >= 7 ? (size_t)atol(argv[6]) : 65536;
+
+  auto load_begin = std::chrono::steady_clock::now();
+  GptTokenizer tokenizer(argv[1], argv[2], cache_size);
+  const double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_begin).count();
+  printf("[INFO] vocab size %d, loaded in %.2f ms\n", tokenizer.getVocabSize(), load_ms);
+
+  std::ifstream text_file(argv[3], std::ios::in);
+  if (!text_file.is_open())
+  {
+    printf("[ERROR] Cannot open the file '%s'. \n", argv[3]);
+    exit(-1);
+  }
+  std::vector<std::string> lines;
+  std::string line;
+  size_t byte_num = 0;
+  while (std::getline(text_file, line))
+  {
+    byte_num += line.size();
+    lines.push_back(line);
+  }
+
+  std::vector<std::vector<int>> ids(lines.size());
+  size_t token_num = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (int ite = 0; ite < iterations; ite++)
+  {
+    token_num = 0;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+      ids[i] = tokenizer.encode(lines[i]);
+      token_num += ids[i].size();
+    }
+  }
+  const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() / iterations;
+  printf("[INFO] %zu lines, %zu bytes, %zu tokens: %.3f ms per pass, %.2f MB/s, %.0f tokens/s\n",
+         lines.size(), byte_num, token_num, ms, byte_num / ms / 1000.0, token_num / ms * 1000.0);
+  printf("[INFO] cache hits %zu, misses %zu\n", tokenizer.getCacheHitNum(), tokenizer.getCacheMissNum());
+
+  size_t mismatch_num = 0;
+  for (size_t i = 0; i < lines.size(); i++)
+    mismatch_num += tokenizer.decode(ids[i]) != lines[i];
+  if (mismatch_num > 0)
+    printf("[WARNING] %zu lines do not decode to the same text\n", mismatch_num);
+
+  if (!output.empty())
+  {
+    std::ofstream out_file(output, std::ios::out);
+    if (!out_file.is_open())
+    {
+      printf("[ERROR] Cannot write the file '%s'. \n", output.c_str());
+      exit(-1);
+    }
+    for (const std::vector<int> &line_ids : ids)
+    {
+      for (size_t j = 0; j < line_ids.size(); j++)
+        out_file << (j == 0 ? "" : ", ") << line_ids[j];
+      out_file << std::endl;
+    }
+  }
+  return 0;
+}
@@ -30,6 +30,12 @@ int main(int argc, char *argv[])
   int world_size = 1;
 
   bool use_mpi = argc >= 3 && std::stoi(argv[2]) == 1 ? true : false;
+  // the ranks get the nccl ids through the files of that directory instead of MPI_Bcast
+  std::string rendezvous_dir = argc >= 4 ? std::string(argv[3]) : "";
+  // the requests of all ranks, and the one after which this rank leaves its groups and exits
+  // after one more request, to be started again
+  int request_num = argc >= 5 ? std::stoi(argv[4]) : 2;
+  int leave_request = argc >= 6 ? std::stoi(argv[5]) : -1;
 
   if(use_mpi)
   {
@@ -45,6 +51,23 @@ int main(int argc, char *argv[])
     device_id = rank % device_count;
     CUDACHECK(cudaSetDevice(device_id));
   }
+  else if(!rendezvous_dir.empty())
+  {
+    // run by a launcher, which starts a process per rank and starts it again when it exits
+    const char* rank_env = getenv("FT_RANK");
+    const char* world_size_env = getenv("FT_WORLD_SIZE");
+    if(rank_env == nullptr || world_size_env == nullptr)
+    {
+      printf("[ERROR] FT_RANK and FT_WORLD_SIZE should be set without MPI \n");
+      return -1;
+    }
+    int rank = std::stoi(rank_env), device_count;
+    world_size = std::stoi(world_size_env);
+    CUDACHECK(cudaGetDeviceCount(&device_count));
+    node_id = rank / device_count;
+    device_id = rank % device_count;
+    CUDACHECK(cudaSetDevice(device_id));
+  }
   else
   {
     // run by triton
@@ -64,7 +87,11 @@ int main(int argc, char *argv[])
   auto model = AbstractTransformerModel::createGptModel(ini_name);
 
   std::vector<ncclUniqueId> nccl_ids;
-  if(use_mpi)
+  if(!rendezvous_dir.empty())
+  {
+    // see init_nccl_from_store below
+  }
+  else if(use_mpi)
   {
     if(node_id == 0 && device_id == 0)
     {
@@ -97,6 +124,14 @@ int main(int argc, char *argv[])
   check_cuda_error(cudaStreamCreate(&stream));
   auto modelInstance = model->createModelInstance(node_id, device_id, world_size, stream);
   auto param_instance = model->createParamInstance(node_id, device_id, world_size, stream, nccl_ids);
+  std::unique_ptr<RendezvousStore> rendezvous_store;
+  int first_request = 0;
+  if(!rendezvous_dir.empty())
+  {
+    rendezvous_store.reset(new FileStore(rendezvous_dir));
+    first_request = param_instance->init_nccl_from_store(*rendezvous_store, "gpt");
+    printf("[INFO] rank %d starts at request %d \n", node_id * 8 + device_id, first_request);
+  }
   modelInstance->set_param(param_instance.get());
   printf("model instance is created \n");
   
@@ -106,15 +141,41 @@ int main(int argc, char *argv[])
 
   print_mem_usage();
 
-  auto output = modelInstance->forward(request);
+  std::shared_ptr<std::vector<Tensor>> output;
+  bool leaving = false;
+  for(int i = first_request; i < request_num; i++)
+  {
+    // the groups in which a rank restarts at this request re-form, with new communicators
+    if(param_instance->refresh_nccl_from_store())
+      modelInstance->set_param(param_instance.get());
 
-  if(node_id == 0 && device_id == 0)
-    check_inputs(request);
+    output = modelInstance->forward(request);
 
-  output = modelInstance->forward(request);
+    if(i == 0 && node_id == 0 && device_id == 0)
+      check_inputs(request);
 
-  if(node_id == 0 && device_id == 0)
+    if(leaving)
+    {
+      printf("[INFO] rank %d exits after request %d \n", node_id * 8 + device_id, i);
+      break;
+    }
+    if(i == leave_request && !rendezvous_dir.empty())
+    {
+      param_instance->leave_nccl_store();
+      leaving = true;
+    }
+  }
+
+  if(!leaving && node_id == 0 && device_id == 0)
     check_outputs(output);
+
+  if(!leaving && node_id == 0 && device_id == 0)
+  {
+    RequestMetrics metrics = modelInstance->get_last_request_metrics();
+    printf("[INFO] context time %.2f ms, time to first token %.2f ms, total time %.2f ms, %.2f tokens/s\n",
+           metrics.context_ms, metrics.first_token_ms, metrics.total_ms, metrics.tokens_per_second);
+    printf("%s", model->get_metrics_prometheus().c_str());
+  }
   
   if(use_mpi)
   {
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the int8 all-reduce and all-gather (see fastertransformer/utils/quantized_comm.h)
+// against the exact ones, with the ranks of a ThreadCommunicator group as threads: every rank
+// must get the same bits, and every value must be within the error bound of the quantization.
+// Runs the sizes of the arguments, or a set of world sizes, block sizes and sizes without them,
+// on float and half data with several distributions. Needs no GPU; returns 1 on a failure.
+
+#include "fastertransformer/utils/communicator.h"
+#include "fastertransformer/utils/quantized_comm.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fastertransformer;
+
+enum Distribution
+{
+  NORMAL,     // N(0, 1)
+  OUTLIERS,   // N(0, 1) with a value of 100 every 97 values, like the outlier channels of activations
+  MAGNITUDES, // N(0, 1) scaled by 10^-3 .. 10^3 every 64 values
+  SPARSE,     // zeros, with a N(0, 1) value every 61 values
+  DISTRIBUTION_NUM
+};
+static const char *distribution_names[] = {"normal", "outliers", "magnitudes", "sparse"};
+
+struct CheckResult
+{
+  double max_error_to_bound = 0.0; // must be <= 1
+  double sq_error = 0.0;
+  double sq_exact = 0.0;
+  bool same_bits = true;
+
+  void add(const CheckResult &other)
+  {
+    max_error_to_bound = std::max(max_error_to_bound, other.max_error_to_bound);
+    sq_error += other.sq_error;
+    sq_exact += other.sq_exact;
+    same_bits = same_bits && other.same_bits;
+  }
+  bool ok() const { return same_bits && max_error_to_bound <= 1.0; }
+  double getRelativeRmsError() const { return sq_exact > 0.0 ? sqrt(sq_error / sq_exact) : sqrt(sq_error); }
+};
+
+template <typename T>
+static std::vector<std::vector<T>> make_inputs(const int world_size, const size_t count, const Distribution distribution,
+                                               const unsigned seed)
+{
+  std::mt19937 gen(seed);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  std::vector<std::vector<T>> inputs(world_size, std::vector<T>(count));
+  for (int r = 0; r < world_size; r++)
+    for (size_t i = 0; i < count; i++)
+    {
+      float x = normal(gen);
+      if (distribution == OUTLIERS && (i + r) % 97 == 0)
+        x = 100.0f;
+      else if (distribution == MAGNITUDES)
+        x *= powf(10.0f, (float)((i / 64 + r) % 7) - 3.0f);
+      else if (distribution == SPARSE && (i + 7 * r) % 61 != 0)
+        x = 0.0f;
+      quantized_comm_from_float(x, &inputs[r][i]);
+    }
+  return inputs;
+}
+
+// The error of a value of a block quantized with max|x| = amax: half the scale, and the rounding
+// of x / scale in float.
+static double get_quantization_error(const double amax) { return amax / 254.0 * (1.0 + 1e-4); }
+
+// The relative rounding of T.
+template <typename T> static double get_epsilon();
+template <> double get_epsilon<float>() { return ldexp(1.0, -24); }
+template <> double get_epsilon<half>() { return ldexp(1.0, -11); }
+
+template <typename T>
+static bool is_same_bits(const std::vector<std::vector<T>> &outputs)
+{
+  for (size_t r = 1; r < outputs.size(); r++)
+    if (memcmp(outputs[r].data(), outputs[0].data(), sizeof(T) * outputs[0].size()) != 0)
+      return false;
+  return true;
+}
+
+template <typename T>
+static CheckResult check_all_reduce(const int world_size, const int block_size, const size_t count,
+                                    const Distribution distribution, const unsigned seed)
+{
+  const std::vector<std::vector<T>> inputs = make_inputs<T>(world_size, count, distribution, seed);
+  std::vector<std::vector<T>> outputs(world_size, std::vector<T>(count));
+  ThreadCommGroup group(world_size);
+  std::vector<std::thread> threads;
+  for (int r = 0; r < world_size; r++)
+    threads.emplace_back([&, r] {
+      ThreadCommunicator comm(group, r);
+      comm.quantizedAllReduceSum(inputs[r].data(), outputs[r].data(), count, block_size);
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+
+  CheckResult result;
+  result.same_bits = is_same_bits(outputs);
+  const QuantizedCommLayout layout(count, block_size, world_size);
+  for (size_t begin = 0; begin < count; begin += block_size)
+  {
+    const size_t end = std::min(count, begin + (size_t)block_size);
+    const int owner = (int)(begin / layout.getSliceCount());
+    // the error of the inputs of the other ranks, and the largest sum of the block
+    double input_error = 0.0, amax_exact = 0.0, amax_input_sum = 0.0;
+    for (int r = 0; r < world_size; r++)
+    {
+      double amax = 0.0;
+      for (size_t i = begin; i < end; i++)
+        amax = std::max(amax, (double)fabsf(quantized_comm_to_float(inputs[r][i])));
+      if (r != owner)
+        input_error += get_quantization_error(amax);
+      amax_input_sum += amax;
+    }
+    for (size_t i = begin; i < end; i++)
+    {
+      double exact = 0.0;
+      for (int r = 0; r < world_size; r++)
+        exact += quantized_comm_to_float(inputs[r][i]);
+      amax_exact = std::max(amax_exact, fabs(exact));
+    }
+    // the sums of the owner are off by input_error at most, and their rounding in float
+    const double sum_rounding = world_size * ldexp(1.0, -24) * (amax_input_sum + input_error);
+    const double sum_error = get_quantization_error(amax_exact + input_error + sum_rounding);
+    for (size_t i = begin; i < end; i++)
+    {
+      double exact = 0.0;
+      for (int r = 0; r < world_size; r++)
+        exact += quantized_comm_to_float(inputs[r][i]);
+      const double error = fabs(quantized_comm_to_float(outputs[0][i]) - exact);
+      const double bound = input_error + sum_rounding + sum_error +
+                           get_epsilon<T>() * (fabs(exact) + input_error + sum_error) + 1e-30;
+      result.max_error_to_bound = std::max(result.max_error_to_bound, error / bound);
+      result.sq_error += error * error;
+      result.sq_exact += exact * exact;
+    }
+  }
+  return result;
+}
+
+template <typename T>
+static CheckResult check_all_gather(const int world_size, const int block_size, const size_t count,
+                                    const Distribution distribution, const unsigned seed)
+{
+  const std::vector<std::vector<T>> inputs = make_inputs<T>(world_size, count, distribution, seed);
+  std::vector<std::vector<T>> outputs(world_size, std::vector<T>(world_size * count));
+  ThreadCommGroup group(world_size);
+  std::vector<std::thread> threads;
+  for (int r = 0; r < world_size; r++)
+    threads.emplace_back([&, r] {
+      ThreadCommunicator comm(group, r);
+      comm.quantizedAllGather(inputs[r].data(), outputs[r].data(), count, block_size);
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+
+  CheckResult result;
+  result.same_bits = is_same_bits(outputs);
+  for (int r = 0; r < world_size; r++)
+    for (size_t begin = 0; begin < count; begin += block_size)
+    {
+      const size_t end = std::min(count, begin + (size_t)block_size);
+      double amax = 0.0;
+      for (size_t i = begin; i < end; i++)
+        amax = std::max(amax, (double)fabsf(quantized_comm_to_float(inputs[r][i])));
+      for (size_t i = begin; i < end; i++)
+      {
+        const double exact = quantized_comm_to_float(inputs[r][i]);
+        const double error = fabs(quantized_comm_to_float(outputs[0][r * count + i]) - exact);
+        const double bound = get_quantization_error(amax) * (1.0 + get_epsilon<T>()) + get_epsilon<T>() * fabs(exact) + 1e-30;
+        result.max_error_to_bound = std::max(result.max_error_to_bound, error / bound);
+        result.sq_error += error * error;
+        result.sq_exact += exact * exact;
+      }
+    }
+  return result;
+}
+
+template <typename T>
+static bool run_checks(const char *type_name, const std::vector<int> &world_sizes, const std::vector<int> &block_sizes,
+                       const std::vector<size_t> &counts)
+{
+  bool ok = true;
+  for (int block_size : block_sizes)
+    for (int d = 0; d < DISTRIBUTION_NUM; d++)
+    {
+      CheckResult reduce, gather;
+      unsigned seed = 0;
+      for (int world_size : world_sizes)
+        for (size_t count : counts)
+        {
+          reduce.add(check_all_reduce<T>(world_size, block_size, count, (Distribution)d, seed++));
+          gather.add(check_all_gather<T>(world_size, block_size, count, (Distribution)d, seed++));
+        }
+      printf("%5s %10d %11s %18.3e %15.3f %18.3e %15.3f %s\n", type_name, block_size, distribution_names[d],
+             reduce.getRelativeRmsError(), reduce.max_error_to_bound, gather.getRelativeRmsError(),
+             gather.max_error_to_bound, reduce.ok() && gather.ok() ? "ok" : "FAILED");
+      ok = ok && reduce.ok() && gather.ok();
+    }
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 1 && argc != 4)
+  {
+    printf("[ERROR] quantized_comm_check [world_size block_size count]\n");
+    printf("e.g., ./bin/quantized_comm_check 4 128 12288\n");
+    return 0;
+  }
+  std::vector<int> world_sizes = {2, 3, 4, 8};
+  std::vector<int> block_sizes = {32, 128, 1024};
+  std::vector<size_t> counts = {1, 100, 4096, 12345};
+  if (argc == 4)
+  {
+    world_sizes = {atoi(argv[1])};
+    block_sizes = {atoi(argv[2])};
+    counts = {(size_t)atol(argv[3])};
+    if (world_sizes[0] < 1 || block_sizes[0] < 1)
+    {
+      printf("[ERROR] world_size and block_size should be positive\n");
+      return 1;
+    }
+  }
+
+  printf("The error of the int8 collectives against the exact ones: the relative RMS error, and the largest\n"
+         "error divided by its bound, which must be at most 1.\n");
+  printf("%5s %10s %11s %18s %15s %18s %15s\n", "type", "block_size", "values", "all-reduce rms", "/ bound",
+         "all-gather rms", "/ bound");
+  bool ok = run_checks<float>("fp32", world_sizes, block_sizes, counts);
+  ok = run_checks<half>("fp16", world_sizes, block_sizes, counts) && ok;
+  printf("%s\n", ok ? "[INFO] all the checks passed" : "[ERROR] some checks failed");
+  return ok ? 0 : 1;
+}
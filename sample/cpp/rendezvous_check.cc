@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the rendezvous of fastertransformer/utils/rendezvous.h with the ranks of a tensor x layer
+// parallel grid as threads of this process, a FileStore in a temporary directory and
+// ThreadCommGroups as the communicators. The ranks run a step per request, at their own pace: the
+// refresh of the stale groups, then an all-gather of their ranks and an all-reduce in their tensor
+// and layer groups. A restarted rank leave()s two steps before its restart, serves one more step,
+// drops all its state and joins again like a new process. Every step must see the ranks of the
+// grid, and only the groups of the restarted ranks may re-form. Needs no GPU; returns 1 on a failure.
+
+#include "fastertransformer/utils/communicator.h"
+#include "fastertransformer/utils/rendezvous.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ftw.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace fastertransformer;
+
+// The ids of the groups of threads: the rank 0 of a generation creates a ThreadCommGroup and
+// publishes its name, like the ncclUniqueId of rendezvous_nccl_comm.
+class ThreadGroupRegistry
+{
+public:
+  std::string create(const int world_size)
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    const std::string name = "thread_group_" + std::to_string(groups_.size());
+    groups_[name] = std::make_shared<ThreadCommGroup>(world_size);
+    return name;
+  }
+  std::shared_ptr<ThreadCommGroup> find(const std::string &name)
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = groups_.find(name);
+    if (it == groups_.end())
+      throw std::runtime_error("[ERROR] no thread group " + name);
+    return it->second;
+  }
+
+private:
+  std::mutex mu_;
+  std::map<std::string, std::shared_ptr<ThreadCommGroup>> groups_;
+};
+
+struct Config
+{
+  std::string dir;
+  int tensor_para_size;
+  int layer_para_size;
+  int step_num;
+  std::map<int, int> restart_steps; // rank -> first step of its new incarnation
+  int timeout_ms = 20000;
+};
+
+// A communicator of a rank and the rendezvous of its group.
+struct RankGroup
+{
+  RankGroup(RendezvousStore &store, const std::string &name, const int world_size, const int rank,
+            const int timeout_ms)
+      : rendezvous(store, name, world_size, rank, timeout_ms)
+  {
+  }
+
+  void form(ThreadGroupRegistry &registry)
+  {
+    comm.reset();
+    const int world_size = rendezvous.getWorldSize();
+    group = registry.find(rendezvous.join([&] { return registry.create(world_size); }));
+    comm.reset(new ThreadCommunicator(*group, rendezvous.getRank()));
+  }
+
+  CommRendezvous rendezvous;
+  std::shared_ptr<ThreadCommGroup> group;
+  std::unique_ptr<ThreadCommunicator> comm;
+};
+
+// The state of an incarnation of a rank, like the one of a GptParamInstance.
+struct RankState
+{
+  RankState(const Config &config, const int rank)
+      : store(config.dir),
+        tensor(store, "tensor/" + std::to_string(rank / config.tensor_para_size), config.tensor_para_size,
+               rank % config.tensor_para_size, config.timeout_ms),
+        layer(store, "layer/" + std::to_string(rank % config.tensor_para_size), config.layer_para_size,
+              rank / config.tensor_para_size, config.timeout_ms)
+  {
+  }
+
+  FileStore store;
+  // every rank forms its tensor group before its layer group, or two ranks could wait for each other
+  RankGroup tensor;
+  RankGroup layer;
+};
+
+struct RankResult
+{
+  std::vector<double> join_ms; // per incarnation
+  int errors = 0;
+};
+
+// The ranks of the group and the sum of the values of the step, against the ones of the grid.
+static int check_step(RankGroup &group, const int rank, const int rank_stride, const int step, const char *name)
+{
+  const int world_size = group.rendezvous.getWorldSize();
+  const int first_rank = rank - group.rendezvous.getRank() * rank_stride;
+  std::vector<int> ranks(world_size);
+  group.comm->allGather(&rank, ranks.data(), 1);
+  const int value = rank * 1000 + step;
+  int sum = 0;
+  group.comm->allReduceSum(&value, &sum, 1);
+  int errors = 0, expected_sum = 0;
+  for (int r = 0; r < world_size; r++)
+  {
+    const int expected_rank = first_rank + r * rank_stride;
+    expected_sum += expected_rank * 1000 + step;
+    if (ranks[r] != expected_rank)
+    {
+      printf("[ERROR] step %d, rank %d: rank %d of its %s group is %d instead of %d\n", step, rank, r, name, ranks[r],
+             expected_rank);
+      errors++;
+    }
+  }
+  if (sum != expected_sum)
+  {
+    printf("[ERROR] step %d, rank %d: the sum of its %s group is %d instead of %d\n", step, rank, name, sum,
+           expected_sum);
+    errors++;
+  }
+  return errors;
+}
+
+static void rank_main(const Config &config, const int rank, ThreadGroupRegistry &registry, RankResult &result)
+{
+  const auto restart = config.restart_steps.find(rank);
+  std::minstd_rand jitter(rank + 1);
+  int step = 0;
+  bool restarted = false;
+  while (step < config.step_num)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    RankState state(config, rank);
+    state.tensor.form(registry);
+    state.layer.form(registry);
+    result.join_ms.push_back(
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+    // an incarnation starts at the step of the generations that it joined
+    step = state.tensor.rendezvous.getStep();
+    const int expected_step = restarted ? restart->second : 0;
+    if (step != expected_step || state.layer.rendezvous.getStep() != expected_step)
+    {
+      printf("[ERROR] rank %d: its tensor and layer groups start at steps %d and %d instead of %d\n", rank, step,
+             state.layer.rendezvous.getStep(), expected_step);
+      result.errors++;
+      return;
+    }
+
+    bool leaving = false;
+    for (; step < config.step_num; step++)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(jitter() % 200));
+      if (state.tensor.rendezvous.isStale())
+        state.tensor.form(registry);
+      if (state.layer.rendezvous.isStale())
+        state.layer.form(registry);
+      state.tensor.rendezvous.nextStep();
+      state.layer.rendezvous.nextStep();
+      result.errors += check_step(state.tensor, rank, 1, step, "tensor");
+      result.errors += check_step(state.layer, rank, config.tensor_para_size, step, "layer");
+      if (leaving)
+      {
+        restarted = true;
+        step++;
+        break;
+      }
+      if (!restarted && restart != config.restart_steps.end() && restart->second == step + 2)
+      {
+        state.tensor.rendezvous.leave();
+        state.layer.rendezvous.leave();
+        leaving = true;
+      }
+    }
+    if (!leaving)
+    {
+      // the generation of a group is the number of restarts of its ranks
+      int tensor_restarts = 0, layer_restarts = 0;
+      for (const auto &r : config.restart_steps)
+      {
+        tensor_restarts += r.first / config.tensor_para_size == rank / config.tensor_para_size;
+        layer_restarts += r.first % config.tensor_para_size == rank % config.tensor_para_size;
+      }
+      if (state.tensor.rendezvous.getGeneration() != tensor_restarts ||
+          state.layer.rendezvous.getGeneration() != layer_restarts)
+      {
+        printf("[ERROR] rank %d: generations %d and %d of its tensor and layer groups instead of %d and %d\n", rank,
+               state.tensor.rendezvous.getGeneration(), state.layer.rendezvous.getGeneration(), tensor_restarts,
+               layer_restarts);
+        result.errors++;
+      }
+    }
+  }
+}
+
+static int remove_file(const char *path, const struct stat *, int, struct FTW *) { return remove(path); }
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    printf("[ERROR] rendezvous_check tensor_para_size layer_para_size [restarted ranks...]\n");
+    printf("e.g., ./bin/rendezvous_check 2 3 0 4\n");
+    return 0;
+  }
+  Config config;
+  config.tensor_para_size = atoi(argv[1]);
+  config.layer_para_size = atoi(argv[2]);
+  const int world_size = config.tensor_para_size * config.layer_para_size;
+  if (config.tensor_para_size < 1 || config.layer_para_size < 1)
+  {
+    printf("[ERROR] tensor_para_size and layer_para_size should be positive\n");
+    return 1;
+  }
+  for (int i = 3; i < argc; i++)
+  {
+    const int rank = atoi(argv[i]);
+    if (rank < 0 || rank >= world_size || config.restart_steps.count(rank))
+    {
+      printf("[ERROR] the restarted ranks should be distinct ranks in [0, %d)\n", world_size);
+      return 1;
+    }
+    // it leaves after the step i - 2
+    config.restart_steps[rank] = i;
+  }
+  config.step_num = (int)config.restart_steps.size() + 3;
+
+  char dir[] = "/tmp/ft_rendezvous_XXXXXX";
+  if (mkdtemp(dir) == nullptr)
+  {
+    printf("[ERROR] cannot create a temporary directory\n");
+    return 1;
+  }
+  config.dir = dir;
+
+  ThreadGroupRegistry registry;
+  std::vector<RankResult> results(world_size);
+  std::vector<std::thread> threads;
+  bool failed = false;
+  for (int rank = 0; rank < world_size; rank++)
+    threads.emplace_back([&, rank] {
+      try
+      {
+        rank_main(config, rank, registry, results[rank]);
+      }
+      catch (const std::exception &e)
+      {
+        printf("[ERROR] rank %d: %s\n", rank, e.what());
+        results[rank].errors++;
+      }
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+  nftw(dir, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+
+  printf("tensor_para_size %d, layer_para_size %d, %d steps\n", config.tensor_para_size, config.layer_para_size,
+         config.step_num);
+  printf("%6s %14s %22s\n", "rank", "start join ms", "restart step, join ms");
+  double max_start_ms = 0.0, max_restart_ms = 0.0;
+  for (int rank = 0; rank < world_size; rank++)
+  {
+    const RankResult &result = results[rank];
+    failed = failed || result.errors > 0;
+    if (result.join_ms.empty())
+      continue;
+    max_start_ms = std::max(max_start_ms, result.join_ms[0]);
+    printf("%6d %14.2f", rank, result.join_ms[0]);
+    if (result.join_ms.size() > 1)
+    {
+      max_restart_ms = std::max(max_restart_ms, result.join_ms[1]);
+      printf(" %11d, %8.2f", config.restart_steps[rank], result.join_ms[1]);
+    }
+    printf("\n");
+  }
+  printf("[INFO] the start of the grid took %.2f ms, the longest restart %.2f ms\n", max_start_ms, max_restart_ms);
+  printf("%s\n", failed ? "[ERROR] some checks failed" : "[INFO] all the checks passed");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Checks the sharing of the weights of fastertransformer/utils/weight_store.h with the host
+// allocator, wrapped in a TrackingAllocator to count the bytes: the model instances of a key,
+// also when they start together, load one copy; other keys load their own; the last release
+// frees the copy; a failed load keeps nothing. Needs no GPU; returns 1 on a failure.
+
+#include "fastertransformer/utils/allocator.h"
+#include "fastertransformer/utils/weight_store.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fastertransformer;
+
+static const int layer_num = 4;
+static const size_t weight_count = 1 << 16;
+
+struct Check
+{
+  int failures = 0;
+  void expect(const bool ok, const char *what)
+  {
+    printf("%-64s %s\n", what, ok ? "ok" : "FAILED");
+    failures += ok ? 0 : 1;
+  }
+};
+
+static WeightKey make_key(const int device_id, const int tensor_para_rank, const std::string &data_type)
+{
+  WeightKey key;
+  key.model_path = "../models/megatron-models/c-model/345m/";
+  key.device_id = device_id;
+  key.tensor_para_rank = tensor_para_rank;
+  key.tensor_para_size = 2;
+  key.data_type = data_type;
+  return key;
+}
+
+static std::string get_name(const int layer) { return "model.layers." + std::to_string(layer) + ".mlp.weight.bin"; }
+
+// A GptParamInstance that loads its layers through the store; loads counts the loads of all of them.
+struct Instance
+{
+  Instance(const WeightKey &key, std::shared_ptr<const IAllocator> allocator, std::atomic<int> &loads,
+           const bool is_failing = false)
+  {
+    weights = WeightStore::getInstance().acquire(key, allocator, [&](WeightBuffers &buffers) {
+      loads++;
+      for (int i = 0; i < layer_num; i++)
+      {
+        float *weight = (float *)buffers.allocate(get_name(i), sizeof(float) * weight_count);
+        for (size_t j = 0; j < weight_count; j++)
+          weight[j] = key.tensor_para_rank * 1000.0f + i + j * 1e-3f;
+        if (is_failing && i == 1)
+          throw std::runtime_error("[ERROR] cannot read " + get_name(i + 1));
+      }
+    });
+    for (int i = 0; i < layer_num; i++)
+      layers.push_back((const float *)weights->find(get_name(i)));
+  }
+
+  bool hasValues(const int tensor_para_rank) const
+  {
+    for (int i = 0; i < layer_num; i++)
+      if (layers[i] == nullptr || layers[i][0] != tensor_para_rank * 1000.0f + i)
+        return false;
+    return true;
+  }
+
+  std::shared_ptr<const WeightBuffers> weights;
+  std::vector<const float *> layers;
+};
+
+int main(int argc, char *argv[])
+{
+  const int instance_num = argc >= 2 ? atoi(argv[1]) : 4;
+  if (instance_num < 2)
+  {
+    printf("[ERROR] weight_store_check [instance_num >= 2]\n");
+    return 1;
+  }
+  Allocator<AllocatorType::CPU> host_allocator;
+  auto allocator = std::make_shared<TrackingAllocator>(host_allocator);
+  const size_t copy_bytes = layer_num * weight_count * sizeof(float);
+  WeightStore &store = WeightStore::getInstance();
+  Check check;
+  std::atomic<int> loads(0);
+
+  // the instances of a device start together
+  std::vector<std::unique_ptr<Instance>> instances(instance_num);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < instance_num; i++)
+    threads.emplace_back([&, i] { instances[i].reset(new Instance(make_key(0, 0, "fp16"), allocator, loads)); });
+  for (std::thread &thread : threads)
+    thread.join();
+  bool same = true;
+  for (int i = 1; i < instance_num; i++)
+    same = same && instances[i]->layers == instances[0]->layers;
+  check.expect(loads == 1, "the instances of a key load once");
+  check.expect(same && instances[0]->hasValues(0), "they read the same buffers");
+  check.expect(allocator->getTotalCurrentBytes() == copy_bytes, "they hold one copy");
+
+  // another rank, device or data type is another copy
+  std::atomic<int> other_loads(0);
+  Instance other_rank(make_key(0, 1, "fp16"), allocator, other_loads);
+  Instance other_device(make_key(1, 0, "fp16"), allocator, other_loads);
+  Instance other_type(make_key(0, 0, "fp32"), allocator, other_loads);
+  check.expect(other_loads == 3 && other_rank.hasValues(1) && other_device.hasValues(0),
+               "another rank, device or data type loads its own copy");
+  check.expect(allocator->getTotalCurrentBytes() == 4 * copy_bytes && store.getLiveNum() == 4, "4 keys hold 4 copies");
+
+  // the copy lives until the last instance of its key releases it
+  const float *first_layer = instances[0]->layers[0];
+  for (int i = 0; i + 1 < instance_num; i++)
+    instances[i].reset();
+  check.expect(allocator->getTotalCurrentBytes() == 4 * copy_bytes &&
+                   instances[instance_num - 1]->layers[0] == first_layer,
+               "the copy lives while an instance holds it");
+  instances[instance_num - 1].reset();
+  check.expect(allocator->getTotalCurrentBytes() == 3 * copy_bytes && store.getLiveNum() == 3,
+               "the last release frees it");
+  Instance restarted(make_key(0, 0, "fp16"), allocator, loads);
+  check.expect(loads == 2 && restarted.hasValues(0), "a new instance after that loads again");
+
+  // a failed load keeps nothing, and the next instance loads
+  std::atomic<int> failing_loads(0);
+  bool thrown = false;
+  try
+  {
+    Instance failing(make_key(2, 0, "fp16"), allocator, failing_loads, true);
+  }
+  catch (const std::runtime_error &)
+  {
+    thrown = true;
+  }
+  check.expect(thrown && allocator->getTotalCurrentBytes() == 4 * copy_bytes && store.getLiveNum() == 4,
+               "a failed load throws and keeps nothing");
+  Instance retried(make_key(2, 0, "fp16"), allocator, failing_loads);
+  check.expect(failing_loads == 2 && retried.hasValues(0), "the next instance of its key loads");
+
+  printf("[INFO] %d instances of a key hold %.2f MB of weights instead of %.2f MB\n", instance_num,
+         copy_bytes / 1048576.0, instance_num * copy_bytes / 1048576.0);
+  printf("%s\n", check.failures == 0 ? "[INFO] all the checks passed" : "[ERROR] some checks failed");
+  return check.failures == 0 ? 0 : 1;
+}
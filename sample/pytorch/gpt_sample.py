@@ -71,6 +71,8 @@ def main():
                         help='whether or not to run in fp16')
     parser.add_argument('--time', action='store_true',
                         help='whether or not to measure time elapsed.')
+    parser.add_argument('--time_call_overhead', action='store_true',
+                        help='whether or not to measure the per-call overhead at batch size 1.')
     parser.add_argument('--sample_input_file', type=str, default=None,
                         help='path to sample input file. If not set, it runs with no context inputs.')
     parser.add_argument('--sample_output_file', type=str, default=None,
@@ -188,5 +190,36 @@ def main():
             time_elapsed = timeit.default_timer() - time_started
             print("[INFO] GPT time costs: {:.2f} ms".format(time_elapsed*1000/iterations))
 
+        # Measure per-call overhead: batch size 1, one context token and one generated token,
+        # so the latency is dominated by the work done on every call rather than by decoding.
+        if args.time_call_overhead:
+            overhead_start_ids = torch.IntTensor([[end_id]])
+            overhead_start_lengths = torch.IntTensor([1])
+            overhead_attn_mask = torch.ones((1, 1, 1)).tril()
+            output_len_backup = gpt.output_len
+            gpt.output_len = 1
+
+            # The op built its decoding buffers in the calls above; cuda() creates a new op,
+            # so the first call below pays for them again, as the first call of a new model does.
+            gpt.cuda()
+            torch.cuda.synchronize()
+            time_started = timeit.default_timer()
+            gpt(overhead_start_ids, overhead_start_lengths, overhead_attn_mask)
+            torch.cuda.synchronize()
+            first_call_elapsed = timeit.default_timer() - time_started
+
+            iterations = 100
+            for i in range(iterations):
+                gpt(overhead_start_ids, overhead_start_lengths, overhead_attn_mask)
+            torch.cuda.synchronize()
+            time_started = timeit.default_timer()
+            for i in range(iterations):
+                gpt(overhead_start_ids, overhead_start_lengths, overhead_attn_mask)
+            torch.cuda.synchronize()
+            time_elapsed = timeit.default_timer() - time_started
+            gpt.output_len = output_len_backup
+            print("[INFO] GPT per-call overhead (batch 1, 1 output token): first call {:.2f} ms, steady state {:.3f} ms".format(
+                first_call_elapsed*1000, time_elapsed*1000/iterations))
+
 if __name__ == '__main__':
     main()
@@ -157,11 +157,14 @@ class EncoderWeights(object):
 class CustomEncoder(torch.nn.Module):
     def __init__(self, layer_num, head_num, head_size, weights,
                  int8_mode=0, remove_padding=False, allow_gemm_test=False,
-                 path='./lib/libpyt_fastertransformer.so'):
+                 path='./lib/libpyt_fastertransformer.so', pooling='none'):
         super().__init__()
         self.layer_num = layer_num
         self.remove_padding = remove_padding
         self.int8_mode = int8_mode
+        # 'cls', 'mean' or 'max' makes forward return [batch, hidden] instead of the whole sequence
+        self.pooling_type = {'none': 0, 'cls': 1, 'mean': 2, 'max': 3}[pooling]
+        assert self.pooling_type == 0 or int8_mode == 0
         self.encoders = []
         use_trt_kernel = True
         torch.classes.load_library(path)
@@ -196,6 +199,12 @@ class CustomEncoder(torch.nn.Module):
             t = torch.transpose(c_r, 0, 1)
             trt_seq_len = torch.reshape(t, [-1])
             trt_seq_len = torch.cat([trt_seq_len, torch.tensor([batch * max_seq_len], device='cuda').to(trt_seq_len.dtype)], dim=0).to(torch.int32)
+        if self.pooling_type != 0:
+            for i in range(self.layer_num - 1):
+                hidden_states = self.encoders[i].forward(hidden_states, attention_mask, trt_seq_len, sequence_id_offset)
+            pooled_output = self.encoders[-1].forward_pooled(hidden_states, attention_mask, trt_seq_len, sequence_id_offset,
+                                                             sequence_lengths.to(torch.int32), self.pooling_type)
+            return (pooled_output,)
         for i in range(self.layer_num):
             hidden_states = self.encoders[i].forward(hidden_states, attention_mask, trt_seq_len, sequence_id_offset)
         if self.remove_padding:
@@ -0,0 +1,64 @@
+# Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Times gpt_token_encoder.py on a text file, one prompt per line, the Python counterpart of
+# sample/cpp/gpt_tokenizer_sample.cc, and compares its ids with the start ids written by it.
+#
+# python ../sample/pytorch/utils/gpt_token_encoder_bench.py --text_file prompts.txt --cpp_ids_file start_ids.csv
+
+import sys
+import os
+import time
+sys.path.append(os.path.dirname(os.path.realpath(__file__)))
+import gpt_token_encoder as encoder
+import fire
+
+def bench(
+    text_file,
+    vocab_file="models/gpt2-vocab.json",
+    bpe_file="models/gpt2-merges.txt",
+    cpp_ids_file=None,
+    iterations=1,
+    use_cache=True
+):
+    enc = encoder.get_encoder(vocab_file, bpe_file)
+    with open(text_file, 'r', encoding='utf-8') as f:
+        lines = f.read().split('\n')
+    if len(lines) > 0 and lines[-1] == '':
+        lines = lines[:-1]
+    byte_num = sum(len(line.encode('utf-8')) for line in lines)
+
+    start = time.time()
+    for _ in range(iterations):
+        if not use_cache:
+            enc.cache = {}
+        ids = [enc.encode(line) for line in lines]
+    ms = (time.time() - start) * 1000.0 / iterations
+    token_num = sum(len(line_ids) for line_ids in ids)
+    print("[INFO] {} lines, {} bytes, {} tokens: {:.3f} ms per pass, {:.2f} MB/s, {:.0f} tokens/s".format(
+        len(lines), byte_num, token_num, ms, byte_num / ms / 1000.0, token_num / ms * 1000.0))
+
+    if cpp_ids_file is not None:
+        with open(cpp_ids_file, 'r') as f:
+            cpp_ids = [[int(i) for i in line.split(',')] if line.strip() != '' else []
+                       for line in f.read().split('\n')[:len(lines)]]
+        mismatch = [i for i in range(len(lines)) if i >= len(cpp_ids) or cpp_ids[i] != ids[i]]
+        if len(mismatch) > 0:
+            print("[ERROR] {} of {} lines have different ids, the first is line {}".format(
+                len(mismatch), len(lines), mismatch[0] + 1))
+            sys.exit(1)
+        print("[INFO] the ids of {} lines are the same".format(len(lines)))
+
+if __name__ == "__main__":
+    fire.Fire(bench)
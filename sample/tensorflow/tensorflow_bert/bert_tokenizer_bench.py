@@ -0,0 +1,81 @@
+# Copyright (c) 2021, NVIDIA CORPORATION.  All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Times FullTokenizer of tokenization.py on a file of queries, one per line with an optional
+# second sentence after a tab, the Python counterpart of sample/cpp/bert_tokenizer_sample.cc,
+# and compares its input ids with the ones written by it.
+#
+# python tensorflow_bert/bert_tokenizer_bench.py --vocab_file vocab.txt --input_file queries.txt --cpp_ids_file input_ids.csv
+
+import argparse
+import os
+import sys
+import time
+bert_submodule = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'bert')
+sys.path.insert(0, bert_submodule)
+import tokenization
+
+def truncate_seq_pair(tokens_a, tokens_b, max_length):
+    while len(tokens_a) + len(tokens_b) > max_length:
+        if len(tokens_a) > len(tokens_b):
+            tokens_a.pop()
+        else:
+            tokens_b.pop()
+
+def encode(tokenizer, line, max_seq_len):
+    texts = line.split('\t', 1)
+    tokens_a = tokenizer.tokenize(texts[0])
+    tokens_b = tokenizer.tokenize(texts[1]) if len(texts) > 1 and texts[1] != '' else None
+    if tokens_b is not None:
+        truncate_seq_pair(tokens_a, tokens_b, max_seq_len - 3)
+    else:
+        tokens_a = tokens_a[:max_seq_len - 2]
+    tokens = ["[CLS]"] + tokens_a + ["[SEP]"]
+    if tokens_b is not None:
+        tokens += tokens_b + ["[SEP]"]
+    return tokenizer.convert_tokens_to_ids(tokens)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--vocab_file', type=str, required=True)
+    parser.add_argument('--input_file', type=str, required=True)
+    parser.add_argument('--max_seq_len', type=int, default=128)
+    parser.add_argument('--do_lower_case', type=int, default=1)
+    parser.add_argument('--cpp_ids_file', type=str, default=None)
+    args = parser.parse_args()
+
+    tokenizer = tokenization.FullTokenizer(vocab_file=args.vocab_file, do_lower_case=bool(args.do_lower_case))
+    with open(args.input_file, 'r', encoding='utf-8') as f:
+        lines = f.read().split('\n')
+    if len(lines) > 0 and lines[-1] == '':
+        lines = lines[:-1]
+
+    start = time.time()
+    ids = [encode(tokenizer, line, args.max_seq_len) for line in lines]
+    ms = (time.time() - start) * 1000.0
+    print("[INFO] {} queries: {:.3f} ms, {:.2f} us per query".format(len(lines), ms, ms * 1000.0 / max(len(lines), 1)))
+
+    if args.cpp_ids_file is not None:
+        with open(args.cpp_ids_file, 'r') as f:
+            cpp_ids = [[int(i) for i in line.split(',')] if line.strip() != '' else []
+                       for line in f.read().split('\n')[:len(lines)]]
+        mismatch = [i for i in range(len(lines)) if i >= len(cpp_ids) or cpp_ids[i] != ids[i]]
+        if len(mismatch) > 0:
+            print("[ERROR] {} of {} queries have different ids, the first is line {}".format(
+                len(mismatch), len(lines), mismatch[0] + 1))
+            sys.exit(1)
+        print("[INFO] the ids of {} queries are the same".format(len(lines)))
+
+if __name__ == "__main__":
+    main()